@@ -45,6 +45,7 @@
 #include "tb-hash.h"
 #include "tb-context.h"
 #include "internal.h"
+#include "tb-prefetch.h"
 
 /* -icount align implementation. */
 
@@ -242,6 +243,69 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
     return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
 }
 
+static CPUJumpCache *tb_jmp_cache_new(unsigned bits)
+{
+    CPUJumpCache *jc = g_malloc0(sizeof(CPUJumpCache) +
+                                 sizeof(CPUJumpCacheEntry) *
+                                 (TB_JMP_CACHE_WAYS << bits));
+
+    jc->bits = bits;
+    return jc;
+}
+
+/* Lookups over which the miss rate of the jump cache is measured */
+#define TB_JMP_CACHE_WINDOW (1 << 16)
+
+/*
+ * Once per window, grow the jump cache of @cpu if more than 1/32 of the
+ * lookups missed, or shrink it if fewer than 1/1024 did.  Much like for
+ * the TLB, the entries that are still valid move to the new cache.
+ */
+static void tb_jmp_cache_resize(CPUState *cpu, CPUJumpCache *jc)
+{
+    size_t lookups = jc->hits + jc->misses - jc->window_lookups;
+    size_t misses = jc->misses - jc->window_misses;
+    unsigned bits = jc->bits;
+    CPUJumpCache *new;
+    size_t i;
+
+    if (lookups < TB_JMP_CACHE_WINDOW) {
+        return;
+    }
+    jc->window_lookups = jc->hits + jc->misses;
+    jc->window_misses = jc->misses;
+
+    if (misses > lookups / 32 && bits < TB_JMP_CACHE_MAX_BITS) {
+        bits++;
+    } else if (misses < lookups / 1024 && bits > TB_JMP_CACHE_MIN_BITS) {
+        bits--;
+    } else {
+        return;
+    }
+
+    new = tb_jmp_cache_new(bits);
+    new->hits = jc->hits;
+    new->misses = jc->misses;
+    new->window_lookups = jc->window_lookups;
+    new->window_misses = jc->window_misses;
+
+    /* Oldest entries first, so that the most recent ones stay in way 0. */
+    for (i = tb_jmp_cache_entries(jc); i-- > 0;) {
+        uint32_t hash = i / TB_JMP_CACHE_WAYS;
+        int way = i % TB_JMP_CACHE_WAYS;
+        TranslationBlock *tb = tb_jmp_cache_get_tb(jc, hash, way);
+        target_ulong pc;
+
+        if (tb && !(tb_cflags(tb) & CF_INVALID)) {
+            pc = tb_jmp_cache_get_pc(jc, hash, way, tb);
+            tb_jmp_cache_set(new, tb_jmp_cache_hash_func(new, pc), tb, pc);
+        }
+    }
+
+    qatomic_rcu_set(&cpu->tb_jmp_cache, new);
+    g_free_rcu(jc, rcu);
+}
+
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
                                           target_ulong cs_base,
@@ -250,30 +314,51 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
     TranslationBlock *tb;
     CPUJumpCache *jc;
     uint32_t hash;
+    int way;
 
     /* we should never be trying to look up an INVALID tb */
     tcg_debug_assert(!(cflags & CF_INVALID));
 
-    hash = tb_jmp_cache_hash_func(pc);
     jc = cpu->tb_jmp_cache;
-    tb = tb_jmp_cache_get_tb(jc, hash);
-
-    if (likely(tb &&
-               tb_jmp_cache_get_pc(jc, hash, tb) == pc &&
-               tb->cs_base == cs_base &&
-               tb->flags == flags &&
-               tb->trace_vcpu_dstate == *cpu->trace_dstate &&
-               tb_cflags(tb) == cflags)) {
-        return tb;
+    hash = tb_jmp_cache_hash_func(jc, pc);
+
+    for (way = 0; way < TB_JMP_CACHE_WAYS; way++) {
+        tb = tb_jmp_cache_get_tb(jc, hash, way);
+        if (likely(tb &&
+                   tb_jmp_cache_get_pc(jc, hash, way, tb) == pc &&
+                   tb->cs_base == cs_base &&
+                   tb->flags == flags &&
+                   tb->trace_vcpu_dstate == *cpu->trace_dstate &&
+                   tb_cflags(tb) == cflags)) {
+            qatomic_set(&jc->hits, jc->hits + 1);
+            if (way) {
+                tb_jmp_cache_set(jc, hash, tb, pc);
+            }
+            return tb;
+        }
     }
+
+    qatomic_set(&jc->misses, jc->misses + 1);
+    tb_jmp_cache_resize(cpu, jc);
+
     tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
     if (tb == NULL) {
         return NULL;
     }
-    tb_jmp_cache_set(jc, hash, tb, pc);
+    jc = cpu->tb_jmp_cache;
+    tb_jmp_cache_set(jc, tb_jmp_cache_hash_func(jc, pc), tb, pc);
     return tb;
 }
 
+/* Add @tb, just generated for @pc, to the jump cache of @cpu. */
+static void tb_jmp_cache_add(CPUState *cpu, TranslationBlock *tb,
+                             target_ulong pc)
+{
+    CPUJumpCache *jc = cpu->tb_jmp_cache;
+
+    tb_jmp_cache_set(jc, tb_jmp_cache_hash_func(jc, pc), tb, pc);
+}
+
 static void log_cpu_exec(target_ulong pc, CPUState *cpu,
                          const TranslationBlock *tb)
 {
@@ -377,6 +462,27 @@ static inline bool check_for_breakpoints(CPUState *cpu, target_ulong pc,
         check_for_breakpoints_slow(cpu, pc, cflags);
 }
 
+static TranslationBlock *lookup_tb(CPUArchState *env, target_ulong *pc)
+{
+    CPUState *cpu = env_cpu(env);
+    TranslationBlock *tb;
+    target_ulong cs_base;
+    uint32_t flags, cflags;
+
+    cpu_get_tb_cpu_state(env, pc, &cs_base, &flags);
+
+    cflags = curr_cflags(cpu);
+    if (check_for_breakpoints(cpu, *pc, &cflags)) {
+        cpu_loop_exit(cpu);
+    }
+
+    tb = tb_lookup(cpu, *pc, cs_base, flags, cflags);
+    if (tb && qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC)) {
+        log_cpu_exec(*pc, cpu, tb);
+    }
+    return tb;
+}
+
 /**
  * helper_lookup_tb_ptr: quick check for next tb
  * @env: current cpu state
@@ -387,28 +493,56 @@ static inline bool check_for_breakpoints(CPUState *cpu, target_ulong pc,
  */
 const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
 {
-    CPUState *cpu = env_cpu(env);
-    TranslationBlock *tb;
-    target_ulong cs_base, pc;
-    uint32_t flags, cflags;
-
-    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    target_ulong pc;
+    TranslationBlock *tb = lookup_tb(env, &pc);
 
-    cflags = curr_cflags(cpu);
-    if (check_for_breakpoints(cpu, pc, &cflags)) {
-        cpu_loop_exit(cpu);
+    if (tb == NULL) {
+        return tcg_code_gen_epilogue;
     }
 
-    tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
+    /* The pinned globals are up to date, skip their loads. */
+    return tb->tc.ptr + tcg_ctx->pinned_entry_size;
+}
+
+/**
+ * helper_lookup_tb_ptr_ras: check for the target of a return
+ * @env: current cpu state
+ *
+ * Like helper_lookup_tb_ptr, for a return that the top entry of the
+ * return-address stack, just popped, failed to predict.  If that entry
+ * holds the right pc, record the TB in it for the next return.
+ */
+const void *HELPER(lookup_tb_ptr_ras)(CPUArchState *env)
+{
+    CPUReturnStack *ras = &cpu_neg(env_cpu(env))->ras;
+    CPUReturnStackEntry *e = &ras->entry[ras->top];
+    target_ulong pc;
+    TranslationBlock *tb = lookup_tb(env, &pc);
+    const void *host;
+
     if (tb == NULL) {
         return tcg_code_gen_epilogue;
     }
 
-    if (qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC)) {
-        log_cpu_exec(pc, cpu, tb);
+    host = tb->tc.ptr + tcg_ctx->pinned_entry_size;
+    if (e->pc == pc) {
+        e->host = host;
+        qatomic_set(&e->tb, tb);
     }
+    return host;
+}
+
+/*
+ * Called when TB @tb runs for the tb_hot_threshold-th time, before any of
+ * its guest instructions: have it exit to cpu_exec_loop(), which makes it
+ * into a superblock.
+ */
+void HELPER(tb_hot)(CPUArchState *env, void *tb)
+{
+    CPUState *cpu = env_cpu(env);
 
-    return tb->tc.ptr;
+    cpu->hot_tb = tb;
+    qatomic_set(&cpu_neg(cpu)->icount_decr.u16.high, -1);
 }
 
 /* Execute a TB, and fix up the CPU state afterwards if necessary */
@@ -606,8 +740,9 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
         goto out_unlock_next;
     }
 
-    /* patch the native jump address */
-    tb_set_jmp_target(tb, n, (uintptr_t)tb_next->tc.ptr);
+    /* patch the native jump address, past the loads of pinned globals */
+    tb_set_jmp_target(tb, n, (uintptr_t)tb_next->tc.ptr +
+                      tcg_ctx->pinned_entry_size);
 
     /* add in TB jmp list */
     tb->jmp_list_next[n] = tb_next->jmp_list_head;
@@ -742,6 +877,21 @@ static inline bool need_replay_interrupt(int interrupt_request)
 }
 #endif /* !CONFIG_USER_ONLY */
 
+/*
+ * Apply the tlb flushes that other vCPUs queued for us, which they may
+ * be waiting for, before running another TB.
+ */
+static inline void cpu_handle_tlb_flush(CPUState *cpu,
+                                        TranslationBlock **last_tb)
+{
+#ifdef CONFIG_SOFTMMU
+    if (unlikely(tlb_flush_is_pending(cpu))) {
+        tlb_flush_pending_drain(cpu);
+        *last_tb = NULL;
+    }
+#endif
+}
+
 static inline bool cpu_handle_interrupt(CPUState *cpu,
                                         TranslationBlock **last_tb)
 {
@@ -751,6 +901,7 @@ static inline bool cpu_handle_interrupt(CPUState *cpu,
      * by the next TB we execute under normal cflags.
      */
     if (cpu->cflags_next_tb != -1 && cpu->cflags_next_tb & CF_NOIRQ) {
+        cpu_handle_tlb_flush(cpu, last_tb);
         return false;
     }
 
@@ -760,6 +911,7 @@ static inline bool cpu_handle_interrupt(CPUState *cpu,
      * cpu->interrupt_request (see also smp_wmb in cpu_exit())
      */
     qatomic_mb_set(&cpu_neg(cpu)->icount_decr.u16.high, 0);
+    cpu_handle_tlb_flush(cpu, last_tb);
 
     if (unlikely(qatomic_read(&cpu->interrupt_request))) {
         int interrupt_request;
@@ -948,9 +1100,21 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
             }
 
             tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
+            if (unlikely(cpu->hot_tb)) {
+                if (tb == cpu->hot_tb) {
+                    TranslationBlock *sb;
+
+                    mmap_lock();
+                    sb = tb_gen_superblock(cpu, tb, pc);
+                    mmap_unlock();
+                    if (sb) {
+                        tb = sb;
+                        tb_jmp_cache_add(cpu, tb, pc);
+                    }
+                }
+                cpu->hot_tb = NULL;
+            }
             if (tb == NULL) {
-                uint32_t h;
-
                 mmap_lock();
                 tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
                 mmap_unlock();
@@ -958,8 +1122,7 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
                  * We add the TB in the virtual pc hash table
                  * for the fast lookup
                  */
-                h = tb_jmp_cache_hash_func(pc);
-                tb_jmp_cache_set(cpu->tb_jmp_cache, h, tb, pc);
+                tb_jmp_cache_add(cpu, tb, pc);
             }
 
 #ifndef CONFIG_USER_ONLY
@@ -1054,7 +1217,7 @@ void tcg_exec_realizefn(CPUState *cpu, Error **errp)
         tcg_target_initialized = true;
     }
 
-    cpu->tb_jmp_cache = g_new0(CPUJumpCache, 1);
+    cpu->tb_jmp_cache = tb_jmp_cache_new(TB_JMP_CACHE_DEFAULT_BITS);
     tlb_init(cpu);
 #ifndef CONFIG_USER_ONLY
     tcg_iommu_init_notifier_list(cpu);
@@ -1067,6 +1230,7 @@ void tcg_exec_unrealizefn(CPUState *cpu)
 {
 #ifndef CONFIG_USER_ONLY
     tcg_iommu_free_notifier_list(cpu);
+    tb_prefetch_cancel(cpu);
 #endif /* !CONFIG_USER_ONLY */
 
     tlb_destroy(cpu);
@@ -101,14 +101,22 @@ static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
 static void tb_jmp_cache_clear_page(CPUState *cpu, target_ulong page_addr)
 {
     CPUJumpCache *jc = cpu->tb_jmp_cache;
-    int i, i0;
+    CPUReturnStack *ras = &cpu_neg(cpu)->ras;
+    size_t i, i0, n;
+
+    for (i = 0; i < CPU_RAS_SIZE; i++) {
+        if ((ras->entry[i].pc & TARGET_PAGE_MASK) == page_addr) {
+            qatomic_set(&ras->entry[i].tb, NULL);
+        }
+    }
 
     if (unlikely(!jc)) {
         return;
     }
 
-    i0 = tb_jmp_cache_hash_page(page_addr);
-    for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
+    i0 = (size_t)tb_jmp_cache_hash_page(jc, page_addr) * TB_JMP_CACHE_WAYS;
+    n = (size_t)TB_JMP_CACHE_WAYS << tb_jmp_page_bits(jc);
+    for (i = 0; i < n; i++) {
         qatomic_set(&jc->array[i0 + i].tb, NULL);
     }
 }
@@ -231,8 +239,7 @@ static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
 static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
 {
     desc->n_used_entries = 0;
-    desc->large_page_addr = -1;
-    desc->large_page_mask = -1;
+    memset(desc->large_page, -1, sizeof(desc->large_page));
     desc->vindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
@@ -270,6 +277,48 @@ static inline void tlb_n_used_entries_dec(CPUArchState *env, uintptr_t mmu_idx)
     env_tlb(env)->d[mmu_idx].n_used_entries--;
 }
 
+/*
+ * Tables of inactive address spaces, for targets that tag them with
+ * tlb_switch_tag().  A bank is swapped with the live tables when its
+ * tag is switched to, so keeping a few of them around means that a
+ * guest context switch needs neither a flush nor a refill.
+ *
+ * Inactive banks are never searched.  A flush of any mmu_idx while a
+ * bank is inactive just marks that mmu_idx as stale; stale indexes
+ * are flushed as a whole when the bank is switched back in.
+ */
+#define CPU_TLB_BANKS 4
+
+typedef struct CPUTLBBank {
+    uint64_t tag;
+    int64_t used;
+    bool valid;
+    /* As CPUTLBCommon.dirty, for the tables held by this bank. */
+    uint16_t dirty;
+    uint16_t stale;
+    CPUTLBDesc d[NB_MMU_MODES];
+    CPUTLBDescFast f[NB_MMU_MODES];
+} CPUTLBBank;
+
+/* Called with tlb_c.lock held */
+static void tlb_banks_flush_locked(CPUArchState *env, uint16_t idxmap)
+{
+    CPUTLBBank *banks = env_tlb(env)->c.banks;
+    int i;
+
+    if (!banks) {
+        return;
+    }
+    for (i = 0; i < CPU_TLB_BANKS; i++) {
+        CPUTLBBank *bank = &banks[i];
+
+        bank->stale |= idxmap & bank->dirty;
+        if (bank->stale == bank->dirty) {
+            bank->valid = false;
+        }
+    }
+}
+
 void tlb_init(CPUState *cpu)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -277,6 +326,7 @@ void tlb_init(CPUState *cpu)
     int i;
 
     qemu_spin_init(&env_tlb(env)->c.lock);
+    qemu_spin_init(&env_tlb(env)->c.pending.lock);
 
     /* All tlbs are initialized flushed. */
     env_tlb(env)->c.dirty = 0;
@@ -292,6 +342,7 @@ void tlb_destroy(CPUState *cpu)
     int i;
 
     qemu_spin_destroy(&env_tlb(env)->c.lock);
+    qemu_spin_destroy(&env_tlb(env)->c.pending.lock);
     for (i = 0; i < NB_MMU_MODES; i++) {
         CPUTLBDesc *desc = &env_tlb(env)->d[i];
         CPUTLBDescFast *fast = &env_tlb(env)->f[i];
@@ -299,8 +350,25 @@ void tlb_destroy(CPUState *cpu)
         g_free(fast->table);
         g_free(desc->fulltlb);
     }
+    if (env_tlb(env)->c.banks) {
+        CPUTLBBank *banks = env_tlb(env)->c.banks;
+        int b;
+
+        for (b = 0; b < CPU_TLB_BANKS; b++) {
+            for (i = 0; i < NB_MMU_MODES; i++) {
+                g_free(banks[b].f[i].table);
+                g_free(banks[b].d[i].fulltlb);
+            }
+        }
+        g_free(banks);
+        env_tlb(env)->c.banks = NULL;
+    }
 }
 
+static bool tlb_flush_all_cpus_queued(CPUState *src_cpu, target_ulong addr,
+                                      target_ulong len, uint16_t idxmap,
+                                      unsigned bits);
+
 /* flush_all_helper: run fn across all cpus
  *
  * If the wait flag is set then the src cpu's helper will be queued as
@@ -359,6 +427,7 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
         int mmu_idx = ctz32(work);
         tlb_flush_one_mmuidx_locked(env, mmu_idx, now);
     }
+    tlb_banks_flush_locked(env, asked);
 
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 
@@ -416,6 +485,9 @@ void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, uint16_t idxmap)
 
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
+    if (tlb_flush_all_cpus_queued(src_cpu, 0, 0, idxmap, 0)) {
+        return;
+    }
     flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
     async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
 }
@@ -425,6 +497,145 @@ void tlb_flush_all_cpus_synced(CPUState *src_cpu)
     tlb_flush_by_mmuidx_all_cpus_synced(src_cpu, ALL_MMUIDX_BITS);
 }
 
+static void tlb_switch_tag_self(CPUState *cpu, uint64_t tag)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLB *tlb = env_tlb(env);
+    CPUTLBBank *bank = NULL;
+    int64_t now;
+    uint16_t dirty, to_clean;
+    int i, mmu_idx;
+
+    assert_cpu_is_self(cpu);
+
+    if (tlb->c.tag == tag) {
+        return;
+    }
+
+    tlb_debug("tag:0x%016" PRIx64 " -> 0x%016" PRIx64 "\n", tlb->c.tag, tag);
+
+    now = get_clock_realtime();
+    qemu_spin_lock(&tlb->c.lock);
+
+    if (!tlb->c.banks) {
+        tlb->c.banks = g_new0(CPUTLBBank, CPU_TLB_BANKS);
+        for (i = 0; i < CPU_TLB_BANKS; i++) {
+            for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+                tlb_mmu_init(&tlb->c.banks[i].d[mmu_idx],
+                             &tlb->c.banks[i].f[mmu_idx], now);
+            }
+        }
+    }
+
+    for (i = 0; i < CPU_TLB_BANKS; i++) {
+        CPUTLBBank *b = &tlb->c.banks[i];
+
+        if (b->valid && b->tag == tag) {
+            bank = b;
+            break;
+        }
+        /* Otherwise pick an invalid bank, or the least recently used. */
+        if (!bank || (bank->valid && (!b->valid || b->used < bank->used))) {
+            bank = b;
+        }
+    }
+
+    if (bank->valid && bank->tag == tag) {
+        to_clean = bank->stale;
+    } else {
+        to_clean = bank->dirty;
+    }
+    dirty = bank->dirty & ~to_clean;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc d = tlb->d[mmu_idx];
+        CPUTLBDescFast f = tlb->f[mmu_idx];
+
+        tlb->d[mmu_idx] = bank->d[mmu_idx];
+        tlb->f[mmu_idx] = bank->f[mmu_idx];
+        bank->d[mmu_idx] = d;
+        bank->f[mmu_idx] = f;
+    }
+    bank->tag = tlb->c.tag;
+    bank->dirty = tlb->c.dirty;
+    bank->stale = 0;
+    bank->valid = true;
+    bank->used = now;
+
+    tlb->c.tag = tag;
+    tlb->c.dirty = dirty;
+    for (; to_clean != 0; to_clean &= to_clean - 1) {
+        tlb_flush_one_mmuidx_locked(env, ctz32(to_clean), now);
+    }
+
+    qemu_spin_unlock(&tlb->c.lock);
+
+    tcg_flush_jmp_cache(cpu);
+}
+
+static void tlb_switch_tag_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    uint64_t *tag = data.host_ptr;
+
+    tlb_switch_tag_self(cpu, *tag);
+    g_free(tag);
+}
+
+void tlb_switch_tag(CPUState *cpu, uint64_t tag)
+{
+    if (cpu->created && !qemu_cpu_is_self(cpu)) {
+        /* run_on_cpu_data cannot hold a 64-bit value on all hosts */
+        uint64_t *p = g_new(uint64_t, 1);
+
+        *p = tag;
+        async_run_on_cpu(cpu, tlb_switch_tag_async_work,
+                         RUN_ON_CPU_HOST_PTR(p));
+    } else {
+        tlb_switch_tag_self(cpu, tag);
+    }
+}
+
+void tlb_flush_tags(CPUState *cpu, uint64_t tag, uint64_t mask)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLB *tlb = env_tlb(env);
+    uint16_t to_clean = 0;
+    int i;
+
+    assert_cpu_is_self(cpu);
+
+    tlb_debug("tag:0x%016" PRIx64 " mask:0x%016" PRIx64 "\n", tag, mask);
+
+    qemu_spin_lock(&tlb->c.lock);
+
+    if (tlb->c.banks) {
+        for (i = 0; i < CPU_TLB_BANKS; i++) {
+            CPUTLBBank *bank = &tlb->c.banks[i];
+
+            if (((bank->tag ^ tag) & mask) == 0) {
+                bank->valid = false;
+            }
+        }
+    }
+
+    if (((tlb->c.tag ^ tag) & mask) == 0) {
+        int64_t now = get_clock_realtime();
+
+        to_clean = tlb->c.dirty;
+        tlb->c.dirty = 0;
+        for (i = to_clean; i != 0; i &= i - 1) {
+            tlb_flush_one_mmuidx_locked(env, ctz32(i), now);
+        }
+    }
+
+    qemu_spin_unlock(&tlb->c.lock);
+
+    if (to_clean) {
+        tcg_flush_jmp_cache(cpu);
+        qatomic_set(&tlb->c.full_flush_count, tlb->c.full_flush_count + 1);
+    }
+}
+
 static bool tlb_hit_page_mask_anyprot(CPUTLBEntry *tlb_entry,
                                       target_ulong page, target_ulong mask)
 {
@@ -491,24 +702,71 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(env, mmu_idx, page, -1);
 }
 
-static void tlb_flush_page_locked(CPUArchState *env, int midx,
-                                  target_ulong page)
+/*
+ * Flush the entries of every large page region of @midx that overlaps
+ * [@first, @last], and forget those regions.  Return true if the whole
+ * tlb had to be flushed instead.
+ */
+static bool tlb_flush_large_pages_locked(CPUArchState *env, int midx,
+                                         target_ulong first,
+                                         target_ulong last)
 {
-    target_ulong lp_addr = env_tlb(env)->d[midx].large_page_addr;
-    target_ulong lp_mask = env_tlb(env)->d[midx].large_page_mask;
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    CPUTLBDescFast *f = &env_tlb(env)->f[midx];
+    int i;
 
-    /* Check if we need to flush due to large pages.  */
-    if ((page & lp_mask) == lp_addr) {
-        tlb_debug("forcing full flush midx %d ("
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        target_ulong lp_addr = d->large_page[i].addr;
+        target_ulong lp_mask = d->large_page[i].mask;
+        target_ulong lp_pages = (~lp_mask >> TARGET_PAGE_BITS) + 1;
+
+        if (lp_addr == (target_ulong)-1 ||
+            last < lp_addr || first > (lp_addr | ~lp_mask)) {
+            continue;
+        }
+
+        /*
+         * A region covering the whole address space, or more pages than
+         * the tlb has entries, is not worth walking.
+         */
+        if (lp_pages == 0 || lp_pages > tlb_n_entries(f)) {
+            tlb_debug("forcing full flush midx %d ("
+                      TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
+                      midx, lp_addr, lp_mask);
+            tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
+            return true;
+        }
+
+        tlb_debug("flushing large page midx %d ("
                   TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
                   midx, lp_addr, lp_mask);
-        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
-    } else {
-        if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
-            tlb_n_used_entries_dec(env, midx);
+        for (target_ulong j = 0; j < lp_pages; j++) {
+            CPUTLBEntry *entry =
+                tlb_entry(env, midx, lp_addr + (j << TARGET_PAGE_BITS));
+
+            if (tlb_flush_entry_mask_locked(entry, lp_addr, lp_mask)) {
+                tlb_n_used_entries_dec(env, midx);
+            }
         }
-        tlb_flush_vtlb_page_locked(env, midx, page);
+        tlb_flush_vtlb_page_mask_locked(env, midx, lp_addr, lp_mask);
+        d->large_page[i].addr = -1;
+        d->large_page[i].mask = -1;
     }
+    return false;
+}
+
+static void tlb_flush_page_locked(CPUArchState *env, int midx,
+                                  target_ulong page)
+{
+    /* Check if we need to flush due to large pages.  */
+    if (tlb_flush_large_pages_locked(env, midx, page,
+                                     page + TARGET_PAGE_SIZE - 1)) {
+        return;
+    }
+    if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
+        tlb_n_used_entries_dec(env, midx);
+    }
+    tlb_flush_vtlb_page_locked(env, midx, page);
 }
 
 /**
@@ -537,6 +795,7 @@ static void tlb_flush_page_by_mmuidx_async_0(CPUState *cpu,
             tlb_flush_page_locked(env, mmu_idx, addr);
         }
     }
+    tlb_banks_flush_locked(env, idxmap);
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 
     /*
@@ -547,6 +806,48 @@ static void tlb_flush_page_by_mmuidx_async_0(CPUState *cpu,
     tb_jmp_cache_clear_page(cpu, addr);
 }
 
+void tlb_flush_page_tags(CPUState *cpu, target_ulong addr,
+                         uint64_t tag, uint64_t mask)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLB *tlb = env_tlb(env);
+    bool live;
+    int i;
+
+    assert_cpu_is_self(cpu);
+
+    addr &= TARGET_PAGE_MASK;
+
+    tlb_debug("page addr:" TARGET_FMT_lx " tag:0x%016" PRIx64
+              " mask:0x%016" PRIx64 "\n", addr, tag, mask);
+
+    qemu_spin_lock(&tlb->c.lock);
+
+    if (tlb->c.banks) {
+        for (i = 0; i < CPU_TLB_BANKS; i++) {
+            CPUTLBBank *bank = &tlb->c.banks[i];
+
+            if (((bank->tag ^ tag) & mask) == 0) {
+                bank->valid = false;
+            }
+        }
+    }
+
+    live = ((tlb->c.tag ^ tag) & mask) == 0;
+    if (live) {
+        for (i = 0; i < NB_MMU_MODES; i++) {
+            tlb_flush_page_locked(env, i, addr);
+        }
+    }
+
+    qemu_spin_unlock(&tlb->c.lock);
+
+    if (live) {
+        tb_jmp_cache_clear_page(cpu, addr - TARGET_PAGE_SIZE);
+        tb_jmp_cache_clear_page(cpu, addr);
+    }
+}
+
 /**
  * tlb_flush_page_by_mmuidx_async_1:
  * @cpu: cpu on which to flush
@@ -673,6 +974,11 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
+    if (tlb_flush_all_cpus_queued(src_cpu, addr, TARGET_PAGE_SIZE, idxmap,
+                                  TARGET_LONG_BITS)) {
+        return;
+    }
+
     /*
      * Allocate memory to hold addr+idxmap only when needed.
      * See tlb_flush_page_by_mmuidx for details.
@@ -714,7 +1020,6 @@ static void tlb_flush_range_locked(CPUArchState *env, int midx,
                                    target_ulong addr, target_ulong len,
                                    unsigned bits)
 {
-    CPUTLBDesc *d = &env_tlb(env)->d[midx];
     CPUTLBDescFast *f = &env_tlb(env)->f[midx];
     target_ulong mask = MAKE_64BIT_MASK(0, bits);
 
@@ -736,16 +1041,8 @@ static void tlb_flush_range_locked(CPUArchState *env, int midx,
         return;
     }
 
-    /*
-     * Check if we need to flush due to large pages.
-     * Because large_page_mask contains all 1's from the msb,
-     * we only need to test the end of the range.
-     */
-    if (((addr + len - 1) & d->large_page_mask) == d->large_page_addr) {
-        tlb_debug("forcing full flush midx %d ("
-                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-                  midx, d->large_page_addr, d->large_page_mask);
-        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
+    /* Check if we need to flush due to large pages.  */
+    if (tlb_flush_large_pages_locked(env, midx, addr, addr + len - 1)) {
         return;
     }
 
@@ -784,13 +1081,15 @@ static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
             tlb_flush_range_locked(env, mmu_idx, d.addr, d.len, d.bits);
         }
     }
+    tlb_banks_flush_locked(env, d.idxmap);
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 
     /*
      * If the length is larger than the jump cache size, then it will take
      * longer to clear each entry individually than it will to clear it all.
      */
-    if (d.len >= (TARGET_PAGE_SIZE * TB_JMP_CACHE_SIZE)) {
+    if (cpu->tb_jmp_cache &&
+        d.len >= ((target_ulong)TARGET_PAGE_SIZE << cpu->tb_jmp_cache->bits)) {
         tcg_flush_jmp_cache(cpu);
         return;
     }
@@ -814,6 +1113,153 @@ static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
     g_free(d);
 }
 
+/*
+ * Queue a flush of @idxmap on @cpu: of [@addr, @addr + @len) with @bits
+ * significant address bits, or of the whole tlb if @len is 0.  Make the
+ * vCPU leave its chain of TBs so that it applies it soon.
+ */
+static void tlb_flush_pending_queue(CPUState *cpu, target_ulong addr,
+                                    target_ulong len, uint16_t idxmap,
+                                    unsigned bits)
+{
+    CPUTLBPending *p = &env_tlb(cpu->env_ptr)->c.pending;
+    unsigned i;
+
+    qemu_spin_lock(&p->lock);
+    if (len == 0) {
+        p->full_idxmap |= idxmap;
+    } else if (idxmap & ~p->full_idxmap) {
+        for (i = 0; i < p->n_ranges; i++) {
+            CPUTLBPendingRange *r = &p->range[i];
+
+            if (r->bits == bits &&
+                addr <= r->addr + r->len && r->addr <= addr + len) {
+                target_ulong end = MAX(r->addr + r->len, addr + len);
+
+                r->addr = MIN(r->addr, addr);
+                r->len = end - r->addr;
+                r->idxmap |= idxmap;
+                break;
+            }
+        }
+        if (i == p->n_ranges) {
+            if (i < CPU_TLB_PENDING_RANGES) {
+                p->range[i] = (CPUTLBPendingRange) {
+                    .addr = addr, .len = len, .idxmap = idxmap, .bits = bits,
+                };
+                p->n_ranges++;
+            } else {
+                p->full_idxmap |= idxmap;
+            }
+        }
+    }
+    qatomic_set(&p->req_gen, p->req_gen + 1);
+    qemu_spin_unlock(&p->lock);
+
+    /* Pairs with the smp_mb in cpu_handle_interrupt.  */
+    smp_wmb();
+    qatomic_set(&cpu_neg(cpu)->icount_decr.u16.high, -1);
+}
+
+void tlb_flush_pending_drain(CPUState *cpu)
+{
+    CPUTLBPending *p = &env_tlb(cpu->env_ptr)->c.pending;
+    CPUTLBPendingRange range[CPU_TLB_PENDING_RANGES];
+    uint16_t full_idxmap;
+    unsigned i, n_ranges;
+    uint32_t gen;
+
+    assert_cpu_is_self(cpu);
+
+    qemu_spin_lock(&p->lock);
+    full_idxmap = p->full_idxmap;
+    n_ranges = p->n_ranges;
+    memcpy(range, p->range, n_ranges * sizeof(range[0]));
+    gen = p->req_gen;
+    p->full_idxmap = 0;
+    p->n_ranges = 0;
+    qemu_spin_unlock(&p->lock);
+
+    if (full_idxmap) {
+        tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(full_idxmap));
+    }
+    for (i = 0; i < n_ranges; i++) {
+        uint16_t idxmap = range[i].idxmap & ~full_idxmap;
+
+        if (!idxmap) {
+            continue;
+        }
+        if (range[i].bits >= TARGET_LONG_BITS &&
+            range[i].len <= TARGET_PAGE_SIZE) {
+            tlb_flush_page_by_mmuidx_async_0(cpu, range[i].addr, idxmap);
+        } else {
+            TLBFlushRangeData d = {
+                .addr = range[i].addr,
+                .len = range[i].len,
+                .idxmap = idxmap,
+                .bits = range[i].bits,
+            };
+            tlb_flush_range_by_mmuidx_async_0(cpu, d);
+        }
+    }
+
+    qatomic_store_release(&p->done_gen, gen);
+}
+
+/*
+ * Flush @src_cpu at once, and queue the flush on the other vCPUs instead
+ * of stopping them all with safe work.  Then wait until each other vCPU
+ * has applied it, or is out of the guest code it was running: a vCPU
+ * always applies its pending flushes before running another TB.
+ *
+ * This needs to run on @src_cpu, without BQL which a vCPU may need to
+ * reach the end of its TB.  Return false otherwise, for the caller to
+ * use safe work.
+ */
+static bool tlb_flush_all_cpus_queued(CPUState *src_cpu, target_ulong addr,
+                                      target_ulong len, uint16_t idxmap,
+                                      unsigned bits)
+{
+    CPUState *cpu;
+
+    if (!qemu_cpu_is_self(src_cpu) || qemu_mutex_iothread_locked()) {
+        return false;
+    }
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src_cpu) {
+            tlb_flush_pending_queue(cpu, addr, len, idxmap, bits);
+        }
+    }
+
+    if (len == 0) {
+        tlb_flush_by_mmuidx_async_work(src_cpu, RUN_ON_CPU_HOST_INT(idxmap));
+    } else {
+        tlb_flush_range_by_mmuidx(src_cpu, addr, len, idxmap, bits);
+    }
+
+    /* Pairs with the smp_mb in cpu_exec_start.  */
+    smp_mb();
+    CPU_FOREACH(cpu) {
+        CPUTLBPending *p = &env_tlb(cpu->env_ptr)->c.pending;
+        /* Our request, or a later one that also covers it.  */
+        uint32_t gen = qatomic_read(&p->req_gen);
+
+        if (cpu == src_cpu) {
+            continue;
+        }
+        while ((int32_t)(qatomic_load_acquire(&p->done_gen) - gen) < 0 &&
+               qatomic_read(&cpu->running)) {
+            /* That vCPU may be waiting for us in turn.  */
+            if (tlb_flush_is_pending(src_cpu)) {
+                tlb_flush_pending_drain(src_cpu);
+            }
+            cpu_relax();
+        }
+    }
+    return true;
+}
+
 void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
                                target_ulong len, uint16_t idxmap,
                                unsigned bits)
@@ -933,6 +1379,10 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
+    if (tlb_flush_all_cpus_queued(src_cpu, d.addr, d.len, d.idxmap, d.bits)) {
+        return;
+    }
+
     /* Allocate a separate data block for each destination cpu.  */
     CPU_FOREACH(dst_cpu) {
         if (dst_cpu != src_cpu) {
@@ -1023,26 +1473,45 @@ static inline void copy_tlb_helper_locked(CPUTLBEntry *d, const CPUTLBEntry *s)
  * We must take tlb_c.lock to avoid racing with another vCPU update. The only
  * thing actually updated is the target TLB entry ->addr_write flags.
  */
+/* Called with tlb_c.lock held */
+static void tlb_reset_dirty_mmu_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
+                                       ram_addr_t start1, ram_addr_t length)
+{
+    unsigned int i;
+    unsigned int n = tlb_n_entries(fast);
+
+    for (i = 0; i < n; i++) {
+        tlb_reset_dirty_range_locked(&fast->table[i], start1, length);
+    }
+
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        tlb_reset_dirty_range_locked(&desc->vtable[i], start1, length);
+    }
+}
+
 void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
 {
     CPUArchState *env;
+    CPUTLBBank *banks;
 
-    int mmu_idx;
+    int mmu_idx, b;
 
     env = cpu->env_ptr;
     qemu_spin_lock(&env_tlb(env)->c.lock);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        unsigned int i;
-        unsigned int n = tlb_n_entries(&env_tlb(env)->f[mmu_idx]);
+        tlb_reset_dirty_mmu_locked(&env_tlb(env)->d[mmu_idx],
+                                   &env_tlb(env)->f[mmu_idx], start1, length);
+    }
 
-        for (i = 0; i < n; i++) {
-            tlb_reset_dirty_range_locked(&env_tlb(env)->f[mmu_idx].table[i],
-                                         start1, length);
+    /* Inactive banks must not keep fast-path writes to clean pages either. */
+    banks = env_tlb(env)->c.banks;
+    for (b = 0; banks && b < CPU_TLB_BANKS; b++) {
+        if (!banks[b].valid) {
+            continue;
         }
-
-        for (i = 0; i < CPU_VTLB_SIZE; i++) {
-            tlb_reset_dirty_range_locked(&env_tlb(env)->d[mmu_idx].vtable[i],
-                                         start1, length);
+        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            tlb_reset_dirty_mmu_locked(&banks[b].d[mmu_idx],
+                                       &banks[b].f[mmu_idx], start1, length);
         }
     }
     qemu_spin_unlock(&env_tlb(env)->c.lock);
@@ -1081,28 +1550,51 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 }
 
-/* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
+/*
+ * Our TLB does not support large pages, so remember the areas covered by
+ * large pages, and flush all the entries of an area if any page in it is
+ * invalidated.  Each mmu_idx tracks a few areas; once they are all used,
+ * the one that grows the least is extended to include the new page.
+ * This is a compromise between unnecessary flushes and the cost of
+ * maintaining a full variable size TLB.
+ */
 static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
                                target_ulong vaddr, target_ulong size)
 {
-    target_ulong lp_addr = env_tlb(env)->d[mmu_idx].large_page_addr;
-    target_ulong lp_mask = ~(size - 1);
+    CPUTLBLargePage *lp = env_tlb(env)->d[mmu_idx].large_page;
+    CPUTLBLargePage *unused = NULL, *best = NULL;
+    target_ulong best_mask = 0;
+    int i;
 
-    if (lp_addr == (target_ulong)-1) {
-        /* No previous large page.  */
-        lp_addr = vaddr;
-    } else {
-        /* Extend the existing region to include the new page.
-           This is a compromise between unnecessary flushes and
-           the cost of maintaining a full variable size TLB.  */
-        lp_mask &= env_tlb(env)->d[mmu_idx].large_page_mask;
-        while (((lp_addr ^ vaddr) & lp_mask) != 0) {
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        target_ulong lp_mask;
+
+        if (lp[i].addr == (target_ulong)-1) {
+            unused = unused ? unused : &lp[i];
+            continue;
+        }
+        lp_mask = ~(size - 1) & lp[i].mask;
+        while (((lp[i].addr ^ vaddr) & lp_mask) != 0) {
             lp_mask <<= 1;
         }
+        if (lp_mask == lp[i].mask) {
+            /* Already covered.  */
+            return;
+        }
+        /* The larger the mask, the smaller the region.  */
+        if (!best || lp_mask > best_mask) {
+            best = &lp[i];
+            best_mask = lp_mask;
+        }
+    }
+
+    if (unused) {
+        unused->addr = vaddr & ~(size - 1);
+        unused->mask = ~(size - 1);
+    } else {
+        best->addr &= best_mask;
+        best->mask = best_mask;
     }
-    env_tlb(env)->d[mmu_idx].large_page_addr = lp_addr & lp_mask;
-    env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
 }
 
 /*
@@ -2693,6 +3185,17 @@ void cpu_st16_le_mmu(CPUArchState *env, abi_ptr addr, Int128 val,
 
 /* Code access functions.  */
 
+/*
+ * Background translation threads must not use the TLB of the vCPU they
+ * translate for: abandon the TB, and leave it to the vCPU.
+ */
+static inline void check_speculative_code_access(void)
+{
+    if (unlikely(tcg_ctx->speculative)) {
+        siglongjmp(tcg_ctx->jmp_trans, -3);
+    }
+}
+
 static uint64_t full_ldub_code(CPUArchState *env, target_ulong addr,
                                MemOpIdx oi, uintptr_t retaddr)
 {
@@ -2701,7 +3204,10 @@ static uint64_t full_ldub_code(CPUArchState *env, target_ulong addr,
 
 uint32_t cpu_ldub_code(CPUArchState *env, abi_ptr addr)
 {
-    MemOpIdx oi = make_memop_idx(MO_UB, cpu_mmu_index(env, true));
+    MemOpIdx oi;
+
+    check_speculative_code_access();
+    oi = make_memop_idx(MO_UB, cpu_mmu_index(env, true));
     return full_ldub_code(env, addr, oi, 0);
 }
 
@@ -2713,7 +3219,10 @@ static uint64_t full_lduw_code(CPUArchState *env, target_ulong addr,
 
 uint32_t cpu_lduw_code(CPUArchState *env, abi_ptr addr)
 {
-    MemOpIdx oi = make_memop_idx(MO_TEUW, cpu_mmu_index(env, true));
+    MemOpIdx oi;
+
+    check_speculative_code_access();
+    oi = make_memop_idx(MO_TEUW, cpu_mmu_index(env, true));
     return full_lduw_code(env, addr, oi, 0);
 }
 
@@ -2725,7 +3234,10 @@ static uint64_t full_ldl_code(CPUArchState *env, target_ulong addr,
 
 uint32_t cpu_ldl_code(CPUArchState *env, abi_ptr addr)
 {
-    MemOpIdx oi = make_memop_idx(MO_TEUL, cpu_mmu_index(env, true));
+    MemOpIdx oi;
+
+    check_speculative_code_access();
+    oi = make_memop_idx(MO_TEUL, cpu_mmu_index(env, true));
     return full_ldl_code(env, addr, oi, 0);
 }
 
@@ -2737,6 +3249,9 @@ static uint64_t full_ldq_code(CPUArchState *env, target_ulong addr,
 
 uint64_t cpu_ldq_code(CPUArchState *env, abi_ptr addr)
 {
-    MemOpIdx oi = make_memop_idx(MO_TEUQ, cpu_mmu_index(env, true));
+    MemOpIdx oi;
+
+    check_speculative_code_access();
+    oi = make_memop_idx(MO_TEUQ, cpu_mmu_index(env, true));
     return full_ldq_code(env, addr, oi, 0);
 }
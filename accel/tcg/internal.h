@@ -40,20 +40,58 @@ void tb_invalidate_phys_range_fast(ram_addr_t ram_addr,
                                    unsigned size,
                                    uintptr_t retaddr);
 G_NORETURN void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
+
+/* Apply the tlb flushes that other vCPUs queued for @cpu. */
+void tlb_flush_pending_drain(CPUState *cpu);
+
+static inline bool tlb_flush_is_pending(CPUState *cpu)
+{
+    CPUTLBPending *p = &env_tlb(cpu->env_ptr)->c.pending;
+
+    return qatomic_read(&p->req_gen) != qatomic_read(&p->done_gen);
+}
 #endif /* CONFIG_SOFTMMU */
 
 TranslationBlock *tb_gen_code(CPUState *cpu, target_ulong pc,
                               target_ulong cs_base, uint32_t flags,
                               int cflags);
+#ifdef CONFIG_SOFTMMU
+TranslationBlock *tb_gen_code_speculative(CPUState *cpu, target_ulong pc,
+                                          target_ulong cs_base,
+                                          uint32_t flags, int cflags,
+                                          uint32_t trace_vcpu_dstate,
+                                          uint64_t translate_key,
+                                          tb_page_addr_t phys_pc,
+                                          const void *host_pc, void *snapshot);
+#endif
+TranslationBlock *tb_gen_superblock(CPUState *cpu, TranslationBlock *hot,
+                                    target_ulong pc);
 void page_init(void);
 void tb_htable_init(void);
 void tb_reset_jump(TranslationBlock *tb, int n);
+void tb_evict_region(void);
 TranslationBlock *tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                                tb_page_addr_t phys_page2);
 bool tb_invalidate_phys_page_unwind(tb_page_addr_t addr, uintptr_t pc);
 void cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
                                uintptr_t host_pc);
 
+/* Executions after which a TB is made into a superblock, or 0 for never */
+extern uint32_t tb_hot_threshold;
+
+/* Whether generated code predicts returns with a return-address stack */
+extern bool tb_ras_enabled;
+
+/* Forget the TBs cached by the return-address stack of @cpu. */
+static inline void tb_ras_flush(CPUState *cpu)
+{
+    CPUReturnStack *ras = &cpu_neg(cpu)->ras;
+
+    for (int i = 0; i < CPU_RAS_SIZE; i++) {
+        qatomic_set(&ras->entry[i].tb, NULL);
+    }
+}
+
 /* Return the current PC from CPU, which may be cached in TB. */
 static inline target_ulong log_pc(CPUState *cpu, const TranslationBlock *tb)
 {
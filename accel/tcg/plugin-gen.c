@@ -73,6 +73,7 @@ enum plugin_gen_from {
 enum plugin_gen_cb {
     PLUGIN_GEN_CB_UDATA,
     PLUGIN_GEN_CB_INLINE,
+    PLUGIN_GEN_CB_COND_UDATA,
     PLUGIN_GEN_CB_MEM,
     PLUGIN_GEN_ENABLE_MEM_HELPER,
     PLUGIN_GEN_DISABLE_MEM_HELPER,
@@ -126,18 +127,64 @@ static void gen_empty_udata_cb(void)
 /*
  * For now we only support addi_i64.
  * When we support more ops, we can generate one empty inline cb for each.
+ *
+ * Ops on a scoreboard update the entry of the current vCPU, at
+ * cpu_index * stride; the others skip that computation.
  */
 static void gen_empty_inline_cb(void)
 {
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
+    TCGv_ptr cpu_offset = tcg_temp_new_ptr();
     TCGv_i64 val = tcg_temp_new_i64();
     TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
 
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    /* use a non-power of 2 so that this is a mul; overwritten later */
+    tcg_gen_muli_i32(cpu_index, cpu_index, 0xdeadbeef);
+    tcg_gen_ext_i32_ptr(cpu_offset, cpu_index);
+    tcg_gen_add_ptr(ptr, ptr, cpu_offset);
+
     tcg_gen_ld_i64(val, ptr, 0);
     /* pass an immediate != 0 so that it doesn't get optimized away */
     tcg_gen_addi_i64(val, val, 0xdeadface);
     tcg_gen_st_i64(val, ptr, 0);
     tcg_temp_free_ptr(ptr);
     tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(cpu_offset);
+    tcg_temp_free_i32(cpu_index);
+}
+
+/*
+ * Compare the scoreboard entry of the current vCPU with an immediate, and
+ * skip the callback unless the condition is met.  The temps are dead
+ * after the branch, so the callback reloads cpu_index.
+ */
+static void gen_empty_cond_udata_cb(void)
+{
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
+    TCGv_ptr cpu_offset = tcg_temp_new_ptr();
+    TCGv_i64 val = tcg_temp_new_i64();
+    TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
+    TCGLabel *skip = gen_new_label();
+
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    /* use a non-power of 2 so that this is a mul; overwritten later */
+    tcg_gen_muli_i32(cpu_index, cpu_index, 0xdeadbeef);
+    tcg_gen_ext_i32_ptr(cpu_offset, cpu_index);
+    tcg_gen_add_ptr(ptr, ptr, cpu_offset);
+    tcg_gen_ld_i64(val, ptr, 0);
+    /* the condition and the immediate are overwritten later */
+    tcg_gen_brcondi_i64(TCG_COND_EQ, val, 0xdeadface, skip);
+
+    gen_empty_udata_cb();
+    gen_set_label(skip);
+
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(cpu_offset);
+    tcg_temp_free_i32(cpu_index);
 }
 
 static void gen_empty_mem_cb(TCGv addr, uint32_t info)
@@ -191,6 +238,7 @@ static void plugin_gen_empty_callback(enum plugin_gen_from from)
     case PLUGIN_GEN_FROM_TB:
         gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb);
         gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_inline_cb);
+        gen_wrapped(from, PLUGIN_GEN_CB_COND_UDATA, gen_empty_cond_udata_cb);
         break;
     default:
         g_assert_not_reached();
@@ -275,6 +323,13 @@ static TCGOp *copy_op(TCGOp **begin_op, TCGOp *op, TCGOpcode opc)
     return op;
 }
 
+/* skip the op following @begin_op, which is not needed */
+static void skip_op(TCGOp **begin_op, TCGOpcode opc)
+{
+    *begin_op = QTAILQ_NEXT(*begin_op, link);
+    tcg_debug_assert(*begin_op && (*begin_op)->opc == opc);
+}
+
 static TCGOp *copy_extu_i32_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -369,6 +424,74 @@ static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
     return op;
 }
 
+/* replace the add_i64 with a move of @v to its output */
+static TCGOp *copy_movi_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
+{
+    TCGOp *old_op;
+
+    if (TCG_TARGET_REG_BITS == 32) {
+        skip_op(begin_op, INDEX_op_add2_i32);
+        old_op = *begin_op;
+        op = tcg_op_insert_after(tcg_ctx, op, INDEX_op_mov_i32, 2);
+        op->args[0] = old_op->args[0];
+        op->args[1] = tcgv_i32_arg(tcg_constant_i32(v));
+        op = tcg_op_insert_after(tcg_ctx, op, INDEX_op_mov_i32, 2);
+        op->args[0] = old_op->args[1];
+        op->args[1] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
+    } else {
+        skip_op(begin_op, INDEX_op_add_i64);
+        old_op = *begin_op;
+        op = tcg_op_insert_after(tcg_ctx, op, INDEX_op_mov_i64, 2);
+        op->args[0] = old_op->args[0];
+        op->args[1] = tcgv_i64_arg(tcg_constant_i64(v));
+    }
+    return op;
+}
+
+static TCGOp *copy_brcondi_i64(TCGOp **begin_op, TCGOp *op, TCGCond cond,
+                               uint64_t v, TCGLabel *l)
+{
+    l->refs++;
+    if (TCG_TARGET_REG_BITS == 32) {
+        op = copy_op(begin_op, op, INDEX_op_brcond2_i32);
+        op->args[2] = tcgv_i32_arg(tcg_constant_i32(v));
+        op->args[3] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
+        op->args[4] = cond;
+        op->args[5] = label_arg(l);
+    } else {
+        op = copy_op(begin_op, op, INDEX_op_brcond_i64);
+        op->args[1] = tcgv_i64_arg(tcg_constant_i64(v));
+        op->args[2] = cond;
+        op->args[3] = label_arg(l);
+    }
+    return op;
+}
+
+static TCGOp *copy_set_label(TCGOp **begin_op, TCGOp *op, TCGLabel *l)
+{
+    op = copy_op(begin_op, op, INDEX_op_set_label);
+    op->args[0] = label_arg(l);
+    l->present = 1;
+    return op;
+}
+
+static TCGOp *copy_mul_i32(TCGOp **begin_op, TCGOp *op, uint32_t v)
+{
+    op = copy_op(begin_op, op, INDEX_op_mul_i32);
+    op->args[2] = tcgv_i32_arg(tcg_constant_i32(v));
+    return op;
+}
+
+static TCGOpcode ext_i32_ptr_opc(void)
+{
+    return UINTPTR_MAX == UINT32_MAX ? INDEX_op_mov_i32 : INDEX_op_ext_i32_i64;
+}
+
+static TCGOpcode add_ptr_opc(void)
+{
+    return UINTPTR_MAX == UINT32_MAX ? INDEX_op_add_i32 : INDEX_op_add_i64;
+}
+
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -436,17 +559,131 @@ static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
                                TCGOp *begin_op, TCGOp *op,
                                int *unused)
 {
+    qemu_plugin_u64 entry = cb->inline_insn.entry;
+
+    if (entry.score) {
+        /* const_ptr */
+        op = copy_const_ptr(&begin_op, op,
+                            entry.score->data + entry.offset);
+
+        /* ld_i32 of cpu_index */
+        op = copy_op(&begin_op, op, INDEX_op_ld_i32);
+
+        /* mul_i32 by the stride */
+        op = copy_mul_i32(&begin_op, op, entry.score->stride);
+
+        /* ext_i32_ptr */
+        op = copy_op(&begin_op, op, ext_i32_ptr_opc());
+
+        /* add_ptr */
+        op = copy_op(&begin_op, op, add_ptr_opc());
+    } else {
+        /* const_ptr */
+        op = copy_const_ptr(&begin_op, op, cb->userp);
+
+        skip_op(&begin_op, INDEX_op_ld_i32);
+        skip_op(&begin_op, INDEX_op_mul_i32);
+        skip_op(&begin_op, ext_i32_ptr_opc());
+        skip_op(&begin_op, add_ptr_opc());
+    }
+
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        /* ld_i64 */
+        op = copy_ld_i64(&begin_op, op);
+
+        /* add_i64 */
+        op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        /* the previous value is not needed */
+        if (TCG_TARGET_REG_BITS == 32) {
+            skip_op(&begin_op, INDEX_op_ld_i32);
+            skip_op(&begin_op, INDEX_op_ld_i32);
+        } else {
+            skip_op(&begin_op, INDEX_op_ld_i64);
+        }
+
+        /* movi_i64 */
+        op = copy_movi_i64(&begin_op, op, cb->inline_insn.imm);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    /* st_i64 */
+    op = copy_st_i64(&begin_op, op);
+
+    return op;
+}
+
+static TCGCond plugin_cond_to_tcgcond(enum qemu_plugin_cond cond)
+{
+    switch (cond) {
+    case QEMU_PLUGIN_COND_EQ:
+        return TCG_COND_EQ;
+    case QEMU_PLUGIN_COND_NE:
+        return TCG_COND_NE;
+    case QEMU_PLUGIN_COND_LT:
+        return TCG_COND_LTU;
+    case QEMU_PLUGIN_COND_LE:
+        return TCG_COND_LEU;
+    case QEMU_PLUGIN_COND_GT:
+        return TCG_COND_GTU;
+    case QEMU_PLUGIN_COND_GE:
+        return TCG_COND_GEU;
+    default:
+        /* ALWAYS and NEVER are handled at registration */
+        g_assert_not_reached();
+    }
+}
+
+/*
+ * Unlike regular callbacks, each conditional callback reloads cpu_index
+ * since it follows a branch.
+ */
+static TCGOp *append_cond_udata_cb(const struct qemu_plugin_dyn_cb *cb,
+                                   TCGOp *begin_op, TCGOp *op, int *unused)
+{
+    qemu_plugin_u64 entry = cb->cond.entry;
+    TCGCond cond = plugin_cond_to_tcgcond(cb->cond.cond);
+    TCGLabel *skip = gen_new_label();
+    int cb_idx;
+
     /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
+    op = copy_const_ptr(&begin_op, op, entry.score->data + entry.offset);
+
+    /* ld_i32 of cpu_index */
+    op = copy_op(&begin_op, op, INDEX_op_ld_i32);
+
+    /* mul_i32 by the stride */
+    op = copy_mul_i32(&begin_op, op, entry.score->stride);
+
+    /* ext_i32_ptr */
+    op = copy_op(&begin_op, op, ext_i32_ptr_opc());
+
+    /* add_ptr */
+    op = copy_op(&begin_op, op, add_ptr_opc());
 
     /* ld_i64 */
     op = copy_ld_i64(&begin_op, op);
 
-    /* add_i64 */
-    op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
+    /* brcond_i64 to skip the call unless @cond holds */
+    op = copy_brcondi_i64(&begin_op, op, tcg_invert_cond(cond),
+                          cb->cond.imm, skip);
 
-    /* st_i64 */
-    op = copy_st_i64(&begin_op, op);
+    /* const_ptr */
+    op = copy_const_ptr(&begin_op, op, cb->userp);
+
+    /* ld_i32 of cpu_index */
+    op = copy_op(&begin_op, op, INDEX_op_ld_i32);
+
+    /* call */
+    op = copy_call(&begin_op, op, HELPER(plugin_vcpu_udata_cb),
+                   cb->f.vcpu_udata, &cb_idx);
+
+    /* set_label */
+    op = copy_set_label(&begin_op, op, skip);
 
     return op;
 }
@@ -542,6 +779,12 @@ inject_inline_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
     inject_cb_type(cbs, begin_op, append_inline_cb, ok);
 }
 
+static void
+inject_cond_udata_cb(const GArray *cbs, TCGOp *begin_op)
+{
+    inject_cb_type(cbs, begin_op, append_cond_udata_cb, op_ok);
+}
+
 static void
 inject_mem_cb(const GArray *cbs, TCGOp *begin_op)
 {
@@ -658,6 +901,12 @@ static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
     inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_ok);
 }
 
+static void plugin_gen_tb_cond_udata(const struct qemu_plugin_tb *ptb,
+                                     TCGOp *begin_op)
+{
+    inject_cond_udata_cb(ptb->cbs[PLUGIN_CB_COND], begin_op);
+}
+
 static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
                                   TCGOp *begin_op, int insn_idx)
 {
@@ -674,6 +923,14 @@ static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
                      begin_op, op_ok);
 }
 
+static void plugin_gen_insn_cond_udata(const struct qemu_plugin_tb *ptb,
+                                       TCGOp *begin_op, int insn_idx)
+{
+    struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+
+    inject_cond_udata_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_COND], begin_op);
+}
+
 static void plugin_gen_mem_regular(const struct qemu_plugin_tb *ptb,
                                    TCGOp *begin_op, int insn_idx)
 {
@@ -740,6 +997,9 @@ static void pr_ops(void)
             case PLUGIN_GEN_CB_INLINE:
                 type = "inline";
                 break;
+            case PLUGIN_GEN_CB_COND_UDATA:
+                type = "cond udata";
+                break;
             case PLUGIN_GEN_CB_MEM:
                 type = "mem";
                 break;
@@ -788,6 +1048,9 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                 case PLUGIN_GEN_CB_INLINE:
                     plugin_gen_tb_inline(plugin_tb, op);
                     break;
+                case PLUGIN_GEN_CB_COND_UDATA:
+                    plugin_gen_tb_cond_udata(plugin_tb, op);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -804,6 +1067,9 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                 case PLUGIN_GEN_CB_INLINE:
                     plugin_gen_insn_inline(plugin_tb, op, insn_idx);
                     break;
+                case PLUGIN_GEN_CB_COND_UDATA:
+                    plugin_gen_insn_cond_udata(plugin_tb, op, insn_idx);
+                    break;
                 case PLUGIN_GEN_ENABLE_MEM_HELPER:
                     plugin_gen_enable_mem_helper(plugin_tb, op, insn_idx);
                     break;
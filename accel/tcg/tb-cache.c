@@ -0,0 +1,785 @@
+/*
+ * Persistent on-disk cache of translated code.
+ *
+ * The cache is meant for running the same guest code over and over, as
+ * when booting one firmware image in many short-lived jobs: each TB is
+ * stored with its host code, search data and the guest code it was
+ * translated from, and later runs copy it into the code buffer instead
+ * of translating again, after checking the guest code still matches.
+ *
+ * Host code is position-independent except for the host addresses it
+ * embeds, which the TCG backend lists in tcg_ctx->host_relocs as it
+ * generates the code: branch and call targets, pointers in the constant
+ * pool, every constant it loads into a register, and every pointer-sized
+ * constant used as an immediate operand, since constants may be pointers
+ * too.  An address into the TranslationBlock or its code, into the QEMU
+ * binary or into the TCG prologue is stored relative to that.  A
+ * constant is only taken to be a plain integer if no memory is mapped
+ * there: the TB is not cached if it embeds any other address, such as a
+ * pointer into the heap, or an immediate operand that would need
+ * relocating.  Only backends defining TCG_TARGET_HOST_RELOCS support the
+ * cache.
+ *
+ * Anything depending on the build or the host goes into the name of the
+ * cache file, which hashes the GNU build ID of QEMU, the prologue and
+ * the host CPU features.  Records in the file are keyed by the guest
+ * address and TB flags of the TB; by a hash of the class properties of
+ * the vCPU, which covers the CPU model and its feature options, and of
+ * the TCG options that change the code generated for it; and by the
+ * translate_key of the vCPU, which covers the state that the guest can
+ * change and that translation depends on beyond the TB flags.
+ *
+ * Each TB is stored once, and the file stops growing at
+ * TB_CACHE_MAX_SIZE.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/units.h"
+#include "qemu/crc32c.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/xxhash.h"
+#include "qapi/error.h"
+#include "qom/object.h"
+#include "exec/exec-all.h"
+#include "hw/core/tcg-cpu-ops.h"
+#include "tcg/tcg.h"
+#include "elf.h"
+#include "trace.h"
+#include "internal.h"
+#include "tb-cache.h"
+
+#include <sys/file.h>
+
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID 3
+#endif
+
+#if HOST_LONG_BITS == 64
+typedef Elf64_Ehdr HostElfEhdr;
+typedef Elf64_Phdr HostElfPhdr;
+typedef Elf64_Nhdr HostElfNhdr;
+#else
+typedef Elf32_Ehdr HostElfEhdr;
+typedef Elf32_Phdr HostElfPhdr;
+typedef Elf32_Nhdr HostElfNhdr;
+#endif
+
+/* Provided by the linker: the bounds of the QEMU binary once loaded. */
+extern const char __executable_start[];
+extern const char _end[];
+
+#define TB_CACHE_MAGIC      "QEMUTBC2"
+#define TB_CACHE_MAX_SIZE   (256 * MiB)
+#define TB_CACHE_REC_MAGIC  0x52434254 /* "TBCR" */
+
+typedef struct TBCacheHeader {
+    char magic[8];
+    uint8_t host_hash[32];
+} TBCacheHeader;
+
+typedef enum TBCacheAnchor {
+    TB_CACHE_ANCHOR_TB,         /* the code of the TB */
+    TB_CACHE_ANCHOR_IMAGE,      /* the QEMU binary */
+    TB_CACHE_ANCHOR_PROLOGUE,   /* the TCG prologue */
+} TBCacheAnchor;
+
+/*
+ * The field at @offset in the code, encoded as a TCGHostRelocKind,
+ * holds the address @addend bytes from @anchor.
+ */
+typedef struct TBCacheReloc {
+    uint32_t offset;
+    uint16_t kind;
+    uint16_t anchor;
+    int64_t addend;
+} TBCacheReloc;
+
+typedef struct TBCacheRecord {
+    uint32_t magic;
+    uint32_t len;           /* of the whole record, a multiple of 8 */
+    uint32_t crc;           /* of everything following this field */
+    uint32_t cflags;
+    uint64_t cpu_fp;
+    uint64_t cpu_key;
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t phys_pc;
+    uint32_t flags;
+    uint16_t size;
+    uint16_t icount;
+    uint32_t code_size;
+    uint32_t search_size;
+    int32_t tb_off;         /* of the TranslationBlock, from its code */
+    uint32_t nb_relocs;
+    uint16_t jmp_reset_offset[2];
+    uint16_t jmp_insn_offset[2];
+    /*
+     * Followed by the guest code padded to 8 bytes, the relocations, and
+     * the host code with its search data.
+     */
+} TBCacheRecord;
+
+QEMU_BUILD_BUG_ON(sizeof(TBCacheHeader) % 8);
+QEMU_BUILD_BUG_ON(sizeof(TBCacheRecord) % 8);
+QEMU_BUILD_BUG_ON(sizeof(TBCacheReloc) % 8);
+
+bool tb_cache_enabled;
+
+static struct {
+    /* Serializes appends to @fd, and accesses to @cpu_fp and @stored. */
+    QemuMutex lock;
+    int fd;
+    uintptr_t image_start, image_end;
+    uintptr_t prologue_start, prologue_end;
+    /* Read-only once loaded: TBCacheRecord -> GSList of TBCacheRecord */
+    GHashTable *index;
+    /* CPUState -> uint64_t fingerprint */
+    GHashTable *cpu_fp;
+    /* The records appended by this process, to store each only once. */
+    GHashTable *stored;
+} tb_cache;
+
+static guint tb_cache_rec_hash(gconstpointer p)
+{
+    const TBCacheRecord *r = p;
+
+    return qemu_xxhash7(r->phys_pc, r->pc, r->flags, r->cflags,
+                        r->cpu_fp ^ r->cpu_key);
+}
+
+static gboolean tb_cache_rec_equal(gconstpointer a, gconstpointer b)
+{
+    const TBCacheRecord *ra = a, *rb = b;
+
+    return ra->pc == rb->pc && ra->cs_base == rb->cs_base &&
+           ra->phys_pc == rb->phys_pc && ra->flags == rb->flags &&
+           ra->cflags == rb->cflags && ra->cpu_fp == rb->cpu_fp &&
+           ra->cpu_key == rb->cpu_key;
+}
+
+static inline const uint8_t *tb_cache_rec_guest(const TBCacheRecord *r)
+{
+    return (const uint8_t *)(r + 1);
+}
+
+/* Records for the same TB and the same guest code. */
+static gboolean tb_cache_rec_same(gconstpointer a, gconstpointer b)
+{
+    const TBCacheRecord *ra = a, *rb = b;
+
+    return tb_cache_rec_equal(ra, rb) && ra->size == rb->size &&
+           memcmp(tb_cache_rec_guest(ra), tb_cache_rec_guest(rb),
+                  ra->size) == 0;
+}
+
+static inline const TBCacheReloc *tb_cache_rec_relocs(const TBCacheRecord *r)
+{
+    return (const void *)(tb_cache_rec_guest(r) + ROUND_UP(r->size, 8));
+}
+
+static inline const uint8_t *tb_cache_rec_code(const TBCacheRecord *r)
+{
+    return (const void *)(tb_cache_rec_relocs(r) + r->nb_relocs);
+}
+
+static uint32_t tb_cache_rec_crc(const TBCacheRecord *r)
+{
+    size_t skip = offsetof(TBCacheRecord, cflags);
+
+    return crc32c(0xffffffff, (const uint8_t *)r + skip, r->len - skip);
+}
+
+static bool tb_cache_rec_valid(const TBCacheRecord *r, size_t avail)
+{
+    size_t need;
+
+    if (r->magic != TB_CACHE_REC_MAGIC || r->len < sizeof(*r) ||
+        r->len > avail || r->len % 8) {
+        return false;
+    }
+    need = sizeof(*r) + ROUND_UP(r->size, 8) +
+           (size_t)r->nb_relocs * sizeof(TBCacheReloc) +
+           r->code_size + r->search_size;
+    return need <= r->len && r->size != 0 && tb_cache_rec_crc(r) == r->crc;
+}
+
+static size_t tb_cache_reloc_size(uint32_t kind)
+{
+    switch (kind) {
+    case TCG_HOST_RELOC_PC32:
+    case TCG_HOST_RELOC_ABS32:
+    case TCG_HOST_RELOC_ABS32S:
+        return 4;
+    case TCG_HOST_RELOC_ABS64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+static bool tb_cache_hash_build_id(GChecksum *sum)
+{
+    const uint8_t *base = (const uint8_t *)__executable_start;
+    const HostElfEhdr *eh = (const void *)base;
+    const HostElfPhdr *ph;
+    uintptr_t bias = 0;
+    int i;
+
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0) {
+        return false;
+    }
+    ph = (const void *)(base + eh->e_phoff);
+
+    /* The ELF header is at the start of the segment mapping offset 0. */
+    for (i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type == PT_LOAD && ph[i].p_offset == 0) {
+            bias = (uintptr_t)base - ph[i].p_vaddr;
+            break;
+        }
+    }
+    if (i == eh->e_phnum) {
+        return false;
+    }
+
+    for (i = 0; i < eh->e_phnum; i++) {
+        const uint8_t *p, *end;
+        size_t align = ph[i].p_align == 8 ? 8 : 4;
+
+        if (ph[i].p_type != PT_NOTE) {
+            continue;
+        }
+        p = (const uint8_t *)(bias + ph[i].p_vaddr);
+        end = p + ph[i].p_filesz;
+        while (end - p >= sizeof(HostElfNhdr)) {
+            const HostElfNhdr *nh = (const void *)p;
+            const uint8_t *name = p + sizeof(*nh);
+            const uint8_t *desc = name + ROUND_UP(nh->n_namesz, align);
+            const uint8_t *next = desc + ROUND_UP(nh->n_descsz, align);
+
+            if (next > end) {
+                break;
+            }
+            if (nh->n_type == NT_GNU_BUILD_ID && nh->n_namesz == 4 &&
+                memcmp(name, "GNU", 4) == 0) {
+                g_checksum_update(sum, desc, nh->n_descsz);
+                return true;
+            }
+            p = next;
+        }
+    }
+    return false;
+}
+
+/* The code generated for the host depends on the ISA extensions it has. */
+static void tb_cache_hash_host_cpu(GChecksum *sum)
+{
+    static const char * const keys[] = { "flags", "Features", "isa" };
+    g_autofree char *info = NULL;
+    g_auto(GStrv) lines = NULL;
+    int i, k;
+
+    if (!g_file_get_contents("/proc/cpuinfo", &info, NULL, NULL)) {
+        return;
+    }
+    lines = g_strsplit(info, "\n", 0);
+    for (i = 0; lines[i]; i++) {
+        for (k = 0; k < ARRAY_SIZE(keys); k++) {
+            if (g_str_has_prefix(lines[i], keys[k])) {
+                g_checksum_update(sum, (const guchar *)lines[i], -1);
+                return;
+            }
+        }
+    }
+}
+
+static gint tb_cache_name_cmp(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+/*
+ * The TCG options that change the code of TBs: the globals pinned to host
+ * registers, which is what the pinned_globals limit ends up as once the
+ * target has registered its globals, and the return-address stack.
+ */
+static void tb_cache_hash_tcg_options(GChecksum *sum)
+{
+    int i;
+
+    for (i = 0; i < tcg_ctx->nb_globals; i++) {
+        const TCGTemp *ts = &tcg_ctx->temps[i];
+        int64_t pin[3] = { ts->mem_offset, ts->type, ts->pin_reg };
+
+        if (ts->pinned) {
+            g_checksum_update(sum, (const guchar *)pin, sizeof(pin));
+        }
+    }
+    g_checksum_update(sum, (const guchar *)&tb_ras_enabled,
+                      sizeof(tb_ras_enabled));
+}
+
+/*
+ * Translation depends on the CPU model and its options, which are not
+ * all reflected in the TB flags.  Hash the type and class properties of
+ * @cpu, which cover both.
+ */
+static uint64_t tb_cache_compute_cpu_fp(CPUState *cpu)
+{
+    Object *obj = OBJECT(cpu);
+    g_autoptr(GChecksum) sum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_autoptr(GPtrArray) names = g_ptr_array_new();
+    ObjectPropertyIterator iter;
+    ObjectProperty *prop;
+    uint8_t digest[32];
+    gsize len = sizeof(digest);
+    uint64_t fp;
+    bool release_lock = !qemu_mutex_iothread_locked();
+    int i;
+
+    if (release_lock) {
+        qemu_mutex_lock_iothread();
+    }
+
+    object_class_property_iter_init(&iter, object_get_class(obj));
+    while ((prop = object_property_iter_next(&iter))) {
+        if (prop->get && !strstart(prop->type, "link<", NULL) &&
+            !strstart(prop->type, "child<", NULL)) {
+            g_ptr_array_add(names, (gpointer)prop->name);
+        }
+    }
+    g_ptr_array_sort(names, tb_cache_name_cmp);
+
+    g_checksum_update(sum, (const guchar *)object_get_typename(obj), -1);
+    for (i = 0; i < names->len; i++) {
+        const char *name = g_ptr_array_index(names, i);
+        g_autofree char *value = object_property_print(obj, name, true, NULL);
+
+        g_checksum_update(sum, (const guchar *)name, strlen(name) + 1);
+        if (value) {
+            g_checksum_update(sum, (const guchar *)value, strlen(value) + 1);
+        }
+    }
+
+    if (release_lock) {
+        qemu_mutex_unlock_iothread();
+    }
+
+    tb_cache_hash_tcg_options(sum);
+    g_checksum_get_digest(sum, digest, &len);
+    memcpy(&fp, digest, sizeof(fp));
+    return fp;
+}
+
+static uint64_t tb_cache_cpu_key(CPUState *cpu)
+{
+    CPUClass *cc = CPU_GET_CLASS(cpu);
+
+    return cc->tcg_ops->translate_key ? cc->tcg_ops->translate_key(cpu) : 0;
+}
+
+static uint64_t tb_cache_cpu_fp(CPUState *cpu)
+{
+    uint64_t *fp;
+
+    qemu_mutex_lock(&tb_cache.lock);
+    fp = g_hash_table_lookup(tb_cache.cpu_fp, cpu);
+    qemu_mutex_unlock(&tb_cache.lock);
+
+    if (!fp) {
+        fp = g_new(uint64_t, 1);
+        *fp = tb_cache_compute_cpu_fp(cpu);
+        qemu_mutex_lock(&tb_cache.lock);
+        g_hash_table_insert(tb_cache.cpu_fp, cpu, fp);
+        qemu_mutex_unlock(&tb_cache.lock);
+    }
+    return *fp;
+}
+
+/* Index the valid records of @buf, and return the length they span. */
+static size_t tb_cache_index(uint8_t *buf, size_t size)
+{
+    size_t ofs = sizeof(TBCacheHeader);
+
+    while (size - ofs >= sizeof(TBCacheRecord)) {
+        TBCacheRecord *r = (TBCacheRecord *)(buf + ofs);
+        GSList *l;
+
+        if (!tb_cache_rec_valid(r, size - ofs)) {
+            break;
+        }
+        l = g_hash_table_lookup(tb_cache.index, r);
+        g_hash_table_insert(tb_cache.index, r, g_slist_prepend(l, r));
+        ofs += r->len;
+    }
+    return ofs;
+}
+
+bool tb_cache_init(const char *dir, Error **errp)
+{
+#ifndef TCG_TARGET_HOST_RELOCS
+    error_setg(errp, "TB cache is not supported on this host");
+    return false;
+#else
+    g_autoptr(GChecksum) sum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_autofree char *path = NULL;
+    TBCacheHeader hdr = { .magic = TB_CACHE_MAGIC };
+    gsize len = sizeof(hdr.host_hash);
+    uint8_t *buf = NULL;
+    size_t size = 0, valid;
+    struct stat st;
+    int fd;
+
+    if (!tb_cache_hash_build_id(sum)) {
+        error_setg(errp, "TB cache needs a QEMU binary with a GNU build ID");
+        return false;
+    }
+
+    tb_cache.image_start = (uintptr_t)__executable_start;
+    tb_cache.image_end = (uintptr_t)_end;
+    tb_cache.prologue_start = (uintptr_t)tcg_qemu_tb_exec;
+    tb_cache.prologue_end =
+        (uintptr_t)tcg_splitwx_to_rx(tcg_ctx->code_gen_buffer);
+    g_checksum_update(sum, tcg_splitwx_to_rw(tcg_qemu_tb_exec),
+                      tb_cache.prologue_end - tb_cache.prologue_start);
+    tb_cache_hash_host_cpu(sum);
+    g_checksum_get_digest(sum, hdr.host_hash, &len);
+
+    if (g_mkdir_with_parents(dir, 0755) < 0) {
+        error_setg_errno(errp, errno, "cannot create TB cache directory '%s'",
+                         dir);
+        return false;
+    }
+    path = g_strdup_printf("%s/%s-%016" PRIx64 ".tbc", dir, TARGET_NAME,
+                           ldq_be_p(hdr.host_hash));
+    fd = qemu_create(path, O_RDWR | O_APPEND, 0644, errp);
+    if (fd < 0) {
+        return false;
+    }
+
+    /* Other QEMU processes may be appending to the same file. */
+    if (flock(fd, LOCK_EX) < 0 || fstat(fd, &st) < 0) {
+        error_setg_errno(errp, errno, "cannot lock TB cache '%s'", path);
+        close(fd);
+        return false;
+    }
+
+    tb_cache.index = g_hash_table_new(tb_cache_rec_hash, tb_cache_rec_equal);
+    tb_cache.cpu_fp = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    tb_cache.stored = g_hash_table_new_full(tb_cache_rec_hash,
+                                            tb_cache_rec_same, g_free, NULL);
+
+    if (st.st_size >= sizeof(hdr)) {
+        size = st.st_size;
+        buf = g_malloc(size);
+        if (pread(fd, buf, size, 0) != size || memcmp(buf, &hdr, sizeof(hdr))) {
+            g_free(buf);
+            buf = NULL;
+            size = 0;
+        }
+    }
+
+    if (buf) {
+        /* The records stay in @buf for the lifetime of the process. */
+        valid = tb_cache_index(buf, size);
+    } else {
+        valid = 0;
+    }
+    if (!valid || valid < st.st_size) {
+        /* Drop a torn or stale tail, and start over if need be. */
+        if (ftruncate(fd, valid) < 0 ||
+            (!valid && qemu_write_full(fd, &hdr, sizeof(hdr)) != sizeof(hdr))) {
+            error_setg_errno(errp, errno, "cannot reset TB cache '%s'", path);
+            flock(fd, LOCK_UN);
+            close(fd);
+            return false;
+        }
+    }
+    flock(fd, LOCK_UN);
+
+    qemu_mutex_init(&tb_cache.lock);
+    tb_cache.fd = fd;
+    tb_cache_enabled = true;
+    return true;
+#endif
+}
+
+bool tb_cache_eligible(CPUState *cpu, const TranslationBlock *tb)
+{
+    if (!tb_cache_enabled || tb_page_addr0(tb) == -1 ||
+        tb->trace_vcpu_dstate) {
+        return false;
+    }
+#ifdef CONFIG_PLUGIN
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+static uintptr_t tb_cache_anchor(uint32_t anchor, uintptr_t rx)
+{
+    switch (anchor) {
+    case TB_CACHE_ANCHOR_TB:
+        return rx;
+    case TB_CACHE_ANCHOR_IMAGE:
+        return tb_cache.image_start;
+    case TB_CACHE_ANCHOR_PROLOGUE:
+        return tb_cache.prologue_start;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Store @target at @p, which is at @at once executable, as @kind.
+ * Return false if it does not fit.
+ */
+static bool tb_cache_put_reloc(uint8_t *p, uintptr_t at, uint32_t kind,
+                               uintptr_t target)
+{
+    intptr_t disp;
+
+    switch (kind) {
+    case TCG_HOST_RELOC_PC32:
+        disp = target - (at + 4);
+        if (disp != (int32_t)disp) {
+            return false;
+        }
+        stl_he_p(p, disp);
+        return true;
+    case TCG_HOST_RELOC_ABS32:
+        if (target != (uint32_t)target) {
+            return false;
+        }
+        stl_he_p(p, target);
+        return true;
+    case TCG_HOST_RELOC_ABS32S:
+        if (target != (int32_t)target) {
+            return false;
+        }
+        stl_he_p(p, target);
+        return true;
+    case TCG_HOST_RELOC_ABS64:
+        stq_he_p(p, target);
+        return true;
+    default:
+        return false;
+    }
+}
+
+int tb_cache_load(CPUState *cpu, TranslationBlock *tb, target_ulong pc,
+                  const void *host_pc, tcg_insn_unit *gen_code_buf,
+                  int *search_size)
+{
+    uintptr_t rx = (uintptr_t)tb->tc.ptr;
+    intptr_t tb_off = (uintptr_t)tcg_splitwx_to_rx(tb) - rx;
+    TBCacheRecord key = {
+        .pc = pc,
+        .cs_base = tb->cs_base,
+        .phys_pc = tb_page_addr0(tb),
+        .flags = tb->flags,
+        .cflags = tb->cflags,
+        .cpu_fp = tb_cache_cpu_fp(cpu),
+        .cpu_key = tb_cache_cpu_key(cpu),
+    };
+    GSList *l;
+
+    for (l = g_hash_table_lookup(tb_cache.index, &key); l; l = l->next) {
+        const TBCacheRecord *r = l->data;
+        const TBCacheReloc *rel = tb_cache_rec_relocs(r);
+        uint8_t *code = (uint8_t *)gen_code_buf;
+        uint32_t i;
+
+        if (r->tb_off != tb_off ||
+            (pc & ~TARGET_PAGE_MASK) + r->size > TARGET_PAGE_SIZE ||
+            memcmp(host_pc, tb_cache_rec_guest(r), r->size) != 0) {
+            continue;
+        }
+        if ((void *)code + r->code_size + r->search_size >
+            tcg_ctx->code_gen_highwater) {
+            return -1;
+        }
+
+        memcpy(code, tb_cache_rec_code(r), r->code_size + r->search_size);
+        for (i = 0; i < r->nb_relocs; i++) {
+            uintptr_t base = tb_cache_anchor(rel[i].anchor, rx);
+
+            if (!base || rel[i].offset + tb_cache_reloc_size(rel[i].kind) >
+                         r->code_size ||
+                !tb_cache_put_reloc(code + rel[i].offset, rx + rel[i].offset,
+                                    rel[i].kind, base + rel[i].addend)) {
+                return -1;
+            }
+        }
+        flush_idcache_range(rx, (uintptr_t)code, r->code_size);
+
+        tb->size = r->size;
+        tb->icount = r->icount;
+        tb->tc.size = r->code_size;
+        tb->jmp_reset_offset[0] = r->jmp_reset_offset[0];
+        tb->jmp_reset_offset[1] = r->jmp_reset_offset[1];
+        tb->jmp_insn_offset[0] = r->jmp_insn_offset[0];
+        tb->jmp_insn_offset[1] = r->jmp_insn_offset[1];
+        *search_size = r->search_size;
+
+        trace_tb_cache_load(tb, pc, r->nb_relocs);
+        return r->code_size;
+    }
+    return -1;
+}
+
+/*
+ * Return true if memory may be mapped at @addr, so that a constant equal
+ * to @addr may be a pointer, for instance into the heap.
+ */
+static bool tb_cache_host_mapped(uintptr_t addr)
+{
+    uintptr_t page = addr & qemu_real_host_page_mask();
+    unsigned char vec;
+
+    if (page == 0) {
+        return false;
+    }
+    return mincore((void *)page, qemu_real_host_page_size(), &vec) == 0 ||
+           errno != ENOMEM;
+}
+
+/*
+ * Turn the host addresses that the backend found in the code of @tb,
+ * generated at @code, into @relocs.  Return false if one cannot be
+ * relocated, or a constant cannot be told apart from a pointer.
+ */
+static bool tb_cache_find_relocs(const TranslationBlock *tb,
+                                 const uint8_t *code, int code_size,
+                                 const TCGHostReloc *hr, GArray *relocs)
+{
+    uintptr_t rx = (uintptr_t)tb->tc.ptr;
+    uintptr_t tb_start = (uintptr_t)tcg_splitwx_to_rx((void *)tb);
+    uintptr_t buf_start, buf_end;
+
+    buf_start = (uintptr_t)tcg_splitwx_to_rx(tcg_ctx->code_gen_buffer);
+    buf_end = buf_start + tcg_ctx->code_gen_buffer_size;
+
+    for (; hr; hr = hr->next) {
+        intptr_t offset = (const uint8_t *)hr->site - code;
+        uintptr_t t = hr->target;
+        TBCacheReloc rel;
+
+        if (hr->kind == TCG_HOST_RELOC_IMM) {
+            if (tb_cache_host_mapped(t)) {
+                trace_tb_cache_reject(tb, offset);
+                return false;
+            }
+            continue;
+        }
+        if (offset < 0 || offset + tb_cache_reloc_size(hr->kind) > code_size) {
+            trace_tb_cache_reject(tb, offset);
+            return false;
+        }
+        rel.offset = offset;
+        rel.kind = hr->kind;
+        if (t >= tb_start && t <= rx + code_size) {
+            rel.anchor = TB_CACHE_ANCHOR_TB;
+            rel.addend = t - rx;
+        } else if (t >= tb_cache.image_start && t < tb_cache.image_end) {
+            rel.anchor = TB_CACHE_ANCHOR_IMAGE;
+            rel.addend = t - tb_cache.image_start;
+        } else if (t >= tb_cache.prologue_start && t < tb_cache.prologue_end) {
+            rel.anchor = TB_CACHE_ANCHOR_PROLOGUE;
+            rel.addend = t - tb_cache.prologue_start;
+        } else if (!hr->addr && (t < buf_start || t >= buf_end) &&
+                   !tb_cache_host_mapped(t)) {
+            /* A plain constant. */
+            continue;
+        } else {
+            trace_tb_cache_reject(tb, offset);
+            return false;
+        }
+        g_array_append_val(relocs, rel);
+    }
+    return true;
+}
+
+void tb_cache_store(CPUState *cpu, const TranslationBlock *tb,
+                    target_ulong pc, const void *host_pc, const void *code,
+                    int code_size, int search_size,
+                    const TCGHostReloc *host_relocs)
+{
+    g_autoptr(GArray) relocs = g_array_new(false, false, sizeof(TBCacheReloc));
+    g_autofree uint8_t *buf = NULL;
+    TBCacheRecord *r;
+    size_t guest_len, relocs_len, len;
+    struct stat st;
+    GSList *l;
+
+    if (!tb_cache_find_relocs(tb, code, code_size, host_relocs, relocs)) {
+        return;
+    }
+
+    guest_len = ROUND_UP(tb->size, 8);
+    relocs_len = relocs->len * sizeof(TBCacheReloc);
+    len = sizeof(*r) + guest_len + relocs_len +
+          ROUND_UP(code_size + search_size, 8);
+    buf = g_malloc0(len);
+
+    r = (TBCacheRecord *)buf;
+    r->magic = TB_CACHE_REC_MAGIC;
+    r->len = len;
+    r->cflags = tb->cflags;
+    r->cpu_fp = tb_cache_cpu_fp(cpu);
+    r->cpu_key = tb_cache_cpu_key(cpu);
+    r->pc = pc;
+    r->cs_base = tb->cs_base;
+    r->phys_pc = tb_page_addr0(tb);
+    r->flags = tb->flags;
+    r->size = tb->size;
+    r->icount = tb->icount;
+    r->code_size = code_size;
+    r->search_size = search_size;
+    r->tb_off = (uintptr_t)tcg_splitwx_to_rx((void *)tb) -
+                (uintptr_t)tb->tc.ptr;
+    r->nb_relocs = relocs->len;
+    r->jmp_reset_offset[0] = tb->jmp_reset_offset[0];
+    r->jmp_reset_offset[1] = tb->jmp_reset_offset[1];
+    r->jmp_insn_offset[0] = tb->jmp_insn_offset[0];
+    r->jmp_insn_offset[1] = tb->jmp_insn_offset[1];
+
+    memcpy(buf + sizeof(*r), host_pc, tb->size);
+    memcpy(buf + sizeof(*r) + guest_len, relocs->data, relocs_len);
+    memcpy(buf + sizeof(*r) + guest_len + relocs_len, code,
+           code_size + search_size);
+    r->crc = tb_cache_rec_crc(r);
+
+    /*
+     * A TB found in the file only misses if its code cannot be relocated
+     * to where this one is; that would not work any better with a copy.
+     */
+    for (l = g_hash_table_lookup(tb_cache.index, r); l; l = l->next) {
+        if (tb_cache_rec_same(l->data, r)) {
+            return;
+        }
+    }
+
+    qemu_mutex_lock(&tb_cache.lock);
+    if (!g_hash_table_contains(tb_cache.stored, r) &&
+        flock(tb_cache.fd, LOCK_EX) == 0) {
+        if (fstat(tb_cache.fd, &st) == 0 &&
+            st.st_size + len > TB_CACHE_MAX_SIZE) {
+            trace_tb_cache_full(st.st_size);
+        } else if (qemu_write_full(tb_cache.fd, buf, len) != len) {
+            warn_report_once("cannot write to TB cache: %s", strerror(errno));
+        } else {
+            /* Only the key and the guest code are needed to compare. */
+            g_hash_table_add(tb_cache.stored,
+                             g_memdup2(buf, sizeof(*r) + tb->size));
+            trace_tb_cache_store(tb, pc, r->nb_relocs);
+        }
+        flock(tb_cache.fd, LOCK_UN);
+    }
+    qemu_mutex_unlock(&tb_cache.lock);
+}
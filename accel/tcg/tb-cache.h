@@ -0,0 +1,76 @@
+/*
+ * Persistent on-disk cache of translated code.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef ACCEL_TCG_TB_CACHE_H
+#define ACCEL_TCG_TB_CACHE_H
+
+#if defined(CONFIG_TCG) && defined(CONFIG_LINUX)
+extern bool tb_cache_enabled;
+
+/*
+ * Open the cache for this QEMU binary and host in @dir, creating it if
+ * needed.  Must be called after the TCG prologue has been generated.
+ */
+bool tb_cache_init(const char *dir, Error **errp);
+
+/*
+ * Return whether @tb, whose identifying fields are filled in, may be
+ * loaded from or stored to the cache.
+ */
+bool tb_cache_eligible(CPUState *cpu, const TranslationBlock *tb);
+
+/*
+ * Look up @tb, at guest address @pc, in the cache, and if the guest
+ * code at @host_pc still matches, copy its host code and search data
+ * to @gen_code_buf.
+ * Return the size of the host code and fill in @search_size, the
+ * size, icount and jump offsets of @tb, or return -1 on a miss.
+ */
+int tb_cache_load(CPUState *cpu, TranslationBlock *tb, target_ulong pc,
+                  const void *host_pc, tcg_insn_unit *gen_code_buf,
+                  int *search_size);
+
+/*
+ * Store @tb, just translated into @code, to the cache, unless it is
+ * there already or the cache is full.  @host_relocs lists the host
+ * addresses in the code, as recorded by the TCG backend.
+ */
+void tb_cache_store(CPUState *cpu, const TranslationBlock *tb,
+                    target_ulong pc, const void *host_pc, const void *code,
+                    int code_size, int search_size,
+                    const TCGHostReloc *host_relocs);
+#else
+#define tb_cache_enabled false
+
+static inline bool tb_cache_init(const char *dir, Error **errp)
+{
+    error_setg(errp, "TB cache is not supported on this host");
+    return false;
+}
+
+static inline bool tb_cache_eligible(CPUState *cpu,
+                                     const TranslationBlock *tb)
+{
+    return false;
+}
+
+static inline int tb_cache_load(CPUState *cpu, TranslationBlock *tb,
+                                target_ulong pc, const void *host_pc,
+                                tcg_insn_unit *gen_code_buf, int *search_size)
+{
+    return -1;
+}
+
+static inline void tb_cache_store(CPUState *cpu, const TranslationBlock *tb,
+                                  target_ulong pc, const void *host_pc,
+                                  const void *code, int code_size,
+                                  int search_size,
+                                  const TCGHostReloc *host_relocs)
+{
+}
+#endif
+
+#endif
@@ -32,8 +32,12 @@ struct TBContext {
 
     struct qht htable;
 
+    /* Bumped by invalidations of code ranges, see tb-prefetch.c */
+    unsigned tb_invalidate_count;
+
     /* statistics */
     unsigned tb_flush_count;
+    unsigned tb_evict_count;
     unsigned tb_phys_invalidate_count;
 };
 
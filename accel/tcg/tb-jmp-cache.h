@@ -9,58 +9,105 @@
 #ifndef ACCEL_TCG_TB_JMP_CACHE_H
 #define ACCEL_TCG_TB_JMP_CACHE_H
 
-#define TB_JMP_CACHE_BITS 12
-#define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
+/*
+ * The cache is two-way set associative, with a number of sets that each
+ * vCPU adjusts to its miss rate, see tb_jmp_cache_resize().
+ */
+#define TB_JMP_CACHE_WAYS 2
+#define TB_JMP_CACHE_MIN_BITS 9
+#define TB_JMP_CACHE_DEFAULT_BITS 11
+#define TB_JMP_CACHE_MAX_BITS 15
+
+typedef struct CPUJumpCacheEntry {
+    TranslationBlock *tb;
+#if TARGET_TB_PCREL
+    target_ulong pc;
+#endif
+} CPUJumpCacheEntry;
 
 /*
  * Accessed in parallel; all accesses to 'tb' must be atomic.
  * For TARGET_TB_PCREL, accesses to 'pc' must be protected by
  * a load_acquire/store_release to 'tb'.
+ * Only the vCPU thread looks up and fills the cache, and replaces it when
+ * resizing; other threads must access it within an RCU read-side critical
+ * section, and may only clear entries.
  */
 struct CPUJumpCache {
     struct rcu_head rcu;
-    struct {
-        TranslationBlock *tb;
-#if TARGET_TB_PCREL
-        target_ulong pc;
-#endif
-    } array[TB_JMP_CACHE_SIZE];
+    unsigned bits; /* log2 of the number of sets */
+
+    /* Statistics, updated by the vCPU thread */
+    size_t hits;
+    size_t misses;
+    /* Values of hits + misses and misses when the window began */
+    size_t window_lookups;
+    size_t window_misses;
+
+    CPUJumpCacheEntry array[]; /* TB_JMP_CACHE_WAYS entries per set */
 };
 
+static inline size_t tb_jmp_cache_entries(const CPUJumpCache *jc)
+{
+    return (size_t)TB_JMP_CACHE_WAYS << jc->bits;
+}
+
 static inline TranslationBlock *
-tb_jmp_cache_get_tb(CPUJumpCache *jc, uint32_t hash)
+tb_jmp_cache_get_tb(CPUJumpCache *jc, uint32_t hash, int way)
 {
+    CPUJumpCacheEntry *e = &jc->array[hash * TB_JMP_CACHE_WAYS + way];
+
 #if TARGET_TB_PCREL
     /* Use acquire to ensure current load of pc from jc. */
-    return qatomic_load_acquire(&jc->array[hash].tb);
+    return qatomic_load_acquire(&e->tb);
 #else
     /* Use rcu_read to ensure current load of pc from *tb. */
-    return qatomic_rcu_read(&jc->array[hash].tb);
+    return qatomic_rcu_read(&e->tb);
 #endif
 }
 
 static inline target_ulong
-tb_jmp_cache_get_pc(CPUJumpCache *jc, uint32_t hash, TranslationBlock *tb)
+tb_jmp_cache_get_pc(CPUJumpCache *jc, uint32_t hash, int way,
+                    TranslationBlock *tb)
 {
 #if TARGET_TB_PCREL
-    return jc->array[hash].pc;
+    return jc->array[hash * TB_JMP_CACHE_WAYS + way].pc;
 #else
     return tb_pc(tb);
 #endif
 }
 
 static inline void
-tb_jmp_cache_set(CPUJumpCache *jc, uint32_t hash,
-                 TranslationBlock *tb, target_ulong pc)
+tb_jmp_cache_set_way(CPUJumpCache *jc, uint32_t hash, int way,
+                     TranslationBlock *tb, target_ulong pc)
 {
+    CPUJumpCacheEntry *e = &jc->array[hash * TB_JMP_CACHE_WAYS + way];
+
 #if TARGET_TB_PCREL
-    jc->array[hash].pc = pc;
+    e->pc = pc;
     /* Use store_release on tb to ensure pc is written first. */
-    qatomic_store_release(&jc->array[hash].tb, tb);
+    qatomic_store_release(&e->tb, tb);
 #else
     /* Use the pc value already stored in tb->pc. */
-    qatomic_set(&jc->array[hash].tb, tb);
+    qatomic_set(&e->tb, tb);
 #endif
 }
 
+/*
+ * Insert @tb as the most recently used entry of set @hash, moving the
+ * previous one to the other way unless it was invalidated.
+ */
+static inline void
+tb_jmp_cache_set(CPUJumpCache *jc, uint32_t hash,
+                 TranslationBlock *tb, target_ulong pc)
+{
+    TranslationBlock *old = tb_jmp_cache_get_tb(jc, hash, 0);
+
+    if (old && old != tb && !(tb_cflags(old) & CF_INVALID)) {
+        tb_jmp_cache_set_way(jc, hash, 1, old,
+                             tb_jmp_cache_get_pc(jc, hash, 0, old));
+    }
+    tb_jmp_cache_set_way(jc, hash, 0, tb, pc);
+}
+
 #endif /* ACCEL_TCG_TB_JMP_CACHE_H */
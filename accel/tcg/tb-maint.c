@@ -28,6 +28,8 @@
 #include "tb-hash.h"
 #include "tb-context.h"
 #include "internal.h"
+#include "tb-prefetch.h"
+#include "trace.h"
 
 
 /* List iterators for lists of tagged pointers in TranslationBlock. */
@@ -39,6 +41,16 @@
 #define TB_FOR_EACH_JMP(head_tb, tb, n)                                 \
     TB_FOR_EACH_TAGGED((head_tb)->jmp_list_head, tb, n, jmp_list_next)
 
+/*
+ * TBs count their executions up to this threshold, after which they are
+ * retranslated together with their successor, see tb_gen_superblock().
+ * Zero disables counting.
+ */
+uint32_t tb_hot_threshold;
+
+/* See translator_ras_return(). */
+bool tb_ras_enabled;
+
 static bool tb_cmp(const void *ap, const void *bp)
 {
     const TranslationBlock *a = ap;
@@ -190,8 +202,39 @@ struct PageDesc {
     QemuSpin lock;
     /* list of TBs intersecting this ram page */
     uintptr_t first_tb;
+    /*
+     * Bit N is set if the TBs may hold code from the Nth 64th of the page.
+     * Written with the lock held, but read without it.
+     */
+    uint64_t code_map;
 };
 
+#define TB_CODE_MAP_SHIFT  (TARGET_PAGE_BITS - 6)
+
+/* Return the code_map bits for [@start, @end[, within a single page. */
+static uint64_t tb_code_map_range(tb_page_addr_t start, tb_page_addr_t end)
+{
+    unsigned first = (start & ~TARGET_PAGE_MASK) >> TB_CODE_MAP_SHIFT;
+    unsigned last = ((end - 1) & ~TARGET_PAGE_MASK) >> TB_CODE_MAP_SHIFT;
+
+    return MAKE_64BIT_MASK(first, last - first + 1);
+}
+
+/* Return the code_map bits for the part of @tb on its page @n. */
+static uint64_t tb_code_map(const TranslationBlock *tb, unsigned n)
+{
+    tb_page_addr_t start, end;
+
+    if (n == 0) {
+        start = tb_page_addr0(tb);
+        end = MIN(start + tb->size, (start | ~TARGET_PAGE_MASK) + 1);
+    } else {
+        start = tb_page_addr1(tb);
+        end = start + ((tb_page_addr0(tb) + tb->size) & ~TARGET_PAGE_MASK);
+    }
+    return end > start ? tb_code_map_range(start, end) : 0;
+}
+
 void page_table_config_init(void)
 {
     uint32_t v_l1_bits;
@@ -579,6 +622,7 @@ static void tb_remove_all_1(int level, void **lp)
         for (i = 0; i < V_L2_SIZE; ++i) {
             page_lock(&pd[i]);
             pd[i].first_tb = (uintptr_t)NULL;
+            qatomic_set(&pd[i].code_map, 0);
             page_unlock(&pd[i]);
         }
     } else {
@@ -613,6 +657,7 @@ static inline void tb_page_add(PageDesc *p, TranslationBlock *tb,
     tb->page_next[n] = p->first_tb;
     page_already_protected = p->first_tb != 0;
     p->first_tb = (uintptr_t)tb | n;
+    qatomic_set(&p->code_map, p->code_map | tb_code_map(tb, n));
 
     /*
      * If some code is already present, then the pages are already
@@ -729,6 +774,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     bool did_flush = false;
 
     mmap_lock();
+    tb_prefetch_lock();
     /* If it is already been done on request of another CPU, just retry. */
     if (tb_ctx.tb_flush_count != tb_flush_count.host_int) {
         goto done;
@@ -737,6 +783,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 
     CPU_FOREACH(cpu) {
         tcg_flush_jmp_cache(cpu);
+        cpu->hot_tb = NULL;
     }
 
     qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
@@ -747,6 +794,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     qatomic_mb_set(&tb_ctx.tb_flush_count, tb_ctx.tb_flush_count + 1);
 
 done:
+    tb_prefetch_unlock();
     mmap_unlock();
     if (did_flush) {
         qemu_plugin_flush_cb();
@@ -767,6 +815,83 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+typedef struct TBEvict {
+    struct rcu_head rcu;
+    size_t region;
+    unsigned gen;
+} TBEvict;
+
+static gboolean tb_evict_collect(gpointer key, gpointer value, gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return false;
+}
+
+static void tb_evict_rcu(TBEvict *e)
+{
+    CPUState *cpu;
+    size_t i;
+
+    /*
+     * No vCPU can be running the region's code anymore, but one may have
+     * cached one of its TBs while it was being invalidated, in its jump
+     * cache or its return-address stack.
+     */
+    WITH_RCU_READ_LOCK_GUARD() {
+        CPU_FOREACH(cpu) {
+            CPUJumpCache *jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+
+            for (i = 0; i < tb_jmp_cache_entries(jc); i++) {
+                TranslationBlock *tb = qatomic_read(&jc->array[i].tb);
+
+                if (tb && tcg_region_contains(e->region, tb)) {
+                    qatomic_cmpxchg(&jc->array[i].tb, tb, NULL);
+                }
+            }
+            for (i = 0; i < CPU_RAS_SIZE; i++) {
+                CPUReturnStackEntry *r = &cpu_neg(cpu)->ras.entry[i];
+                TranslationBlock *tb = qatomic_read(&r->tb);
+
+                if (tb && tcg_region_contains(e->region, tb)) {
+                    qatomic_cmpxchg(&r->tb, tb, NULL);
+                }
+            }
+        }
+    }
+    tcg_region_evict_finish(e->region, e->gen);
+    g_free(e);
+}
+
+/*
+ * Evict the oldest region of the code buffer if it is running out of
+ * space, instead of waiting for it to be full and flushing all of it.
+ * The TBs of the region are invalidated like for self-modifying code,
+ * which unlinks them and drops them from the hash table and jump caches.
+ * Other vCPUs keep running meanwhile; the region is reused once they all
+ * left cpu_exec(), after an RCU grace period.
+ */
+void tb_evict_region(void)
+{
+    g_autoptr(GPtrArray) tbs = NULL;
+    TBEvict *e = g_new(TBEvict, 1);
+    guint i;
+
+    if (!tcg_region_evict_start(&e->region, &e->gen)) {
+        g_free(e);
+        return;
+    }
+
+    tbs = g_ptr_array_new();
+    tcg_region_tb_foreach(e->region, tb_evict_collect, tbs);
+    for (i = 0; i < tbs->len; i++) {
+        tb_phys_invalidate(g_ptr_array_index(tbs, i), -1);
+    }
+    trace_tb_evict_region(e->region, tbs->len);
+    qatomic_inc(&tb_ctx.tb_evict_count);
+
+    call_rcu(e, tb_evict_rcu, rcu);
+}
+
 /* remove @orig from its @n_orig-th jump list */
 static inline void tb_remove_from_jmp_list(TranslationBlock *orig, int n_orig)
 {
@@ -853,13 +978,19 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
             tcg_flush_jmp_cache(cpu);
         }
     } else {
-        uint32_t h = tb_jmp_cache_hash_func(tb_pc(tb));
+        RCU_READ_LOCK_GUARD();
 
         CPU_FOREACH(cpu) {
-            CPUJumpCache *jc = cpu->tb_jmp_cache;
+            CPUJumpCache *jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+            uint32_t h = tb_jmp_cache_hash_func(jc, tb_pc(tb));
+            int way;
+
+            for (way = 0; way < TB_JMP_CACHE_WAYS; way++) {
+                CPUJumpCacheEntry *e = &jc->array[h * TB_JMP_CACHE_WAYS + way];
 
-            if (qatomic_read(&jc->array[h].tb) == tb) {
-                qatomic_set(&jc->array[h].tb, NULL);
+                if (qatomic_read(&e->tb) == tb) {
+                    qatomic_set(&e->tb, NULL);
+                }
             }
         }
     }
@@ -1085,11 +1216,16 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
     TranslationBlock *tb;
     tb_page_addr_t tb_start, tb_end;
     PageForEachNext n;
+    uint64_t code_map = 0;
 #ifdef TARGET_HAS_PRECISE_SMC
     bool current_tb_modified = false;
     TranslationBlock *current_tb = retaddr ? tcg_tb_lookup(retaddr) : NULL;
 #endif /* TARGET_HAS_PRECISE_SMC */
 
+    if (tb_prefetch_enabled) {
+        qatomic_inc(&tb_ctx.tb_invalidate_count);
+    }
+
     /*
      * We remove all the TBs in the range [start, end[.
      * XXX: see if in some cases it could be faster to invalidate all the code
@@ -1125,6 +1261,12 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
         }
     }
 
+    /* Narrow down the parts of the page that still hold code. */
+    PAGE_FOR_EACH_TB(start, end, p, tb, n) {
+        code_map |= tb_code_map(tb, n);
+    }
+    qatomic_set(&p->code_map, code_map);
+
     /* if no code remaining, no need to continue to use slow writes */
     if (!p->first_tb) {
         tlb_unprotect_code(start);
@@ -1210,7 +1352,7 @@ static void tb_invalidate_phys_page_fast__locked(struct page_collection *pages,
 }
 
 /*
- * len must be <= 8 and start must be a multiple of len.
+ * The range must not cross a page boundary.
  * Called via softmmu_template.h when code areas are written to with
  * iothread mutex not held.
  */
@@ -1219,6 +1361,27 @@ void tb_invalidate_phys_range_fast(ram_addr_t ram_addr,
                                    uintptr_t retaddr)
 {
     struct page_collection *pages;
+    PageDesc *p = page_find(ram_addr >> TARGET_PAGE_BITS);
+    uint64_t code_map = p ? qatomic_read(&p->code_map) : 0;
+
+    /*
+     * Guests that generate code, such as JIT compilers, mostly write
+     * next to code rather than over it.  Skip the locks and the walk of
+     * the TBs when the page still holds code, but no TB may hold the
+     * bytes written.  A TB being recorded concurrently by another vCPU
+     * may be missed, as it can with the locks; background translations
+     * are discarded through tb_invalidate_count as on the locked path.
+     *
+     * A page without any code left, e.g. after tb_flush(), takes the
+     * locked path so that its write protection is removed.
+     */
+    if (code_map && !(code_map & tb_code_map_range(ram_addr,
+                                                   ram_addr + size))) {
+        if (tb_prefetch_enabled) {
+            qatomic_inc(&tb_ctx.tb_invalidate_count);
+        }
+        return;
+    }
 
     pages = page_collection_lock(ram_addr, ram_addr + size);
     tb_invalidate_phys_page_fast__locked(pages, ram_addr, size, retaddr);
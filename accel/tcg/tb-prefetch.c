@@ -0,0 +1,316 @@
+/*
+ * Background translation of likely successors of TranslationBlocks.
+ *
+ * A vCPU stalls whenever it reaches code that was not translated yet.
+ * To hide some of that latency, the direct jump targets of every new TB,
+ * which include the fall-through path of conditional branches, are
+ * queued for translation by a pool of threads.  Each thread has its own
+ * TCG context, and so its own region of the code buffer.  The TBs they
+ * generate are linked like any other, and found by the vCPU on lookup.
+ *
+ * Only targets on the same guest page as the TB are considered, since
+ * their physical address is known without a TLB lookup; they are assumed
+ * to run with the same flags as the TB, and with the same translate_key,
+ * which the vCPU computes when it queues them so that the threads never
+ * read its state.  Targets without translate_key are not supported.
+ * Translation is abandoned when it would need the vCPU, see
+ * tb_gen_code_speculative().
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "exec/exec-all.h"
+#include "hw/core/tcg-cpu-ops.h"
+#include "tcg/tcg.h"
+#include "tb-hash.h"
+#include "tb-context.h"
+#include "internal.h"
+#include "tb-prefetch.h"
+#include "trace.h"
+
+#define TB_PREFETCH_QUEUE_SIZE  256
+
+/* How many speculative TBs may follow one generated for a vCPU */
+#define TB_PREFETCH_MAX_DEPTH   2
+
+typedef struct TBPrefetchJob {
+    CPUState *cpu;
+    target_ulong pc;
+    target_ulong cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t trace_vcpu_dstate;
+    uint64_t translate_key;
+    unsigned tb_flush_count;
+    int depth;
+    tb_page_addr_t phys_pc;
+    const void *host_pc;
+} TBPrefetchJob;
+
+typedef struct TBPrefetchWorker {
+    /*
+     * Held by the thread while it translates, so that tb_flush() can
+     * exclude it.  Taken before tb_prefetch.lock.
+     */
+    QemuMutex gen_lock;
+    QemuThread thread;
+} TBPrefetchWorker;
+
+bool tb_prefetch_enabled;
+
+static struct {
+    TBPrefetchWorker *workers;
+    unsigned n_workers;
+
+    /* Protects the queue. */
+    QemuMutex lock;
+    QemuCond cond;
+    TBPrefetchJob queue[TB_PREFETCH_QUEUE_SIZE];
+    unsigned head;
+    unsigned count;
+} tb_prefetch;
+
+/* Plugins expect translation callbacks from the vCPU thread. */
+static bool tb_prefetch_plugin_active(CPUState *cpu)
+{
+#ifdef CONFIG_PLUGIN
+    return test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask);
+#else
+    return false;
+#endif
+}
+
+void tb_prefetch_queue(CPUState *cpu, const TranslationBlock *tb,
+                       target_ulong pc, const void *host_pc, int depth)
+{
+    const TCGCPUOps *ops = CPU_GET_CLASS(cpu)->tcg_ops;
+    uint32_t cflags = tb_cflags(tb);
+    uint64_t key;
+    int i, j, n;
+
+    if (tcg_ctx->nb_gen_jmp_dest == 0 || tb_page_addr0(tb) == -1 ||
+        (cflags & (CF_COUNT_MASK | CF_LAST_IO | CF_SINGLE_STEP |
+                   CF_NOIRQ | CF_MEMI_ONLY)) ||
+        !ops->translate_key || tb_prefetch_plugin_active(cpu)) {
+        return;
+    }
+    /* @tb was translated with this key, by the vCPU or from its own job. */
+    key = tcg_ctx->speculative ? tcg_ctx->speculative_key
+                               : ops->translate_key(cpu);
+
+    n = MIN(tcg_ctx->nb_gen_jmp_dest, ARRAY_SIZE(tcg_ctx->gen_jmp_dest));
+    qemu_mutex_lock(&tb_prefetch.lock);
+    for (i = 0; i < n; i++) {
+        target_ulong dest = tcg_ctx->gen_jmp_dest[i];
+        TBPrefetchJob *job;
+
+        for (j = 0; j < i && tcg_ctx->gen_jmp_dest[j] != dest; j++) {
+            continue;
+        }
+        if (dest == pc || j < i) {
+            continue;
+        }
+        /* Drop the oldest request rather than stall the vCPU. */
+        if (tb_prefetch.count == TB_PREFETCH_QUEUE_SIZE) {
+            tb_prefetch.head = (tb_prefetch.head + 1) % TB_PREFETCH_QUEUE_SIZE;
+            tb_prefetch.count--;
+        }
+        job = &tb_prefetch.queue[(tb_prefetch.head + tb_prefetch.count) %
+                                 TB_PREFETCH_QUEUE_SIZE];
+        tb_prefetch.count++;
+
+        *job = (TBPrefetchJob) {
+            .cpu = cpu,
+            .pc = dest,
+            .cs_base = tb->cs_base,
+            .flags = tb->flags,
+            .cflags = cflags & ~CF_INVALID,
+            .trace_vcpu_dstate = tb->trace_vcpu_dstate,
+            .translate_key = key,
+            .tb_flush_count = qatomic_read(&tb_ctx.tb_flush_count),
+            .depth = depth,
+            .phys_pc = tb_page_addr0(tb) + (dest - pc),
+            .host_pc = host_pc + (dest - pc),
+        };
+    }
+    qemu_cond_broadcast(&tb_prefetch.cond);
+    qemu_mutex_unlock(&tb_prefetch.lock);
+}
+
+/* Call with the RCU read lock held. */
+static bool tb_prefetch_present(const TBPrefetchJob *job)
+{
+    TranslationBlock key = {
+        .cs_base = job->cs_base,
+        .flags = job->flags,
+        .cflags = job->cflags,
+        .trace_vcpu_dstate = job->trace_vcpu_dstate,
+    };
+    uint32_t h;
+
+#if !TARGET_TB_PCREL
+    key.pc = job->pc;
+#endif
+    tb_set_page_addr0(&key, job->phys_pc);
+    tb_set_page_addr1(&key, -1);
+
+    h = tb_hash_func(job->phys_pc, (TARGET_TB_PCREL ? 0 : job->pc),
+                     job->flags, job->cflags, job->trace_vcpu_dstate);
+    return qht_lookup(&tb_ctx.htable, &key, h) != NULL;
+}
+
+/*
+ * Return whether @job is still worth doing: the code buffer was not
+ * flushed, no plugin was loaded, the guest RAM it refers to is still
+ * mapped, and the TB was not translated in the meantime.
+ * Call with the RCU read lock held.
+ */
+static bool tb_prefetch_valid(const TBPrefetchJob *job)
+{
+    RAMBlock *rb;
+    ram_addr_t offset;
+
+    if (qatomic_read(&tb_ctx.tb_flush_count) != job->tb_flush_count ||
+        tb_prefetch_plugin_active(job->cpu)) {
+        return false;
+    }
+    rb = qemu_ram_block_from_host((void *)job->host_pc, false, &offset);
+    if (!rb || qemu_ram_get_offset(rb) + offset != job->phys_pc) {
+        return false;
+    }
+    return !tb_prefetch_present(job);
+}
+
+static void *tb_prefetch_thread_fn(void *arg)
+{
+    TBPrefetchWorker *worker = arg;
+    g_autofree void *snapshot = g_malloc(TARGET_PAGE_SIZE);
+    bool registered = false;
+
+    rcu_register_thread();
+
+    while (true) {
+        TranslationBlock *tb;
+        TBPrefetchJob job;
+
+        qemu_mutex_lock(&tb_prefetch.lock);
+        while (tb_prefetch.count == 0) {
+            qemu_cond_wait(&tb_prefetch.cond, &tb_prefetch.lock);
+        }
+        qemu_mutex_unlock(&tb_prefetch.lock);
+
+        qemu_mutex_lock(&worker->gen_lock);
+        qemu_mutex_lock(&tb_prefetch.lock);
+        if (tb_prefetch.count == 0) {
+            /* Taken by another thread, or cancelled. */
+            qemu_mutex_unlock(&tb_prefetch.lock);
+            qemu_mutex_unlock(&worker->gen_lock);
+            continue;
+        }
+        job = tb_prefetch.queue[tb_prefetch.head];
+        tb_prefetch.head = (tb_prefetch.head + 1) % TB_PREFETCH_QUEUE_SIZE;
+        tb_prefetch.count--;
+        qemu_mutex_unlock(&tb_prefetch.lock);
+
+        /*
+         * Copy the TCG context only now that a vCPU ran, so that it has
+         * the globals registered by the target.
+         */
+        if (!registered) {
+            tcg_register_thread();
+            tcg_ctx->speculative = true;
+            registered = true;
+        }
+
+        WITH_RCU_READ_LOCK_GUARD() {
+            if (tb_prefetch_valid(&job)) {
+                tb = tb_gen_code_speculative(job.cpu, job.pc, job.cs_base,
+                                             job.flags, job.cflags,
+                                             job.trace_vcpu_dstate,
+                                             job.translate_key,
+                                             job.phys_pc, job.host_pc,
+                                             snapshot);
+                trace_tb_prefetch(tb, job.pc, job.depth);
+                if (tb && job.depth < TB_PREFETCH_MAX_DEPTH) {
+                    tb_prefetch_queue(job.cpu, tb, job.pc, job.host_pc,
+                                      job.depth + 1);
+                }
+            }
+        }
+        qemu_mutex_unlock(&worker->gen_lock);
+    }
+
+    return NULL;
+}
+
+void tb_prefetch_cancel(CPUState *cpu)
+{
+    unsigned i, n = 0;
+
+    if (!tb_prefetch_enabled) {
+        return;
+    }
+
+    tb_prefetch_lock();
+    qemu_mutex_lock(&tb_prefetch.lock);
+    for (i = 0; i < tb_prefetch.count; i++) {
+        TBPrefetchJob *job = &tb_prefetch.queue[(tb_prefetch.head + i) %
+                                                TB_PREFETCH_QUEUE_SIZE];
+
+        if (job->cpu != cpu) {
+            tb_prefetch.queue[(tb_prefetch.head + n++) %
+                              TB_PREFETCH_QUEUE_SIZE] = *job;
+        }
+    }
+    tb_prefetch.count = n;
+    qemu_mutex_unlock(&tb_prefetch.lock);
+    tb_prefetch_unlock();
+}
+
+/* Wait for every thread to be done translating, in a fixed order. */
+void tb_prefetch_lock(void)
+{
+    unsigned i;
+
+    if (tb_prefetch_enabled) {
+        for (i = 0; i < tb_prefetch.n_workers; i++) {
+            qemu_mutex_lock(&tb_prefetch.workers[i].gen_lock);
+        }
+    }
+}
+
+void tb_prefetch_unlock(void)
+{
+    unsigned i;
+
+    if (tb_prefetch_enabled) {
+        for (i = tb_prefetch.n_workers; i-- > 0; ) {
+            qemu_mutex_unlock(&tb_prefetch.workers[i].gen_lock);
+        }
+    }
+}
+
+void tb_prefetch_init(unsigned n_threads)
+{
+    unsigned i;
+
+    qemu_mutex_init(&tb_prefetch.lock);
+    qemu_cond_init(&tb_prefetch.cond);
+    tb_prefetch.workers = g_new0(TBPrefetchWorker, n_threads);
+    tb_prefetch.n_workers = n_threads;
+    for (i = 0; i < n_threads; i++) {
+        qemu_mutex_init(&tb_prefetch.workers[i].gen_lock);
+    }
+    tb_prefetch_enabled = true;
+
+    for (i = 0; i < n_threads; i++) {
+        TBPrefetchWorker *worker = &tb_prefetch.workers[i];
+        g_autofree char *name = g_strdup_printf("TCG prefetch %u", i);
+
+        qemu_thread_create(&worker->thread, name, tb_prefetch_thread_fn,
+                           worker, QEMU_THREAD_DETACHED);
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * Background translation of likely successors of TranslationBlocks.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef ACCEL_TCG_TB_PREFETCH_H
+#define ACCEL_TCG_TB_PREFETCH_H
+
+#ifdef CONFIG_SOFTMMU
+extern bool tb_prefetch_enabled;
+
+/* Start @n_threads background translation threads. */
+void tb_prefetch_init(unsigned n_threads);
+
+/*
+ * Queue the direct jump targets of @tb, just generated from the guest
+ * code at @host_pc by the current TCG context, for translation in the
+ * background.  @depth counts the speculative TBs leading to @tb.
+ */
+void tb_prefetch_queue(CPUState *cpu, const TranslationBlock *tb,
+                       target_ulong pc, const void *host_pc, int depth);
+
+/* Drop the pending requests of @cpu, and wait for those in progress. */
+void tb_prefetch_cancel(CPUState *cpu);
+
+/*
+ * Exclude background translation, for instance while flushing the code
+ * buffer.
+ */
+void tb_prefetch_lock(void);
+void tb_prefetch_unlock(void);
+#else
+#define tb_prefetch_enabled false
+
+static inline void tb_prefetch_queue(CPUState *cpu,
+                                     const TranslationBlock *tb,
+                                     target_ulong pc, const void *host_pc,
+                                     int depth)
+{
+}
+
+static inline void tb_prefetch_cancel(CPUState *cpu)
+{
+}
+
+static inline void tb_prefetch_lock(void)
+{
+}
+
+static inline void tb_prefetch_unlock(void)
+{
+}
+#endif
+
+#endif
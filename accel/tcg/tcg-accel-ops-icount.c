@@ -1,6 +1,10 @@
 /*
  * QEMU TCG Single Threaded vCPUs implementation using instruction counting
  *
+ * With several RR threads, the vCPUs run in parallel for a quantum of
+ * instructions each, and QEMU_CLOCK_VIRTUAL only advances once all of
+ * them have run it or gone idle.
+ *
  * Copyright (c) 2003-2008 Fabrice Bellard
  * Copyright (c) 2014 Red Hat Inc.
  *
@@ -73,6 +77,60 @@ static void icount_notify_aio_contexts(void)
     qemu_clock_run_timers(QEMU_CLOCK_VIRTUAL);
 }
 
+/*
+ * With parallel vCPUs, the length of the current quantum, which is
+ * icount_quantum unless a timer is due earlier.  It only changes at the
+ * end of a quantum, under BQL, while no vCPU runs.
+ */
+static int64_t icount_quantum_len = INT64_MAX;
+
+static int64_t icount_quantum_left(CPUState *cpu)
+{
+    return MIN(icount_quantum_len, icount_quantum) - cpu->icount_quantum_used;
+}
+
+bool icount_quantum_done(CPUState *cpu)
+{
+    return icount_quantum && icount_quantum_left(cpu) <= 0;
+}
+
+bool icount_try_end_quantum(void)
+{
+    CPUState *cpu;
+
+    g_assert(qemu_mutex_iothread_locked());
+
+    if (!icount_quantum) {
+        return false;
+    }
+    CPU_FOREACH(cpu) {
+        /*
+         * A vCPU that ran WFI is idle before its last instructions are
+         * in icount_quantum_used; wait for them.
+         */
+        if (cpu->icount_quantum_running ||
+            (!icount_quantum_done(cpu) && !cpu_thread_is_idle(cpu))) {
+            return false;
+        }
+    }
+    if (!icount_end_quantum()) {
+        /* Every vCPU is idle: the warp timer moves the clock instead. */
+        return false;
+    }
+
+    /*
+     * The clock is now the same for every vCPU, so the timers run as
+     * they would with a single thread.
+     */
+    icount_notify_aio_contexts();
+    icount_quantum_len = MAX(1, MIN(icount_quantum, icount_get_limit()));
+
+    CPU_FOREACH(cpu) {
+        qemu_cond_broadcast(cpu->halt_cond);
+    }
+    return true;
+}
+
 void icount_handle_deadline(void)
 {
     assert(qemu_in_vcpu_thread());
@@ -101,7 +159,11 @@ void icount_prepare_for_run(CPUState *cpu)
     g_assert(cpu_neg(cpu)->icount_decr.u16.low == 0);
     g_assert(cpu->icount_extra == 0);
 
-    cpu->icount_budget = icount_get_limit();
+    if (icount_quantum) {
+        cpu->icount_budget = icount_quantum_left(cpu);
+    } else {
+        cpu->icount_budget = icount_get_limit();
+    }
     insns_left = MIN(0xffff, cpu->icount_budget);
     cpu_neg(cpu)->icount_decr.u16.low = insns_left;
     cpu->icount_extra = cpu->icount_budget - insns_left;
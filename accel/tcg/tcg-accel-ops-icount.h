@@ -14,6 +14,16 @@ void icount_handle_deadline(void);
 void icount_prepare_for_run(CPUState *cpu);
 void icount_process_data(CPUState *cpu);
 
+/* Whether @cpu ran its share of the current quantum, and must wait. */
+bool icount_quantum_done(CPUState *cpu);
+
+/*
+ * End the quantum if every vCPU is done with it or idle, then run the
+ * timers that are due and wake up the vCPU threads.  Return whether the
+ * quantum ended.  Caller must hold BQL.
+ */
+bool icount_try_end_quantum(void);
+
 void icount_handle_interrupt(CPUState *cpu, int mask);
 
 #endif /* TCG_ACCEL_OPS_ICOUNT_H */
@@ -31,19 +31,62 @@
 #include "qemu/notify.h"
 #include "qemu/guest-random.h"
 #include "exec/exec-all.h"
+#include "hw/boards.h"
 
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-rr.h"
 #include "tcg-accel-ops-icount.h"
 
-/* Kick all RR vCPUs */
-void rr_kick_vcpu_thread(CPUState *unused)
+/*
+ * With rr_n_threads > 1, the vCPUs are split between as many threads,
+ * each of which runs its share in turn.  vCPU N belongs to thread
+ * N % rr_n_threads.  The vCPUs of a thread share its QemuThread and
+ * halt condition.
+ */
+typedef struct RRThread {
+    QemuThread thread;
+    QemuCond halt_cond;
+    Notifier force_rcu;
+    /* The first vCPU of the thread, which starts it */
+    CPUState *first;
+    /* The vCPU being run, if any */
+    CPUState *current;
+} RRThread;
+
+unsigned int rr_n_threads = 1;
+static RRThread *rr_threads;
+
+static RRThread *rr_thread_of(CPUState *cpu)
 {
-    CPUState *cpu;
+    return &rr_threads[cpu->cpu_index % rr_n_threads];
+}
 
-    CPU_FOREACH(cpu) {
-        cpu_exit(cpu);
-    };
+/* Return the vCPU of @t after @cpu, or NULL. */
+static CPUState *rr_next_cpu(RRThread *t, CPUState *cpu)
+{
+    do {
+        cpu = CPU_NEXT(cpu);
+    } while (cpu && rr_thread_of(cpu) != t);
+    return cpu;
+}
+
+static CPUState *rr_first_cpu(RRThread *t)
+{
+    return rr_thread_of(first_cpu) == t ? first_cpu : rr_next_cpu(t, first_cpu);
+}
+
+#define RR_FOREACH_CPU(t, cpu) \
+    for ((cpu) = rr_first_cpu(t); (cpu); (cpu) = rr_next_cpu(t, cpu))
+
+/* Kick all the RR vCPUs that share the thread of @cpu */
+void rr_kick_vcpu_thread(CPUState *cpu)
+{
+    RRThread *t = rr_thread_of(cpu);
+    CPUState *other;
+
+    RR_FOREACH_CPU(t, other) {
+        cpu_exit(other);
+    }
 }
 
 /*
@@ -59,29 +102,32 @@ void rr_kick_vcpu_thread(CPUState *unused)
  */
 
 static QEMUTimer *rr_kick_vcpu_timer;
-static CPUState *rr_current_cpu;
 
 static inline int64_t rr_next_kick_time(void)
 {
     return qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + TCG_KICK_PERIOD;
 }
 
-/* Kick the currently round-robin scheduled vCPU to next */
-static void rr_kick_next_cpu(void)
+/* Kick the currently round-robin scheduled vCPU of @t to next */
+static void rr_kick_next_cpu(RRThread *t)
 {
     CPUState *cpu;
     do {
-        cpu = qatomic_mb_read(&rr_current_cpu);
+        cpu = qatomic_mb_read(&t->current);
         if (cpu) {
             cpu_exit(cpu);
         }
-    } while (cpu != qatomic_mb_read(&rr_current_cpu));
+    } while (cpu != qatomic_mb_read(&t->current));
 }
 
 static void rr_kick_thread(void *opaque)
 {
+    unsigned int i;
+
     timer_mod(rr_kick_vcpu_timer, rr_next_kick_time());
-    rr_kick_next_cpu();
+    for (i = 0; i < rr_n_threads; i++) {
+        rr_kick_next_cpu(&rr_threads[i]);
+    }
 }
 
 static void rr_start_kick_timer(void)
@@ -102,18 +148,42 @@ static void rr_stop_kick_timer(void)
     }
 }
 
-static void rr_wait_io_event(void)
+/*
+ * Whether the vCPUs of @t have nothing to do, or, with icount, only
+ * have to wait for the others to finish the quantum.
+ */
+static bool rr_thread_idle(RRThread *t)
+{
+    CPUState *cpu;
+
+    RR_FOREACH_CPU(t, cpu) {
+        if (!cpu_thread_is_idle(cpu) &&
+            !(icount_quantum_done(cpu) && !cpu->stop &&
+              cpu_work_list_empty(cpu))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void rr_wait_io_event(RRThread *t)
 {
     CPUState *cpu;
 
-    while (all_cpu_threads_idle()) {
-        rr_stop_kick_timer();
-        qemu_cond_wait_iothread(first_cpu->halt_cond);
+    while (rr_thread_idle(t)) {
+        if (icount_try_end_quantum()) {
+            continue;
+        }
+        /* The other threads may still need the timer. */
+        if (all_cpu_threads_idle()) {
+            rr_stop_kick_timer();
+        }
+        qemu_cond_wait_iothread(&t->halt_cond);
     }
 
     rr_start_kick_timer();
 
-    CPU_FOREACH(cpu) {
+    RR_FOREACH_CPU(t, cpu) {
         qemu_wait_io_event_common(cpu);
     }
 }
@@ -122,11 +192,11 @@ static void rr_wait_io_event(void)
  * Destroy any remaining vCPUs which have been unplugged and have
  * finished running
  */
-static void rr_deal_with_unplugged_cpus(void)
+static void rr_deal_with_unplugged_cpus(RRThread *t)
 {
     CPUState *cpu;
 
-    CPU_FOREACH(cpu) {
+    RR_FOREACH_CPU(t, cpu) {
         if (cpu->unplug && !cpu_can_run(cpu)) {
             tcg_cpus_destroy(cpu);
             break;
@@ -136,7 +206,7 @@ static void rr_deal_with_unplugged_cpus(void)
 
 static void rr_force_rcu(Notifier *notify, void *data)
 {
-    rr_kick_next_cpu();
+    rr_kick_next_cpu(container_of(notify, RRThread, force_rcu));
 }
 
 /*
@@ -149,13 +219,13 @@ static void rr_force_rcu(Notifier *notify, void *data)
 
 static void *rr_cpu_thread_fn(void *arg)
 {
-    Notifier force_rcu;
-    CPUState *cpu = arg;
+    RRThread *t = arg;
+    CPUState *cpu = t->first;
 
     assert(tcg_enabled());
     rcu_register_thread();
-    force_rcu.notify = rr_force_rcu;
-    rcu_add_force_rcu_notifier(&force_rcu);
+    t->force_rcu.notify = rr_force_rcu;
+    rcu_add_force_rcu_notifier(&t->force_rcu);
     tcg_register_thread();
 
     qemu_mutex_lock_iothread();
@@ -167,11 +237,11 @@ static void *rr_cpu_thread_fn(void *arg)
     qemu_guest_random_seed_thread_part2(cpu->random_seed);
 
     /* wait for initial kick-off after machine start */
-    while (first_cpu->stopped) {
-        qemu_cond_wait_iothread(first_cpu->halt_cond);
+    while (t->first->stopped) {
+        qemu_cond_wait_iothread(&t->halt_cond);
 
         /* process any pending work */
-        CPU_FOREACH(cpu) {
+        RR_FOREACH_CPU(t, cpu) {
             current_cpu = cpu;
             qemu_wait_io_event_common(cpu);
         }
@@ -179,7 +249,7 @@ static void *rr_cpu_thread_fn(void *arg)
 
     rr_start_kick_timer();
 
-    cpu = first_cpu;
+    cpu = rr_first_cpu(t);
 
     /* process any pending work */
     cpu->exit_request = 1;
@@ -195,27 +265,35 @@ static void *rr_cpu_thread_fn(void *arg)
             /*
              * Run the timers here.  This is much more efficient than
              * waking up the I/O thread and waiting for completion.
+             * With parallel vCPUs, they run at the end of each quantum.
              */
-            icount_handle_deadline();
+            if (!icount_quantum) {
+                icount_handle_deadline();
+            }
         }
 
         replay_mutex_unlock();
 
         if (!cpu) {
-            cpu = first_cpu;
+            cpu = rr_first_cpu(t);
         }
 
         while (cpu && cpu_work_list_empty(cpu) && !cpu->exit_request) {
 
-            qatomic_mb_set(&rr_current_cpu, cpu);
+            qatomic_mb_set(&t->current, cpu);
             current_cpu = cpu;
 
             qemu_clock_enable(QEMU_CLOCK_VIRTUAL,
                               (cpu->singlestep_enabled & SSTEP_NOTIMER) == 0);
 
-            if (cpu_can_run(cpu)) {
+            if (cpu_can_run(cpu) && !icount_quantum_done(cpu)) {
                 int r;
 
+                /*
+                 * The quantum must not end before the instructions run
+                 * here are accounted, even if the vCPU goes idle first.
+                 */
+                cpu->icount_quantum_running = true;
                 qemu_mutex_unlock_iothread();
                 if (icount_enabled()) {
                     icount_prepare_for_run(cpu);
@@ -225,6 +303,7 @@ static void *rr_cpu_thread_fn(void *arg)
                     icount_process_data(cpu);
                 }
                 qemu_mutex_lock_iothread();
+                cpu->icount_quantum_running = false;
 
                 if (r == EXCP_DEBUG) {
                     cpu_handle_guest_debug(cpu);
@@ -237,16 +316,16 @@ static void *rr_cpu_thread_fn(void *arg)
                 }
             } else if (cpu->stop) {
                 if (cpu->unplug) {
-                    cpu = CPU_NEXT(cpu);
+                    cpu = rr_next_cpu(t, cpu);
                 }
                 break;
             }
 
-            cpu = CPU_NEXT(cpu);
+            cpu = rr_next_cpu(t, cpu);
         } /* while (cpu && !cpu->exit_request).. */
 
         /* Does not need qatomic_mb_set because a spurious wakeup is okay.  */
-        qatomic_set(&rr_current_cpu, NULL);
+        qatomic_set(&t->current, NULL);
 
         if (cpu && cpu->exit_request) {
             qatomic_mb_set(&cpu->exit_request, 0);
@@ -260,11 +339,11 @@ static void *rr_cpu_thread_fn(void *arg)
             qemu_notify_event();
         }
 
-        rr_wait_io_event();
-        rr_deal_with_unplugged_cpus();
+        rr_wait_io_event(t);
+        rr_deal_with_unplugged_cpus(t);
     }
 
-    rcu_remove_force_rcu_notifier(&force_rcu);
+    rcu_remove_force_rcu_notifier(&t->force_rcu);
     rcu_unregister_thread();
     return NULL;
 }
@@ -272,33 +351,39 @@ static void *rr_cpu_thread_fn(void *arg)
 void rr_start_vcpu_thread(CPUState *cpu)
 {
     char thread_name[VCPU_THREAD_NAME_SIZE];
-    static QemuCond *single_tcg_halt_cond;
-    static QemuThread *single_tcg_cpu_thread;
+    RRThread *t;
 
     g_assert(tcg_enabled());
-    tcg_cpu_init_cflags(cpu, false);
+    tcg_cpu_init_cflags(cpu, rr_n_threads > 1 &&
+                        current_machine->smp.max_cpus > 1);
 
-    if (!single_tcg_cpu_thread) {
-        cpu->thread = g_new0(QemuThread, 1);
-        cpu->halt_cond = g_new0(QemuCond, 1);
+    if (!rr_threads) {
+        rr_threads = g_new0(RRThread, rr_n_threads);
+    }
+    t = rr_thread_of(cpu);
+    cpu->thread = &t->thread;
+    cpu->halt_cond = &t->halt_cond;
+
+    if (!t->first) {
+        t->first = cpu;
         qemu_cond_init(cpu->halt_cond);
 
-        /* share a single thread for all cpus with TCG */
-        snprintf(thread_name, VCPU_THREAD_NAME_SIZE, "ALL CPUs/TCG");
+        if (rr_n_threads == 1) {
+            /* share a single thread for all cpus with TCG */
+            snprintf(thread_name, VCPU_THREAD_NAME_SIZE, "ALL CPUs/TCG");
+        } else {
+            snprintf(thread_name, VCPU_THREAD_NAME_SIZE, "CPUs %td/TCG",
+                     t - rr_threads);
+        }
         qemu_thread_create(cpu->thread, thread_name,
                            rr_cpu_thread_fn,
-                           cpu, QEMU_THREAD_JOINABLE);
-
-        single_tcg_halt_cond = cpu->halt_cond;
-        single_tcg_cpu_thread = cpu->thread;
+                           t, QEMU_THREAD_JOINABLE);
 #ifdef _WIN32
         cpu->hThread = qemu_thread_get_handle(cpu->thread);
 #endif
     } else {
         /* we share the thread */
-        cpu->thread = single_tcg_cpu_thread;
-        cpu->halt_cond = single_tcg_halt_cond;
-        cpu->thread_id = first_cpu->thread_id;
+        cpu->thread_id = t->first->thread_id;
         cpu->can_do_io = 1;
         cpu->created = true;
     }
@@ -12,10 +12,16 @@
 
 #define TCG_KICK_PERIOD (NANOSECONDS_PER_SECOND / 10)
 
-/* Kick all RR vCPUs. */
-void rr_kick_vcpu_thread(CPUState *unused);
+/*
+ * Number of threads between which the vCPUs are split, each running
+ * its share in turn.  Set before the vCPUs are created.
+ */
+extern unsigned int rr_n_threads;
+
+/* Kick all RR vCPUs that share the thread of @cpu. */
+void rr_kick_vcpu_thread(CPUState *cpu);
 
-/* start the round robin vcpu thread */
+/* start the round robin vcpu thread, or share it */
 void rr_start_vcpu_thread(CPUState *cpu);
 
 #endif /* TCG_ACCEL_OPS_RR_H */
@@ -35,8 +35,11 @@
 #include "qemu/units.h"
 #if !defined(CONFIG_USER_ONLY)
 #include "hw/boards.h"
+#include "tcg-accel-ops-rr.h"
 #endif
 #include "internal.h"
+#include "tb-cache.h"
+#include "tb-prefetch.h"
 
 struct TCGState {
     AccelState parent_obj;
@@ -44,6 +47,15 @@ struct TCGState {
     bool mttcg_enabled;
     int splitwx_enabled;
     unsigned long tb_size;
+    uint32_t tb_workers;
+    uint32_t rr_threads;
+    uint32_t icount_quantum;
+    uint32_t superblock_threshold;
+    uint32_t pinned_globals;
+    bool tb_evict;
+    bool return_stack;
+    bool cross_bb_regs;
+    char *tb_cache_dir;
 };
 typedef struct TCGState TCGState;
 
@@ -99,6 +111,7 @@ static void tcg_accel_instance_init(Object *obj)
     TCGState *s = TCG_STATE(obj);
 
     s->mttcg_enabled = default_mttcg_enabled();
+    s->icount_quantum = 10000;
 
     /* If debugging enabled, default "auto on", otherwise off. */
 #if defined(CONFIG_DEBUG_TCG) && !defined(CONFIG_USER_ONLY)
@@ -109,22 +122,71 @@ static void tcg_accel_instance_init(Object *obj)
 }
 
 bool mttcg_enabled;
+bool tcg_parallel_enabled;
 
 static int tcg_init_machine(MachineState *ms)
 {
     TCGState *s = TCG_STATE(current_accel());
 #ifdef CONFIG_USER_ONLY
-    unsigned max_cpus = 1;
+    unsigned max_threads = 1;
+
+    if (s->rr_threads > 1) {
+        error_report("rr-threads is not supported in user mode emulation");
+        return -EINVAL;
+    }
 #else
-    unsigned max_cpus = ms->smp.max_cpus;
+    unsigned rr_threads = MIN(MAX(s->rr_threads, 1), ms->smp.max_cpus);
+    unsigned max_threads = s->mttcg_enabled ? ms->smp.max_cpus : rr_threads;
+
+    max_threads += s->tb_workers;
+
+    if (rr_threads > 1) {
+        if (s->mttcg_enabled) {
+            error_report("rr-threads needs thread=single");
+            return -EINVAL;
+        }
+        if (replay_mode != REPLAY_MODE_NONE) {
+            error_report("rr-threads is not supported with record/replay");
+            return -EINVAL;
+        }
+        if (TCG_OVERSIZED_GUEST) {
+            error_report("rr-threads is not supported when guest word size "
+                         "> hosts");
+            return -EINVAL;
+        }
+        /* The threads run in parallel, like with thread=multi. */
+        if (!check_tcg_memory_orders_compatible()) {
+            warn_report("Guest expects a stronger memory ordering "
+                        "than the host provides");
+        }
+    }
+    rr_n_threads = rr_threads;
+    if (rr_threads > 1 && icount_enabled()) {
+        icount_quantum = MAX(s->icount_quantum, 1);
+    }
 #endif
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
+#ifdef CONFIG_USER_ONLY
+    tcg_parallel_enabled = mttcg_enabled;
+#else
+    tcg_parallel_enabled = mttcg_enabled || rr_n_threads > 1;
+#endif
 
     page_init();
     tb_htable_init();
-    tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
+#ifdef CONFIG_USER_ONLY
+    if (s->tb_evict) {
+        error_report("tb-evict is not supported in user mode emulation");
+        return -EINVAL;
+    }
+#endif
+    tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_threads, s->tb_evict);
+    tb_hot_threshold = s->superblock_threshold;
+    tcg_ctx->max_pinned = s->pinned_globals;
+    tb_ras_enabled = s->return_stack;
+    tcg_ctx->cross_bb_regs = s->cross_bb_regs;
 
 #if defined(CONFIG_SOFTMMU)
     /*
@@ -132,6 +194,28 @@ static int tcg_init_machine(MachineState *ms)
      * initialize the prologue now.
      */
     tcg_prologue_init(tcg_ctx);
+
+    if (s->tb_cache_dir) {
+        Error *local_err = NULL;
+
+        if (!tb_cache_init(s->tb_cache_dir, &local_err)) {
+            error_report_err(local_err);
+            return -EINVAL;
+        }
+    }
+
+    if (s->tb_workers) {
+        tb_prefetch_init(s->tb_workers);
+    }
+#else
+    if (s->tb_cache_dir) {
+        error_report("tb-cache is not supported in user mode emulation");
+        return -EINVAL;
+    }
+    if (s->tb_workers) {
+        error_report("tb-workers is not supported in user mode emulation");
+        return -EINVAL;
+    }
 #endif
 
     return 0;
@@ -196,6 +280,187 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_tb_workers(Object *obj, Visitor *v,
+                               const char *name, void *opaque,
+                               Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->tb_workers;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_tb_workers(Object *obj, Visitor *v,
+                               const char *name, void *opaque,
+                               Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > 64) {
+        error_setg(errp, "Invalid 'tb-workers' value %" PRIu32
+                   ", the maximum is 64", value);
+        return;
+    }
+
+    s->tb_workers = value;
+}
+
+static void tcg_get_rr_threads(Object *obj, Visitor *v,
+                               const char *name, void *opaque,
+                               Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->rr_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_rr_threads(Object *obj, Visitor *v,
+                               const char *name, void *opaque,
+                               Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->rr_threads = value;
+}
+
+static void tcg_get_icount_quantum(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->icount_quantum;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_icount_quantum(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->icount_quantum = value;
+}
+
+static void tcg_get_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->superblock_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->superblock_threshold = value;
+}
+
+static void tcg_get_pinned_globals(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->pinned_globals;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_pinned_globals(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > 8) {
+        error_setg(errp, "Invalid 'pinned-globals' value %" PRIu32
+                   ", the maximum is 8", value);
+        return;
+    }
+
+    s->pinned_globals = value;
+}
+
+static char *tcg_get_tb_cache(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->tb_cache_dir);
+}
+
+static void tcg_set_tb_cache(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    g_free(s->tb_cache_dir);
+    s->tb_cache_dir = g_strdup(value);
+}
+
+static bool tcg_get_tb_evict(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->tb_evict;
+}
+
+static void tcg_set_tb_evict(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->tb_evict = value;
+}
+
+static bool tcg_get_return_stack(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->return_stack;
+}
+
+static void tcg_set_return_stack(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->return_stack = value;
+}
+
+static bool tcg_get_cross_bb_regs(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->cross_bb_regs;
+}
+
+static void tcg_set_cross_bb_regs(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->cross_bb_regs = value;
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -241,6 +506,58 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "tb-workers", "int",
+        tcg_get_tb_workers, tcg_set_tb_workers,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tb-workers",
+        "Number of threads translating code ahead of the vCPUs");
+
+    object_class_property_add(oc, "rr-threads", "int",
+        tcg_get_rr_threads, tcg_set_rr_threads,
+        NULL, NULL);
+    object_class_property_set_description(oc, "rr-threads",
+        "Number of threads running the vCPUs in turn with thread=single");
+
+    object_class_property_add(oc, "icount-quantum", "int",
+        tcg_get_icount_quantum, tcg_set_icount_quantum,
+        NULL, NULL);
+    object_class_property_set_description(oc, "icount-quantum",
+        "Instructions each vCPU runs before the others catch up, "
+        "with icount and rr-threads");
+
+    object_class_property_add(oc, "superblock-threshold", "int",
+        tcg_get_superblock_threshold, tcg_set_superblock_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "superblock-threshold",
+        "Executions after which a TB is retranslated with its successor");
+
+    object_class_property_add(oc, "pinned-globals", "int",
+        tcg_get_pinned_globals, tcg_set_pinned_globals,
+        NULL, NULL);
+    object_class_property_set_description(oc, "pinned-globals",
+        "Number of guest registers kept in host registers across TBs");
+
+    object_class_property_add_bool(oc, "return-stack",
+        tcg_get_return_stack, tcg_set_return_stack);
+    object_class_property_set_description(oc, "return-stack",
+        "Predict the targets of guest returns in generated code");
+
+    object_class_property_add_bool(oc, "cross-bb-regs",
+        tcg_get_cross_bb_regs, tcg_set_cross_bb_regs);
+    object_class_property_set_description(oc, "cross-bb-regs",
+        "Keep guest registers in host registers across branches within a TB");
+
+    object_class_property_add_str(oc, "tb-cache",
+                                  tcg_get_tb_cache,
+                                  tcg_set_tb_cache);
+    object_class_property_set_description(oc, "tb-cache",
+        "Directory of the persistent translation cache");
+
+    object_class_property_add_bool(oc, "tb-evict",
+        tcg_get_tb_evict, tcg_set_tb_evict);
+    object_class_property_set_description(oc, "tb-evict",
+        "Evict the oldest translations instead of flushing a full cache");
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
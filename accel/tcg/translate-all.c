@@ -63,6 +63,8 @@
 #include "tb-context.h"
 #include "internal.h"
 #include "perf.h"
+#include "tb-cache.h"
+#include "tb-prefetch.h"
 
 /* Make sure all possible CPU event bits fit in tb->trace_vcpu_dstate */
 QEMU_BUILD_BUG_ON(CPU_TRACE_DSTATE_MAX_EVENTS >
@@ -296,6 +298,25 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
     return tcg_gen_code(tcg_ctx, tb, pc);
 }
 
+static void tb_init_jumps(TranslationBlock *tb)
+{
+    /* init jump list */
+    qemu_spin_init(&tb->jmp_lock);
+    tb->jmp_list_head = (uintptr_t)NULL;
+    tb->jmp_list_next[0] = (uintptr_t)NULL;
+    tb->jmp_list_next[1] = (uintptr_t)NULL;
+    tb->jmp_dest[0] = (uintptr_t)NULL;
+    tb->jmp_dest[1] = (uintptr_t)NULL;
+
+    /* init original jump addresses which have been set during tcg_gen_code() */
+    if (tb->jmp_reset_offset[0] != TB_JMP_OFFSET_INVALID) {
+        tb_reset_jump(tb, 0);
+    }
+    if (tb->jmp_reset_offset[1] != TB_JMP_OFFSET_INVALID) {
+        tb_reset_jump(tb, 1);
+    }
+}
+
 /* Called with mmap_lock held for user mode emulation.  */
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
@@ -311,6 +332,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 #endif
     int64_t ti;
     void *host_pc;
+    bool cacheable;
 
     assert_memory_lock();
     qemu_thread_jit_write();
@@ -338,6 +360,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         cpu->exception_index = EXCP_INTERRUPT;
         cpu_loop_exit(cpu);
     }
+    if (unlikely(tcg_region_evict_wanted())) {
+        tb_evict_region();
+    }
 
     gen_code_buf = tcg_ctx->code_gen_ptr;
     tb->tc.ptr = tcg_splitwx_to_rx(gen_code_buf);
@@ -348,9 +373,22 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->exec_count = tb_hot_threshold;
     tb_set_page_addr0(tb, phys_pc);
     tb_set_page_addr1(tb, -1);
     tcg_ctx->gen_tb = tb;
+
+    cacheable = tb_cache_eligible(cpu, tb);
+    if (cacheable) {
+        gen_code_size = tb_cache_load(cpu, tb, pc, host_pc, gen_code_buf,
+                                      &search_size);
+        if (gen_code_size >= 0) {
+            goto tb_loaded;
+        }
+    }
+    /* Have the backend note the host addresses it embeds in the code. */
+    tcg_ctx->record_host_relocs = cacheable;
+
  tb_overflow:
 
 #ifdef CONFIG_PROFILER
@@ -495,25 +533,17 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
 #endif
 
+    /* Only TBs within a single guest page are cached. */
+    if (cacheable && tb_page_addr1(tb) == -1) {
+        tb_cache_store(cpu, tb, pc, host_pc, gen_code_buf, gen_code_size,
+                       search_size, tcg_ctx->host_relocs);
+    }
+
+ tb_loaded:
     qatomic_set(&tcg_ctx->code_gen_ptr, (void *)
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN));
-
-    /* init jump list */
-    qemu_spin_init(&tb->jmp_lock);
-    tb->jmp_list_head = (uintptr_t)NULL;
-    tb->jmp_list_next[0] = (uintptr_t)NULL;
-    tb->jmp_list_next[1] = (uintptr_t)NULL;
-    tb->jmp_dest[0] = (uintptr_t)NULL;
-    tb->jmp_dest[1] = (uintptr_t)NULL;
-
-    /* init original jump addresses which have been set during tcg_gen_code() */
-    if (tb->jmp_reset_offset[0] != TB_JMP_OFFSET_INVALID) {
-        tb_reset_jump(tb, 0);
-    }
-    if (tb->jmp_reset_offset[1] != TB_JMP_OFFSET_INVALID) {
-        tb_reset_jump(tb, 1);
-    }
+    tb_init_jumps(tb);
 
     /*
      * If the TB is not associated with a physical RAM page then it must be
@@ -545,8 +575,415 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         tcg_tb_remove(tb);
         return existing_tb;
     }
+
+    if (tb_prefetch_enabled) {
+        tb_prefetch_queue(cpu, tb, pc, host_pc, 0);
+    }
+    return tb;
+}
+
+#ifdef CONFIG_SOFTMMU
+/*
+ * Translate a TB at @pc for @cpu on a background thread, whose TCG
+ * context is marked speculative.  The front end reads the state of @cpu
+ * that is not in @flags from @translate_key, computed by the vCPU thread
+ * when it queued the TB, since the vCPU keeps running meanwhile.  The
+ * guest code is read from @snapshot, a copy of the rest of the page at
+ * @host_pc taken beforehand, so that the TB can be checked against the
+ * page once it is visible to writers.  Translation is abandoned if it
+ * needs the vCPU, for instance to read code from another page.
+ *
+ * Return the new TB, or NULL if none was added.
+ */
+TranslationBlock *tb_gen_code_speculative(CPUState *cpu, target_ulong pc,
+                                          target_ulong cs_base,
+                                          uint32_t flags, int cflags,
+                                          uint32_t trace_vcpu_dstate,
+                                          uint64_t translate_key,
+                                          tb_page_addr_t phys_pc,
+                                          const void *host_pc, void *snapshot)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TranslationBlock *tb, *existing_tb;
+    tcg_insn_unit *gen_code_buf;
+    int gen_code_size, search_size, max_insns = TCG_MAX_INSNS;
+    unsigned invalidate_count;
+    int64_t ti = 0;
+
+    tcg_debug_assert(tcg_ctx->speculative);
+    tcg_ctx->speculative_key = translate_key;
+
+    invalidate_count = qatomic_load_acquire(&tb_ctx.tb_invalidate_count);
+    memcpy(snapshot, host_pc, TARGET_PAGE_SIZE - (pc & ~TARGET_PAGE_MASK));
+
+    qemu_thread_jit_write();
+
+ buffer_overflow:
+    tb = tcg_tb_alloc(tcg_ctx);
+    if (unlikely(!tb)) {
+        /* Leave flushing the buffer to the vCPUs. */
+        goto out;
+    }
+
+    gen_code_buf = tcg_ctx->code_gen_ptr;
+    tb->tc.ptr = tcg_splitwx_to_rx(gen_code_buf);
+#if !TARGET_TB_PCREL
+    tb->pc = pc;
+#endif
+    tb->cs_base = cs_base;
+    tb->flags = flags;
+    tb->cflags = cflags;
+    tb->trace_vcpu_dstate = trace_vcpu_dstate;
+    tb->exec_count = tb_hot_threshold;
+    tb_set_page_addr0(tb, phys_pc);
+    tb_set_page_addr1(tb, -1);
+    tcg_ctx->gen_tb = tb;
+ tb_overflow:
+
+    gen_code_size = setjmp_gen_code(env, tb, pc, snapshot, &max_insns, &ti);
+    if (unlikely(gen_code_size < 0)) {
+        switch (gen_code_size) {
+        case -1:
+            goto buffer_overflow;
+        case -2:
+            assert(max_insns > 1);
+            max_insns /= 2;
+            goto tb_overflow;
+        case -3:
+            /* Abandoned, the vCPU will translate it when it gets there. */
+            goto discard;
+        default:
+            g_assert_not_reached();
+        }
+    }
+    search_size = encode_search(tb, (void *)gen_code_buf + gen_code_size);
+    if (unlikely(search_size < 0)) {
+        goto buffer_overflow;
+    }
+    tb->tc.size = gen_code_size;
+
+    qatomic_set(&tcg_ctx->code_gen_ptr, (void *)
+        ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
+                 CODE_GEN_ALIGN));
+    tb_init_jumps(tb);
+
+    tcg_tb_insert(tb);
+    existing_tb = tb_link_page(tb, phys_pc, -1);
+    if (unlikely(existing_tb != tb)) {
+        tcg_tb_remove(tb);
+        goto discard;
+    }
+
+    /*
+     * Now that the TB is on the page, writes to its code invalidate it.
+     * A write may have raced with translation though: check that the code
+     * did not change since the snapshot, and that no invalidation started
+     * in the meantime, whose write may not have landed yet.
+     */
+    smp_mb();
+    if (qatomic_read(&tb_ctx.tb_invalidate_count) != invalidate_count ||
+        memcmp(host_pc, snapshot, tb->size) != 0) {
+        tb_phys_invalidate(tb, -1);
+        tb = NULL;
+    }
+    goto out;
+
+ discard:
+    /* Give back the space, starting with the TB itself. */
+    qatomic_set(&tcg_ctx->code_gen_ptr, (void *)tb);
+    tb = NULL;
+ out:
+    qemu_thread_jit_execute();
     return tb;
 }
+#endif
+
+/*
+ * Check that the ops just generated for @tb, a retranslation of @hot at
+ * @pc, end with a direct jump to a TB that can be appended to them: one
+ * on the same page, at or after @pc, to which @hot is chained and which
+ * therefore runs with the same flags.  Only the exit request path may
+ * follow the jump.
+ * Return the goto_tb op and fill in @dest, or return NULL.
+ */
+static TCGOp *superblock_tail_jump(TCGContext *s, TranslationBlock *tb,
+                                   TranslationBlock *hot, target_ulong pc,
+                                   target_ulong *dest)
+{
+    uintptr_t rx = (uintptr_t)tcg_splitwx_to_rx(tb);
+    TCGOp *op, *goto_op = NULL;
+    TranslationBlock *succ;
+    uintptr_t jmp_dest;
+    int n = 0, slot;
+
+    QTAILQ_FOREACH(op, &s->ops, link) {
+        if (op->opc == INDEX_op_goto_tb) {
+            goto_op = op;
+            n++;
+        }
+    }
+    if (!goto_op || n != s->nb_gen_jmp_dest ||
+        n > ARRAY_SIZE(s->gen_jmp_dest) ||
+        tb->icount != hot->icount || tb->size != hot->size) {
+        return NULL;
+    }
+    slot = goto_op->args[0];
+
+    /* Between the goto_tb and its exit_tb, only the PC may be updated. */
+    op = QTAILQ_NEXT(goto_op, link);
+    while (op && op->opc != INDEX_op_exit_tb) {
+        if (op->opc == INDEX_op_set_label || op->opc == INDEX_op_call ||
+            (tcg_op_defs[op->opc].flags &
+             (TCG_OPF_BB_EXIT | TCG_OPF_BB_END | TCG_OPF_COND_BRANCH))) {
+            return NULL;
+        }
+        op = QTAILQ_NEXT(op, link);
+    }
+    if (!op || op->args[0] != rx + slot) {
+        return NULL;
+    }
+
+    op = QTAILQ_NEXT(op, link);
+    if (op) {
+        if (op->opc != INDEX_op_set_label ||
+            arg_label(op->args[0]) != s->exitreq_label) {
+            return NULL;
+        }
+        op = QTAILQ_NEXT(op, link);
+        if (!op || op->opc != INDEX_op_exit_tb ||
+            op->args[0] != rx + TB_EXIT_REQUESTED ||
+            QTAILQ_NEXT(op, link)) {
+            return NULL;
+        }
+    }
+
+    *dest = s->gen_jmp_dest[n - 1];
+    if (*dest < pc) {
+        return NULL;
+    }
+    jmp_dest = qatomic_read(&hot->jmp_dest[slot]);
+    succ = (TranslationBlock *)(jmp_dest & ~1);
+    if (!succ || (jmp_dest & 1) ||
+        succ->cs_base != hot->cs_base ||
+        succ->flags != hot->flags ||
+        (tb_cflags(succ) & ~CF_INVALID) != (tb_cflags(hot) & ~CF_INVALID) ||
+        succ->trace_vcpu_dstate != hot->trace_vcpu_dstate ||
+        tb_page_addr0(succ) != tb_page_addr0(hot) + (*dest - pc)) {
+        return NULL;
+    }
+    return goto_op;
+}
+
+/*
+ * Generate the code of superblock @tb: @hot translated again at @pc,
+ * followed by the TB its last direct jump leads to in place of the jump.
+ * Return the size of the generated code, or negative on error, with -3
+ * meaning that the superblock cannot be formed.
+ */
+static int setjmp_gen_superblock(CPUArchState *env, TranslationBlock *tb,
+                                 TranslationBlock *hot, target_ulong pc,
+                                 void *host_pc)
+{
+    CPUState *cpu = env_cpu(env);
+    TCGContext *s = tcg_ctx;
+    uintptr_t rx = (uintptr_t)tcg_splitwx_to_rx(tb);
+    QTAILQ_HEAD(, TCGOp) tail = QTAILQ_HEAD_INITIALIZER(tail);
+    TCGOp *op, *next, *goto_op, *last_op;
+    target_ulong dest;
+    unsigned used = 0;
+    int ret, icount, size;
+
+    ret = sigsetjmp(s->jmp_trans, 0);
+    if (unlikely(ret != 0)) {
+        return ret;
+    }
+
+    tcg_func_start(s);
+    s->cpu = cpu;
+    gen_intermediate_code(cpu, tb, hot->icount, pc, host_pc);
+
+    goto_op = superblock_tail_jump(s, tb, hot, pc, &dest);
+    if (!goto_op) {
+        s->cpu = NULL;
+        return -3;
+    }
+
+    /*
+     * Drop the jump but keep the PC update before it, and set aside the
+     * exit request path, which goes back at the end.
+     */
+    op = QTAILQ_NEXT(goto_op, link);
+    tcg_op_remove(s, goto_op);
+    while (op->opc != INDEX_op_exit_tb) {
+        op = QTAILQ_NEXT(op, link);
+    }
+    next = QTAILQ_NEXT(op, link);
+    tcg_op_remove(s, op);
+    for (op = next; op; op = next) {
+        next = QTAILQ_NEXT(op, link);
+        QTAILQ_REMOVE(&s->ops, op, link);
+        QTAILQ_INSERT_TAIL(&tail, op, link);
+    }
+
+    QTAILQ_FOREACH(op, &s->ops, link) {
+        if (op->opc == INDEX_op_goto_tb) {
+            used |= 1 << op->args[0];
+        }
+    }
+    last_op = tcg_last_op();
+    icount = tb->icount;
+    size = tb->size;
+
+    /* The successor runs on without checking for exit requests. */
+#ifdef CONFIG_DEBUG_TCG
+    s->goto_tb_issue_mask = 0;
+#endif
+    tb->cflags |= CF_NOIRQ;
+    gen_intermediate_code(cpu, tb, TCG_MAX_INSNS - icount, dest,
+                          host_pc + (dest - pc));
+    tb->cflags &= ~CF_NOIRQ;
+    s->cpu = NULL;
+
+    if (tb_page_addr1(tb) != -1) {
+        return -3;
+    }
+    tb->icount += icount;
+    tb->size = MAX(size, dest - pc + tb->size);
+
+    /*
+     * Move the direct jumps of the successor to the slots left free, or
+     * make them return to the main loop if there are none.
+     */
+    for (op = QTAILQ_NEXT(last_op, link); op; op = next) {
+        TCGOp *exit_op = QTAILQ_NEXT(op, link);
+        int slot, new_slot;
+
+        next = exit_op;
+        if (op->opc != INDEX_op_goto_tb) {
+            continue;
+        }
+        slot = op->args[0];
+        while (exit_op->opc != INDEX_op_exit_tb ||
+               exit_op->args[0] != rx + slot) {
+            exit_op = QTAILQ_NEXT(exit_op, link);
+        }
+
+        new_slot = (used & (1 << slot)) ? ctz32(~used) : slot;
+        if (new_slot >= ARRAY_SIZE(tb->jmp_dest)) {
+            tcg_op_remove(s, op);
+            exit_op->args[0] = 0;
+        } else {
+            op->args[0] = new_slot;
+            exit_op->args[0] = rx + new_slot;
+            used |= 1 << new_slot;
+        }
+    }
+
+    while ((op = QTAILQ_FIRST(&tail))) {
+        QTAILQ_REMOVE(&tail, op, link);
+        QTAILQ_INSERT_TAIL(&s->ops, op, link);
+    }
+
+    return tcg_gen_code(s, tb, pc);
+}
+
+/*
+ * Replace @hot, found at @pc and just become hot, with a superblock: a
+ * retranslation of @hot that carries on into the TB its last direct jump
+ * leads to, instead of jumping there.  When @hot is the body of a loop,
+ * that TB is often @hot itself, which is then unrolled once.  Either way
+ * the optimizer and register allocator see the two as a single unit, and
+ * the jump between them goes away.
+ *
+ * Called with mmap_lock held for user mode emulation.
+ * Return the superblock, or NULL if none was formed and @hot stays.
+ */
+TranslationBlock *tb_gen_superblock(CPUState *cpu, TranslationBlock *hot,
+                                    target_ulong pc)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TranslationBlock *tb, *existing_tb;
+    tcg_insn_unit *gen_code_buf;
+    tb_page_addr_t phys_pc;
+    int gen_code_size, search_size;
+    void *host_pc;
+
+    assert_memory_lock();
+
+    if (hot->icount >= TCG_MAX_INSNS || tb_page_addr1(hot) != -1 ||
+        (tb_cflags(hot) & (CF_COUNT_MASK | CF_LAST_IO | CF_SINGLE_STEP |
+                           CF_NOIRQ | CF_MEMI_ONLY | CF_USE_ICOUNT |
+                           CF_INVALID))) {
+        return NULL;
+    }
+#ifdef CONFIG_PLUGIN
+    /* Plugins expect each translation to match a single guest block. */
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        return NULL;
+    }
+#endif
+    phys_pc = get_page_addr_code_hostp(env, pc, &host_pc);
+    if (phys_pc == -1 || phys_pc != tb_page_addr0(hot)) {
+        return NULL;
+    }
+
+    qemu_thread_jit_write();
+
+    tb = tcg_tb_alloc(tcg_ctx);
+    if (unlikely(!tb)) {
+        /* Leave flushing the buffer to tb_gen_code(). */
+        return NULL;
+    }
+
+    gen_code_buf = tcg_ctx->code_gen_ptr;
+    tb->tc.ptr = tcg_splitwx_to_rx(gen_code_buf);
+#if !TARGET_TB_PCREL
+    tb->pc = pc;
+#endif
+    tb->cs_base = hot->cs_base;
+    tb->flags = hot->flags;
+    tb->cflags = tb_cflags(hot);
+    tb->trace_vcpu_dstate = hot->trace_vcpu_dstate;
+    /* Superblocks are not counted, and do not grow any further. */
+    tb->exec_count = 0;
+    tb_set_page_addr0(tb, phys_pc);
+    tb_set_page_addr1(tb, -1);
+    tcg_ctx->gen_tb = tb;
+
+    gen_code_size = setjmp_gen_superblock(env, tb, hot, pc, host_pc);
+    if (unlikely(gen_code_size < 0)) {
+        goto discard;
+    }
+    search_size = encode_search(tb, (void *)gen_code_buf + gen_code_size);
+    if (unlikely(search_size < 0)) {
+        goto discard;
+    }
+    tb->tc.size = gen_code_size;
+
+    qatomic_set(&tcg_ctx->code_gen_ptr, (void *)
+        ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
+                 CODE_GEN_ALIGN));
+    tb_init_jumps(tb);
+
+    /* @hot must go first, since the superblock has the same key. */
+    tb_phys_invalidate(hot, -1);
+    tcg_tb_insert(tb);
+    existing_tb = tb_link_page(tb, phys_pc, -1);
+    if (unlikely(existing_tb != tb)) {
+        /* Another vCPU got there first. */
+        tcg_tb_remove(tb);
+        qatomic_set(&tcg_ctx->code_gen_ptr, (void *)tb);
+        return existing_tb;
+    }
+
+    trace_tb_superblock(tb, pc, tb->icount);
+    return tb;
+
+ discard:
+    /* Give back the space, starting with the TB itself. */
+    qatomic_set(&tcg_ctx->code_gen_ptr, (void *)tb);
+    return NULL;
+}
 
 /* user-mode: call with mmap_lock held */
 void tb_check_watchpoint(CPUState *cpu, uintptr_t retaddr)
@@ -702,6 +1139,37 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
+static void dump_jmp_cache_info(GString *buf)
+{
+    size_t hits = 0, misses = 0, lookups;
+    unsigned min_bits = UINT_MAX, max_bits = 0;
+    CPUState *cpu;
+
+    RCU_READ_LOCK_GUARD();
+    CPU_FOREACH(cpu) {
+        CPUJumpCache *jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+
+        if (jc) {
+            hits += qatomic_read(&jc->hits);
+            misses += qatomic_read(&jc->misses);
+            min_bits = MIN(min_bits, jc->bits);
+            max_bits = MAX(max_bits, jc->bits);
+        }
+    }
+    if (min_bits > max_bits) {
+        return;
+    }
+
+    lookups = hits + misses;
+    g_string_append_printf(buf, "jump cache hits     %zu (%0.1f%%)\n",
+                           hits, lookups ? (double)hits * 100 / lookups : 0);
+    g_string_append_printf(buf, "jump cache misses   %zu (%0.1f%%)\n",
+                           misses,
+                           lookups ? (double)misses * 100 / lookups : 0);
+    g_string_append_printf(buf, "jump cache sets     %u..%u per vCPU\n",
+                           1u << min_bits, 1u << max_bits);
+}
+
 void dump_exec_info(GString *buf)
 {
     struct tb_tree_stats tst = {};
@@ -747,6 +1215,9 @@ void dump_exec_info(GString *buf)
                            qatomic_read(&tb_ctx.tb_flush_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    g_string_append_printf(buf, "TB region evictions %u\n",
+                           qatomic_read(&tb_ctx.tb_evict_count));
+    dump_jmp_cache_info(buf);
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
@@ -772,14 +1243,19 @@ void cpu_interrupt(CPUState *cpu, int mask)
  */
 void tcg_flush_jmp_cache(CPUState *cpu)
 {
-    CPUJumpCache *jc = cpu->tb_jmp_cache;
+    CPUJumpCache *jc;
+
+    tb_ras_flush(cpu);
+
+    RCU_READ_LOCK_GUARD();
+    jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
 
     /* During early initialization, the cache may not yet be allocated. */
     if (unlikely(jc == NULL)) {
         return;
     }
 
-    for (int i = 0; i < TB_JMP_CACHE_SIZE; i++) {
+    for (size_t i = 0; i < tb_jmp_cache_entries(jc); i++) {
         qatomic_set(&jc->array[i].tb, NULL);
     }
 }
@@ -17,6 +17,7 @@
 #include "exec/translator.h"
 #include "exec/plugin-gen.h"
 #include "sysemu/replay.h"
+#include "internal.h"
 
 /* Pairs with tcg_clear_temp_count.
    To be called by #TranslatorOps.{translate_insn,tb_stop} if
@@ -39,7 +40,168 @@ bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest)
     }
 
     /* Check for the dest on the same page as the start of the TB.  */
-    return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
+    if ((db->pc_first ^ dest) & TARGET_PAGE_MASK) {
+        return false;
+    }
+
+    /*
+     * Record the destination, for background translation and superblock
+     * formation.  The count goes on past the size of the array.
+     */
+    if (tcg_ctx->nb_gen_jmp_dest < ARRAY_SIZE(tcg_ctx->gen_jmp_dest)) {
+        tcg_ctx->gen_jmp_dest[tcg_ctx->nb_gen_jmp_dest] = dest;
+    }
+    tcg_ctx->nb_gen_jmp_dest++;
+    return true;
+}
+
+#define CPU_RAS_OFS(FIELD) \
+    ((int)offsetof(ArchCPU, neg.ras.FIELD) - (int)offsetof(ArchCPU, env))
+
+static bool translator_use_ras(DisasContextBase *db)
+{
+    return tb_ras_enabled &&
+           !(tb_cflags(db->tb) & (CF_COUNT_MASK | CF_LAST_IO | CF_SINGLE_STEP |
+                                  CF_MEMI_ONLY | CF_NO_GOTO_PTR));
+}
+
+/*
+ * Return env plus the offset of entry @top from entry 0 of the
+ * return-address stack, to be used with CPU_RAS_OFS(entry[0].FIELD).
+ * The pointer is live across the branches that follow.
+ */
+static TCGv_ptr gen_ras_entry(TCGv_i32 top)
+{
+    TCGv_ptr ptr = tcg_temp_local_new_ptr();
+    TCGv_i32 ofs = tcg_temp_new_i32();
+
+    tcg_gen_muli_i32(ofs, top, sizeof(CPUReturnStackEntry));
+    tcg_gen_ext_i32_ptr(ptr, ofs);
+    tcg_gen_add_ptr(ptr, ptr, cpu_env);
+    tcg_temp_free_i32(ofs);
+    return ptr;
+}
+
+void translator_ras_push(DisasContextBase *db, target_ulong ret_pc)
+{
+    TCGv_i32 top;
+    TCGv_ptr ptr;
+    TCGv pc;
+    TCGLabel *same;
+
+    if (!translator_use_ras(db)) {
+        return;
+    }
+
+    top = tcg_temp_new_i32();
+    tcg_gen_ld_i32(top, cpu_env, CPU_RAS_OFS(top));
+    ptr = gen_ras_entry(top);
+    tcg_gen_addi_i32(top, top, 1);
+    tcg_gen_andi_i32(top, top, CPU_RAS_SIZE - 1);
+    tcg_gen_st_i32(top, cpu_env, CPU_RAS_OFS(top));
+    tcg_temp_free_i32(top);
+
+    /*
+     * Keep the TB cached in the entry if it is for the same return
+     * address, as when a loop calls the same function over and over.
+     */
+    pc = tcg_temp_new();
+    same = gen_new_label();
+    tcg_gen_ld_tl(pc, ptr, CPU_RAS_OFS(entry[0].pc));
+    tcg_gen_brcondi_tl(TCG_COND_EQ, pc, ret_pc, same);
+    tcg_gen_st_tl(tcg_constant_tl(ret_pc), ptr, CPU_RAS_OFS(entry[0].pc));
+    tcg_gen_st_ptr(tcg_constant_ptr(NULL), ptr, CPU_RAS_OFS(entry[0].tb));
+    gen_set_label(same);
+    tcg_temp_free(pc);
+    tcg_temp_free_ptr(ptr);
+}
+
+bool translator_ras_return(DisasContextBase *db, TCGv dest,
+                           target_ulong cs_base, uint32_t flags)
+{
+    TCGv_i32 top, val;
+    TCGv_ptr ptr, tb, host;
+    TCGv pc;
+    TCGLabel *miss;
+
+    if (!translator_use_ras(db)) {
+        return false;
+    }
+
+    plugin_gen_disable_mem_helpers();
+
+    top = tcg_temp_new_i32();
+    tcg_gen_ld_i32(top, cpu_env, CPU_RAS_OFS(top));
+    tcg_gen_subi_i32(top, top, 1);
+    tcg_gen_andi_i32(top, top, CPU_RAS_SIZE - 1);
+    tcg_gen_st_i32(top, cpu_env, CPU_RAS_OFS(top));
+    ptr = gen_ras_entry(top);
+    tcg_temp_free_i32(top);
+
+    miss = gen_new_label();
+    pc = tcg_temp_new();
+    tcg_gen_ld_tl(pc, ptr, CPU_RAS_OFS(entry[0].pc));
+    tcg_gen_brcond_tl(TCG_COND_NE, pc, dest, miss);
+    tcg_temp_free(pc);
+
+    tb = tcg_temp_local_new_ptr();
+    tcg_gen_ld_ptr(tb, ptr, CPU_RAS_OFS(entry[0].tb));
+    tcg_gen_brcondi_ptr(TCG_COND_EQ, tb, 0, miss);
+
+    /*
+     * Check the TB like tb_lookup() would.  It is not invalid, since
+     * CF_INVALID is part of cflags, and it is still mapped at @dest,
+     * since the entry is cleared along with the jump cache.
+     */
+    pc = tcg_temp_new();
+    tcg_gen_ld_tl(pc, tb, offsetof(TranslationBlock, cs_base));
+    tcg_gen_brcondi_tl(TCG_COND_NE, pc, cs_base, miss);
+    tcg_temp_free(pc);
+    val = tcg_temp_new_i32();
+    tcg_gen_ld_i32(val, tb, offsetof(TranslationBlock, flags));
+    tcg_gen_brcondi_i32(TCG_COND_NE, val, flags, miss);
+    tcg_gen_ld_i32(val, tb, offsetof(TranslationBlock, cflags));
+    /* A superblock is only uninterruptible while it is translated. */
+    tcg_gen_brcondi_i32(TCG_COND_NE, val, tb_cflags(db->tb) & ~CF_NOIRQ,
+                        miss);
+    tcg_temp_free_i32(val);
+    tcg_temp_free_ptr(tb);
+
+    host = tcg_temp_new_ptr();
+    tcg_gen_ld_ptr(host, ptr, CPU_RAS_OFS(entry[0].host));
+    tcg_gen_op1i(INDEX_op_goto_ptr, tcgv_ptr_arg(host));
+    tcg_temp_free_ptr(host);
+    tcg_temp_free_ptr(ptr);
+
+    gen_set_label(miss);
+    host = tcg_temp_new_ptr();
+    gen_helper_lookup_tb_ptr_ras(host, cpu_env);
+    tcg_gen_op1i(INDEX_op_goto_ptr, tcgv_ptr_arg(host));
+    tcg_temp_free_ptr(host);
+    return true;
+}
+
+/*
+ * Count down the executions of @tb left before it is hot, and on reaching
+ * zero leave to the execution loop, which makes @tb into a superblock.
+ * The threshold is only in tb->exec_count, so that the code does not
+ * depend on it.  This is emitted before the exit request check, so that
+ * the exit happens before any guest instruction.
+ */
+static void gen_tb_exec_count(TranslationBlock *tb)
+{
+    TCGv_ptr ptr = tcg_constant_ptr(tb);
+    TCGv_i32 count = tcg_temp_new_i32();
+    TCGLabel *done = gen_new_label();
+
+    tcg_gen_ld_i32(count, ptr, offsetof(TranslationBlock, exec_count));
+    tcg_gen_brcondi_i32(TCG_COND_EQ, count, 0, done);
+    tcg_gen_subi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, offsetof(TranslationBlock, exec_count));
+    tcg_gen_brcondi_i32(TCG_COND_NE, count, 0, done);
+    gen_helper_tb_hot(cpu_env, ptr);
+    gen_set_label(done);
+    tcg_temp_free_i32(count);
 }
 
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int max_insns,
@@ -59,6 +221,7 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int max_insns,
     db->singlestep_enabled = cflags & CF_SINGLE_STEP;
     db->host_addr[0] = host_pc;
     db->host_addr[1] = NULL;
+    tcg_ctx->nb_gen_jmp_dest = 0;
 
 #ifdef CONFIG_USER_ONLY
     page_protect(pc);
@@ -70,6 +233,17 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int max_insns,
     /* Reset the temp count so that we can identify leaks */
     tcg_clear_temp_count();
 
+    /*
+     * Superblocks start out hot, and are not counted.  Neither are TBs
+     * whose exit paths are unusual, or that are not backed by RAM.
+     */
+    if (tb->exec_count != 0 &&
+        !(cflags & (CF_COUNT_MASK | CF_LAST_IO | CF_SINGLE_STEP |
+                    CF_NOIRQ | CF_MEMI_ONLY | CF_USE_ICOUNT)) &&
+        tb_page_addr0(tb) != -1) {
+        gen_tb_exec_count(tb);
+    }
+
     /* Start translating.  */
     gen_tb_start(db->tb);
     ops->tb_start(db, cpu);
@@ -171,6 +345,14 @@ static void *translator_access(CPUArchState *env, DisasContextBase *db,
         host = db->host_addr[0];
         base = db->pc_first;
     } else {
+        /*
+         * Background translation only has a snapshot of the first page,
+         * and may not use the TLB of the vCPU to look up the second one.
+         */
+        if (unlikely(tcg_ctx->speculative)) {
+            siglongjmp(tcg_ctx->jmp_trans, -3);
+        }
+
         host = db->host_addr[1];
         base = TARGET_PAGE_ALIGN(db->pc_first);
         if (host == NULL) {
@@ -84,6 +84,7 @@ this code that are retained.
  */
 #include "qemu/osdep.h"
 #include <math.h>
+#include <float.h>
 #include "qemu/bitops.h"
 #include "fpu/softfloat.h"
 
@@ -2377,6 +2378,643 @@ float64_muladd(float64 xa, float64 xb, float64 xc, int flags, float_status *s)
     return soft_f64_muladd(ua.s, ub.s, uc.s, flags, s);
 }
 
+/*
+ * Batched operations
+ *
+ * The operands are processed in chunks.  When rounding to nearest even,
+ * a chunk in which every operand and result is zero or normal is computed
+ * with host operations, in loops that the compiler can vectorise; as for
+ * the scalar hardfloat paths, results at or close to the subnormal range
+ * are left to softfloat.  The only flag such a chunk can raise is inexact,
+ * which is derived from error-free transformations once per chunk, unless
+ * it is already set.  For float64 these need a host fused multiply-add, so
+ * chunks that would check exactness are left to softfloat on hosts whose
+ * fma is not correctly rounded.  Any other chunk is computed one element
+ * at a time.
+ */
+
+#define FLOAT_BATCH_CHUNK 16
+
+/* The smallest magnitude for which fma remainders are not subnormal */
+#define F64_BATCH_MIN (DBL_MIN * (1ULL << 62))
+
+static inline bool batch_can_use_fpu(const float_status *s)
+{
+    return !QEMU_NO_HARDFLOAT && FLT_EVAL_METHOD == 0 &&
+           s->float_rounding_mode == float_round_nearest_even;
+}
+
+static inline bool batch_inexact(const float_status *s)
+{
+    return s->float_exception_flags & float_flag_inexact;
+}
+
+static bool f32_addsub_chunk(float32 *d, const float32 *a, const float32 *b,
+                             size_t n, bool subtract, float_status *s)
+{
+    union_float32 ua, ub, ur[FLOAT_BATCH_CHUNK];
+    bool ok = true, exact = true;
+    float bv;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        ua.s = a[i];
+        ub.s = subtract ? float32_chs(b[i]) : b[i];
+        ur[i].h = ua.h + ub.h;
+        /* A zero sum of normal operands is exact */
+        ok &= float32_is_zero_or_normal(ua.s) &
+              float32_is_zero_or_normal(ub.s) &
+              float32_is_zero_or_normal(ur[i].s);
+    }
+    if (!ok) {
+        return false;
+    }
+    if (!batch_inexact(s)) {
+        /* TwoSum: the rounding error of a sum is representable */
+        for (i = 0; i < n; i++) {
+            ua.s = a[i];
+            ub.s = subtract ? float32_chs(b[i]) : b[i];
+            bv = ur[i].h - ua.h;
+            exact &= (ua.h - (ur[i].h - bv)) + (ub.h - bv) == 0;
+        }
+        if (!exact) {
+            float_raise(float_flag_inexact, s);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        d[i] = ur[i].s;
+    }
+    return true;
+}
+
+static bool f32_mul_chunk(float32 *d, const float32 *a, const float32 *b,
+                          size_t n, float_status *s)
+{
+    union_float32 ua, ub, ur[FLOAT_BATCH_CHUNK];
+    double p[FLOAT_BATCH_CHUNK];
+    bool ok = true, exact = true;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        ua.s = a[i];
+        ub.s = b[i];
+        /* The product of two floats is exact in double precision */
+        p[i] = (double)ua.h * ub.h;
+        ur[i].h = p[i];
+        ok &= float32_is_zero_or_normal(ua.s) &
+              float32_is_zero_or_normal(ub.s) &
+              (float32_is_zero(ur[i].s) ? p[i] == 0
+                                        : float32_is_normal(ur[i].s) &
+                                          (fabsf(ur[i].h) > FLT_MIN));
+    }
+    if (!ok) {
+        return false;
+    }
+    if (!batch_inexact(s)) {
+        for (i = 0; i < n; i++) {
+            exact &= (double)ur[i].h == p[i];
+        }
+        if (!exact) {
+            float_raise(float_flag_inexact, s);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        d[i] = ur[i].s;
+    }
+    return true;
+}
+
+static bool f32_div_chunk(float32 *d, const float32 *a, const float32 *b,
+                          size_t n, float_status *s)
+{
+    union_float32 ua, ub, ur[FLOAT_BATCH_CHUNK];
+    bool ok = true, exact = true;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        ua.s = a[i];
+        ub.s = b[i];
+        ur[i].h = ua.h / ub.h;
+        ok &= float32_is_zero_or_normal(ua.s) & float32_is_normal(ub.s) &
+              (float32_is_zero(ur[i].s) ? float32_is_zero(ua.s)
+                                        : float32_is_normal(ur[i].s) &
+                                          (fabsf(ur[i].h) > FLT_MIN));
+    }
+    if (!ok) {
+        return false;
+    }
+    if (!batch_inexact(s)) {
+        /* The product of two floats is exact in double precision */
+        for (i = 0; i < n; i++) {
+            ua.s = a[i];
+            ub.s = b[i];
+            exact &= (double)ur[i].h * ub.h == ua.h;
+        }
+        if (!exact) {
+            float_raise(float_flag_inexact, s);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        d[i] = ur[i].s;
+    }
+    return true;
+}
+
+static bool f32_sqrt_chunk(float32 *d, const float32 *a, size_t n,
+                           float_status *s)
+{
+    union_float32 ua, ur[FLOAT_BATCH_CHUNK];
+    bool ok = true, exact = true;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        ua.s = a[i];
+        ur[i].h = sqrtf(ua.h);
+        ok &= float32_is_zero(ua.s) |
+              (float32_is_normal(ua.s) & !float32_is_neg(ua.s));
+    }
+    if (!ok) {
+        return false;
+    }
+    if (!batch_inexact(s)) {
+        for (i = 0; i < n; i++) {
+            ua.s = a[i];
+            exact &= (double)ur[i].h * ur[i].h == ua.h;
+        }
+        if (!exact) {
+            float_raise(float_flag_inexact, s);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        d[i] = ur[i].s;
+    }
+    return true;
+}
+
+static bool f32_muladd_chunk(float32 *d, const float32 *a, const float32 *b,
+                             const float32 *c, size_t n, int flags,
+                             float_status *s)
+{
+    union_float32 ua, ub, uc, ur[FLOAT_BATCH_CHUNK];
+    bool ok = true;
+    size_t i;
+
+    /* The inexact flag of a fused multiply-add is not cheap to compute */
+    if (!batch_inexact(s) || (flags & float_muladd_halve_result) ||
+        force_soft_fma) {
+        return false;
+    }
+    for (i = 0; i < n; i++) {
+        ua.s = flags & float_muladd_negate_product ? float32_chs(a[i]) : a[i];
+        ub.s = b[i];
+        uc.s = flags & float_muladd_negate_c ? float32_chs(c[i]) : c[i];
+        ur[i].h = fmaf(ua.h, ub.h, uc.h);
+        ok &= float32_is_zero_or_normal(ua.s) &
+              float32_is_zero_or_normal(ub.s) &
+              float32_is_zero_or_normal(uc.s) &
+              float32_is_normal(ur[i].s) & (fabsf(ur[i].h) > FLT_MIN);
+    }
+    if (!ok) {
+        return false;
+    }
+    for (i = 0; i < n; i++) {
+        d[i] = flags & float_muladd_negate_result ? float32_chs(ur[i].s)
+                                                  : ur[i].s;
+    }
+    return true;
+}
+
+static bool f64_addsub_chunk(float64 *d, const float64 *a, const float64 *b,
+                             size_t n, bool subtract, float_status *s)
+{
+    union_float64 ua, ub, ur[FLOAT_BATCH_CHUNK];
+    bool ok = true, exact = true;
+    double bv;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        ua.s = a[i];
+        ub.s = subtract ? float64_chs(b[i]) : b[i];
+        ur[i].h = ua.h + ub.h;
+        /* A zero sum of normal operands is exact */
+        ok &= float64_is_zero_or_normal(ua.s) &
+              float64_is_zero_or_normal(ub.s) &
+              float64_is_zero_or_normal(ur[i].s);
+    }
+    if (!ok) {
+        return false;
+    }
+    if (!batch_inexact(s)) {
+        /* TwoSum: the rounding error of a sum is representable */
+        for (i = 0; i < n; i++) {
+            ua.s = a[i];
+            ub.s = subtract ? float64_chs(b[i]) : b[i];
+            bv = ur[i].h - ua.h;
+            exact &= (ua.h - (ur[i].h - bv)) + (ub.h - bv) == 0;
+        }
+        if (!exact) {
+            float_raise(float_flag_inexact, s);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        d[i] = ur[i].s;
+    }
+    return true;
+}
+
+static bool f64_mul_chunk(float64 *d, const float64 *a, const float64 *b,
+                          size_t n, float_status *s)
+{
+    union_float64 ua, ub, ur[FLOAT_BATCH_CHUNK];
+    bool ok = true, exact = true;
+    size_t i;
+
+    if (!batch_inexact(s) && force_soft_fma) {
+        return false;
+    }
+    for (i = 0; i < n; i++) {
+        ua.s = a[i];
+        ub.s = b[i];
+        ur[i].h = ua.h * ub.h;
+        ok &= float64_is_zero_or_normal(ua.s) &
+              float64_is_zero_or_normal(ub.s) &
+              (float64_is_zero(ur[i].s)
+               ? float64_is_zero(ua.s) | float64_is_zero(ub.s)
+               : float64_is_normal(ur[i].s) &
+                 (fabs(ur[i].h) >= F64_BATCH_MIN));
+    }
+    if (!ok) {
+        return false;
+    }
+    if (!batch_inexact(s)) {
+        /* The remainder of the product is representable, see above */
+        for (i = 0; i < n; i++) {
+            ua.s = a[i];
+            ub.s = b[i];
+            exact &= fma(ua.h, ub.h, -ur[i].h) == 0;
+        }
+        if (!exact) {
+            float_raise(float_flag_inexact, s);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        d[i] = ur[i].s;
+    }
+    return true;
+}
+
+static bool f64_div_chunk(float64 *d, const float64 *a, const float64 *b,
+                          size_t n, float_status *s)
+{
+    union_float64 ua, ub, ur[FLOAT_BATCH_CHUNK];
+    bool ok = true, exact = true;
+    size_t i;
+
+    if (!batch_inexact(s) && force_soft_fma) {
+        return false;
+    }
+    for (i = 0; i < n; i++) {
+        ua.s = a[i];
+        ub.s = b[i];
+        ur[i].h = ua.h / ub.h;
+        /* The remainder is a multiple of about ulp(a) * 2**-53 */
+        ok &= float64_is_zero_or_normal(ua.s) & float64_is_normal(ub.s) &
+              (float64_is_zero(ur[i].s)
+               ? float64_is_zero(ua.s)
+               : float64_is_normal(ur[i].s) & (fabs(ur[i].h) > DBL_MIN) &
+                 (fabs(ua.h) >= F64_BATCH_MIN));
+    }
+    if (!ok) {
+        return false;
+    }
+    if (!batch_inexact(s)) {
+        for (i = 0; i < n; i++) {
+            ua.s = a[i];
+            ub.s = b[i];
+            exact &= fma(ur[i].h, ub.h, -ua.h) == 0;
+        }
+        if (!exact) {
+            float_raise(float_flag_inexact, s);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        d[i] = ur[i].s;
+    }
+    return true;
+}
+
+static bool f64_sqrt_chunk(float64 *d, const float64 *a, size_t n,
+                           float_status *s)
+{
+    union_float64 ua, ur[FLOAT_BATCH_CHUNK];
+    bool ok = true, exact = true;
+    size_t i;
+
+    if (!batch_inexact(s) && force_soft_fma) {
+        return false;
+    }
+    for (i = 0; i < n; i++) {
+        ua.s = a[i];
+        ur[i].h = sqrt(ua.h);
+        ok &= float64_is_zero(ua.s) |
+              (float64_is_normal(ua.s) & !float64_is_neg(ua.s) &
+               (ua.h >= F64_BATCH_MIN));
+    }
+    if (!ok) {
+        return false;
+    }
+    if (!batch_inexact(s)) {
+        for (i = 0; i < n; i++) {
+            ua.s = a[i];
+            exact &= fma(ur[i].h, ur[i].h, -ua.h) == 0;
+        }
+        if (!exact) {
+            float_raise(float_flag_inexact, s);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        d[i] = ur[i].s;
+    }
+    return true;
+}
+
+static bool f64_muladd_chunk(float64 *d, const float64 *a, const float64 *b,
+                             const float64 *c, size_t n, int flags,
+                             float_status *s)
+{
+    union_float64 ua, ub, uc, ur[FLOAT_BATCH_CHUNK];
+    bool ok = true;
+    size_t i;
+
+    /* The inexact flag of a fused multiply-add is not cheap to compute */
+    if (!batch_inexact(s) || (flags & float_muladd_halve_result) ||
+        force_soft_fma) {
+        return false;
+    }
+    for (i = 0; i < n; i++) {
+        ua.s = flags & float_muladd_negate_product ? float64_chs(a[i]) : a[i];
+        ub.s = b[i];
+        uc.s = flags & float_muladd_negate_c ? float64_chs(c[i]) : c[i];
+        ur[i].h = fma(ua.h, ub.h, uc.h);
+        ok &= float64_is_zero_or_normal(ua.s) &
+              float64_is_zero_or_normal(ub.s) &
+              float64_is_zero_or_normal(uc.s) &
+              float64_is_normal(ur[i].s) & (fabs(ur[i].h) > DBL_MIN);
+    }
+    if (!ok) {
+        return false;
+    }
+    for (i = 0; i < n; i++) {
+        d[i] = flags & float_muladd_negate_result ? float64_chs(ur[i].s)
+                                                  : ur[i].s;
+    }
+    return true;
+}
+
+void float32_add_n(float32 *d, const float32 *a, const float32 *b,
+                   size_t n, float_status *s)
+{
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = MIN(n - i, FLOAT_BATCH_CHUNK);
+        if (!batch_can_use_fpu(s) ||
+            !f32_addsub_chunk(d + i, a + i, b + i, len, false, s)) {
+            for (j = i; j < i + len; j++) {
+                d[j] = float32_add(a[j], b[j], s);
+            }
+        }
+    }
+}
+
+void float32_sub_n(float32 *d, const float32 *a, const float32 *b,
+                   size_t n, float_status *s)
+{
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = MIN(n - i, FLOAT_BATCH_CHUNK);
+        if (!batch_can_use_fpu(s) ||
+            !f32_addsub_chunk(d + i, a + i, b + i, len, true, s)) {
+            for (j = i; j < i + len; j++) {
+                d[j] = float32_sub(a[j], b[j], s);
+            }
+        }
+    }
+}
+
+void float32_mul_n(float32 *d, const float32 *a, const float32 *b,
+                   size_t n, float_status *s)
+{
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = MIN(n - i, FLOAT_BATCH_CHUNK);
+        if (!batch_can_use_fpu(s) ||
+            !f32_mul_chunk(d + i, a + i, b + i, len, s)) {
+            for (j = i; j < i + len; j++) {
+                d[j] = float32_mul(a[j], b[j], s);
+            }
+        }
+    }
+}
+
+void float32_div_n(float32 *d, const float32 *a, const float32 *b,
+                   size_t n, float_status *s)
+{
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = MIN(n - i, FLOAT_BATCH_CHUNK);
+        if (!batch_can_use_fpu(s) ||
+            !f32_div_chunk(d + i, a + i, b + i, len, s)) {
+            for (j = i; j < i + len; j++) {
+                d[j] = float32_div(a[j], b[j], s);
+            }
+        }
+    }
+}
+
+void float32_sqrt_n(float32 *d, const float32 *a, size_t n, float_status *s)
+{
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = MIN(n - i, FLOAT_BATCH_CHUNK);
+        if (!batch_can_use_fpu(s) || !f32_sqrt_chunk(d + i, a + i, len, s)) {
+            for (j = i; j < i + len; j++) {
+                d[j] = float32_sqrt(a[j], s);
+            }
+        }
+    }
+}
+
+void float32_muladd_n(float32 *d, const float32 *a, const float32 *b,
+                      const float32 *c, size_t n, int flags, float_status *s)
+{
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = MIN(n - i, FLOAT_BATCH_CHUNK);
+        if (!batch_can_use_fpu(s) ||
+            !f32_muladd_chunk(d + i, a + i, b + i, c + i, len, flags, s)) {
+            for (j = i; j < i + len; j++) {
+                d[j] = float32_muladd(a[j], b[j], c[j], flags, s);
+            }
+        }
+    }
+}
+
+float32 float32_sum_n(float32 acc, const float32 *a, size_t n,
+                      float_status *s)
+{
+    union_float32 ua, ub, ur;
+    float bv;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        ua.s = acc;
+        ub.s = a[i];
+        ur.h = ua.h + ub.h;
+        if (batch_can_use_fpu(s) && float32_is_zero_or_normal(ua.s) &&
+            float32_is_zero_or_normal(ub.s) &&
+            float32_is_zero_or_normal(ur.s)) {
+            if (!batch_inexact(s)) {
+                bv = ur.h - ua.h;
+                if ((ua.h - (ur.h - bv)) + (ub.h - bv) != 0) {
+                    float_raise(float_flag_inexact, s);
+                }
+            }
+            acc = ur.s;
+        } else {
+            acc = float32_add(acc, a[i], s);
+        }
+    }
+    return acc;
+}
+
+void float64_add_n(float64 *d, const float64 *a, const float64 *b,
+                   size_t n, float_status *s)
+{
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = MIN(n - i, FLOAT_BATCH_CHUNK);
+        if (!batch_can_use_fpu(s) ||
+            !f64_addsub_chunk(d + i, a + i, b + i, len, false, s)) {
+            for (j = i; j < i + len; j++) {
+                d[j] = float64_add(a[j], b[j], s);
+            }
+        }
+    }
+}
+
+void float64_sub_n(float64 *d, const float64 *a, const float64 *b,
+                   size_t n, float_status *s)
+{
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = MIN(n - i, FLOAT_BATCH_CHUNK);
+        if (!batch_can_use_fpu(s) ||
+            !f64_addsub_chunk(d + i, a + i, b + i, len, true, s)) {
+            for (j = i; j < i + len; j++) {
+                d[j] = float64_sub(a[j], b[j], s);
+            }
+        }
+    }
+}
+
+void float64_mul_n(float64 *d, const float64 *a, const float64 *b,
+                   size_t n, float_status *s)
+{
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = MIN(n - i, FLOAT_BATCH_CHUNK);
+        if (!batch_can_use_fpu(s) ||
+            !f64_mul_chunk(d + i, a + i, b + i, len, s)) {
+            for (j = i; j < i + len; j++) {
+                d[j] = float64_mul(a[j], b[j], s);
+            }
+        }
+    }
+}
+
+void float64_div_n(float64 *d, const float64 *a, const float64 *b,
+                   size_t n, float_status *s)
+{
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = MIN(n - i, FLOAT_BATCH_CHUNK);
+        if (!batch_can_use_fpu(s) ||
+            !f64_div_chunk(d + i, a + i, b + i, len, s)) {
+            for (j = i; j < i + len; j++) {
+                d[j] = float64_div(a[j], b[j], s);
+            }
+        }
+    }
+}
+
+void float64_sqrt_n(float64 *d, const float64 *a, size_t n, float_status *s)
+{
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = MIN(n - i, FLOAT_BATCH_CHUNK);
+        if (!batch_can_use_fpu(s) || !f64_sqrt_chunk(d + i, a + i, len, s)) {
+            for (j = i; j < i + len; j++) {
+                d[j] = float64_sqrt(a[j], s);
+            }
+        }
+    }
+}
+
+void float64_muladd_n(float64 *d, const float64 *a, const float64 *b,
+                      const float64 *c, size_t n, int flags, float_status *s)
+{
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = MIN(n - i, FLOAT_BATCH_CHUNK);
+        if (!batch_can_use_fpu(s) ||
+            !f64_muladd_chunk(d + i, a + i, b + i, c + i, len, flags, s)) {
+            for (j = i; j < i + len; j++) {
+                d[j] = float64_muladd(a[j], b[j], c[j], flags, s);
+            }
+        }
+    }
+}
+
+float64 float64_sum_n(float64 acc, const float64 *a, size_t n,
+                      float_status *s)
+{
+    union_float64 ua, ub, ur;
+    double bv;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        ua.s = acc;
+        ub.s = a[i];
+        ur.h = ua.h + ub.h;
+        if (batch_can_use_fpu(s) && float64_is_zero_or_normal(ua.s) &&
+            float64_is_zero_or_normal(ub.s) &&
+            float64_is_zero_or_normal(ur.s)) {
+            if (!batch_inexact(s)) {
+                bv = ur.h - ua.h;
+                if ((ua.h - (ur.h - bv)) + (ub.h - bv) != 0) {
+                    float_raise(float_flag_inexact, s);
+                }
+            }
+            acc = ur.s;
+        } else {
+            acc = float64_add(acc, a[i], s);
+        }
+    }
+    return acc;
+}
+
 float64 float64r32_muladd(float64 a, float64 b, float64 c,
                           int flags, float_status *status)
 {
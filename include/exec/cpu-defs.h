@@ -177,19 +177,30 @@ typedef struct CPUTLBEntryFull {
 #endif
 } CPUTLBEntryFull;
 
+/* Number of regions that track the large pages of an MMU mode. */
+#define CPU_TLB_LARGE_PAGES 4
+
+/*
+ * A region covering some of the large pages allocated into the tlb.
+ * The region is matched if (addr & mask) == addr; an unused region
+ * has addr == mask == -1.
+ */
+typedef struct CPUTLBLargePage {
+    target_ulong addr;
+    target_ulong mask;
+} CPUTLBLargePage;
+
 /*
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
  */
 typedef struct CPUTLBDesc {
     /*
-     * Describe a region covering all of the large pages allocated
-     * into the tlb.  When any page within this region is flushed,
-     * we must flush the entire tlb.  The region is matched if
-     * (addr & large_page_mask) == large_page_addr.
+     * Describe regions covering all of the large pages allocated
+     * into the tlb.  When any page within a region is flushed,
+     * we must flush every entry of the region.
      */
-    target_ulong large_page_addr;
-    target_ulong large_page_mask;
+    CPUTLBLargePage large_page[CPU_TLB_LARGE_PAGES];
     /* host time (in ns) at the beginning of the time window */
     int64_t window_begin_ns;
     /* maximum number of entries observed in the window */
@@ -217,6 +228,36 @@ typedef struct CPUTLBDescFast {
 /*
  * Data elements that are shared between all MMU modes.
  */
+/* Number of ranges that can wait in a CPUTLBPending.  */
+#define CPU_TLB_PENDING_RANGES 8
+
+typedef struct CPUTLBPendingRange {
+    target_ulong addr;
+    target_ulong len;
+    uint16_t idxmap;
+    uint16_t bits;
+} CPUTLBPendingRange;
+
+/*
+ * Flushes that other vCPUs asked for, and that this vCPU applies before
+ * its next TB; see tlb_flush_pending_drain().  Overlapping ranges are
+ * merged, and once the ranges are all used, further ones become full
+ * flushes of their mmu_idx.
+ */
+typedef struct CPUTLBPending {
+    /* Protects the fields below, except for the generations. */
+    QemuSpin lock;
+    uint16_t full_idxmap;
+    unsigned n_ranges;
+    CPUTLBPendingRange range[CPU_TLB_PENDING_RANGES];
+    /*
+     * The number of requests queued and applied so far.  They differ
+     * while a flush is pending.  Read and written atomically.
+     */
+    uint32_t req_gen;
+    uint32_t done_gen;
+} CPUTLBPending;
+
 typedef struct CPUTLBCommon {
     /* Serialize updates to f.table and d.vtable, and others as noted. */
     QemuSpin lock;
@@ -226,6 +267,15 @@ typedef struct CPUTLBCommon {
      * Protected by tlb_c.lock.
      */
     uint16_t dirty;
+    /*
+     * The address-space tag of the live d[] and f[] tables, and the
+     * lazily allocated banks holding the tables of inactive tags.
+     * See tlb_switch_tag().  Protected by tlb_c.lock.
+     */
+    uint64_t tag;
+    struct CPUTLBBank *banks;
+    /* Flushes requested by the other vCPUs. */
+    CPUTLBPending pending;
     /*
      * Statistics.  These are not lock protected, but are read and
      * written atomically.  This allows the monitor to print a snapshot
@@ -259,11 +309,35 @@ typedef struct CPUTLB { } CPUTLB;
 
 #endif  /* !CONFIG_USER_ONLY && CONFIG_TCG */
 
+/*
+ * The return-address stack, which generated code uses to predict the
+ * targets of guest returns; see translator_ras_return().
+ */
+#define CPU_RAS_SIZE 16
+
+typedef struct CPUReturnStackEntry {
+    target_ulong pc;
+    /*
+     * The TB found the last time a return went to @pc, and the code
+     * pointer to enter it, or NULL.  Other threads may clear @tb.
+     */
+    TranslationBlock *tb;
+    const void *host;
+} CPUReturnStackEntry;
+
+typedef struct CPUReturnStack {
+    CPUReturnStackEntry entry[CPU_RAS_SIZE];
+    uint32_t top;
+} CPUReturnStack;
+
 /*
  * This structure must be placed in ArchCPU immediately
  * before CPUArchState, as a field named "neg".
+ * The return-address stack comes first, so that it does not push
+ * the TLB away from env.
  */
 typedef struct CPUNegativeOffsetState {
+    CPUReturnStack ras;
     CPUTLB tlb;
     IcountDecr icount_decr;
 } CPUNegativeOffsetState;
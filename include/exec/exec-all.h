@@ -266,6 +266,46 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
                                                uint16_t idxmap,
                                                unsigned bits);
 
+/**
+ * tlb_switch_tag:
+ * @cpu: CPU whose TLB should be switched
+ * @tag: target-defined tag of the address space to switch to
+ *
+ * Make @tag the address space of the live TLB.  The tables of the
+ * address space being switched away from are kept in a small set of
+ * banks, so that switching back to it later does not require a flush.
+ * Flushes of any kind that are requested while a bank is inactive
+ * invalidate the affected MMU indexes of that bank as a whole.
+ * Targets that never call this function see a single untagged TLB.
+ * When called from another thread, the switch is deferred to @cpu's
+ * thread, as for tlb_flush().
+ */
+void tlb_switch_tag(CPUState *cpu, uint64_t tag);
+/**
+ * tlb_flush_tags:
+ * @cpu: CPU whose TLB should be flushed
+ * @tag: tag of the address spaces to flush
+ * @mask: significant bits of @tag
+ *
+ * Flush all MMU indexes of every address space whose tag equals @tag
+ * in the bits set in @mask, be it live or held in a bank.
+ * Must be called from @cpu's own thread.
+ */
+void tlb_flush_tags(CPUState *cpu, uint64_t tag, uint64_t mask);
+/**
+ * tlb_flush_page_tags:
+ * @cpu: CPU whose TLB should be flushed
+ * @addr: virtual address of page to be flushed
+ * @tag: tag of the address spaces to flush
+ * @mask: significant bits of @tag
+ *
+ * Like tlb_flush_tags, but only flush the page at @addr from the live
+ * TLB.  Matching banks are still invalidated as a whole.
+ * Must be called from @cpu's own thread.
+ */
+void tlb_flush_page_tags(CPUState *cpu, target_ulong addr,
+                         uint64_t tag, uint64_t mask);
+
 /**
  * tlb_set_page_full:
  * @cpu: CPU context
@@ -410,6 +450,16 @@ static inline void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
                                                              unsigned bits)
 {
 }
+static inline void tlb_switch_tag(CPUState *cpu, uint64_t tag)
+{
+}
+static inline void tlb_flush_tags(CPUState *cpu, uint64_t tag, uint64_t mask)
+{
+}
+static inline void tlb_flush_page_tags(CPUState *cpu, target_ulong addr,
+                                       uint64_t tag, uint64_t mask)
+{
+}
 #endif
 /**
  * probe_access:
@@ -559,6 +609,9 @@ struct TranslationBlock {
     uint16_t size;
     uint16_t icount;
 
+    /* executions left before the TB is hot, from tb_hot_threshold down */
+    uint32_t exec_count;
+
     struct tb_tc tc;
 
     /*
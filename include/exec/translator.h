@@ -162,6 +162,38 @@ void translator_loop_temp_check(DisasContextBase *db);
  */
 bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest);
 
+/**
+ * translator_ras_push
+ * @db: Disassembly context
+ * @ret_pc: return address of the call being translated
+ *
+ * Push @ret_pc onto the return-address stack of the vCPU, for
+ * translator_ras_return() to predict the matching return.
+ * Does nothing if the return-address stack is disabled.
+ */
+void translator_ras_push(DisasContextBase *db, target_ulong ret_pc);
+
+/**
+ * translator_ras_return
+ * @db: Disassembly context
+ * @dest: target pc of the return, already stored as the guest pc
+ * @cs_base: cs_base at the end of the current TB
+ * @flags: TB flags at the end of the current TB
+ *
+ * End the TB with a return to @dest.  Pop the return-address stack,
+ * and if its top entry predicted @dest and holds a TB matching
+ * @cs_base and @flags, jump straight to that TB.  Otherwise, look
+ * up the TB like tcg_gen_lookup_and_goto_ptr(), and remember it in
+ * the entry.  @cs_base and @flags are what cpu_get_tb_cpu_state()
+ * will return, and must be known at translation time.
+ *
+ * Return false without emitting anything if the return-address stack
+ * is disabled or may not be used by the current TB; the caller should
+ * then use tcg_gen_lookup_and_goto_ptr().
+ */
+bool translator_ras_return(DisasContextBase *db, TCGv dest,
+                           target_ulong cs_base, uint32_t flags);
+
 /*
  * Translator Load Functions
  *
@@ -586,6 +586,28 @@ float32 float32_div(float32, float32, float_status *status);
 float32 float32_rem(float32, float32, float_status *status);
 float32 float32_muladd(float32, float32, float32, int, float_status *status);
 float32 float32_sqrt(float32, float_status *status);
+
+/*
+ * Element-wise operations on @n values, with the same results and flags as
+ * the scalar operations applied in order.  @d may be the same as any input.
+ */
+void float32_add_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+                   float_status *status);
+void float32_sub_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+                   float_status *status);
+void float32_mul_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+                   float_status *status);
+void float32_div_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+                   float_status *status);
+void float32_sqrt_n(float32 *d, const float32 *a, size_t n,
+                    float_status *status);
+void float32_muladd_n(float32 *d, const float32 *a, const float32 *b,
+                      const float32 *c, size_t n, int flags,
+                      float_status *status);
+/* Add the @n values of @a to @acc, in order. */
+float32 float32_sum_n(float32 acc, const float32 *a, size_t n,
+                      float_status *status);
+
 float32 float32_exp2(float32, float_status *status);
 float32 float32_log2(float32, float_status *status);
 FloatRelation float32_compare(float32, float32, float_status *status);
@@ -778,6 +800,23 @@ float64 float64_div(float64, float64, float_status *status);
 float64 float64_rem(float64, float64, float_status *status);
 float64 float64_muladd(float64, float64, float64, int, float_status *status);
 float64 float64_sqrt(float64, float_status *status);
+
+void float64_add_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+                   float_status *status);
+void float64_sub_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+                   float_status *status);
+void float64_mul_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+                   float_status *status);
+void float64_div_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+                   float_status *status);
+void float64_sqrt_n(float64 *d, const float64 *a, size_t n,
+                    float_status *status);
+void float64_muladd_n(float64 *d, const float64 *a, const float64 *b,
+                      const float64 *c, size_t n, int flags,
+                      float_status *status);
+float64 float64_sum_n(float64 acc, const float64 *a, size_t n,
+                      float_status *status);
+
 float64 float64_log2(float64, float_status *status);
 FloatRelation float64_compare(float64, float64, float_status *status);
 FloatRelation float64_compare_quiet(float64, float64, float_status *status);
@@ -287,6 +287,11 @@ struct qemu_work_item;
  * @crash_occurred: Indicates the OS reported a crash (panic) for this CPU
  * @singlestep_enabled: Flags for single-stepping.
  * @icount_extra: Instructions until next timer event.
+ * @icount_quantum_used: Instructions run in the current quantum, when
+ * vCPUs run in parallel with icount.  Only other threads holding BQL
+ * read it, while @icount_quantum_running is clear.
+ * @icount_quantum_running: Set under BQL while the vCPU runs without it,
+ * until its instructions are added to @icount_quantum_used.
  * @can_do_io: Nonzero if memory-mapped IO is safe. Deterministic execution
  * requires that IO only be performed on the last instruction of a TB
  * so that interrupts take effect immediately.
@@ -297,6 +302,8 @@ struct qemu_work_item;
  *      only have a single AddressSpace
  * @env_ptr: Pointer to subclass-specific CPUArchState field.
  * @icount_decr_ptr: Pointer to IcountDecr field within subclass.
+ * @hot_tb: TB that just reached the superblock threshold, to be
+ *          retranslated by the execution loop.
  * @gdb_regs: Additional GDB registers.
  * @gdb_num_regs: Number of total registers accessible to GDB.
  * @gdb_num_g_regs: Number of registers in GDB 'g' packets.
@@ -356,6 +363,8 @@ struct CPUState {
     int singlestep_enabled;
     int64_t icount_budget;
     int64_t icount_extra;
+    int64_t icount_quantum_used;
+    bool icount_quantum_running;
     uint64_t random_seed;
     sigjmp_buf jmp_env;
 
@@ -371,6 +380,7 @@ struct CPUState {
     IcountDecr *icount_decr_ptr;
 
     CPUJumpCache *tb_jmp_cache;
+    TranslationBlock *hot_tb;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -468,6 +478,16 @@ extern __thread CPUState *current_cpu;
 extern bool mttcg_enabled;
 #define qemu_tcg_mttcg_enabled() (mttcg_enabled)
 
+/**
+ * qemu_tcg_parallel_enabled:
+ * Check whether TCG can run several vCPUs at the same time, either with
+ * MTTCG or with more than one round-robin thread.
+ *
+ * Returns: %true if vCPUs can execute concurrently, %false otherwise.
+ */
+extern bool tcg_parallel_enabled;
+#define qemu_tcg_parallel_enabled() (tcg_parallel_enabled)
+
 /**
  * cpu_paging_enabled:
  * @cpu: The CPU whose state is to be inspected.
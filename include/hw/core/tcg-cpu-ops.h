@@ -42,6 +42,20 @@ struct TCGCPUOps {
     void (*restore_state_to_opc)(CPUState *cpu, const TranslationBlock *tb,
                                  const uint64_t *data);
 
+    /**
+     * @translate_key: Hash the CPU state that translation depends on
+     *
+     * Return a hash of the state, outside of the TB flags and of the CPU
+     * properties, that the front end reads while translating, such as
+     * ISA extensions that the guest may toggle at run time.  Code for
+     * the same TB flags and key is the same.  NULL if there is none.
+     *
+     * Background threads translate only for targets that implement it,
+     * and their front end must then take that state from
+     * tcg_ctx->speculative_key instead of the CPU, which is running.
+     */
+    uint64_t (*translate_key)(CPUState *cpu);
+
     /** @cpu_exec_enter: Callback for cpu_exec preparation */
     void (*cpu_exec_enter)(CPUState *cpu);
     /** @cpu_exec_exit: Callback for cpu_exec cleanup */
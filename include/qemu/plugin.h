@@ -90,6 +90,7 @@ enum plugin_dyn_cb_type {
 enum plugin_dyn_cb_subtype {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_INLINE,
+    PLUGIN_CB_COND,
     PLUGIN_N_CB_SUBTYPES,
 };
 
@@ -109,7 +110,15 @@ struct qemu_plugin_dyn_cb {
         struct {
             enum qemu_plugin_op op;
             uint64_t imm;
+            /* if @entry.score is set, @userp is unused */
+            qemu_plugin_u64 entry;
         } inline_insn;
+        /* @f.vcpu_udata is called with @userp if the entry meets @cond */
+        struct {
+            enum qemu_plugin_cond cond;
+            uint64_t imm;
+            qemu_plugin_u64 entry;
+        } cond;
     };
 };
 
@@ -31,6 +31,22 @@ extern int use_icount;
 #define icount_enabled() 0
 #endif
 
+/*
+ * When several threads run vCPUs in parallel, the number of instructions
+ * each vCPU runs before QEMU_CLOCK_VIRTUAL advances; 0 otherwise.
+ * A vCPU then sees the virtual clock advance with its own instructions,
+ * while the other threads see it advance at the end of each quantum.
+ */
+extern int64_t icount_quantum;
+
+/*
+ * End a quantum of parallel execution: advance QEMU_CLOCK_VIRTUAL by the
+ * instructions of the vCPU that ran the most of them, and start every
+ * vCPU afresh.  Return the number of instructions, or 0 if no vCPU ran.
+ * Caller must hold BQL, and the vCPUs must not be running.
+ */
+int64_t icount_end_quantum(void);
+
 /*
  * Update the icount with the executed instructions. Called by
  * cpus-tcg vCPU thread so the main-loop can see time has moved forward.
@@ -244,6 +244,13 @@ struct TCGLabel {
     unsigned has_value : 1;
     unsigned id : 14;
     unsigned refs : 16;
+    /*
+     * With cross_bb_regs, the number of branches to the label that the
+     * register allocator went through, and the globals and local temps
+     * that were in host registers, in sync with memory, at all of them.
+     */
+    uint16_t edges;
+    TCGTemp **reg_state;
     union {
         uintptr_t value;
         const tcg_insn_unit *value_ptr;
@@ -457,6 +464,9 @@ typedef struct TCGTemp {
     unsigned int mem_allocated:1;
     unsigned int temp_allocated:1;
     unsigned int temp_subindex:1;
+    /* Global mirrored in host register pin_reg, see tcg_global_pin_i32. */
+    unsigned int pinned:1;
+    TCGReg pin_reg:8;
 
     int64_t val;
     struct TCGTemp *mem_base;
@@ -541,6 +551,34 @@ typedef struct TCGProfile {
     int64_t table_op_count[NB_OPS];
 } TCGProfile;
 
+/*
+ * A host address embedded in generated code, which the TB cache has to
+ * relocate when it copies the code elsewhere.
+ */
+typedef enum TCGHostRelocKind {
+    TCG_HOST_RELOC_PC32,        /* displacement from the end of the field */
+    TCG_HOST_RELOC_ABS32,       /* zero-extended to a host pointer */
+    TCG_HOST_RELOC_ABS32S,      /* sign-extended to a host pointer */
+    TCG_HOST_RELOC_ABS64,
+    /*
+     * A constant used as an immediate operand of an insn emitted at or
+     * after @site, whose field cannot be patched.
+     */
+    TCG_HOST_RELOC_IMM,
+} TCGHostRelocKind;
+
+typedef struct TCGHostReloc {
+    struct TCGHostReloc *next;
+    void *site;                 /* writable address of the field */
+    uintptr_t target;
+    TCGHostRelocKind kind;
+    /*
+     * False for constants, which may be plain integers that only happen
+     * to look like host addresses.
+     */
+    bool addr;
+} TCGHostReloc;
+
 struct TCGContext {
     uint8_t *pool_cur, *pool_end;
     TCGPool *pool_first, *pool_current, *pool_first_large;
@@ -585,6 +623,39 @@ struct TCGContext {
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
 
+    /* Set for background threads translating on behalf of a vCPU */
+    bool speculative;
+    /* For those, the translate_key of the vCPU to translate for */
+    uint64_t speculative_key;
+
+    /*
+     * Pinned globals: at most max_pinned may be registered, mirrored in
+     * pinned_regs.  A register in pinned_valid holds the current value
+     * of its global in memory.  pinned_entry_size is the size of the code
+     * that loads all of them at the start of each TB; chained jumps skip
+     * it.
+     */
+    int nb_pinned;
+    int max_pinned;
+    TCGRegSet pinned_regs;
+    TCGRegSet pinned_valid;
+    size_t pinned_entry_size;
+
+    /*
+     * Keep globals and local temps in host registers across the labels
+     * within a TB, when every branch to a label leaves them in the same
+     * registers, instead of reloading them after each label.
+     */
+    bool cross_bb_regs;
+
+    /*
+     * With record_host_relocs, backends that define TCG_TARGET_HOST_RELOCS
+     * list in host_relocs every host address they embed in the code of
+     * the current TB, for the TB cache.
+     */
+    bool record_host_relocs;
+    TCGHostReloc *host_relocs;
+
     /* These structures are private to tcg-target.c.inc.  */
 #ifdef TCG_TARGET_NEED_LDST_LABELS
     QSIMPLEQ_HEAD(, TCGLabelQemuLdst) ldst_labels;
@@ -623,6 +694,10 @@ struct TCGContext {
     uint16_t gen_insn_end_off[TCG_MAX_INSNS];
     target_ulong gen_insn_data[TCG_MAX_INSNS][TARGET_INSN_START_WORDS];
 
+    /* Targets of the goto_tb ops of the TB, in order, within its first page */
+    target_ulong gen_jmp_dest[2];
+    int nb_gen_jmp_dest;
+
     /* Exit to translator on overflow. */
     sigjmp_buf jmp_trans;
 };
@@ -810,6 +885,11 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+bool tcg_region_evict_wanted(void);
+bool tcg_region_evict_start(size_t *idx, unsigned *gen);
+bool tcg_region_contains(size_t idx, const void *p);
+void tcg_region_tb_foreach(size_t idx, GTraverseFunc func, gpointer user_data);
+void tcg_region_evict_finish(size_t idx, unsigned gen);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -839,7 +919,7 @@ static inline void *tcg_malloc(int size)
     }
 }
 
-void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus);
+void tcg_init(size_t tb_size, int splitwx, unsigned max_threads, bool evict);
 void tcg_register_thread(void);
 void tcg_prologue_init(TCGContext *s);
 void tcg_func_start(TCGContext *s);
@@ -853,6 +933,7 @@ void tcg_set_frame(TCGContext *s, TCGReg reg, intptr_t start, intptr_t size);
 
 TCGTemp *tcg_global_mem_new_internal(TCGType, TCGv_ptr,
                                      intptr_t, const char *);
+bool tcg_global_pin_internal(TCGTemp *);
 TCGTemp *tcg_temp_new_internal(TCGType, bool);
 void tcg_temp_free_internal(TCGTemp *);
 TCGv_vec tcg_temp_new_vec(TCGType type);
@@ -890,6 +971,16 @@ static inline TCGv_i32 tcg_global_mem_new_i32(TCGv_ptr reg, intptr_t offset,
     return temp_tcgv_i32(t);
 }
 
+/*
+ * Mirror the global @arg, which must live in the CPU state, in a host
+ * register that is preserved across TBs, so that chained TBs need not
+ * reload it.  Return false if no register is left for it.
+ */
+static inline bool tcg_global_pin_i32(TCGv_i32 arg)
+{
+    return tcg_global_pin_internal(tcgv_i32_temp(arg));
+}
+
 static inline TCGv_i32 tcg_temp_new_i32(void)
 {
     TCGTemp *t = tcg_temp_new_internal(TCG_TYPE_I32, false);
@@ -909,6 +1000,11 @@ static inline TCGv_i64 tcg_global_mem_new_i64(TCGv_ptr reg, intptr_t offset,
     return temp_tcgv_i64(t);
 }
 
+static inline bool tcg_global_pin_i64(TCGv_i64 arg)
+{
+    return tcg_global_pin_internal(tcgv_i64_temp(arg));
+}
+
 static inline TCGv_i64 tcg_temp_new_i64(void)
 {
     TCGTemp *t = tcg_temp_new_internal(TCG_TYPE_I64, false);
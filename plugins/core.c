@@ -16,6 +16,7 @@
 #include "qemu/config-file.h"
 #include "qapi/error.h"
 #include "qemu/lockable.h"
+#include "qemu/memalign.h"
 #include "qemu/option.h"
 #include "qemu/rcu_queue.h"
 #include "qemu/xxhash.h"
@@ -210,10 +211,104 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+int plugin_num_vcpus(void)
+{
+    return qatomic_read(&plugin.num_vcpus);
+}
+
+/* Entries of different vCPUs do not share a cache line */
+#define PLUGIN_SCOREBOARD_ALIGN 64
+
+static void *plugin_scoreboard_alloc(size_t stride, size_t n)
+{
+    void *data = qemu_memalign(PLUGIN_SCOREBOARD_ALIGN, stride * n);
+
+    memset(data, 0, stride * n);
+    return data;
+}
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
+{
+    struct qemu_plugin_scoreboard *score;
+
+    score = g_new0(struct qemu_plugin_scoreboard, 1);
+    score->element_size = element_size;
+    score->stride = ROUND_UP(MAX(element_size, 1), PLUGIN_SCOREBOARD_ALIGN);
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    if (!plugin.scoreboard_alloc_size) {
+        /* System emulation knows the maximum number of vCPUs up front */
+        plugin.scoreboard_alloc_size = MAX(qemu_plugin_n_max_vcpus(), 1);
+    }
+    /* The scoreboards are not grown while there are none */
+    while (plugin.scoreboard_alloc_size < plugin.num_vcpus) {
+        plugin.scoreboard_alloc_size *= 2;
+    }
+    score->data = plugin_scoreboard_alloc(score->stride,
+                                          plugin.scoreboard_alloc_size);
+    QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
+    return score;
+}
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    WITH_QEMU_LOCK_GUARD(&plugin.lock) {
+        QLIST_REMOVE(score, entry);
+    }
+    qemu_vfree(score->data);
+    g_free(score);
+}
+
+/*
+ * Make room for the entries of @cpu, which has not run yet.  Only
+ * user-mode emulation creates vCPUs beyond the maximum known when the
+ * scoreboards were allocated; it does so from the thread of another vCPU,
+ * which can stop all of them while the entries move.
+ */
+static void plugin_grow_scoreboards(CPUState *cpu)
+{
+    struct qemu_plugin_scoreboard *score;
+    size_t size;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    qatomic_set(&plugin.num_vcpus, MAX(plugin.num_vcpus, cpu->cpu_index + 1));
+    if (QLIST_EMPTY(&plugin.scoreboards) ||
+        plugin.num_vcpus <= plugin.scoreboard_alloc_size) {
+        qemu_rec_mutex_unlock(&plugin.lock);
+        return;
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    /* see qemu_plugin_user_exit() for the locking order */
+    g_assert(current_cpu);
+    start_exclusive();
+    qemu_rec_mutex_lock(&plugin.lock);
+    size = plugin.scoreboard_alloc_size;
+    while (size < plugin.num_vcpus) {
+        size *= 2;
+    }
+    QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+        void *data = plugin_scoreboard_alloc(score->stride, size);
+
+        memcpy(data, score->data,
+               score->stride * plugin.scoreboard_alloc_size);
+        qemu_vfree(score->data);
+        score->data = data;
+    }
+    plugin.scoreboard_alloc_size = size;
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    /* the generated code embeds the addresses of the entries */
+    tb_flush(current_cpu);
+    end_exclusive();
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
 
+    plugin_grow_scoreboards(cpu);
+
     qemu_rec_mutex_lock(&plugin.lock);
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
@@ -292,6 +387,24 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->rw = rw;
     dyn_cb->inline_insn.op = op;
     dyn_cb->inline_insn.imm = imm;
+    dyn_cb->inline_insn.entry = (qemu_plugin_u64) { NULL, 0 };
+}
+
+void plugin_register_inline_op_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = NULL;
+    dyn_cb->type = PLUGIN_CB_INLINE;
+    dyn_cb->rw = rw;
+    dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.imm = imm;
+    dyn_cb->inline_insn.entry = entry;
 }
 
 void plugin_register_dyn_cb__udata(GArray **arr,
@@ -307,6 +420,25 @@ void plugin_register_dyn_cb__udata(GArray **arr,
     dyn_cb->type = PLUGIN_CB_REGULAR;
 }
 
+void plugin_register_dyn_cond_cb__udata(GArray **arr,
+                                        qemu_plugin_vcpu_udata_cb_t cb,
+                                        enum qemu_plugin_cb_flags flags,
+                                        enum qemu_plugin_cond cond,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm,
+                                        void *udata)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+
+    dyn_cb->userp = udata;
+    /* Note flags are discarded as unused. */
+    dyn_cb->f.vcpu_udata = cb;
+    dyn_cb->type = PLUGIN_CB_COND;
+    dyn_cb->cond.cond = cond;
+    dyn_cb->cond.imm = imm;
+    dyn_cb->cond.entry = entry;
+}
+
 void plugin_register_vcpu_mem_cb(GArray **arr,
                                  void *cb,
                                  enum qemu_plugin_cb_flags flags,
@@ -432,14 +564,22 @@ void qemu_plugin_flush_cb(void)
     plugin_cb__simple(QEMU_PLUGIN_EV_FLUSH);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index)
 {
+    qemu_plugin_u64 entry = cb->inline_insn.entry;
     uint64_t *val = cb->userp;
 
+    if (entry.score) {
+        val = plugin_scoreboard_entry(entry.score, cpu_index) + entry.offset;
+    }
+
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
         *val += cb->inline_insn.imm;
         break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        *val = cb->inline_insn.imm;
+        break;
     default:
         g_assert_not_reached();
     }
@@ -467,7 +607,7 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                            vaddr, cb->userp);
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+            exec_inline_op(cb, cpu->cpu_index);
             break;
         default:
             g_assert_not_reached();
@@ -579,6 +719,7 @@ static void __attribute__((__constructor__)) plugin_init(void)
     plugin.id_ht = g_hash_table_new(g_int64_hash, g_int64_equal);
     plugin.cpu_ht = g_hash_table_new(g_int_hash, g_int_equal);
     QTAILQ_INIT(&plugin.ctxs);
+    QLIST_INIT(&plugin.scoreboards);
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
     atexit(qemu_plugin_atexit_cb);
@@ -44,6 +44,24 @@ struct qemu_plugin_state {
      * the code cache is flushed.
      */
     struct qht dyn_cb_arr_ht;
+    /* highest vCPU index seen so far, plus one */
+    int num_vcpus;
+    /* number of entries allocated in each scoreboard */
+    size_t scoreboard_alloc_size;
+    QLIST_HEAD(, qemu_plugin_scoreboard) scoreboards;
+};
+
+/*
+ * The entries of a scoreboard are @stride bytes apart, a multiple of the
+ * cache line size.  The code generated for inline ops embeds @data, which
+ * is only reallocated while all vCPUs are stopped, followed by a flush of
+ * the code cache.
+ */
+struct qemu_plugin_scoreboard {
+    void *data;
+    size_t element_size;
+    size_t stride;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
 };
 
 
@@ -69,6 +87,12 @@ void plugin_register_inline_op(GArray **arr,
                                enum qemu_plugin_op op, void *ptr,
                                uint64_t imm);
 
+void plugin_register_inline_op_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm);
+
 void plugin_reset_uninstall(qemu_plugin_id_t id,
                             qemu_plugin_simple_cb_t cb,
                             bool reset);
@@ -88,6 +112,14 @@ plugin_register_dyn_cb__udata(GArray **arr,
                               qemu_plugin_vcpu_udata_cb_t cb,
                               enum qemu_plugin_cb_flags flags, void *udata);
 
+void
+plugin_register_dyn_cond_cb__udata(GArray **arr,
+                                   qemu_plugin_vcpu_udata_cb_t cb,
+                                   enum qemu_plugin_cb_flags flags,
+                                   enum qemu_plugin_cond cond,
+                                   qemu_plugin_u64 entry,
+                                   uint64_t imm,
+                                   void *udata);
 
 void plugin_register_vcpu_mem_cb(GArray **arr,
                                  void *cb,
@@ -95,6 +127,18 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
                                  enum qemu_plugin_mem_rw rw,
                                  void *udata);
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb);
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index);
+
+int plugin_num_vcpus(void);
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size);
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+static inline void *plugin_scoreboard_entry(struct qemu_plugin_scoreboard *s,
+                                            unsigned int vcpu_index)
+{
+    return s->data + vcpu_index * s->stride;
+}
 
 #endif /* PLUGIN_H */
@@ -184,6 +184,15 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tb-cache=dir (persistent TCG translation cache directory)\n"
+    "                tb-evict=on|off (evict old TCG translations when the cache fills up, default=off)\n"
+    "                tb-workers=n (TCG background translation threads, default 0)\n"
+    "                rr-threads=n (threads sharing the vCPUs with thread=single, default 1)\n"
+    "                icount-quantum=n (instructions per vCPU between icount synchronisations with rr-threads, default 10000)\n"
+    "                superblock-threshold=n (TCG superblock formation after n runs of a block, default 0)\n"
+    "                pinned-globals=n (guest registers TCG keeps in host registers, default 0)\n"
+    "                return-stack=on|off (TCG prediction of guest returns, default=off)\n"
+    "                cross-bb-regs=on|off (TCG register allocation across branches within a block, default=off)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
@@ -219,6 +228,78 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tb-cache=dir``
+        Keeps the code translated by TCG in a file under ``dir``, and
+        reuses it in later runs of the same QEMU binary on the same host,
+        as long as the guest code is unchanged.  The file is shared by
+        all instances using the same directory, and stops growing at
+        256 MiB.  Only supported for system emulation on x86-64 Linux
+        hosts; translation blocks spanning two pages or embedding
+        pointers that may change from one run to the next, and all
+        blocks while TCG plugins are active, are not cached.
+
+    ``tb-evict=on|off``
+        When the translation block cache is close to full, discards the
+        oldest part of it rather than waiting for it to fill up and then
+        discarding all of it.  Other vCPUs keep running meanwhile.  Only
+        supported for system emulation.  The default is off.
+
+    ``tb-workers=n``
+        Starts ``n`` threads that translate the likely successors of
+        newly translated blocks in the background, so that the vCPUs find
+        them ready.  Only direct jump targets within the same guest page
+        are translated ahead of time, and only for targets that describe
+        the CPU state translation depends on, currently RISC-V.  The
+        default is 0, which translates on the vCPU threads only.
+
+    ``rr-threads=n``
+        With ``thread=single``, splits the vCPUs between ``n`` threads
+        instead of one, each of which runs its share of the vCPUs in turn.
+        This runs fewer host threads than ``thread=multi`` would for a
+        large guest, but has the same requirements on the guest and host
+        memory models.  Not supported with record/replay.  The default
+        is 1.
+
+    ``icount-quantum=n``
+        With icount and ``rr-threads`` greater than 1, each vCPU runs
+        ``n`` instructions, or fewer if a timer is due earlier, then waits
+        until every other vCPU has done the same or gone idle.  The
+        virtual clock then advances by the instructions of one vCPU
+        rather than of all of them, so that each vCPU runs at the speed
+        set by the icount shift.  A vCPU sees the clock advance
+        with its own instructions within a quantum.  Smaller quanta keep
+        the vCPUs closer in time but synchronise them more often.  The
+        default is 10000.
+
+    ``superblock-threshold=n``
+        Counts the executions of each translation block, and once a block
+        has run ``n`` times, translates it again together with the block
+        its last direct jump leads to, so that the two are optimized as a
+        single unit.  For a loop, this unrolls the loop body once.  The
+        default is 0, which disables counting.  Superblocks are not formed
+        with icount or while TCG plugins are active.
+
+    ``pinned-globals=n``
+        Keeps up to ``n`` frequently used guest registers in call-saved
+        host registers, so that translation blocks jumping to each other
+        do not reload them from memory.  Only RISC-V guests on x86-64 and
+        AArch64 hosts use this, with at most 4 and 8 registers
+        respectively.  The default is 0, which disables it.
+
+    ``return-stack=on|off``
+        Keeps a stack of the return addresses of guest calls, so that
+        translated returns can jump straight to the code of the caller
+        instead of looking it up.  Only RISC-V guests use this.  The
+        default is off.
+
+    ``cross-bb-regs=on|off``
+        Lets the TCG register allocator keep guest registers in host
+        registers past the labels within a translation block, when every
+        branch to a label leaves them in the same host registers.  This
+        saves reloading them after guest instructions that are translated
+        with internal branches, such as conditional moves, at the cost of
+        a little more register pressure.  The default is off.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -57,6 +57,9 @@ static bool icount_sleep = true;
  */
 int use_icount;
 
+/* See cpu-timers.h */
+int64_t icount_quantum;
+
 static void icount_enable_precise(void)
 {
     use_icount = 1;
@@ -82,12 +85,18 @@ static int64_t icount_get_executed(CPUState *cpu)
  * Update the global shared timer_state.qemu_icount to take into
  * account executed instructions. This is done by the TCG vCPU
  * thread so the main-loop can see time has moved forward.
+ * With parallel vCPUs, the instructions only count towards the quantum
+ * of @cpu; see icount_end_quantum().
  */
 static void icount_update_locked(CPUState *cpu)
 {
     int64_t executed = icount_get_executed(cpu);
     cpu->icount_budget -= executed;
 
+    if (icount_quantum) {
+        cpu->icount_quantum_used += executed;
+        return;
+    }
     qatomic_set_i64(&timers_state.qemu_icount,
                     timers_state.qemu_icount + executed);
 }
@@ -109,6 +118,7 @@ void icount_update(CPUState *cpu)
 static int64_t icount_get_raw_locked(void)
 {
     CPUState *cpu = current_cpu;
+    int64_t icount;
 
     if (cpu && cpu->running) {
         if (!cpu->can_do_io) {
@@ -119,7 +129,13 @@ static int64_t icount_get_raw_locked(void)
         icount_update_locked(cpu);
     }
     /* The read is protected by the seqlock, but needs atomic64 to avoid UB */
-    return qatomic_read_i64(&timers_state.qemu_icount);
+    icount = qatomic_read_i64(&timers_state.qemu_icount);
+
+    /* A vCPU sees its own progress through the quantum. */
+    if (icount_quantum && cpu) {
+        icount += cpu->icount_quantum_used;
+    }
+    return icount;
 }
 
 static int64_t icount_get_locked(void)
@@ -169,6 +185,31 @@ int64_t icount_to_ns(int64_t icount)
  */
 #define ICOUNT_WOBBLE (NANOSECONDS_PER_SECOND / 10)
 
+int64_t icount_end_quantum(void)
+{
+    CPUState *cpu;
+    int64_t count = 0;
+
+    CPU_FOREACH(cpu) {
+        assert(!cpu->icount_quantum_running);
+        count = MAX(count, cpu->icount_quantum_used);
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    seqlock_write_lock(&timers_state.vm_clock_seqlock,
+                       &timers_state.vm_clock_lock);
+    qatomic_set_i64(&timers_state.qemu_icount,
+                    timers_state.qemu_icount + count);
+    CPU_FOREACH(cpu) {
+        cpu->icount_quantum_used = 0;
+    }
+    seqlock_write_unlock(&timers_state.vm_clock_seqlock,
+                         &timers_state.vm_clock_lock);
+    return count;
+}
+
 static void icount_adjust(void)
 {
     int64_t cur_time;
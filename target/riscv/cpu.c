@@ -314,10 +314,11 @@ static void rv64_thead_c906_cpu_init(Object *obj)
 
 static void rv128_base_cpu_init(Object *obj)
 {
-    if (qemu_tcg_mttcg_enabled()) {
+    if (qemu_tcg_parallel_enabled()) {
         /* Missing 128-bit aligned atomics */
-        error_report("128-bit RISC-V currently does not work with Multi "
-                     "Threaded TCG. Please use: -accel tcg,thread=single");
+        error_report("128-bit RISC-V currently does not work with vCPUs "
+                     "running in parallel. Please use: "
+                     "-accel tcg,thread=single,rr-threads=1");
         exit(EXIT_FAILURE);
     }
     CPURISCVState *env = &RISCV_CPU(obj)->env;
@@ -540,6 +541,24 @@ static void riscv_cpu_synchronize_from_tb(CPUState *cs,
     }
 }
 
+uint64_t riscv_cpu_translate_key(CPUState *cs)
+{
+    RISCVCPU *cpu = RISCV_CPU(cs);
+    CPURISCVState *env = &cpu->env;
+    uint64_t key = 0;
+
+    key = FIELD_DP64(key, TR_KEY, MISA_EXT, env->misa_ext);
+    key = FIELD_DP64(key, TR_KEY, PRIV_VER, env->priv_ver);
+    key = FIELD_DP64(key, TR_KEY, MXL_MAX, env->misa_mxl_max);
+    key = FIELD_DP64(key, TR_KEY, VSTART_NZ, env->vstart != 0);
+#ifndef CONFIG_USER_ONLY
+    if (riscv_has_ext(env, RVH)) {
+        key = FIELD_DP64(key, TR_KEY, VIRT, riscv_cpu_virt_enabled(env));
+    }
+#endif
+    return key;
+}
+
 static bool riscv_cpu_has_work(CPUState *cs)
 {
 #ifndef CONFIG_USER_ONLY
@@ -629,6 +648,8 @@ static void riscv_cpu_reset_hold(Object *obj)
     }
     /* mmte is supposed to have pm.current hardwired to 1 */
     env->mmte |= (PM_EXT_INITIAL | MMTE_M_PM_CURRENT);
+    riscv_cpu_pwc_flush(env);
+    riscv_cpu_update_tlb_tag(env);
 #endif
     env->xl = riscv_cpu_mxl(env);
     riscv_cpu_update_mask(env);
@@ -973,6 +994,8 @@ static void riscv_cpu_realize(DeviceState *dev, Error **errp)
         if (!riscv_pmu_init(cpu, cpu->cfg.pmu_num) && cpu->cfg.ext_sscofpmf) {
             cpu->pmu_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
                                           riscv_pmu_timer_cb, cpu);
+            cpu->pmu_tb_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                             riscv_pmu_tb_timer_cb, cpu);
         }
      }
 #endif
@@ -1059,10 +1082,15 @@ static void riscv_cpu_init(Object *obj)
     cpu->cfg.pmp = true;
 
     cpu_set_cpustate_pointers(cpu);
+    riscv_cpu_init_vidx(&cpu->env);
 
 #ifndef CONFIG_USER_ONLY
     qdev_init_gpio_in(DEVICE(cpu), riscv_cpu_set_irq,
                       IRQ_LOCAL_MAX + IRQ_LOCAL_GUEST_MAX);
+    object_property_add_uint64_ptr(obj, "pwc-hits", &cpu->env.pwc_hits,
+                                   OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(obj, "pwc-misses", &cpu->env.pwc_misses,
+                                   OBJ_PROP_FLAG_READ);
 #endif /* CONFIG_USER_ONLY */
 }
 
@@ -1197,6 +1225,7 @@ static void register_cpu_props(DeviceState *dev)
 
 static Property riscv_cpu_properties[] = {
     DEFINE_PROP_BOOL("debug", RISCVCPU, cfg.debug, true),
+    DEFINE_PROP_BOOL("pwc", RISCVCPU, cfg.pwc, true),
 
     DEFINE_PROP_UINT32("mvendorid", RISCVCPU, cfg.mvendorid, 0),
     DEFINE_PROP_UINT64("marchid", RISCVCPU, cfg.marchid, RISCV_CPU_MARCHID),
@@ -1259,6 +1288,7 @@ static const struct TCGCPUOps riscv_tcg_ops = {
     .initialize = riscv_translate_init,
     .synchronize_from_tb = riscv_cpu_synchronize_from_tb,
     .restore_state_to_opc = riscv_restore_state_to_opc,
+    .translate_key = riscv_cpu_translate_key,
 
 #ifndef CONFIG_USER_ONLY
     .tlb_fill = riscv_cpu_tlb_fill,
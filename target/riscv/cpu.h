@@ -131,6 +131,16 @@ FIELD(VTYPE, VMA, 7, 1)
 FIELD(VTYPE, VEDIV, 8, 2)
 FIELD(VTYPE, RESERVED, 10, sizeof(target_ulong) * 8 - 11)
 
+/* Events counted by translated code, see riscv_pmu_tb_event() */
+enum {
+    RISCV_PMU_TB_INSNS,
+    RISCV_PMU_TB_BRANCHES,
+    RISCV_PMU_TB_TAKEN_BRANCHES,
+    RISCV_PMU_TB_LOADS,
+    RISCV_PMU_TB_STORES,
+    RISCV_PMU_TB_EVENTS
+};
+
 typedef struct PMUCTRState {
     /* Current value of a counter */
     target_ulong mhpmcounter_val;
@@ -145,6 +155,23 @@ typedef struct PMUCTRState {
     target_ulong irq_overflow_left;
 } PMUCTRState;
 
+#define RISCV_PWC_SIZE 64
+
+/*
+ * Page-walk cache entry: the base of the page table used at @level of a
+ * walk rooted at @atp, for virtual addresses whose bits above that
+ * level's index equal @tag.  VS-stage entries also record the @hgatp
+ * that their guest-physical bases are relative to.
+ */
+typedef struct RISCVPWCEntry {
+    target_ulong atp;
+    target_ulong hgatp;
+    target_ulong tag;
+    hwaddr base;
+    uint8_t stage;
+    uint8_t level;      /* 0 if the entry is invalid */
+} RISCVPWCEntry;
+
 struct CPUArchState {
     target_ulong gpr[32];
     target_ulong gprh[32]; /* 64 top bits of the 128-bit registers */
@@ -152,6 +179,15 @@ struct CPUArchState {
 
     /* vector coprocessor state. */
     uint64_t vreg[32 * RV_VLEN_MAX / 64] QEMU_ALIGNED(16);
+    /*
+     * Scratch space for predicated GVEC expansion of up to LMUL=8
+     * register groups: the expanded element predicate and the result
+     * computed over VLMAX elements before it is merged into vd.
+     */
+    uint64_t vpred[8 * RV_VLEN_MAX / 64] QEMU_ALIGNED(16);
+    uint64_t vtmp[8 * RV_VLEN_MAX / 64] QEMU_ALIGNED(16);
+    /* Constant element indexes for each SEW, see riscv_cpu_init_vidx() */
+    uint64_t vidx[4][8 * RV_VLEN_MAX / 64] QEMU_ALIGNED(16);
     target_ulong vxrm;
     target_ulong vxsat;
     target_ulong vl;
@@ -311,6 +347,14 @@ struct CPUArchState {
     /* PMU event selector configured values for RV32*/
     target_ulong mhpmeventh_val[RV_MAX_MHPMEVENTS];
 
+    /*
+     * Events counted by translated code, not yet added to the counters,
+     * and the mask of RISCV_PMU_TB_* events counted in each privilege
+     * mode, indexed by priv + 4 * virt.
+     */
+    uint64_t pmu_tb_pending[RISCV_PMU_TB_EVENTS];
+    uint8_t pmu_tb_events[8];
+
     target_ulong sscratch;
     target_ulong mscratch;
 
@@ -323,6 +367,11 @@ struct CPUArchState {
     pmp_table_t pmp_state;
     target_ulong mseccfg;
 
+    /* page-walk cache of non-leaf PTEs */
+    RISCVPWCEntry pwc[RISCV_PWC_SIZE];
+    uint64_t pwc_hits;
+    uint64_t pwc_misses;
+
     /* trigger module */
     target_ulong trigger_cur;
     target_ulong tdata1[RV_MAX_TRIGGERS];
@@ -498,6 +547,7 @@ struct RISCVCPUConfig {
     bool pmp;
     bool epmp;
     bool debug;
+    bool pwc;
 
     bool short_isa_string;
 };
@@ -524,6 +574,8 @@ struct ArchCPU {
     RISCVCPUConfig cfg;
 
     QEMUTimer *pmu_timer;
+    /* Overflow timer of the events counted by translated code */
+    QEMUTimer *pmu_tb_timer;
     /* A bitmask of Available programmable counters */
     uint32_t pmu_avail_ctrs;
     /* Mapping of events to counters */
@@ -591,9 +643,19 @@ void riscv_cpu_list(void);
 #define cpu_list riscv_cpu_list
 #define cpu_mmu_index riscv_cpu_mmu_index
 
+/* Softmmu TLB address-space tag, as computed by riscv_cpu_tlb_tag() */
+#define RISCV_TLB_TAG_ASID  0x000000000000ffffULL
+#define RISCV_TLB_TAG_VMID  0x00000000ffff0000ULL
+#define RISCV_TLB_TAG_V     0x0000000100000000ULL
+
 #ifndef CONFIG_USER_ONLY
 bool riscv_cpu_exec_interrupt(CPUState *cs, int interrupt_request);
 void riscv_cpu_swap_hypervisor_regs(CPURISCVState *env);
+void riscv_cpu_pwc_flush(CPURISCVState *env);
+uint64_t riscv_cpu_tlb_tag(CPURISCVState *env);
+void riscv_cpu_update_tlb_tag(CPURISCVState *env);
+void riscv_cpu_flush_guest_tlb(CPURISCVState *env);
+void riscv_cpu_flush_guest_tlb_page(CPURISCVState *env, target_ulong addr);
 int riscv_cpu_claim_interrupts(RISCVCPU *cpu, uint64_t interrupts);
 uint64_t riscv_cpu_update_mip(RISCVCPU *cpu, uint64_t mask, uint64_t value);
 #define BOOL_TO_MASK(x) (-!!(x)) /* helper for riscv_cpu_update_mip value */
@@ -643,6 +705,8 @@ FIELD(TB_FLAGS, VTA, 24, 1)
 FIELD(TB_FLAGS, VMA, 25, 1)
 /* Native debug itrigger */
 FIELD(TB_FLAGS, ITRIGGER, 26, 1)
+/* Mask of the RISCV_PMU_TB_* events counted by translated code */
+FIELD(TB_FLAGS, PMU_EVENTS, 27, 5)
 
 #ifdef TARGET_RISCV32
 #define riscv_cpu_mxl(env)  ((void)(env), MXL_RV32)
@@ -798,9 +862,14 @@ enum {
 enum riscv_pmu_event_idx {
     RISCV_PMU_EVENT_HW_CPU_CYCLES = 0x01,
     RISCV_PMU_EVENT_HW_INSTRUCTIONS = 0x02,
+    RISCV_PMU_EVENT_HW_BRANCH_INSTRUCTIONS = 0x05,
+    RISCV_PMU_EVENT_CACHE_L1D_READ_ACCESS = 0x10000,
+    RISCV_PMU_EVENT_CACHE_L1D_WRITE_ACCESS = 0x10002,
     RISCV_PMU_EVENT_CACHE_DTLB_READ_MISS = 0x10019,
     RISCV_PMU_EVENT_CACHE_DTLB_WRITE_MISS = 0x1001B,
     RISCV_PMU_EVENT_CACHE_ITLB_PREFETCH_MISS = 0x10021,
+    /* Raw event (type 0x2), QEMU specific */
+    RISCV_PMU_EVENT_RAW_TAKEN_BRANCHES = 0x20001,
 };
 
 /* CSR function table */
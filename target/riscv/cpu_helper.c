@@ -28,6 +28,7 @@
 #include "trace.h"
 #include "semihosting/common-semi.h"
 #include "sysemu/cpu-timers.h"
+#include "sysemu/tcg.h"
 #include "cpu_bits.h"
 #include "debug.h"
 
@@ -108,6 +109,9 @@ void cpu_get_tb_cpu_state(CPURISCVState *env, target_ulong *pc,
     if (riscv_feature(env, RISCV_FEATURE_DEBUG) && !icount_enabled()) {
         flags = FIELD_DP32(flags, TB_FLAGS, ITRIGGER, env->itrigger_enabled);
     }
+    flags = FIELD_DP32(flags, TB_FLAGS, PMU_EVENTS,
+                       env->pmu_tb_events[env->priv +
+                                          4 * riscv_cpu_virt_enabled(env)]);
 #endif
 
     flags = FIELD_DP32(flags, TB_FLAGS, XL, env->xl);
@@ -567,19 +571,92 @@ bool riscv_cpu_virt_enabled(CPURISCVState *env)
     return get_field(env->virt, VIRT_ONOFF);
 }
 
+/*
+ * The softmmu TLB keeps the translations of a few address spaces apart,
+ * tagged by the ASID of the active satp and, while V=1, by the VMID of
+ * hgatp.  The VMID field of hgatp lies where the ASID field of satp
+ * does, only narrower.
+ */
+uint64_t riscv_cpu_tlb_tag(CPURISCVState *env)
+{
+    uint64_t tag;
+
+    if (riscv_cpu_mxl(env) == MXL_RV32) {
+        tag = get_field(env->satp, SATP32_ASID);
+    } else {
+        tag = get_field(env->satp, SATP64_ASID);
+    }
+
+    if (riscv_cpu_virt_enabled(env)) {
+        uint64_t vmid;
+
+        if (riscv_cpu_mxl(env) == MXL_RV32) {
+            vmid = get_field(env->hgatp, SATP32_ASID);
+        } else {
+            vmid = get_field(env->hgatp, SATP64_ASID);
+        }
+        tag |= RISCV_TLB_TAG_V | (vmid << 16);
+    }
+    return tag;
+}
+
+void riscv_cpu_update_tlb_tag(CPURISCVState *env)
+{
+    if (tcg_enabled()) {
+        tlb_switch_tag(env_cpu(env), riscv_cpu_tlb_tag(env));
+    }
+}
+
+/*
+ * Translations of guest addresses made while V=0 are not tagged by the
+ * guest ASID or the VMID: HLV/HSV use the TB_FLAGS_PRIV_HYP_ACCESS_MASK
+ * indexes, and M-mode loads and stores with MPRV and MPV set use the
+ * PRV_M index.  Flush those whenever vsatp or hgatp change, or the guest
+ * fences its own translations.
+ */
+static uint16_t riscv_cpu_guest_mmuidx_map(void)
+{
+    uint16_t idxmap = 1 << PRV_M;
+    int i;
+
+    for (i = 0; i < NB_MMU_MODES; i++) {
+        if (i & TB_FLAGS_PRIV_HYP_ACCESS_MASK) {
+            idxmap |= 1 << i;
+        }
+    }
+    return idxmap;
+}
+
+void riscv_cpu_flush_guest_tlb(CPURISCVState *env)
+{
+    if (riscv_has_ext(env, RVH)) {
+        tlb_flush_by_mmuidx(env_cpu(env), riscv_cpu_guest_mmuidx_map());
+    }
+}
+
+void riscv_cpu_flush_guest_tlb_page(CPURISCVState *env, target_ulong addr)
+{
+    if (riscv_has_ext(env, RVH)) {
+        tlb_flush_page_by_mmuidx(env_cpu(env), addr,
+                                 riscv_cpu_guest_mmuidx_map());
+    }
+}
+
 void riscv_cpu_set_virt_enabled(CPURISCVState *env, bool enable)
 {
     if (!riscv_has_ext(env, RVH)) {
         return;
     }
 
-    /* Flush the TLB on all virt mode changes. */
-    if (get_field(env->virt, VIRT_ONOFF) != enable) {
-        tlb_flush(env_cpu(env));
-    }
-
     env->virt = set_field(env->virt, VIRT_ONOFF, enable);
 
+    /*
+     * V=0 and V=1 translations are tagged apart, so this switches TLB
+     * banks instead of flushing.  The callers have already swapped satp
+     * with vsatp.
+     */
+    riscv_cpu_update_tlb_tag(env);
+
     if (enable) {
         /*
          * The guest external interrupts from an interrupt controller are
@@ -719,16 +796,90 @@ static int get_physical_address_pmp(CPURISCVState *env, int *prot,
     }
 
     *prot = pmp_priv_to_page_prot(pmp_priv);
-    if ((tlb_size != NULL) && pmp_index != MAX_RISCV_PMPS) {
-        target_ulong tlb_sa = addr & ~(TARGET_PAGE_SIZE - 1);
-        target_ulong tlb_ea = tlb_sa + TARGET_PAGE_SIZE - 1;
-
-        *tlb_size = pmp_get_tlb_size(env, pmp_index, tlb_sa, tlb_ea);
+    if (tlb_size != NULL) {
+        *tlb_size = pmp_get_tlb_size(env, addr, 1 << access_type, mode);
     }
 
     return TRANSLATE_SUCCESS;
 }
 
+/*
+ * Page-walk cache
+ *
+ * Non-leaf PTEs may be cached until the next SFENCE.VMA or HFENCE, so
+ * remember the table base reached at each level of a walk and resume
+ * later walks for nearby addresses from the deepest cached level.
+ * Entries are keyed by the root register of the walk, which carries
+ * the ASID or VMID, and VS-stage entries also by hgatp, as their bases
+ * are guest-physical.  The PMP checks on the skipped PTE loads were
+ * done when the entry was filled, so PMP updates flush the cache too.
+ */
+enum {
+    PWC_STAGE_S,    /* single stage, rooted at satp */
+    PWC_STAGE_VS,   /* first of two stages, rooted at satp or vsatp */
+    PWC_STAGE_G,    /* second stage, rooted at hgatp */
+};
+
+void riscv_cpu_pwc_flush(CPURISCVState *env)
+{
+    memset(env->pwc, 0, sizeof(env->pwc));
+}
+
+static inline target_ulong pwc_tag(target_ulong addr, int levels,
+                                   int ptidxbits, int level)
+{
+    return addr >> (PGSHIFT + (levels - level) * ptidxbits);
+}
+
+static RISCVPWCEntry *pwc_entry(CPURISCVState *env, int stage,
+                                target_ulong atp, target_ulong tag, int level)
+{
+    target_ulong h = tag ^ (tag >> 6) ^ atp ^ (level << 3) ^ stage;
+
+    return &env->pwc[h & (RISCV_PWC_SIZE - 1)];
+}
+
+/*
+ * Return the deepest level of the walk for @addr whose table base is
+ * cached, and set *@base to it, or return 0 if there is none.
+ */
+static int pwc_lookup(CPURISCVState *env, int stage, target_ulong atp,
+                      target_ulong hgatp, target_ulong addr, int levels,
+                      int ptidxbits, hwaddr *base)
+{
+    int level;
+
+    for (level = levels - 1; level > 0; level--) {
+        target_ulong tag = pwc_tag(addr, levels, ptidxbits, level);
+        RISCVPWCEntry *e = pwc_entry(env, stage, atp, tag, level);
+
+        if (e->level == level && e->stage == stage && e->atp == atp &&
+            e->hgatp == hgatp && e->tag == tag) {
+            env->pwc_hits++;
+            *base = e->base;
+            return level;
+        }
+    }
+
+    env->pwc_misses++;
+    return 0;
+}
+
+static void pwc_fill(CPURISCVState *env, int stage, target_ulong atp,
+                     target_ulong hgatp, target_ulong addr, int levels,
+                     int ptidxbits, int level, hwaddr base)
+{
+    target_ulong tag = pwc_tag(addr, levels, ptidxbits, level);
+    RISCVPWCEntry *e = pwc_entry(env, stage, atp, tag, level);
+
+    e->atp = atp;
+    e->hgatp = hgatp;
+    e->tag = tag;
+    e->base = base;
+    e->stage = stage;
+    e->level = level;
+}
+
 /* get_physical_address - get the physical address for this virtual address
  *
  * Do a page table walk to obtain the physical address corresponding to a
@@ -805,7 +956,9 @@ static int get_physical_address(CPURISCVState *env, hwaddr *physical,
     *prot = 0;
 
     hwaddr base;
-    int levels, ptidxbits, ptesize, vm, sum, mxr, widened;
+    target_ulong atp, hgatp = 0;
+    int levels, ptidxbits, ptesize, vm, sum, mxr, widened, stage;
+    bool use_pwc = cpu->cfg.pwc && !is_debug;
 
     if (first_stage == true) {
         mxr = get_field(env->mstatus, MSTATUS_MXR);
@@ -814,34 +967,26 @@ static int get_physical_address(CPURISCVState *env, hwaddr *physical,
     }
 
     if (first_stage == true) {
-        if (use_background) {
-            if (riscv_cpu_mxl(env) == MXL_RV32) {
-                base = (hwaddr)get_field(env->vsatp, SATP32_PPN) << PGSHIFT;
-                vm = get_field(env->vsatp, SATP32_MODE);
-            } else {
-                base = (hwaddr)get_field(env->vsatp, SATP64_PPN) << PGSHIFT;
-                vm = get_field(env->vsatp, SATP64_MODE);
-            }
+        atp = use_background ? env->vsatp : env->satp;
+        if (two_stage) {
+            stage = PWC_STAGE_VS;
+            hgatp = env->hgatp;
         } else {
-            if (riscv_cpu_mxl(env) == MXL_RV32) {
-                base = (hwaddr)get_field(env->satp, SATP32_PPN) << PGSHIFT;
-                vm = get_field(env->satp, SATP32_MODE);
-            } else {
-                base = (hwaddr)get_field(env->satp, SATP64_PPN) << PGSHIFT;
-                vm = get_field(env->satp, SATP64_MODE);
-            }
+            stage = PWC_STAGE_S;
         }
         widened = 0;
     } else {
-        if (riscv_cpu_mxl(env) == MXL_RV32) {
-            base = (hwaddr)get_field(env->hgatp, SATP32_PPN) << PGSHIFT;
-            vm = get_field(env->hgatp, SATP32_MODE);
-        } else {
-            base = (hwaddr)get_field(env->hgatp, SATP64_PPN) << PGSHIFT;
-            vm = get_field(env->hgatp, SATP64_MODE);
-        }
+        atp = env->hgatp;
+        stage = PWC_STAGE_G;
         widened = 2;
     }
+    if (riscv_cpu_mxl(env) == MXL_RV32) {
+        base = (hwaddr)get_field(atp, SATP32_PPN) << PGSHIFT;
+        vm = get_field(atp, SATP32_MODE);
+    } else {
+        base = (hwaddr)get_field(atp, SATP64_PPN) << PGSHIFT;
+        vm = get_field(atp, SATP64_MODE);
+    }
     /* status.SUM will be ignored if execute on background */
     sum = get_field(env->mstatus, MSTATUS_SUM) || use_background || is_debug;
     switch (vm) {
@@ -876,13 +1021,20 @@ static int get_physical_address(CPURISCVState *env, hwaddr *physical,
         return TRANSLATE_FAIL;
     }
 
-    int ptshift = (levels - 1) * ptidxbits;
+    hwaddr root = base;
+    int ptshift;
     int i;
 
 #if !TCG_OVERSIZED_GUEST
 restart:
 #endif
-    for (i = 0; i < levels; i++, ptshift -= ptidxbits) {
+    base = root;
+    i = 0;
+    if (use_pwc) {
+        i = pwc_lookup(env, stage, atp, hgatp, addr, levels, ptidxbits, &base);
+    }
+    for (ptshift = (levels - 1 - i) * ptidxbits; i < levels;
+         i++, ptshift -= ptidxbits) {
         target_ulong idx;
         if (i == 0) {
             idx = (addr >> (PGSHIFT + ptshift)) &
@@ -958,6 +1110,10 @@ restart:
                 return TRANSLATE_FAIL;
             }
             base = ppn << PGSHIFT;
+            if (use_pwc && i + 1 < levels) {
+                pwc_fill(env, stage, atp, hgatp, addr, levels, ptidxbits,
+                         i + 1, base);
+            }
         } else if ((pte & (PTE_R | PTE_W | PTE_X)) == PTE_W) {
             /* Reserved leaf PTE flags: PTE_W */
             return TRANSLATE_FAIL;
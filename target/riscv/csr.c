@@ -715,6 +715,7 @@ static int write_mhpmevent(CPURISCVState *env, int csrno, target_ulong val)
     int evt_index = csrno - CSR_MCOUNTINHIBIT;
     uint64_t mhpmevt_val = val;
 
+    riscv_pmu_sync_tb_events(env);
     env->mhpmevent_val[evt_index] = val;
 
     if (riscv_cpu_mxl(env) == MXL_RV32) {
@@ -722,6 +723,7 @@ static int write_mhpmevent(CPURISCVState *env, int csrno, target_ulong val)
                       ((uint64_t)env->mhpmeventh_val[evt_index] << 32);
     }
     riscv_pmu_update_event_map(env, mhpmevt_val, evt_index);
+    riscv_pmu_update_tb_events(env);
 
     return RISCV_EXCP_NONE;
 }
@@ -741,10 +743,12 @@ static int write_mhpmeventh(CPURISCVState *env, int csrno, target_ulong val)
     uint64_t mhpmevth_val = val;
     uint64_t mhpmevt_val = env->mhpmevent_val[evt_index];
 
+    riscv_pmu_sync_tb_events(env);
     mhpmevt_val = mhpmevt_val | (mhpmevth_val << 32);
     env->mhpmeventh_val[evt_index] = val;
 
     riscv_pmu_update_event_map(env, mhpmevt_val, evt_index);
+    riscv_pmu_update_tb_events(env);
 
     return RISCV_EXCP_NONE;
 }
@@ -755,20 +759,25 @@ static int write_mhpmcounter(CPURISCVState *env, int csrno, target_ulong val)
     PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
     uint64_t mhpmctr_val = val;
 
+    riscv_pmu_sync_tb_events(env);
     counter->mhpmcounter_val = val;
+    if (riscv_cpu_mxl(env) == MXL_RV32) {
+        mhpmctr_val = mhpmctr_val |
+                      ((uint64_t)counter->mhpmcounterh_val << 32);
+    }
     if (riscv_pmu_ctr_monitor_cycles(env, ctr_idx) ||
         riscv_pmu_ctr_monitor_instructions(env, ctr_idx)) {
         counter->mhpmcounter_prev = get_ticks(false);
         if (ctr_idx > 2) {
-            if (riscv_cpu_mxl(env) == MXL_RV32) {
-                mhpmctr_val = mhpmctr_val |
-                              ((uint64_t)counter->mhpmcounterh_val << 32);
-            }
             riscv_pmu_setup_timer(env, mhpmctr_val, ctr_idx);
         }
      } else {
         /* Other counters can keep incrementing from the given value */
         counter->mhpmcounter_prev = val;
+        if (ctr_idx > 2) {
+            /* Only events counted by translated code need the timer */
+            riscv_pmu_setup_timer(env, mhpmctr_val, ctr_idx);
+        }
     }
 
     return RISCV_EXCP_NONE;
@@ -778,9 +787,11 @@ static int write_mhpmcounterh(CPURISCVState *env, int csrno, target_ulong val)
 {
     int ctr_idx = csrno - CSR_MCYCLEH;
     PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
-    uint64_t mhpmctr_val = counter->mhpmcounter_val;
+    uint64_t mhpmctr_val;
     uint64_t mhpmctrh_val = val;
 
+    riscv_pmu_sync_tb_events(env);
+    mhpmctr_val = counter->mhpmcounter_val;
     counter->mhpmcounterh_val = val;
     mhpmctr_val = mhpmctr_val | (mhpmctrh_val << 32);
     if (riscv_pmu_ctr_monitor_cycles(env, ctr_idx) ||
@@ -791,6 +802,9 @@ static int write_mhpmcounterh(CPURISCVState *env, int csrno, target_ulong val)
         }
     } else {
         counter->mhpmcounterh_prev = val;
+        if (ctr_idx > 2) {
+            riscv_pmu_setup_timer(env, mhpmctr_val, ctr_idx);
+        }
     }
 
     return RISCV_EXCP_NONE;
@@ -846,6 +860,7 @@ static int read_hpmcounter(CPURISCVState *env, int csrno, target_ulong *val)
         return RISCV_EXCP_ILLEGAL_INST;
     }
 
+    riscv_pmu_sync_tb_events(env);
     return riscv_pmu_read_ctr(env, val, false, ctr_index);
 }
 
@@ -861,6 +876,7 @@ static int read_hpmcounterh(CPURISCVState *env, int csrno, target_ulong *val)
         return RISCV_EXCP_ILLEGAL_INST;
     }
 
+    riscv_pmu_sync_tb_events(env);
     return riscv_pmu_read_ctr(env, val, true, ctr_index);
 }
 
@@ -872,6 +888,7 @@ static int read_scountovf(CPURISCVState *env, int csrno, target_ulong *val)
     target_ulong *mhpm_evt_val;
     uint64_t of_bit_mask;
 
+    riscv_pmu_sync_tb_events(env);
     if (riscv_cpu_mxl(env) == MXL_RV32) {
         mhpm_evt_val = env->mhpmeventh_val;
         of_bit_mask = MHPMEVENTH_BIT_OF;
@@ -1775,6 +1792,7 @@ static RISCVException write_mcountinhibit(CPURISCVState *env, int csrno,
     int cidx;
     PMUCTRState *counter;
 
+    riscv_pmu_sync_tb_events(env);
     env->mcountinhibit = val;
 
     /* Check if any other counter is also monitoring cycles/instructions */
@@ -1784,6 +1802,7 @@ static RISCVException write_mcountinhibit(CPURISCVState *env, int csrno,
             counter->started = true;
         }
     }
+    riscv_pmu_update_tb_events(env);
 
     return RISCV_EXCP_NONE;
 }
@@ -2659,14 +2678,26 @@ static RISCVException write_satp(CPURISCVState *env, int csrno,
         if (env->priv == PRV_S && get_field(env->mstatus, MSTATUS_TVM)) {
             return RISCV_EXCP_ILLEGAL_INST;
         } else {
+            uint64_t tag = riscv_cpu_tlb_tag(env);
+
             /*
              * The ISA defines SATP.MODE=Bare as "no translation", but we still
              * pass these through QEMU's TLB emulation as it improves
-             * performance.  Flushing the TLB on SATP writes with paging
-             * enabled avoids leaking those invalid cached mappings.
+             * performance.  A new ASID selects a different TLB bank, whose
+             * mappings are ones the guest still owns.  Otherwise flush the
+             * live bank on SATP writes with paging enabled, to avoid leaking
+             * those invalid cached mappings.
              */
-            tlb_flush(env_cpu(env));
             env->satp = val;
+            if (riscv_cpu_tlb_tag(env) != tag) {
+                riscv_cpu_update_tlb_tag(env);
+            } else {
+                tlb_flush_tags(env_cpu(env), tag, -1);
+            }
+            /* With V=1 this is vsatp, which HLV/HSV also walk. */
+            if (riscv_cpu_virt_enabled(env)) {
+                riscv_cpu_flush_guest_tlb(env);
+            }
         }
     }
     return RISCV_EXCP_NONE;
@@ -3027,6 +3058,9 @@ static RISCVException read_hgatp(CPURISCVState *env, int csrno,
 static RISCVException write_hgatp(CPURISCVState *env, int csrno,
                                   target_ulong val)
 {
+    if (env->hgatp != val) {
+        riscv_cpu_flush_guest_tlb(env);
+    }
     env->hgatp = val;
     return RISCV_EXCP_NONE;
 }
@@ -3297,6 +3331,9 @@ static RISCVException read_vsatp(CPURISCVState *env, int csrno,
 static RISCVException write_vsatp(CPURISCVState *env, int csrno,
                                   target_ulong val)
 {
+    if (env->vsatp != val) {
+        riscv_cpu_flush_guest_tlb(env);
+    }
     env->vsatp = val;
     return RISCV_EXCP_NONE;
 }
@@ -128,14 +128,29 @@ static uint64_t do_fmadd_h(CPURISCVState *env, uint64_t rs1, uint64_t rs2,
                                         &env->fp_status));
 }
 
+/*
+ * Single and double precision arithmetic uses the batched softfloat
+ * operations, which can use the host FPU even when inexact is clear.
+ */
 static uint64_t do_fmadd_s(CPURISCVState *env, uint64_t rs1, uint64_t rs2,
                            uint64_t rs3, int flags)
 {
     float32 frs1 = check_nanbox_s(env, rs1);
     float32 frs2 = check_nanbox_s(env, rs2);
     float32 frs3 = check_nanbox_s(env, rs3);
-    return nanbox_s(env, float32_muladd(frs1, frs2, frs3, flags,
-                                        &env->fp_status));
+    float32 ret;
+
+    float32_muladd_n(&ret, &frs1, &frs2, &frs3, 1, flags, &env->fp_status);
+    return nanbox_s(env, ret);
+}
+
+static uint64_t do_fmadd_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2,
+                           uint64_t frs3, int flags)
+{
+    float64 ret;
+
+    float64_muladd_n(&ret, &frs1, &frs2, &frs3, 1, flags, &env->fp_status);
+    return ret;
 }
 
 uint64_t helper_fmadd_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2,
@@ -147,7 +162,7 @@ uint64_t helper_fmadd_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2,
 uint64_t helper_fmadd_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2,
                         uint64_t frs3)
 {
-    return float64_muladd(frs1, frs2, frs3, 0, &env->fp_status);
+    return do_fmadd_d(env, frs1, frs2, frs3, 0);
 }
 
 uint64_t helper_fmadd_h(CPURISCVState *env, uint64_t frs1, uint64_t frs2,
@@ -165,8 +180,7 @@ uint64_t helper_fmsub_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2,
 uint64_t helper_fmsub_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2,
                         uint64_t frs3)
 {
-    return float64_muladd(frs1, frs2, frs3, float_muladd_negate_c,
-                          &env->fp_status);
+    return do_fmadd_d(env, frs1, frs2, frs3, float_muladd_negate_c);
 }
 
 uint64_t helper_fmsub_h(CPURISCVState *env, uint64_t frs1, uint64_t frs2,
@@ -184,8 +198,7 @@ uint64_t helper_fnmsub_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2,
 uint64_t helper_fnmsub_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2,
                          uint64_t frs3)
 {
-    return float64_muladd(frs1, frs2, frs3, float_muladd_negate_product,
-                          &env->fp_status);
+    return do_fmadd_d(env, frs1, frs2, frs3, float_muladd_negate_product);
 }
 
 uint64_t helper_fnmsub_h(CPURISCVState *env, uint64_t frs1, uint64_t frs2,
@@ -204,8 +217,8 @@ uint64_t helper_fnmadd_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2,
 uint64_t helper_fnmadd_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2,
                          uint64_t frs3)
 {
-    return float64_muladd(frs1, frs2, frs3, float_muladd_negate_c |
-                          float_muladd_negate_product, &env->fp_status);
+    return do_fmadd_d(env, frs1, frs2, frs3,
+                      float_muladd_negate_c | float_muladd_negate_product);
 }
 
 uint64_t helper_fnmadd_h(CPURISCVState *env, uint64_t frs1, uint64_t frs2,
@@ -219,28 +232,40 @@ uint64_t helper_fadd_s(CPURISCVState *env, uint64_t rs1, uint64_t rs2)
 {
     float32 frs1 = check_nanbox_s(env, rs1);
     float32 frs2 = check_nanbox_s(env, rs2);
-    return nanbox_s(env, float32_add(frs1, frs2, &env->fp_status));
+    float32 ret;
+
+    float32_add_n(&ret, &frs1, &frs2, 1, &env->fp_status);
+    return nanbox_s(env, ret);
 }
 
 uint64_t helper_fsub_s(CPURISCVState *env, uint64_t rs1, uint64_t rs2)
 {
     float32 frs1 = check_nanbox_s(env, rs1);
     float32 frs2 = check_nanbox_s(env, rs2);
-    return nanbox_s(env, float32_sub(frs1, frs2, &env->fp_status));
+    float32 ret;
+
+    float32_sub_n(&ret, &frs1, &frs2, 1, &env->fp_status);
+    return nanbox_s(env, ret);
 }
 
 uint64_t helper_fmul_s(CPURISCVState *env, uint64_t rs1, uint64_t rs2)
 {
     float32 frs1 = check_nanbox_s(env, rs1);
     float32 frs2 = check_nanbox_s(env, rs2);
-    return nanbox_s(env, float32_mul(frs1, frs2, &env->fp_status));
+    float32 ret;
+
+    float32_mul_n(&ret, &frs1, &frs2, 1, &env->fp_status);
+    return nanbox_s(env, ret);
 }
 
 uint64_t helper_fdiv_s(CPURISCVState *env, uint64_t rs1, uint64_t rs2)
 {
     float32 frs1 = check_nanbox_s(env, rs1);
     float32 frs2 = check_nanbox_s(env, rs2);
-    return nanbox_s(env, float32_div(frs1, frs2, &env->fp_status));
+    float32 ret;
+
+    float32_div_n(&ret, &frs1, &frs2, 1, &env->fp_status);
+    return nanbox_s(env, ret);
 }
 
 uint64_t helper_fmin_s(CPURISCVState *env, uint64_t rs1, uint64_t rs2)
@@ -264,7 +289,10 @@ uint64_t helper_fmax_s(CPURISCVState *env, uint64_t rs1, uint64_t rs2)
 uint64_t helper_fsqrt_s(CPURISCVState *env, uint64_t rs1)
 {
     float32 frs1 = check_nanbox_s(env, rs1);
-    return nanbox_s(env, float32_sqrt(frs1, &env->fp_status));
+    float32 ret;
+
+    float32_sqrt_n(&ret, &frs1, 1, &env->fp_status);
+    return nanbox_s(env, ret);
 }
 
 target_ulong helper_fle_s(CPURISCVState *env, uint64_t rs1, uint64_t rs2)
@@ -340,22 +368,34 @@ target_ulong helper_fclass_s(CPURISCVState *env, uint64_t rs1)
 
 uint64_t helper_fadd_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2)
 {
-    return float64_add(frs1, frs2, &env->fp_status);
+    float64 ret;
+
+    float64_add_n(&ret, &frs1, &frs2, 1, &env->fp_status);
+    return ret;
 }
 
 uint64_t helper_fsub_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2)
 {
-    return float64_sub(frs1, frs2, &env->fp_status);
+    float64 ret;
+
+    float64_sub_n(&ret, &frs1, &frs2, 1, &env->fp_status);
+    return ret;
 }
 
 uint64_t helper_fmul_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2)
 {
-    return float64_mul(frs1, frs2, &env->fp_status);
+    float64 ret;
+
+    float64_mul_n(&ret, &frs1, &frs2, 1, &env->fp_status);
+    return ret;
 }
 
 uint64_t helper_fdiv_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2)
 {
-    return float64_div(frs1, frs2, &env->fp_status);
+    float64 ret;
+
+    float64_div_n(&ret, &frs1, &frs2, 1, &env->fp_status);
+    return ret;
 }
 
 uint64_t helper_fmin_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2)
@@ -385,7 +425,10 @@ uint64_t helper_fcvt_d_s(CPURISCVState *env, uint64_t rs1)
 
 uint64_t helper_fsqrt_d(CPURISCVState *env, uint64_t frs1)
 {
-    return float64_sqrt(frs1, &env->fp_status);
+    float64 ret;
+
+    float64_sqrt_n(&ret, &frs1, 1, &env->fp_status);
+    return ret;
 }
 
 target_ulong helper_fle_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2)
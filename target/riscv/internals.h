@@ -35,6 +35,20 @@ target_ulong fclass_h(uint64_t frs1);
 target_ulong fclass_s(uint64_t frs1);
 target_ulong fclass_d(uint64_t frs1);
 
+void riscv_cpu_init_vidx(CPURISCVState *env);
+
+/*
+ * The translate_key of RISC-V: the CPU state that translation depends
+ * on besides the TB flags and the CPU configuration.
+ */
+FIELD(TR_KEY, MISA_EXT, 0, 32)
+FIELD(TR_KEY, PRIV_VER, 32, 8)
+FIELD(TR_KEY, MXL_MAX, 40, 8)
+FIELD(TR_KEY, VSTART_NZ, 48, 1)
+FIELD(TR_KEY, VIRT, 49, 1)
+
+uint64_t riscv_cpu_translate_key(CPUState *cs);
+
 #ifndef CONFIG_USER_ONLY
 extern const VMStateDescription vmstate_riscv_cpu;
 #endif
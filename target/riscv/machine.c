@@ -23,6 +23,7 @@
 #include "migration/cpu.h"
 #include "sysemu/cpu-timers.h"
 #include "debug.h"
+#include "pmu.h"
 
 static bool pmp_needed(void *opaque)
 {
@@ -258,13 +259,36 @@ static const VMStateDescription vmstate_debug = {
     }
 };
 
+static int riscv_cpu_pre_save(void *opaque)
+{
+    RISCVCPU *cpu = opaque;
+
+    /* Add the events counted by translated code to the migrated counters */
+    riscv_pmu_sync_tb_events(&cpu->env);
+    return 0;
+}
+
 static int riscv_cpu_post_load(void *opaque, int version_id)
 {
     RISCVCPU *cpu = opaque;
     CPURISCVState *env = &cpu->env;
+    uint64_t mhpmevt_val;
+    int i;
 
     env->xl = cpu_recompute_xl(env);
     riscv_cpu_update_mask(env);
+    riscv_cpu_pwc_flush(env);
+    riscv_cpu_update_tlb_tag(env);
+
+    /* Rebuild the PMU state derived from the event selectors */
+    for (i = 3; i < RV_MAX_MHPMEVENTS; i++) {
+        mhpmevt_val = env->mhpmevent_val[i];
+        if (riscv_cpu_mxl(env) == MXL_RV32) {
+            mhpmevt_val |= (uint64_t)env->mhpmeventh_val[i] << 32;
+        }
+        riscv_pmu_update_event_map(env, mhpmevt_val, i);
+    }
+    riscv_pmu_update_tb_events(env);
     return 0;
 }
 
@@ -335,6 +359,7 @@ const VMStateDescription vmstate_riscv_cpu = {
     .name = "cpu",
     .version_id = 6,
     .minimum_version_id = 6,
+    .pre_save = riscv_cpu_pre_save,
     .post_load = riscv_cpu_post_load,
     .fields = (VMStateField[]) {
         VMSTATE_UINTTL_ARRAY(env.gpr, RISCVCPU, 32),
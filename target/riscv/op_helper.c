@@ -243,24 +243,90 @@ void helper_wfi(CPURISCVState *env)
     }
 }
 
-void helper_tlb_flush(CPURISCVState *env)
+static void check_sfence_vma(CPURISCVState *env, uintptr_t ra)
 {
-    CPUState *cs = env_cpu(env);
     if (!(env->priv >= PRV_S) ||
         (env->priv == PRV_S &&
          get_field(env->mstatus, MSTATUS_TVM))) {
-        riscv_raise_exception(env, RISCV_EXCP_ILLEGAL_INST, GETPC());
+        riscv_raise_exception(env, RISCV_EXCP_ILLEGAL_INST, ra);
     } else if (riscv_has_ext(env, RVH) && riscv_cpu_virt_enabled(env) &&
                get_field(env->hstatus, HSTATUS_VTVM)) {
-        riscv_raise_exception(env, RISCV_EXCP_VIRT_INSTRUCTION_FAULT, GETPC());
-    } else {
-        tlb_flush(cs);
+        riscv_raise_exception(env, RISCV_EXCP_VIRT_INSTRUCTION_FAULT, ra);
+    }
+}
+
+/*
+ * SFENCE.VMA only orders the translations of the current virtualization
+ * mode and, with V=1, of the current VMID.  Those are the TLB banks
+ * whose tag matches the current one outside of the ASID field.
+ */
+void helper_tlb_flush(CPURISCVState *env)
+{
+    check_sfence_vma(env, GETPC());
+    riscv_cpu_pwc_flush(env);
+    tlb_flush_tags(env_cpu(env), riscv_cpu_tlb_tag(env),
+                   RISCV_TLB_TAG_V | RISCV_TLB_TAG_VMID);
+    if (riscv_cpu_virt_enabled(env)) {
+        riscv_cpu_flush_guest_tlb(env);
+    }
+}
+
+void helper_tlb_flush_asid(CPURISCVState *env, target_ulong asid)
+{
+    uint64_t tag;
+
+    check_sfence_vma(env, GETPC());
+    riscv_cpu_pwc_flush(env);
+    tag = (riscv_cpu_tlb_tag(env) & ~RISCV_TLB_TAG_ASID) |
+          (asid & RISCV_TLB_TAG_ASID);
+    tlb_flush_tags(env_cpu(env), tag, -1);
+    if (riscv_cpu_virt_enabled(env)) {
+        riscv_cpu_flush_guest_tlb(env);
+    }
+}
+
+/* A negative @asid stands for rs2 = x0, i.e. every ASID. */
+void helper_tlb_flush_page(CPURISCVState *env, target_ulong addr,
+                           target_ulong asid)
+{
+    uint64_t tag, mask = RISCV_TLB_TAG_V | RISCV_TLB_TAG_VMID;
+
+    check_sfence_vma(env, GETPC());
+    riscv_cpu_pwc_flush(env);
+    tag = riscv_cpu_tlb_tag(env);
+    if ((target_long)asid >= 0) {
+        tag = (tag & ~RISCV_TLB_TAG_ASID) | (asid & RISCV_TLB_TAG_ASID);
+        mask = -1;
+    }
+    tlb_flush_page_tags(env_cpu(env), addr, tag, mask);
+    if (riscv_cpu_virt_enabled(env)) {
+        riscv_cpu_flush_guest_tlb_page(env, addr);
     }
 }
 
+static void do_pwc_flush_work(CPUState *cs, run_on_cpu_data data)
+{
+    riscv_cpu_pwc_flush(&RISCV_CPU(cs)->env);
+}
+
+/*
+ * th.sfence.vmas of XTheadSync, the only broadcast TLB invalidation on
+ * RISC-V, and so the only user of the queued remote flushes.  Standard
+ * remote fences are IPIs to the SBI firmware, which runs SFENCE.VMA or
+ * HFENCE on each target hart: those only ever flush the local TLB.
+ */
 void helper_tlb_flush_all(CPURISCVState *env)
 {
     CPUState *cs = env_cpu(env);
+    CPUState *other;
+
+    CPU_FOREACH(other) {
+        if (other == cs) {
+            riscv_cpu_pwc_flush(env);
+        } else {
+            async_run_on_cpu(other, do_pwc_flush_work, RUN_ON_CPU_NULL);
+        }
+    }
     tlb_flush_all_cpus_synced(cs);
 }
 
@@ -274,6 +340,7 @@ void helper_hyp_tlb_flush(CPURISCVState *env)
 
     if (env->priv == PRV_M ||
         (env->priv == PRV_S && !riscv_cpu_virt_enabled(env))) {
+        riscv_cpu_pwc_flush(env);
         tlb_flush(cs);
         return;
     }
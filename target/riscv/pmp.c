@@ -189,6 +189,7 @@ void pmp_update_rule_addr(CPURISCVState *env, uint32_t pmp_index)
 
     env->pmp_state.addr[pmp_index].sa = sa;
     env->pmp_state.addr[pmp_index].ea = ea;
+    env->pmp_state.epoch++;
 }
 
 void pmp_update_rule_nums(CPURISCVState *env)
@@ -230,6 +231,102 @@ static int pmp_is_in_range(CPURISCVState *env, int pmp_index, target_ulong addr)
     return result;
 }
 
+/*
+ * Return the highest priority active rule matching addr, or MAX_RISCV_PMPS.
+ */
+static int pmp_first_match(CPURISCVState *env, target_ulong addr)
+{
+    int i;
+
+    for (i = 0; i < MAX_RISCV_PMPS; i++) {
+        if (pmp_get_a_field(env->pmp_state.pmp[i].cfg_reg) != PMP_AMATCH_OFF &&
+            pmp_is_in_range(env, i, addr)) {
+            return i;
+        }
+    }
+
+    return MAX_RISCV_PMPS;
+}
+
+/*
+ * Split the address space at every boundary of an active rule, so that
+ * the matching rule is constant within each segment, and merge adjacent
+ * segments that resolve to the same rule.
+ */
+static void pmp_update_segs(CPURISCVState *env)
+{
+    pmp_table_t *t = &env->pmp_state;
+    target_ulong bound[2 * MAX_RISCV_PMPS + 1];
+    int nb = 0;
+    int i, j;
+
+    bound[nb++] = 0;
+    for (i = 0; i < MAX_RISCV_PMPS; i++) {
+        if (pmp_get_a_field(t->pmp[i].cfg_reg) == PMP_AMATCH_OFF) {
+            continue;
+        }
+        bound[nb++] = t->addr[i].sa;
+        if (t->addr[i].ea != (target_ulong)-1) {
+            bound[nb++] = t->addr[i].ea + 1;
+        }
+    }
+
+    /* At most 2 * MAX_RISCV_PMPS + 1 entries: insertion sort is plenty. */
+    for (i = 1; i < nb; i++) {
+        target_ulong b = bound[i];
+
+        for (j = i; j > 0 && bound[j - 1] > b; j--) {
+            bound[j] = bound[j - 1];
+        }
+        bound[j] = b;
+    }
+
+    t->num_segs = 0;
+    for (i = 0; i < nb; i++) {
+        int rule;
+
+        if (i > 0 && bound[i] == bound[i - 1]) {
+            continue;
+        }
+        rule = pmp_first_match(env, bound[i]);
+        if (t->num_segs && t->seg[t->num_segs - 1].rule == rule) {
+            continue;
+        }
+        t->seg[t->num_segs].sa = bound[i];
+        t->seg[t->num_segs].rule = rule;
+        t->num_segs++;
+    }
+    t->seg_epoch = t->epoch;
+}
+
+/*
+ * Return the index of the segment containing addr.
+ */
+static int pmp_find_seg(CPURISCVState *env, target_ulong addr)
+{
+    pmp_table_t *t = &env->pmp_state;
+    int lo, hi;
+
+    if (t->num_segs == 0 || t->seg_epoch != t->epoch) {
+        pmp_update_segs(env);
+    }
+
+    /* seg[0].sa is always 0, so some segment always matches. */
+    lo = 0;
+    hi = t->num_segs - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+
+        if (t->seg[mid].sa <= addr) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    return lo;
+}
+
 /*
  * Check if the address has required RWX privs when no PMP entry is matched.
  */
@@ -285,6 +382,132 @@ static bool pmp_hart_has_privs_default(CPURISCVState *env, target_ulong addr,
     return ret;
 }
 
+/*
+ * Return the privileges granted to mode by a matching active rule.
+ */
+static pmp_priv_t pmp_rule_privs(CPURISCVState *env, int pmp_index,
+                                 target_ulong mode)
+{
+    uint8_t cfg = env->pmp_state.pmp[pmp_index].cfg_reg;
+    pmp_priv_t allowed_privs;
+
+    /*
+     * Convert the PMP permissions to match the truth table in the
+     * ePMP spec.
+     */
+    const uint8_t epmp_operation =
+        ((cfg & PMP_LOCK) >> 4) |
+        ((cfg & PMP_READ) << 2) |
+        (cfg & PMP_WRITE) |
+        ((cfg & PMP_EXEC) >> 2);
+
+    if (!MSECCFG_MML_ISSET(env)) {
+        /*
+         * If mseccfg.MML Bit is not set, do pmp priv check
+         * This will always apply to regular PMP.
+         */
+        allowed_privs = PMP_READ | PMP_WRITE | PMP_EXEC;
+        if ((mode != PRV_M) || pmp_is_locked(env, pmp_index)) {
+            allowed_privs &= cfg;
+        }
+    } else {
+        /*
+         * If mseccfg.MML Bit set, do the enhanced pmp priv check
+         */
+        if (mode == PRV_M) {
+            switch (epmp_operation) {
+            case 0:
+            case 1:
+            case 4:
+            case 5:
+            case 6:
+            case 7:
+            case 8:
+                allowed_privs = 0;
+                break;
+            case 2:
+            case 3:
+            case 14:
+                allowed_privs = PMP_READ | PMP_WRITE;
+                break;
+            case 9:
+            case 10:
+                allowed_privs = PMP_EXEC;
+                break;
+            case 11:
+            case 13:
+                allowed_privs = PMP_READ | PMP_EXEC;
+                break;
+            case 12:
+            case 15:
+                allowed_privs = PMP_READ;
+                break;
+            default:
+                g_assert_not_reached();
+            }
+        } else {
+            switch (epmp_operation) {
+            case 0:
+            case 8:
+            case 9:
+            case 12:
+            case 13:
+            case 14:
+                allowed_privs = 0;
+                break;
+            case 1:
+            case 10:
+            case 11:
+                allowed_privs = PMP_EXEC;
+                break;
+            case 2:
+            case 4:
+            case 15:
+                allowed_privs = PMP_READ;
+                break;
+            case 3:
+            case 6:
+                allowed_privs = PMP_READ | PMP_WRITE;
+                break;
+            case 5:
+                allowed_privs = PMP_READ | PMP_EXEC;
+                break;
+            case 7:
+                allowed_privs = PMP_READ | PMP_WRITE | PMP_EXEC;
+                break;
+            default:
+                g_assert_not_reached();
+            }
+        }
+    }
+
+    return allowed_privs;
+}
+
+/*
+ * Check the privileges of an access that starts and ends within segments
+ * resolving to the given rule, or MAX_RISCV_PMPS for none.  Falls back to
+ * the default policy when the rule does not grant privs.
+ */
+static int pmp_check_rule(CPURISCVState *env, int rule, target_ulong addr,
+    target_ulong size, pmp_priv_t privs, pmp_priv_t *allowed_privs,
+    target_ulong mode)
+{
+    if (rule < MAX_RISCV_PMPS) {
+        *allowed_privs = pmp_rule_privs(env, rule, mode);
+        if ((privs & *allowed_privs) == privs) {
+            return rule;
+        }
+    }
+
+    if (pmp_hart_has_privs_default(env, addr, size, privs,
+                                   allowed_privs, mode)) {
+        return MAX_RISCV_PMPS;
+    }
+
+    return -1;
+}
+
 
 /*
  * Public Interface
@@ -300,18 +523,13 @@ int pmp_hart_has_privs(CPURISCVState *env, target_ulong addr,
     target_ulong size, pmp_priv_t privs, pmp_priv_t *allowed_privs,
     target_ulong mode)
 {
-    int i = 0;
-    int ret = -1;
     int pmp_size = 0;
-    target_ulong s = 0;
-    target_ulong e = 0;
+    int s, e;
 
     /* Short cut if no rules */
     if (0 == pmp_get_num_rules(env)) {
-        if (pmp_hart_has_privs_default(env, addr, size, privs,
-                                       allowed_privs, mode)) {
-            ret = MAX_RISCV_PMPS;
-        }
+        return pmp_check_rule(env, MAX_RISCV_PMPS, addr, size, privs,
+                              allowed_privs, mode);
     }
 
     if (size == 0) {
@@ -328,135 +546,21 @@ int pmp_hart_has_privs(CPURISCVState *env, target_ulong addr,
         pmp_size = size;
     }
 
-    /* 1.10 draft priv spec states there is an implicit order
-         from low to high */
-    for (i = 0; i < MAX_RISCV_PMPS; i++) {
-        s = pmp_is_in_range(env, i, addr);
-        e = pmp_is_in_range(env, i, addr + pmp_size - 1);
-
-        /* partially inside */
-        if ((s + e) == 1) {
-            qemu_log_mask(LOG_GUEST_ERROR,
-                          "pmp violation - access is partially inside\n");
-            ret = -1;
-            break;
-        }
-
-        /* fully inside */
-        const uint8_t a_field =
-            pmp_get_a_field(env->pmp_state.pmp[i].cfg_reg);
-
-        /*
-         * Convert the PMP permissions to match the truth table in the
-         * ePMP spec.
-         */
-        const uint8_t epmp_operation =
-            ((env->pmp_state.pmp[i].cfg_reg & PMP_LOCK) >> 4) |
-            ((env->pmp_state.pmp[i].cfg_reg & PMP_READ) << 2) |
-            (env->pmp_state.pmp[i].cfg_reg & PMP_WRITE) |
-            ((env->pmp_state.pmp[i].cfg_reg & PMP_EXEC) >> 2);
-
-        if (((s + e) == 2) && (PMP_AMATCH_OFF != a_field)) {
-            /*
-             * If the PMP entry is not off and the address is in range,
-             * do the priv check
-             */
-            if (!MSECCFG_MML_ISSET(env)) {
-                /*
-                 * If mseccfg.MML Bit is not set, do pmp priv check
-                 * This will always apply to regular PMP.
-                 */
-                *allowed_privs = PMP_READ | PMP_WRITE | PMP_EXEC;
-                if ((mode != PRV_M) || pmp_is_locked(env, i)) {
-                    *allowed_privs &= env->pmp_state.pmp[i].cfg_reg;
-                }
-            } else {
-                /*
-                 * If mseccfg.MML Bit set, do the enhanced pmp priv check
-                 */
-                if (mode == PRV_M) {
-                    switch (epmp_operation) {
-                    case 0:
-                    case 1:
-                    case 4:
-                    case 5:
-                    case 6:
-                    case 7:
-                    case 8:
-                        *allowed_privs = 0;
-                        break;
-                    case 2:
-                    case 3:
-                    case 14:
-                        *allowed_privs = PMP_READ | PMP_WRITE;
-                        break;
-                    case 9:
-                    case 10:
-                        *allowed_privs = PMP_EXEC;
-                        break;
-                    case 11:
-                    case 13:
-                        *allowed_privs = PMP_READ | PMP_EXEC;
-                        break;
-                    case 12:
-                    case 15:
-                        *allowed_privs = PMP_READ;
-                        break;
-                    default:
-                        g_assert_not_reached();
-                    }
-                } else {
-                    switch (epmp_operation) {
-                    case 0:
-                    case 8:
-                    case 9:
-                    case 12:
-                    case 13:
-                    case 14:
-                        *allowed_privs = 0;
-                        break;
-                    case 1:
-                    case 10:
-                    case 11:
-                        *allowed_privs = PMP_EXEC;
-                        break;
-                    case 2:
-                    case 4:
-                    case 15:
-                        *allowed_privs = PMP_READ;
-                        break;
-                    case 3:
-                    case 6:
-                        *allowed_privs = PMP_READ | PMP_WRITE;
-                        break;
-                    case 5:
-                        *allowed_privs = PMP_READ | PMP_EXEC;
-                        break;
-                    case 7:
-                        *allowed_privs = PMP_READ | PMP_WRITE | PMP_EXEC;
-                        break;
-                    default:
-                        g_assert_not_reached();
-                    }
-                }
-            }
-
-            if ((privs & *allowed_privs) == privs) {
-                ret = i;
-            }
-            break;
-        }
-    }
-
-    /* No rule matched */
-    if (ret == -1) {
-        if (pmp_hart_has_privs_default(env, addr, size, privs,
-                                       allowed_privs, mode)) {
-            ret = MAX_RISCV_PMPS;
-        }
+    /*
+     * 1.10 draft priv spec states there is an implicit order from low
+     * to high, which the segment table has already resolved.
+     */
+    s = env->pmp_state.seg[pmp_find_seg(env, addr)].rule;
+    e = env->pmp_state.seg[pmp_find_seg(env, addr + pmp_size - 1)].rule;
+
+    /* partially inside */
+    if (s != e) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "pmp violation - access is partially inside\n");
+        s = MAX_RISCV_PMPS;
     }
 
-    return ret;
+    return pmp_check_rule(env, s, addr, size, privs, allowed_privs, mode);
 }
 
 /*
@@ -476,7 +580,11 @@ void pmpcfg_csr_write(CPURISCVState *env, uint32_t reg_index,
         pmp_write_cfg(env, (reg_index * 4) + i, cfg_val);
     }
 
-    /* If PMP permission of any addr has been changed, flush TLB pages. */
+    /*
+     * If PMP permission of any addr has been changed, flush TLB pages
+     * and the page-walk cache, which skips the checks on cached PTEs.
+     */
+    riscv_cpu_pwc_flush(env);
     tlb_flush(env_cpu(env));
 }
 
@@ -528,6 +636,9 @@ void pmpaddr_csr_write(CPURISCVState *env, uint32_t addr_index,
         if (!pmp_is_locked(env, addr_index)) {
             env->pmp_state.pmp[addr_index].addr_reg = val;
             pmp_update_rule(env, addr_index);
+            /* TLB entries may now span a page the rule no longer covers. */
+            riscv_cpu_pwc_flush(env);
+            tlb_flush(env_cpu(env));
         } else {
             qemu_log_mask(LOG_GUEST_ERROR,
                           "ignoring pmpaddr write - locked\n");
@@ -579,6 +690,9 @@ void mseccfg_csr_write(CPURISCVState *env, target_ulong val)
     /* Sticky bits */
     val |= (env->mseccfg & (MSECCFG_MMWP | MSECCFG_MML));
 
+    if (val != env->mseccfg) {
+        riscv_cpu_pwc_flush(env);
+    }
     env->mseccfg = val;
 }
 
@@ -592,28 +706,38 @@ target_ulong mseccfg_csr_read(CPURISCVState *env)
 }
 
 /*
- * Calculate the TLB size if the start address or the end address of
- * PMP entry is presented in the TLB page.
+ * Calculate the TLB size for the page containing addr.  A whole page can
+ * be mapped if every segment overlapping it yields the same privileges
+ * for this access; otherwise drop the size to 1 so that the result isn't
+ * cached in the TLB and is only used for a single translation.
+ *
+ * Segments with equal privileges are not required to share a rule: a
+ * misaligned access straddling two of them is then permitted as if it
+ * had been decomposed into its component accesses.
  */
-target_ulong pmp_get_tlb_size(CPURISCVState *env, int pmp_index,
-                              target_ulong tlb_sa, target_ulong tlb_ea)
+target_ulong pmp_get_tlb_size(CPURISCVState *env, target_ulong addr,
+                              pmp_priv_t privs, target_ulong mode)
 {
-    target_ulong pmp_sa = env->pmp_state.addr[pmp_index].sa;
-    target_ulong pmp_ea = env->pmp_state.addr[pmp_index].ea;
-
-    if (pmp_sa <= tlb_sa && pmp_ea >= tlb_ea) {
-        return TARGET_PAGE_SIZE;
-    } else {
-        /*
-        * At this point we have a tlb_size that is the smallest possible size
-        * That fits within a TARGET_PAGE_SIZE and the PMP region.
-        *
-        * If the size is less then TARGET_PAGE_SIZE we drop the size to 1.
-        * This means the result isn't cached in the TLB and is only used for
-        * a single translation.
-        */
+    pmp_table_t *t = &env->pmp_state;
+    target_ulong tlb_sa = addr & ~(TARGET_PAGE_SIZE - 1);
+    target_ulong tlb_ea = tlb_sa + TARGET_PAGE_SIZE - 1;
+    pmp_priv_t page_privs, seg_privs;
+    int i = pmp_find_seg(env, tlb_sa);
+
+    if (pmp_check_rule(env, t->seg[i].rule, tlb_sa, 0, privs,
+                       &page_privs, mode) < 0) {
         return 1;
     }
+
+    for (i++; i < t->num_segs && t->seg[i].sa <= tlb_ea; i++) {
+        if (pmp_check_rule(env, t->seg[i].rule, t->seg[i].sa, 0, privs,
+                           &seg_privs, mode) < 0 ||
+            seg_privs != page_privs) {
+            return 1;
+        }
+    }
+
+    return TARGET_PAGE_SIZE;
 }
 
 /*
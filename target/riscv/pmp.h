@@ -56,10 +56,29 @@ typedef struct {
     target_ulong ea;
 } pmp_addr_t;
 
+/*
+ * One interval of the physical address space, running from sa up to the
+ * sa of the next segment, over which the highest priority active rule
+ * does not change.  rule is MAX_RISCV_PMPS if no active rule matches.
+ */
+typedef struct {
+    target_ulong sa;
+    uint8_t rule;
+} pmp_seg_t;
+
 typedef struct {
     pmp_entry_t pmp[MAX_RISCV_PMPS];
     pmp_addr_t  addr[MAX_RISCV_PMPS];
     uint32_t num_rules;
+    /*
+     * Sorted lookup table derived from addr[].  It is rebuilt lazily
+     * whenever seg_epoch lags behind epoch, which is bumped on every
+     * rule update.
+     */
+    uint32_t epoch;
+    uint32_t seg_epoch;
+    uint32_t num_segs;
+    pmp_seg_t seg[2 * MAX_RISCV_PMPS + 1];
 } pmp_table_t;
 
 void pmpcfg_csr_write(CPURISCVState *env, uint32_t reg_index,
@@ -75,8 +94,8 @@ target_ulong pmpaddr_csr_read(CPURISCVState *env, uint32_t addr_index);
 int pmp_hart_has_privs(CPURISCVState *env, target_ulong addr,
     target_ulong size, pmp_priv_t privs, pmp_priv_t *allowed_privs,
     target_ulong mode);
-target_ulong pmp_get_tlb_size(CPURISCVState *env, int pmp_index,
-                              target_ulong tlb_sa, target_ulong tlb_ea);
+target_ulong pmp_get_tlb_size(CPURISCVState *env, target_ulong addr,
+                              pmp_priv_t privs, target_ulong mode);
 void pmp_update_rule_addr(CPURISCVState *env, uint32_t pmp_index);
 void pmp_update_rule_nums(CPURISCVState *env);
 uint32_t pmp_get_num_rules(CPURISCVState *env);
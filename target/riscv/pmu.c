@@ -35,7 +35,8 @@
  */
 void riscv_pmu_generate_fdt_node(void *fdt, int num_ctrs, char *pmu_name)
 {
-    uint32_t fdt_event_ctr_map[20] = {};
+    uint32_t fdt_event_ctr_map[24] = {};
+    uint32_t fdt_raw_event_ctr_map[5] = {};
     uint32_t cmask;
 
     /* All the programmable counters can map to any event */
@@ -62,24 +63,51 @@ void riscv_pmu_generate_fdt_node(void *fdt, int num_ctrs, char *pmu_name)
    fdt_event_ctr_map[4] = cpu_to_be32(0x00000002);
    fdt_event_ctr_map[5] = cpu_to_be32(cmask | 1 << 2);
 
-   /* SBI_PMU_HW_CACHE_DTLB : 0x03 READ : 0x00 MISS : 0x00 type(0x01) */
-   fdt_event_ctr_map[6] = cpu_to_be32(0x00010019);
-   fdt_event_ctr_map[7] = cpu_to_be32(0x00010019);
+   /* SBI_PMU_HW_BRANCH_INSTRUCTIONS: 0x05 : type(0x00) */
+   fdt_event_ctr_map[6] = cpu_to_be32(0x00000005);
+   fdt_event_ctr_map[7] = cpu_to_be32(0x00000005);
    fdt_event_ctr_map[8] = cpu_to_be32(cmask);
 
-   /* SBI_PMU_HW_CACHE_DTLB : 0x03 WRITE : 0x01 MISS : 0x00 type(0x01) */
-   fdt_event_ctr_map[9] = cpu_to_be32(0x0001001B);
-   fdt_event_ctr_map[10] = cpu_to_be32(0x0001001B);
+   /* SBI_PMU_HW_CACHE_L1D : 0x00 READ : 0x00 ACCESS : 0x00 type(0x01) */
+   fdt_event_ctr_map[9] = cpu_to_be32(0x00010000);
+   fdt_event_ctr_map[10] = cpu_to_be32(0x00010000);
    fdt_event_ctr_map[11] = cpu_to_be32(cmask);
 
-   /* SBI_PMU_HW_CACHE_ITLB : 0x04 READ : 0x00 MISS : 0x00 type(0x01) */
-   fdt_event_ctr_map[12] = cpu_to_be32(0x00010021);
-   fdt_event_ctr_map[13] = cpu_to_be32(0x00010021);
+   /* SBI_PMU_HW_CACHE_L1D : 0x00 WRITE : 0x01 ACCESS : 0x00 type(0x01) */
+   fdt_event_ctr_map[12] = cpu_to_be32(0x00010002);
+   fdt_event_ctr_map[13] = cpu_to_be32(0x00010002);
    fdt_event_ctr_map[14] = cpu_to_be32(cmask);
 
+   /* SBI_PMU_HW_CACHE_DTLB : 0x03 READ : 0x00 MISS : 0x00 type(0x01) */
+   fdt_event_ctr_map[15] = cpu_to_be32(0x00010019);
+   fdt_event_ctr_map[16] = cpu_to_be32(0x00010019);
+   fdt_event_ctr_map[17] = cpu_to_be32(cmask);
+
+   /* SBI_PMU_HW_CACHE_DTLB : 0x03 WRITE : 0x01 MISS : 0x00 type(0x01) */
+   fdt_event_ctr_map[18] = cpu_to_be32(0x0001001B);
+   fdt_event_ctr_map[19] = cpu_to_be32(0x0001001B);
+   fdt_event_ctr_map[20] = cpu_to_be32(cmask);
+
+   /* SBI_PMU_HW_CACHE_ITLB : 0x04 READ : 0x00 MISS : 0x00 type(0x01) */
+   fdt_event_ctr_map[21] = cpu_to_be32(0x00010021);
+   fdt_event_ctr_map[22] = cpu_to_be32(0x00010021);
+   fdt_event_ctr_map[23] = cpu_to_be32(cmask);
+
    /* This a OpenSBI specific DT property documented in OpenSBI docs */
    qemu_fdt_setprop(fdt, pmu_name, "riscv,event-to-mhpmcounters",
                     fdt_event_ctr_map, sizeof(fdt_event_ctr_map));
+
+   /*
+    * Raw events are programmed as is into mhpmevent: select value (64 bit),
+    * select mask (64 bit) and counter mask.
+    */
+   fdt_raw_event_ctr_map[0] = cpu_to_be32(0);
+   fdt_raw_event_ctr_map[1] = cpu_to_be32(RISCV_PMU_EVENT_RAW_TAKEN_BRANCHES);
+   fdt_raw_event_ctr_map[2] = cpu_to_be32(0);
+   fdt_raw_event_ctr_map[3] = cpu_to_be32(MHPMEVENT_IDX_MASK);
+   fdt_raw_event_ctr_map[4] = cpu_to_be32(cmask);
+   qemu_fdt_setprop(fdt, pmu_name, "riscv,raw-event-to-mhpmcounters",
+                    fdt_raw_event_ctr_map, sizeof(fdt_raw_event_ctr_map));
 }
 
 static bool riscv_pmu_counter_valid(RISCVCPU *cpu, uint32_t ctr_idx)
@@ -104,6 +132,30 @@ static bool riscv_pmu_counter_enabled(RISCVCPU *cpu, uint32_t ctr_idx)
     }
 }
 
+static bool riscv_pmu_mode_inhibited(CPURISCVState *env, uint32_t ctr_idx,
+                                     target_ulong priv, bool virt)
+{
+    uint64_t mhpmevent_val = env->mhpmevent_val[ctr_idx];
+
+    if (riscv_cpu_mxl(env) == MXL_RV32) {
+        mhpmevent_val = (uint32_t)mhpmevent_val |
+                        ((uint64_t)env->mhpmeventh_val[ctr_idx] << 32);
+    }
+
+    switch (priv) {
+    case PRV_M:
+        return mhpmevent_val & MHPMEVENT_BIT_MINH;
+    case PRV_S:
+        return mhpmevent_val &
+               (virt ? MHPMEVENT_BIT_VSINH : MHPMEVENT_BIT_SINH);
+    case PRV_U:
+        return mhpmevent_val &
+               (virt ? MHPMEVENT_BIT_VUINH : MHPMEVENT_BIT_UINH);
+    default:
+        return false;
+    }
+}
+
 static int riscv_pmu_incr_ctr_rv32(RISCVCPU *cpu, uint32_t ctr_idx)
 {
     CPURISCVState *env = &cpu->env;
@@ -112,16 +164,7 @@ static int riscv_pmu_incr_ctr_rv32(RISCVCPU *cpu, uint32_t ctr_idx)
     bool virt_on = riscv_cpu_virt_enabled(env);
 
     /* Privilege mode filtering */
-    if ((env->priv == PRV_M &&
-        (env->mhpmeventh_val[ctr_idx] & MHPMEVENTH_BIT_MINH)) ||
-        (env->priv == PRV_S && virt_on &&
-        (env->mhpmeventh_val[ctr_idx] & MHPMEVENTH_BIT_VSINH)) ||
-        (env->priv == PRV_U && virt_on &&
-        (env->mhpmeventh_val[ctr_idx] & MHPMEVENTH_BIT_VUINH)) ||
-        (env->priv == PRV_S && !virt_on &&
-        (env->mhpmeventh_val[ctr_idx] & MHPMEVENTH_BIT_SINH)) ||
-        (env->priv == PRV_U && !virt_on &&
-        (env->mhpmeventh_val[ctr_idx] & MHPMEVENTH_BIT_UINH))) {
+    if (riscv_pmu_mode_inhibited(env, ctr_idx, env->priv, virt_on)) {
         return 0;
     }
 
@@ -153,16 +196,7 @@ static int riscv_pmu_incr_ctr_rv64(RISCVCPU *cpu, uint32_t ctr_idx)
     bool virt_on = riscv_cpu_virt_enabled(env);
 
     /* Privilege mode filtering */
-    if ((env->priv == PRV_M &&
-        (env->mhpmevent_val[ctr_idx] & MHPMEVENT_BIT_MINH)) ||
-        (env->priv == PRV_S && virt_on &&
-        (env->mhpmevent_val[ctr_idx] & MHPMEVENT_BIT_VSINH)) ||
-        (env->priv == PRV_U && virt_on &&
-        (env->mhpmevent_val[ctr_idx] & MHPMEVENT_BIT_VUINH)) ||
-        (env->priv == PRV_S && !virt_on &&
-        (env->mhpmevent_val[ctr_idx] & MHPMEVENT_BIT_SINH)) ||
-        (env->priv == PRV_U && !virt_on &&
-        (env->mhpmevent_val[ctr_idx] & MHPMEVENT_BIT_UINH))) {
+    if (riscv_pmu_mode_inhibited(env, ctr_idx, env->priv, virt_on)) {
         return 0;
     }
 
@@ -211,6 +245,97 @@ int riscv_pmu_incr_ctr(RISCVCPU *cpu, enum riscv_pmu_event_idx event_idx)
     return ret;
 }
 
+/*
+ * Events counted by translated code: each TB adds its static counts to
+ * env->pmu_tb_pending[] for the events that are enabled in the privilege
+ * mode it runs in, see TB_FLAGS.PMU_EVENTS.  The pending counts are added
+ * to the counters when the guest accesses the PMU CSRs, or when the TB
+ * timer estimates that a counter may have overflowed.
+ */
+static const enum riscv_pmu_event_idx pmu_tb_event_idx[RISCV_PMU_TB_EVENTS] = {
+    [RISCV_PMU_TB_INSNS] = RISCV_PMU_EVENT_HW_INSTRUCTIONS,
+    [RISCV_PMU_TB_BRANCHES] = RISCV_PMU_EVENT_HW_BRANCH_INSTRUCTIONS,
+    [RISCV_PMU_TB_TAKEN_BRANCHES] = RISCV_PMU_EVENT_RAW_TAKEN_BRANCHES,
+    [RISCV_PMU_TB_LOADS] = RISCV_PMU_EVENT_CACHE_L1D_READ_ACCESS,
+    [RISCV_PMU_TB_STORES] = RISCV_PMU_EVENT_CACHE_L1D_WRITE_ACCESS,
+};
+
+/* Return the RISCV_PMU_TB_* event that counts @event_idx, or -1. */
+static int riscv_pmu_tb_event(enum riscv_pmu_event_idx event_idx)
+{
+    int i;
+
+    /* With icount, retired instructions are derived from the budget. */
+    if (event_idx == RISCV_PMU_EVENT_HW_INSTRUCTIONS && icount_enabled()) {
+        return -1;
+    }
+
+    for (i = 0; i < RISCV_PMU_TB_EVENTS; i++) {
+        if (pmu_tb_event_idx[i] == event_idx) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Return the counter mapped to a RISCV_PMU_TB_* event, or 0. */
+static uint32_t riscv_pmu_tb_ctr(RISCVCPU *cpu, int tb_event)
+{
+    if (!cpu->pmu_event_ctr_map ||
+        riscv_pmu_tb_event(pmu_tb_event_idx[tb_event]) < 0) {
+        return 0;
+    }
+
+    return GPOINTER_TO_UINT(g_hash_table_lookup(cpu->pmu_event_ctr_map,
+                            GUINT_TO_POINTER(pmu_tb_event_idx[tb_event])));
+}
+
+/* Return the RISCV_PMU_TB_* event counted by @ctr_idx, or -1. */
+static int riscv_pmu_ctr_tb_event(RISCVCPU *cpu, uint32_t ctr_idx)
+{
+    int i;
+
+    if (!riscv_pmu_counter_valid(cpu, ctr_idx)) {
+        return -1;
+    }
+
+    for (i = 0; i < RISCV_PMU_TB_EVENTS; i++) {
+        if (riscv_pmu_tb_ctr(cpu, i) == ctr_idx) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static uint64_t riscv_pmu_ctr_get(CPURISCVState *env, uint32_t ctr_idx)
+{
+    PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
+
+    if (riscv_cpu_mxl(env) == MXL_RV32) {
+        return (uint32_t)counter->mhpmcounter_val |
+               ((uint64_t)counter->mhpmcounterh_val << 32);
+    }
+    return counter->mhpmcounter_val;
+}
+
+/* Add @n to the counter @ctr_idx, and return whether it wrapped around. */
+static bool riscv_pmu_ctr_add(CPURISCVState *env, uint32_t ctr_idx,
+                              uint64_t n)
+{
+    PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
+    uint64_t old = riscv_pmu_ctr_get(env, ctr_idx);
+    uint64_t val = old + n;
+
+    if (riscv_cpu_mxl(env) == MXL_RV32) {
+        counter->mhpmcounter_val = (uint32_t)val;
+        counter->mhpmcounterh_val = val >> 32;
+    } else {
+        counter->mhpmcounter_val = val;
+    }
+
+    return val < old;
+}
+
 bool riscv_pmu_ctr_monitor_instructions(CPURISCVState *env,
                                         uint32_t target_ctr)
 {
@@ -223,6 +348,11 @@ bool riscv_pmu_ctr_monitor_instructions(CPURISCVState *env,
         return true;
     }
 
+    /* Without icount, instructions are counted by translated code. */
+    if (!icount_enabled()) {
+        return false;
+    }
+
     cpu = RISCV_CPU(env_cpu(env));
     if (!cpu->pmu_event_ctr_map) {
         return false;
@@ -315,12 +445,15 @@ int riscv_pmu_update_event_map(CPURISCVState *env, uint64_t value,
     switch (event_idx) {
     case RISCV_PMU_EVENT_HW_CPU_CYCLES:
     case RISCV_PMU_EVENT_HW_INSTRUCTIONS:
+    case RISCV_PMU_EVENT_HW_BRANCH_INSTRUCTIONS:
+    case RISCV_PMU_EVENT_CACHE_L1D_READ_ACCESS:
+    case RISCV_PMU_EVENT_CACHE_L1D_WRITE_ACCESS:
     case RISCV_PMU_EVENT_CACHE_DTLB_READ_MISS:
     case RISCV_PMU_EVENT_CACHE_DTLB_WRITE_MISS:
     case RISCV_PMU_EVENT_CACHE_ITLB_PREFETCH_MISS:
+    case RISCV_PMU_EVENT_RAW_TAKEN_BRANCHES:
         break;
     default:
-        /* We don't support any raw events right now */
         return -1;
     }
     g_hash_table_insert(cpu->pmu_event_ctr_map, GUINT_TO_POINTER(event_idx),
@@ -340,7 +473,8 @@ static void pmu_timer_trigger_irq(RISCVCPU *cpu,
     int64_t irq_trigger_at;
 
     if (evt_idx != RISCV_PMU_EVENT_HW_CPU_CYCLES &&
-        evt_idx != RISCV_PMU_EVENT_HW_INSTRUCTIONS) {
+        evt_idx != RISCV_PMU_EVENT_HW_INSTRUCTIONS &&
+        riscv_pmu_tb_event(evt_idx) < 0) {
         return;
     }
 
@@ -383,7 +517,95 @@ void riscv_pmu_timer_cb(void *priv)
 
     /* Timer event was triggered only for these events */
     pmu_timer_trigger_irq(cpu, RISCV_PMU_EVENT_HW_CPU_CYCLES);
-    pmu_timer_trigger_irq(cpu, RISCV_PMU_EVENT_HW_INSTRUCTIONS);
+    if (riscv_pmu_tb_event(RISCV_PMU_EVENT_HW_INSTRUCTIONS) < 0) {
+        pmu_timer_trigger_irq(cpu, RISCV_PMU_EVENT_HW_INSTRUCTIONS);
+    }
+}
+
+void riscv_pmu_sync_tb_events(CPURISCVState *env)
+{
+    RISCVCPU *cpu = env_archcpu(env);
+    uint32_t ctr_idx;
+    uint64_t n;
+    int i;
+
+    for (i = 0; i < RISCV_PMU_TB_EVENTS; i++) {
+        n = env->pmu_tb_pending[i];
+        if (!n) {
+            continue;
+        }
+        env->pmu_tb_pending[i] = 0;
+
+        ctr_idx = riscv_pmu_tb_ctr(cpu, i);
+        if (riscv_pmu_counter_enabled(cpu, ctr_idx) &&
+            riscv_pmu_ctr_add(env, ctr_idx, n)) {
+            pmu_timer_trigger_irq(cpu, pmu_tb_event_idx[i]);
+        }
+    }
+}
+
+void riscv_pmu_update_tb_events(CPURISCVState *env)
+{
+    RISCVCPU *cpu = env_archcpu(env);
+    uint32_t ctr_idx;
+    int i, virt;
+    target_ulong priv;
+
+    memset(env->pmu_tb_events, 0, sizeof(env->pmu_tb_events));
+
+    for (i = 0; i < RISCV_PMU_TB_EVENTS; i++) {
+        ctr_idx = riscv_pmu_tb_ctr(cpu, i);
+        if (!riscv_pmu_counter_enabled(cpu, ctr_idx)) {
+            continue;
+        }
+        for (virt = 0; virt < 2; virt++) {
+            for (priv = PRV_U; priv <= PRV_M; priv++) {
+                if (!riscv_pmu_mode_inhibited(env, ctr_idx, priv, virt)) {
+                    env->pmu_tb_events[priv + 4 * virt] |= BIT(i);
+                }
+            }
+        }
+    }
+}
+
+static void riscv_pmu_tb_timer_work(CPUState *cs, run_on_cpu_data data)
+{
+    RISCVCPU *cpu = RISCV_CPU(cs);
+    CPURISCVState *env = &cpu->env;
+    uint32_t ctr_idx;
+    uint64_t of_bit_mask;
+    target_ulong *mhpmevent_val;
+    int i;
+
+    riscv_pmu_sync_tb_events(env);
+
+    /* Wait again for the counters that did not overflow yet */
+    for (i = 0; i < RISCV_PMU_TB_EVENTS; i++) {
+        ctr_idx = riscv_pmu_tb_ctr(cpu, i);
+        if (!riscv_pmu_counter_enabled(cpu, ctr_idx)) {
+            continue;
+        }
+        if (riscv_cpu_mxl(env) == MXL_RV32) {
+            mhpmevent_val = &env->mhpmeventh_val[ctr_idx];
+            of_bit_mask = MHPMEVENTH_BIT_OF;
+        } else {
+            mhpmevent_val = &env->mhpmevent_val[ctr_idx];
+            of_bit_mask = MHPMEVENT_BIT_OF;
+        }
+        if (!(*mhpmevent_val & of_bit_mask)) {
+            riscv_pmu_setup_timer(env, riscv_pmu_ctr_get(env, ctr_idx),
+                                  ctr_idx);
+        }
+    }
+}
+
+/* Timer callback for the counters of events counted by translated code */
+void riscv_pmu_tb_timer_cb(void *priv)
+{
+    RISCVCPU *cpu = priv;
+
+    /* The pending counts are only accessed by the vCPU thread */
+    async_run_on_cpu(CPU(cpu), riscv_pmu_tb_timer_work, RUN_ON_CPU_NULL);
 }
 
 int riscv_pmu_setup_timer(CPURISCVState *env, uint64_t value, uint32_t ctr_idx)
@@ -412,6 +634,20 @@ int riscv_pmu_setup_timer(CPURISCVState *env, uint64_t value, uint32_t ctr_idx)
         overflow_left = overflow_delta - INT64_MAX;
     }
 
+    if (riscv_pmu_ctr_tb_event(cpu, ctr_idx) >= 0) {
+        /*
+         * Translated code does not check for overflow.  Assume at most one
+         * event per nanosecond, and find out how many there really were
+         * when the timer expires.
+         */
+        overflow_at = (uint64_t)qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                      MIN(overflow_delta, INT64_MAX);
+        counter->irq_overflow_left = 0;
+        timer_mod_anticipate_ns(cpu->pmu_tb_timer,
+                                MIN(overflow_at, INT64_MAX));
+        return 0;
+    }
+
     if (riscv_pmu_ctr_monitor_cycles(env, ctr_idx) ||
         riscv_pmu_ctr_monitor_instructions(env, ctr_idx)) {
         overflow_ns = pmu_icount_ticks_to_ns((int64_t)overflow_delta);
@@ -72,8 +72,8 @@ typedef struct DisasContext {
     /* Remember the rounding mode encoded in the previous fp instruction,
        which we have already installed into env->fp_status.  Or -1 for
        no previous fp instruction.  Note that we exit the TB when writing
-       to any system register, which includes CSR_FRM, so we do not have
-       to reset this known value.  */
+       to any system register, except for the inline CSR_FRM write in
+       do_csrrw_inline, which resets this known value itself.  */
     int frm;
     RISCVMXL ol;
     bool virt_inst_excp;
@@ -118,6 +118,11 @@ typedef struct DisasContext {
     bool frm_valid;
     /* TCG of the current insn_start */
     TCGOp *insn_start;
+    /* Mask of the RISCV_PMU_TB_* events counted by this TB */
+    uint8_t pmu_events;
+    /* Their static counts, and the ops adding them, see gen_pmu_tb_start */
+    uint32_t pmu_count[RISCV_PMU_TB_EVENTS];
+    TCGOp *pmu_count_op[RISCV_PMU_TB_EVENTS];
 } DisasContext;
 
 static inline bool has_ext(DisasContext *ctx, uint32_t ext)
@@ -307,6 +312,23 @@ static void gen_goto_tb(DisasContext *ctx, int n, target_ulong dest)
     }
 }
 
+/* Count a dynamic PMU event, see gen_pmu_tb_start() */
+static void gen_pmu_incr(DisasContext *ctx, int event)
+{
+    TCGv_i64 count;
+
+    if (!(ctx->pmu_events & BIT(event))) {
+        return;
+    }
+    count = tcg_temp_new_i64();
+    tcg_gen_ld_i64(count, cpu_env,
+                   offsetof(CPURISCVState, pmu_tb_pending[event]));
+    tcg_gen_addi_i64(count, count, 1);
+    tcg_gen_st_i64(count, cpu_env,
+                   offsetof(CPURISCVState, pmu_tb_pending[event]));
+    tcg_temp_free_i64(count);
+}
+
 /*
  * Wrappers for getting reg values.
  *
@@ -563,6 +585,12 @@ static void gen_set_fpr_d(DisasContext *ctx, int reg_num, TCGv_i64 t)
     }
 }
 
+/* x1 and x5 are the link registers, as far as return prediction goes. */
+static bool is_link_reg(int reg)
+{
+    return reg == 1 || reg == 5;
+}
+
 static void gen_jal(DisasContext *ctx, int rd, target_ulong imm)
 {
     target_ulong next_pc;
@@ -577,6 +605,9 @@ static void gen_jal(DisasContext *ctx, int rd, target_ulong imm)
     }
 
     gen_set_gpri(ctx, rd, ctx->pc_succ_insn);
+    if (is_link_reg(rd)) {
+        translator_ras_push(&ctx->base, ctx->pc_succ_insn);
+    }
     gen_goto_tb(ctx, 0, ctx->base.pc_next + imm); /* must use this for safety */
     ctx->base.is_jmp = DISAS_NORETURN;
 }
@@ -693,6 +724,57 @@ static void mark_vs_dirty(DisasContext *ctx)
 static inline void mark_vs_dirty(DisasContext *ctx) { }
 #endif
 
+/*
+ * Return the TB flags at the end of the current TB: those of the TB,
+ * except for the FS and VS states that mark_fs_dirty() and mark_vs_dirty()
+ * may have changed since.  Other changes end the TB.  The exception
+ * is vstart, which vector instructions reset: that may only set
+ * VL_EQ_VLMAX, and code translated without it is correct regardless.
+ */
+static uint32_t tb_exit_flags(DisasContext *ctx)
+{
+    uint32_t flags = ctx->base.tb->flags;
+
+    flags &= ~(TB_FLAGS_MSTATUS_FS | TB_FLAGS_MSTATUS_VS);
+    flags |= ctx->mstatus_fs | ctx->mstatus_vs;
+    if (ctx->mstatus_hs_fs == MSTATUS_FS) {
+        flags = FIELD_DP32(flags, TB_FLAGS, MSTATUS_HS_FS,
+                           get_field(ctx->mstatus_hs_fs, MSTATUS_FS));
+    }
+    if (ctx->mstatus_hs_vs == MSTATUS_VS) {
+        flags = FIELD_DP32(flags, TB_FLAGS, MSTATUS_HS_VS,
+                           get_field(ctx->mstatus_hs_vs, MSTATUS_VS));
+    }
+    return flags;
+}
+
+/*
+ * End the TB after a jalr, following the hints of the ISA for return
+ * address prediction: jalr with a link register as rd is a call, and
+ * with a link register as rs1 only, a return.
+ */
+static void gen_jalr_goto_ptr(DisasContext *ctx, int rd, int rs1)
+{
+    bool rd_link = is_link_reg(rd);
+    bool rs1_link = is_link_reg(rs1);
+
+    if (rd_link && (!rs1_link || rs1 == rd)) {
+        translator_ras_push(&ctx->base, ctx->pc_succ_insn);
+    } else if (!rd_link && rs1_link && !ctx->itrigger) {
+        TCGv dest = cpu_pc;
+
+        /* cpu_get_tb_cpu_state() zero-extends the pc for RV32. */
+        if (get_xl(ctx) == MXL_RV32) {
+            dest = temp_new(ctx);
+            tcg_gen_ext32u_tl(dest, cpu_pc);
+        }
+        if (translator_ras_return(&ctx->base, dest, 0, tb_exit_flags(ctx))) {
+            return;
+        }
+    }
+    lookup_and_goto_ptr(ctx);
+}
+
 static void gen_set_rm(DisasContext *ctx, int rm)
 {
     if (ctx->frm == rm) {
@@ -1125,6 +1207,121 @@ static inline int insn_len(uint16_t first_word)
     return (first_word & 3) == 3 ? 4 : 2;
 }
 
+/*
+ * PMU events are counted statically for the whole TB, by adding to
+ * env->pmu_tb_pending[] at the start of the TB a count that is only known
+ * once the TB is translated; gen_pmu_tb_end() patches it like gen_tb_end()
+ * does for icount.  Only taken conditional branches are counted as they
+ * are executed.
+ */
+static void gen_pmu_tb_start(DisasContext *ctx)
+{
+    TCGv_i64 count;
+    int i;
+
+    for (i = 0; i < RISCV_PMU_TB_EVENTS; i++) {
+        ctx->pmu_count[i] = 0;
+        if (!(ctx->pmu_events & BIT(i))) {
+            continue;
+        }
+        count = tcg_temp_new_i64();
+        tcg_gen_ld_i64(count, cpu_env,
+                       offsetof(CPURISCVState, pmu_tb_pending[i]));
+        tcg_gen_add_i64(count, count, tcg_constant_i64(0));
+        ctx->pmu_count_op[i] = tcg_last_op();
+        tcg_gen_st_i64(count, cpu_env,
+                       offsetof(CPURISCVState, pmu_tb_pending[i]));
+        tcg_temp_free_i64(count);
+    }
+}
+
+static void gen_pmu_tb_end(DisasContext *ctx)
+{
+    int i;
+
+    ctx->pmu_count[RISCV_PMU_TB_INSNS] = ctx->base.num_insns;
+    for (i = 0; i < RISCV_PMU_TB_EVENTS; i++) {
+        if (!(ctx->pmu_events & BIT(i))) {
+            continue;
+        }
+#if TCG_TARGET_REG_BITS == 64
+        tcg_set_insn_param(ctx->pmu_count_op[i], 2,
+                           tcgv_i64_arg(tcg_constant_i64(ctx->pmu_count[i])));
+#else
+        /* add2_i32 rl, rh, al, ah, bl, bh: the high part stays zero */
+        tcg_set_insn_param(ctx->pmu_count_op[i], 4,
+                           tcgv_i32_arg(tcg_constant_i32(ctx->pmu_count[i])));
+#endif
+    }
+}
+
+/* Classify @insn for the static PMU event counts of the TB. */
+static void pmu_count_insn(DisasContext *ctx, uint32_t insn)
+{
+    bool load = false, store = false, branch = false, jump = false;
+
+    if (insn_len(insn) == 4) {
+        switch (extract32(insn, 0, 7)) {
+        case 0x03: /* LOAD */
+        case 0x07: /* LOAD-FP, including vector loads */
+            load = true;
+            break;
+        case 0x23: /* STORE */
+        case 0x27: /* STORE-FP, including vector stores */
+            store = true;
+            break;
+        case 0x2f: /* AMO */
+            switch (extract32(insn, 27, 5)) {
+            case 0x02: /* LR */
+                load = true;
+                break;
+            case 0x03: /* SC */
+                store = true;
+                break;
+            default:
+                load = store = true;
+                break;
+            }
+            break;
+        case 0x63: /* BRANCH */
+            branch = true;
+            break;
+        case 0x67: /* JALR */
+        case 0x6f: /* JAL */
+            jump = true;
+            break;
+        }
+    } else {
+        int funct3 = extract32(insn, 13, 3);
+
+        switch (extract32(insn, 0, 2)) {
+        case 0:
+            /* C.FLD, C.LW, C.LD/C.FLW; C.FSD, C.SW, C.SD/C.FSW */
+            load = funct3 >= 1 && funct3 <= 3;
+            store = funct3 >= 5;
+            break;
+        case 1:
+            /* C.JAL (RV32 only), C.J; C.BEQZ, C.BNEZ */
+            jump = funct3 == 5 || (funct3 == 1 && get_xl(ctx) == MXL_RV32);
+            branch = funct3 >= 6;
+            break;
+        case 2:
+            /* C.*LDSP, C.LWSP, C.FLWSP; C.*SDSP, C.SWSP, C.FSWSP */
+            load = funct3 >= 1 && funct3 <= 3;
+            store = funct3 >= 5;
+            /* C.JR, C.JALR */
+            jump = funct3 == 4 && extract32(insn, 2, 5) == 0 &&
+                   extract32(insn, 7, 5) != 0;
+            break;
+        }
+    }
+
+    ctx->pmu_count[RISCV_PMU_TB_LOADS] += load;
+    ctx->pmu_count[RISCV_PMU_TB_STORES] += store;
+    ctx->pmu_count[RISCV_PMU_TB_BRANCHES] += branch || jump;
+    ctx->pmu_count[RISCV_PMU_TB_TAKEN_BRANCHES] += jump;
+}
+
 static void decode_opc(CPURISCVState *env, DisasContext *ctx, uint16_t opcode)
 {
     /*
@@ -1170,25 +1367,21 @@ static void decode_opc(CPURISCVState *env, DisasContext *ctx, uint16_t opcode)
 static void riscv_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
 {
     DisasContext *ctx = container_of(dcbase, DisasContext, base);
-    CPURISCVState *env = cs->env_ptr;
     RISCVCPU *cpu = RISCV_CPU(cs);
     uint32_t tb_flags = ctx->base.tb->flags;
+    uint64_t key;
+
+    /* Background translation must not read the state of the vCPU. */
+    key = tcg_ctx->speculative ? tcg_ctx->speculative_key
+                               : riscv_cpu_translate_key(cs);
 
     ctx->pc_succ_insn = ctx->base.pc_first;
     ctx->mem_idx = FIELD_EX32(tb_flags, TB_FLAGS, MEM_IDX);
     ctx->mstatus_fs = tb_flags & TB_FLAGS_MSTATUS_FS;
     ctx->mstatus_vs = tb_flags & TB_FLAGS_MSTATUS_VS;
-    ctx->priv_ver = env->priv_ver;
-#if !defined(CONFIG_USER_ONLY)
-    if (riscv_has_ext(env, RVH)) {
-        ctx->virt_enabled = riscv_cpu_virt_enabled(env);
-    } else {
-        ctx->virt_enabled = false;
-    }
-#else
-    ctx->virt_enabled = false;
-#endif
-    ctx->misa_ext = env->misa_ext;
+    ctx->priv_ver = FIELD_EX64(key, TR_KEY, PRIV_VER);
+    ctx->virt_enabled = FIELD_EX64(key, TR_KEY, VIRT);
+    ctx->misa_ext = FIELD_EX64(key, TR_KEY, MISA_EXT);
     ctx->frm = -1;  /* unknown rounding mode */
     ctx->cfg_ptr = &(cpu->cfg);
     ctx->mstatus_hs_fs = FIELD_EX32(tb_flags, TB_FLAGS, MSTATUS_HS_FS);
@@ -1200,9 +1393,10 @@ static void riscv_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
     ctx->vta = FIELD_EX32(tb_flags, TB_FLAGS, VTA) && cpu->cfg.rvv_ta_all_1s;
     ctx->vma = FIELD_EX32(tb_flags, TB_FLAGS, VMA) && cpu->cfg.rvv_ma_all_1s;
     ctx->cfg_vta_all_1s = cpu->cfg.rvv_ta_all_1s;
-    ctx->vstart = env->vstart;
+    /* Only whether vstart is zero matters. */
+    ctx->vstart = FIELD_EX64(key, TR_KEY, VSTART_NZ);
     ctx->vl_eq_vlmax = FIELD_EX32(tb_flags, TB_FLAGS, VL_EQ_VLMAX);
-    ctx->misa_mxl_max = env->misa_mxl_max;
+    ctx->misa_mxl_max = FIELD_EX64(key, TR_KEY, MXL_MAX);
     ctx->xl = FIELD_EX32(tb_flags, TB_FLAGS, XL);
     ctx->cs = cs;
     ctx->ntemp = 0;
@@ -1212,12 +1406,16 @@ static void riscv_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
     ctx->pm_mask_enabled = FIELD_EX32(tb_flags, TB_FLAGS, PM_MASK_ENABLED);
     ctx->pm_base_enabled = FIELD_EX32(tb_flags, TB_FLAGS, PM_BASE_ENABLED);
     ctx->itrigger = FIELD_EX32(tb_flags, TB_FLAGS, ITRIGGER);
+    ctx->pmu_events = FIELD_EX32(tb_flags, TB_FLAGS, PMU_EVENTS);
     ctx->zero = tcg_constant_tl(0);
     ctx->virt_inst_excp = false;
 }
 
 static void riscv_tr_tb_start(DisasContextBase *db, CPUState *cpu)
 {
+    DisasContext *ctx = container_of(db, DisasContext, base);
+
+    gen_pmu_tb_start(ctx);
 }
 
 static void riscv_tr_insn_start(DisasContextBase *dcbase, CPUState *cpu)
@@ -1237,6 +1435,9 @@ static void riscv_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
 
     ctx->ol = ctx->xl;
     decode_opc(env, ctx, opcode16);
+    if (ctx->pmu_events) {
+        pmu_count_insn(ctx, ctx->opcode);
+    }
     ctx->base.pc_next = ctx->pc_succ_insn;
 
     for (i = ctx->ntemp - 1; i >= 0; --i) {
@@ -1273,6 +1474,8 @@ static void riscv_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
 {
     DisasContext *ctx = container_of(dcbase, DisasContext, base);
 
+    gen_pmu_tb_end(ctx);
+
     switch (ctx->base.is_jmp) {
     case DISAS_TOO_MANY:
         gen_goto_tb(ctx, 0, ctx->base.pc_next);
@@ -1317,6 +1520,9 @@ void gen_intermediate_code(CPUState *cs, TranslationBlock *tb, int max_insns,
     translator_loop(cs, tb, max_insns, pc, host_pc, &riscv_tr_ops, &ctx.base);
 }
 
+/* The registers kept in host registers when possible: sp, ra, a0-a5. */
+static const int riscv_pinned_gprs[] = { 2, 1, 10, 11, 12, 13, 14, 15 };
+
 void riscv_translate_init(void)
 {
     int i;
@@ -1336,6 +1542,12 @@ void riscv_translate_init(void)
             offsetof(CPURISCVState, gprh[i]), riscv_int_regnamesh[i]);
     }
 
+    for (i = 0; i < ARRAY_SIZE(riscv_pinned_gprs); i++) {
+        if (!tcg_global_pin(cpu_gpr[riscv_pinned_gprs[i]])) {
+            break;
+        }
+    }
+
     for (i = 0; i < 32; i++) {
         cpu_fpr[i] = tcg_global_mem_new_i64(cpu_env,
             offsetof(CPURISCVState, fpr[i]), riscv_fpr_regnames[i]);
@@ -2052,6 +2052,29 @@ GEN_VEXT_VMV_VX(vmv_v_x_h, int16_t, H2)
 GEN_VEXT_VMV_VX(vmv_v_x_w, int32_t, H4)
 GEN_VEXT_VMV_VX(vmv_v_x_d, int64_t, H8)
 
+/*
+ * Fill env->vidx with the index of each element, for every SEW, so that
+ * the translator can build the predicate of the body elements with
+ * GVEC compares against vstart and vl.
+ */
+void riscv_cpu_init_vidx(CPURISCVState *env)
+{
+    uint32_t i;
+
+    for (i = 0; i < sizeof(env->vidx[MO_8]); i++) {
+        *((uint8_t *)env->vidx[MO_8] + H1(i)) = i;
+    }
+    for (i = 0; i < sizeof(env->vidx[MO_16]) / 2; i++) {
+        *((uint16_t *)env->vidx[MO_16] + H2(i)) = i;
+    }
+    for (i = 0; i < sizeof(env->vidx[MO_32]) / 4; i++) {
+        *((uint32_t *)env->vidx[MO_32] + H4(i)) = i;
+    }
+    for (i = 0; i < sizeof(env->vidx[MO_64]) / 8; i++) {
+        *((uint64_t *)env->vidx[MO_64] + H8(i)) = i;
+    }
+}
+
 #define GEN_VEXT_VMERGE_VV(NAME, ETYPE, H)                           \
 void HELPER(NAME)(void *vd, void *v0, void *vs1, void *vs2,          \
                   CPURISCVState *env, uint32_t desc)                 \
@@ -3055,12 +3078,133 @@ void HELPER(NAME)(void *vd, void *v0, void *vs1,          \
                       total_elems * ESZ);                 \
 }
 
+/*
+ * Unmasked single and double precision operations are computed in
+ * batches, which softfloat can hand to the host FPU as a whole, see
+ * float32_add_n().  CVT promotes the source elements of widening
+ * operations; every element still gets the same result and flags.
+ */
+#define VEXT_FP_BATCH 32
+
+#define FCVT_NONE(X, S) (X)
+#define FCVT_WIDEN(X, S) float32_to_float64(X, S)
+
+#define OPFVV2_BATCH(NAME, TD, T1, T2, TX1, TX2, HD, HS1, HS2, CVT, OP) \
+static void batch_##NAME(void *vd, void *vs1, void *vs2, uint32_t i,  \
+                         uint32_t n, CPURISCVState *env)              \
+{                                                                     \
+    TX1 s1[VEXT_FP_BATCH];                                            \
+    TX2 s2[VEXT_FP_BATCH];                                            \
+    uint32_t j;                                                       \
+                                                                      \
+    for (j = 0; j < n; j++) {                                         \
+        s2[j] = CVT(*((T2 *)vs2 + HS2(i + j)), &env->fp_status);      \
+        s1[j] = CVT(*((T1 *)vs1 + HS1(i + j)), &env->fp_status);      \
+    }                                                                 \
+    OP(s2, s2, s1, n, &env->fp_status);                               \
+    for (j = 0; j < n; j++) {                                         \
+        *((TD *)vd + HD(i + j)) = s2[j];                              \
+    }                                                                 \
+}
+
+#define OPFVF2_BATCH(NAME, TD, T1, T2, TX1, TX2, HD, HS2, CVT, OP)    \
+static void batch_##NAME(void *vd, uint64_t s1, void *vs2, uint32_t i, \
+                         uint32_t n, CPURISCVState *env)              \
+{                                                                     \
+    TX1 b[VEXT_FP_BATCH];                                             \
+    TX2 s2[VEXT_FP_BATCH];                                            \
+    uint32_t j;                                                       \
+                                                                      \
+    for (j = 0; j < n; j++) {                                         \
+        s2[j] = CVT(*((T2 *)vs2 + HS2(i + j)), &env->fp_status);      \
+        b[j] = CVT((T1)s1, &env->fp_status);                          \
+    }                                                                 \
+    OP(s2, s2, b, n, &env->fp_status);                                \
+    for (j = 0; j < n; j++) {                                         \
+        *((TD *)vd + HD(i + j)) = s2[j];                              \
+    }                                                                 \
+}
+
+#define GEN_VEXT_VV_ENV_BATCH(NAME, ESZ)                  \
+void HELPER(NAME)(void *vd, void *v0, void *vs1,          \
+                  void *vs2, CPURISCVState *env,          \
+                  uint32_t desc)                          \
+{                                                         \
+    uint32_t vm = vext_vm(desc);                          \
+    uint32_t vl = env->vl;                                \
+    uint32_t total_elems =                                \
+        vext_get_total_elems(env, desc, ESZ);             \
+    uint32_t vta = vext_vta(desc);                        \
+    uint32_t vma = vext_vma(desc);                        \
+    uint32_t i, n;                                        \
+                                                          \
+    if (vm) {                                             \
+        for (i = env->vstart; i < vl; i += n) {           \
+            n = MIN(vl - i, VEXT_FP_BATCH);               \
+            batch_##NAME(vd, vs1, vs2, i, n, env);        \
+        }                                                 \
+    } else {                                              \
+        for (i = env->vstart; i < vl; i++) {              \
+            if (!vext_elem_mask(v0, i)) {                 \
+                /* set masked-off elements to 1s */       \
+                vext_set_elems_1s(vd, vma, i * ESZ,       \
+                                  (i + 1) * ESZ);         \
+                continue;                                 \
+            }                                             \
+            do_##NAME(vd, vs1, vs2, i, env);              \
+        }                                                 \
+    }                                                     \
+    env->vstart = 0;                                      \
+    /* set tail elements to 1s */                         \
+    vext_set_elems_1s(vd, vta, vl * ESZ,                  \
+                      total_elems * ESZ);                 \
+}
+
+#define GEN_VEXT_VF_BATCH(NAME, ESZ)                      \
+void HELPER(NAME)(void *vd, void *v0, uint64_t s1,        \
+                  void *vs2, CPURISCVState *env,          \
+                  uint32_t desc)                          \
+{                                                         \
+    uint32_t vm = vext_vm(desc);                          \
+    uint32_t vl = env->vl;                                \
+    uint32_t total_elems =                                \
+        vext_get_total_elems(env, desc, ESZ);             \
+    uint32_t vta = vext_vta(desc);                        \
+    uint32_t vma = vext_vma(desc);                        \
+    uint32_t i, n;                                        \
+                                                          \
+    if (vm) {                                             \
+        for (i = env->vstart; i < vl; i += n) {           \
+            n = MIN(vl - i, VEXT_FP_BATCH);               \
+            batch_##NAME(vd, s1, vs2, i, n, env);         \
+        }                                                 \
+    } else {                                              \
+        for (i = env->vstart; i < vl; i++) {              \
+            if (!vext_elem_mask(v0, i)) {                 \
+                /* set masked-off elements to 1s */       \
+                vext_set_elems_1s(vd, vma, i * ESZ,       \
+                                  (i + 1) * ESZ);         \
+                continue;                                 \
+            }                                             \
+            do_##NAME(vd, s1, vs2, i, env);               \
+        }                                                 \
+    }                                                     \
+    env->vstart = 0;                                      \
+    /* set tail elements to 1s */                         \
+    vext_set_elems_1s(vd, vta, vl * ESZ,                  \
+                      total_elems * ESZ);                 \
+}
+
 RVVCALL(OPFVV2, vfadd_vv_h, OP_UUU_H, H2, H2, H2, float16_add)
 RVVCALL(OPFVV2, vfadd_vv_w, OP_UUU_W, H4, H4, H4, float32_add)
+RVVCALL(OPFVV2_BATCH, vfadd_vv_w, OP_UUU_W, H4, H4, H4,
+        FCVT_NONE, float32_add_n)
 RVVCALL(OPFVV2, vfadd_vv_d, OP_UUU_D, H8, H8, H8, float64_add)
+RVVCALL(OPFVV2_BATCH, vfadd_vv_d, OP_UUU_D, H8, H8, H8,
+        FCVT_NONE, float64_add_n)
 GEN_VEXT_VV_ENV(vfadd_vv_h, 2)
-GEN_VEXT_VV_ENV(vfadd_vv_w, 4)
-GEN_VEXT_VV_ENV(vfadd_vv_d, 8)
+GEN_VEXT_VV_ENV_BATCH(vfadd_vv_w, 4)
+GEN_VEXT_VV_ENV_BATCH(vfadd_vv_d, 8)
 
 #define OPFVF2(NAME, TD, T1, T2, TX1, TX2, HD, HS2, OP)        \
 static void do_##NAME(void *vd, uint64_t s1, void *vs2, int i, \
@@ -3100,23 +3244,35 @@ void HELPER(NAME)(void *vd, void *v0, uint64_t s1,        \
 
 RVVCALL(OPFVF2, vfadd_vf_h, OP_UUU_H, H2, H2, float16_add)
 RVVCALL(OPFVF2, vfadd_vf_w, OP_UUU_W, H4, H4, float32_add)
+RVVCALL(OPFVF2_BATCH, vfadd_vf_w, OP_UUU_W, H4, H4,
+        FCVT_NONE, float32_add_n)
 RVVCALL(OPFVF2, vfadd_vf_d, OP_UUU_D, H8, H8, float64_add)
+RVVCALL(OPFVF2_BATCH, vfadd_vf_d, OP_UUU_D, H8, H8,
+        FCVT_NONE, float64_add_n)
 GEN_VEXT_VF(vfadd_vf_h, 2)
-GEN_VEXT_VF(vfadd_vf_w, 4)
-GEN_VEXT_VF(vfadd_vf_d, 8)
+GEN_VEXT_VF_BATCH(vfadd_vf_w, 4)
+GEN_VEXT_VF_BATCH(vfadd_vf_d, 8)
 
 RVVCALL(OPFVV2, vfsub_vv_h, OP_UUU_H, H2, H2, H2, float16_sub)
 RVVCALL(OPFVV2, vfsub_vv_w, OP_UUU_W, H4, H4, H4, float32_sub)
+RVVCALL(OPFVV2_BATCH, vfsub_vv_w, OP_UUU_W, H4, H4, H4,
+        FCVT_NONE, float32_sub_n)
 RVVCALL(OPFVV2, vfsub_vv_d, OP_UUU_D, H8, H8, H8, float64_sub)
+RVVCALL(OPFVV2_BATCH, vfsub_vv_d, OP_UUU_D, H8, H8, H8,
+        FCVT_NONE, float64_sub_n)
 GEN_VEXT_VV_ENV(vfsub_vv_h, 2)
-GEN_VEXT_VV_ENV(vfsub_vv_w, 4)
-GEN_VEXT_VV_ENV(vfsub_vv_d, 8)
+GEN_VEXT_VV_ENV_BATCH(vfsub_vv_w, 4)
+GEN_VEXT_VV_ENV_BATCH(vfsub_vv_d, 8)
 RVVCALL(OPFVF2, vfsub_vf_h, OP_UUU_H, H2, H2, float16_sub)
 RVVCALL(OPFVF2, vfsub_vf_w, OP_UUU_W, H4, H4, float32_sub)
+RVVCALL(OPFVF2_BATCH, vfsub_vf_w, OP_UUU_W, H4, H4,
+        FCVT_NONE, float32_sub_n)
 RVVCALL(OPFVF2, vfsub_vf_d, OP_UUU_D, H8, H8, float64_sub)
+RVVCALL(OPFVF2_BATCH, vfsub_vf_d, OP_UUU_D, H8, H8,
+        FCVT_NONE, float64_sub_n)
 GEN_VEXT_VF(vfsub_vf_h, 2)
-GEN_VEXT_VF(vfsub_vf_w, 4)
-GEN_VEXT_VF(vfsub_vf_d, 8)
+GEN_VEXT_VF_BATCH(vfsub_vf_w, 4)
+GEN_VEXT_VF_BATCH(vfsub_vf_d, 8)
 
 static uint16_t float16_rsub(uint16_t a, uint16_t b, float_status *s)
 {
@@ -3156,12 +3312,16 @@ static uint64_t vfwadd32(uint32_t a, uint32_t b, float_status *s)
 
 RVVCALL(OPFVV2, vfwadd_vv_h, WOP_UUU_H, H4, H2, H2, vfwadd16)
 RVVCALL(OPFVV2, vfwadd_vv_w, WOP_UUU_W, H8, H4, H4, vfwadd32)
+RVVCALL(OPFVV2_BATCH, vfwadd_vv_w, WOP_UUU_W, H8, H4, H4,
+        FCVT_WIDEN, float64_add_n)
 GEN_VEXT_VV_ENV(vfwadd_vv_h, 4)
-GEN_VEXT_VV_ENV(vfwadd_vv_w, 8)
+GEN_VEXT_VV_ENV_BATCH(vfwadd_vv_w, 8)
 RVVCALL(OPFVF2, vfwadd_vf_h, WOP_UUU_H, H4, H2, vfwadd16)
 RVVCALL(OPFVF2, vfwadd_vf_w, WOP_UUU_W, H8, H4, vfwadd32)
+RVVCALL(OPFVF2_BATCH, vfwadd_vf_w, WOP_UUU_W, H8, H4,
+        FCVT_WIDEN, float64_add_n)
 GEN_VEXT_VF(vfwadd_vf_h, 4)
-GEN_VEXT_VF(vfwadd_vf_w, 8)
+GEN_VEXT_VF_BATCH(vfwadd_vf_w, 8)
 
 static uint32_t vfwsub16(uint16_t a, uint16_t b, float_status *s)
 {
@@ -3178,12 +3338,16 @@ static uint64_t vfwsub32(uint32_t a, uint32_t b, float_status *s)
 
 RVVCALL(OPFVV2, vfwsub_vv_h, WOP_UUU_H, H4, H2, H2, vfwsub16)
 RVVCALL(OPFVV2, vfwsub_vv_w, WOP_UUU_W, H8, H4, H4, vfwsub32)
+RVVCALL(OPFVV2_BATCH, vfwsub_vv_w, WOP_UUU_W, H8, H4, H4,
+        FCVT_WIDEN, float64_sub_n)
 GEN_VEXT_VV_ENV(vfwsub_vv_h, 4)
-GEN_VEXT_VV_ENV(vfwsub_vv_w, 8)
+GEN_VEXT_VV_ENV_BATCH(vfwsub_vv_w, 8)
 RVVCALL(OPFVF2, vfwsub_vf_h, WOP_UUU_H, H4, H2, vfwsub16)
 RVVCALL(OPFVF2, vfwsub_vf_w, WOP_UUU_W, H8, H4, vfwsub32)
+RVVCALL(OPFVF2_BATCH, vfwsub_vf_w, WOP_UUU_W, H8, H4,
+        FCVT_WIDEN, float64_sub_n)
 GEN_VEXT_VF(vfwsub_vf_h, 4)
-GEN_VEXT_VF(vfwsub_vf_w, 8)
+GEN_VEXT_VF_BATCH(vfwsub_vf_w, 8)
 
 static uint32_t vfwaddw16(uint32_t a, uint16_t b, float_status *s)
 {
@@ -3226,16 +3390,24 @@ GEN_VEXT_VF(vfwsub_wf_w, 8)
 /* Vector Single-Width Floating-Point Multiply/Divide Instructions */
 RVVCALL(OPFVV2, vfmul_vv_h, OP_UUU_H, H2, H2, H2, float16_mul)
 RVVCALL(OPFVV2, vfmul_vv_w, OP_UUU_W, H4, H4, H4, float32_mul)
+RVVCALL(OPFVV2_BATCH, vfmul_vv_w, OP_UUU_W, H4, H4, H4,
+        FCVT_NONE, float32_mul_n)
 RVVCALL(OPFVV2, vfmul_vv_d, OP_UUU_D, H8, H8, H8, float64_mul)
+RVVCALL(OPFVV2_BATCH, vfmul_vv_d, OP_UUU_D, H8, H8, H8,
+        FCVT_NONE, float64_mul_n)
 GEN_VEXT_VV_ENV(vfmul_vv_h, 2)
-GEN_VEXT_VV_ENV(vfmul_vv_w, 4)
-GEN_VEXT_VV_ENV(vfmul_vv_d, 8)
+GEN_VEXT_VV_ENV_BATCH(vfmul_vv_w, 4)
+GEN_VEXT_VV_ENV_BATCH(vfmul_vv_d, 8)
 RVVCALL(OPFVF2, vfmul_vf_h, OP_UUU_H, H2, H2, float16_mul)
 RVVCALL(OPFVF2, vfmul_vf_w, OP_UUU_W, H4, H4, float32_mul)
+RVVCALL(OPFVF2_BATCH, vfmul_vf_w, OP_UUU_W, H4, H4,
+        FCVT_NONE, float32_mul_n)
 RVVCALL(OPFVF2, vfmul_vf_d, OP_UUU_D, H8, H8, float64_mul)
+RVVCALL(OPFVF2_BATCH, vfmul_vf_d, OP_UUU_D, H8, H8,
+        FCVT_NONE, float64_mul_n)
 GEN_VEXT_VF(vfmul_vf_h, 2)
-GEN_VEXT_VF(vfmul_vf_w, 4)
-GEN_VEXT_VF(vfmul_vf_d, 8)
+GEN_VEXT_VF_BATCH(vfmul_vf_w, 4)
+GEN_VEXT_VF_BATCH(vfmul_vf_d, 8)
 
 RVVCALL(OPFVV2, vfdiv_vv_h, OP_UUU_H, H2, H2, H2, float16_div)
 RVVCALL(OPFVV2, vfdiv_vv_w, OP_UUU_W, H4, H4, H4, float32_div)
@@ -3287,12 +3459,16 @@ static uint64_t vfwmul32(uint32_t a, uint32_t b, float_status *s)
 }
 RVVCALL(OPFVV2, vfwmul_vv_h, WOP_UUU_H, H4, H2, H2, vfwmul16)
 RVVCALL(OPFVV2, vfwmul_vv_w, WOP_UUU_W, H8, H4, H4, vfwmul32)
+RVVCALL(OPFVV2_BATCH, vfwmul_vv_w, WOP_UUU_W, H8, H4, H4,
+        FCVT_WIDEN, float64_mul_n)
 GEN_VEXT_VV_ENV(vfwmul_vv_h, 4)
-GEN_VEXT_VV_ENV(vfwmul_vv_w, 8)
+GEN_VEXT_VV_ENV_BATCH(vfwmul_vv_w, 8)
 RVVCALL(OPFVF2, vfwmul_vf_h, WOP_UUU_H, H4, H2, vfwmul16)
 RVVCALL(OPFVF2, vfwmul_vf_w, WOP_UUU_W, H8, H4, vfwmul32)
+RVVCALL(OPFVF2_BATCH, vfwmul_vf_w, WOP_UUU_W, H8, H4,
+        FCVT_WIDEN, float64_mul_n)
 GEN_VEXT_VF(vfwmul_vf_h, 4)
-GEN_VEXT_VF(vfwmul_vf_w, 8)
+GEN_VEXT_VF_BATCH(vfwmul_vf_w, 8)
 
 /* Vector Single-Width Floating-Point Fused Multiply-Add Instructions */
 #define OPFVV3(NAME, TD, T1, T2, TX1, TX2, HD, HS1, HS2, OP)       \
@@ -3322,10 +3498,14 @@ static uint64_t fmacc64(uint64_t a, uint64_t b, uint64_t d, float_status *s)
 
 RVVCALL(OPFVV3, vfmacc_vv_h, OP_UUU_H, H2, H2, H2, fmacc16)
 RVVCALL(OPFVV3, vfmacc_vv_w, OP_UUU_W, H4, H4, H4, fmacc32)
+RVVCALL(OPFVV3_BATCH, vfmacc_vv_w, OP_UUU_W, H4, H4, H4,
+        FCVT_NONE, float32_muladd_n, 0)
 RVVCALL(OPFVV3, vfmacc_vv_d, OP_UUU_D, H8, H8, H8, fmacc64)
+RVVCALL(OPFVV3_BATCH, vfmacc_vv_d, OP_UUU_D, H8, H8, H8,
+        FCVT_NONE, float64_muladd_n, 0)
 GEN_VEXT_VV_ENV(vfmacc_vv_h, 2)
-GEN_VEXT_VV_ENV(vfmacc_vv_w, 4)
-GEN_VEXT_VV_ENV(vfmacc_vv_d, 8)
+GEN_VEXT_VV_ENV_BATCH(vfmacc_vv_w, 4)
+GEN_VEXT_VV_ENV_BATCH(vfmacc_vv_d, 8)
 
 #define OPFVF3(NAME, TD, T1, T2, TX1, TX2, HD, HS2, OP)           \
 static void do_##NAME(void *vd, uint64_t s1, void *vs2, int i,    \
@@ -3336,12 +3516,57 @@ static void do_##NAME(void *vd, uint64_t s1, void *vs2, int i,    \
     *((TD *)vd + HD(i)) = OP(s2, (TX1)(T1)s1, d, &env->fp_status);\
 }
 
+#define OPFVV3_BATCH(NAME, TD, T1, T2, TX1, TX2, HD, HS1, HS2, CVT, OP, \
+                     FLAGS)                                           \
+static void batch_##NAME(void *vd, void *vs1, void *vs2, uint32_t i,  \
+                         uint32_t n, CPURISCVState *env)              \
+{                                                                     \
+    TX1 s1[VEXT_FP_BATCH];                                            \
+    TX2 s2[VEXT_FP_BATCH];                                            \
+    TD d[VEXT_FP_BATCH];                                              \
+    uint32_t j;                                                       \
+                                                                      \
+    for (j = 0; j < n; j++) {                                         \
+        s2[j] = CVT(*((T2 *)vs2 + HS2(i + j)), &env->fp_status);      \
+        s1[j] = CVT(*((T1 *)vs1 + HS1(i + j)), &env->fp_status);      \
+        d[j] = *((TD *)vd + HD(i + j));                               \
+    }                                                                 \
+    OP(d, s2, s1, d, n, FLAGS, &env->fp_status);                      \
+    for (j = 0; j < n; j++) {                                         \
+        *((TD *)vd + HD(i + j)) = d[j];                               \
+    }                                                                 \
+}
+
+#define OPFVF3_BATCH(NAME, TD, T1, T2, TX1, TX2, HD, HS2, CVT, OP, FLAGS) \
+static void batch_##NAME(void *vd, uint64_t s1, void *vs2, uint32_t i, \
+                         uint32_t n, CPURISCVState *env)              \
+{                                                                     \
+    TX1 b[VEXT_FP_BATCH];                                             \
+    TX2 s2[VEXT_FP_BATCH];                                            \
+    TD d[VEXT_FP_BATCH];                                              \
+    uint32_t j;                                                       \
+                                                                      \
+    for (j = 0; j < n; j++) {                                         \
+        s2[j] = CVT(*((T2 *)vs2 + HS2(i + j)), &env->fp_status);      \
+        b[j] = CVT((T1)s1, &env->fp_status);                          \
+        d[j] = *((TD *)vd + HD(i + j));                               \
+    }                                                                 \
+    OP(d, s2, b, d, n, FLAGS, &env->fp_status);                       \
+    for (j = 0; j < n; j++) {                                         \
+        *((TD *)vd + HD(i + j)) = d[j];                               \
+    }                                                                 \
+}
+
 RVVCALL(OPFVF3, vfmacc_vf_h, OP_UUU_H, H2, H2, fmacc16)
 RVVCALL(OPFVF3, vfmacc_vf_w, OP_UUU_W, H4, H4, fmacc32)
+RVVCALL(OPFVF3_BATCH, vfmacc_vf_w, OP_UUU_W, H4, H4,
+        FCVT_NONE, float32_muladd_n, 0)
 RVVCALL(OPFVF3, vfmacc_vf_d, OP_UUU_D, H8, H8, fmacc64)
+RVVCALL(OPFVF3_BATCH, vfmacc_vf_d, OP_UUU_D, H8, H8,
+        FCVT_NONE, float64_muladd_n, 0)
 GEN_VEXT_VF(vfmacc_vf_h, 2)
-GEN_VEXT_VF(vfmacc_vf_w, 4)
-GEN_VEXT_VF(vfmacc_vf_d, 8)
+GEN_VEXT_VF_BATCH(vfmacc_vf_w, 4)
+GEN_VEXT_VF_BATCH(vfmacc_vf_d, 8)
 
 static uint16_t fnmacc16(uint16_t a, uint16_t b, uint16_t d, float_status *s)
 {
@@ -3363,16 +3588,28 @@ static uint64_t fnmacc64(uint64_t a, uint64_t b, uint64_t d, float_status *s)
 
 RVVCALL(OPFVV3, vfnmacc_vv_h, OP_UUU_H, H2, H2, H2, fnmacc16)
 RVVCALL(OPFVV3, vfnmacc_vv_w, OP_UUU_W, H4, H4, H4, fnmacc32)
+RVVCALL(OPFVV3_BATCH, vfnmacc_vv_w, OP_UUU_W, H4, H4, H4,
+        FCVT_NONE, float32_muladd_n,
+        float_muladd_negate_c | float_muladd_negate_product)
 RVVCALL(OPFVV3, vfnmacc_vv_d, OP_UUU_D, H8, H8, H8, fnmacc64)
+RVVCALL(OPFVV3_BATCH, vfnmacc_vv_d, OP_UUU_D, H8, H8, H8,
+        FCVT_NONE, float64_muladd_n,
+        float_muladd_negate_c | float_muladd_negate_product)
 GEN_VEXT_VV_ENV(vfnmacc_vv_h, 2)
-GEN_VEXT_VV_ENV(vfnmacc_vv_w, 4)
-GEN_VEXT_VV_ENV(vfnmacc_vv_d, 8)
+GEN_VEXT_VV_ENV_BATCH(vfnmacc_vv_w, 4)
+GEN_VEXT_VV_ENV_BATCH(vfnmacc_vv_d, 8)
 RVVCALL(OPFVF3, vfnmacc_vf_h, OP_UUU_H, H2, H2, fnmacc16)
 RVVCALL(OPFVF3, vfnmacc_vf_w, OP_UUU_W, H4, H4, fnmacc32)
+RVVCALL(OPFVF3_BATCH, vfnmacc_vf_w, OP_UUU_W, H4, H4,
+        FCVT_NONE, float32_muladd_n,
+        float_muladd_negate_c | float_muladd_negate_product)
 RVVCALL(OPFVF3, vfnmacc_vf_d, OP_UUU_D, H8, H8, fnmacc64)
+RVVCALL(OPFVF3_BATCH, vfnmacc_vf_d, OP_UUU_D, H8, H8,
+        FCVT_NONE, float64_muladd_n,
+        float_muladd_negate_c | float_muladd_negate_product)
 GEN_VEXT_VF(vfnmacc_vf_h, 2)
-GEN_VEXT_VF(vfnmacc_vf_w, 4)
-GEN_VEXT_VF(vfnmacc_vf_d, 8)
+GEN_VEXT_VF_BATCH(vfnmacc_vf_w, 4)
+GEN_VEXT_VF_BATCH(vfnmacc_vf_d, 8)
 
 static uint16_t fmsac16(uint16_t a, uint16_t b, uint16_t d, float_status *s)
 {
@@ -3391,16 +3628,24 @@ static uint64_t fmsac64(uint64_t a, uint64_t b, uint64_t d, float_status *s)
 
 RVVCALL(OPFVV3, vfmsac_vv_h, OP_UUU_H, H2, H2, H2, fmsac16)
 RVVCALL(OPFVV3, vfmsac_vv_w, OP_UUU_W, H4, H4, H4, fmsac32)
+RVVCALL(OPFVV3_BATCH, vfmsac_vv_w, OP_UUU_W, H4, H4, H4,
+        FCVT_NONE, float32_muladd_n, float_muladd_negate_c)
 RVVCALL(OPFVV3, vfmsac_vv_d, OP_UUU_D, H8, H8, H8, fmsac64)
+RVVCALL(OPFVV3_BATCH, vfmsac_vv_d, OP_UUU_D, H8, H8, H8,
+        FCVT_NONE, float64_muladd_n, float_muladd_negate_c)
 GEN_VEXT_VV_ENV(vfmsac_vv_h, 2)
-GEN_VEXT_VV_ENV(vfmsac_vv_w, 4)
-GEN_VEXT_VV_ENV(vfmsac_vv_d, 8)
+GEN_VEXT_VV_ENV_BATCH(vfmsac_vv_w, 4)
+GEN_VEXT_VV_ENV_BATCH(vfmsac_vv_d, 8)
 RVVCALL(OPFVF3, vfmsac_vf_h, OP_UUU_H, H2, H2, fmsac16)
 RVVCALL(OPFVF3, vfmsac_vf_w, OP_UUU_W, H4, H4, fmsac32)
+RVVCALL(OPFVF3_BATCH, vfmsac_vf_w, OP_UUU_W, H4, H4,
+        FCVT_NONE, float32_muladd_n, float_muladd_negate_c)
 RVVCALL(OPFVF3, vfmsac_vf_d, OP_UUU_D, H8, H8, fmsac64)
+RVVCALL(OPFVF3_BATCH, vfmsac_vf_d, OP_UUU_D, H8, H8,
+        FCVT_NONE, float64_muladd_n, float_muladd_negate_c)
 GEN_VEXT_VF(vfmsac_vf_h, 2)
-GEN_VEXT_VF(vfmsac_vf_w, 4)
-GEN_VEXT_VF(vfmsac_vf_d, 8)
+GEN_VEXT_VF_BATCH(vfmsac_vf_w, 4)
+GEN_VEXT_VF_BATCH(vfmsac_vf_d, 8)
 
 static uint16_t fnmsac16(uint16_t a, uint16_t b, uint16_t d, float_status *s)
 {
@@ -3419,16 +3664,24 @@ static uint64_t fnmsac64(uint64_t a, uint64_t b, uint64_t d, float_status *s)
 
 RVVCALL(OPFVV3, vfnmsac_vv_h, OP_UUU_H, H2, H2, H2, fnmsac16)
 RVVCALL(OPFVV3, vfnmsac_vv_w, OP_UUU_W, H4, H4, H4, fnmsac32)
+RVVCALL(OPFVV3_BATCH, vfnmsac_vv_w, OP_UUU_W, H4, H4, H4,
+        FCVT_NONE, float32_muladd_n, float_muladd_negate_product)
 RVVCALL(OPFVV3, vfnmsac_vv_d, OP_UUU_D, H8, H8, H8, fnmsac64)
+RVVCALL(OPFVV3_BATCH, vfnmsac_vv_d, OP_UUU_D, H8, H8, H8,
+        FCVT_NONE, float64_muladd_n, float_muladd_negate_product)
 GEN_VEXT_VV_ENV(vfnmsac_vv_h, 2)
-GEN_VEXT_VV_ENV(vfnmsac_vv_w, 4)
-GEN_VEXT_VV_ENV(vfnmsac_vv_d, 8)
+GEN_VEXT_VV_ENV_BATCH(vfnmsac_vv_w, 4)
+GEN_VEXT_VV_ENV_BATCH(vfnmsac_vv_d, 8)
 RVVCALL(OPFVF3, vfnmsac_vf_h, OP_UUU_H, H2, H2, fnmsac16)
 RVVCALL(OPFVF3, vfnmsac_vf_w, OP_UUU_W, H4, H4, fnmsac32)
+RVVCALL(OPFVF3_BATCH, vfnmsac_vf_w, OP_UUU_W, H4, H4,
+        FCVT_NONE, float32_muladd_n, float_muladd_negate_product)
 RVVCALL(OPFVF3, vfnmsac_vf_d, OP_UUU_D, H8, H8, fnmsac64)
+RVVCALL(OPFVF3_BATCH, vfnmsac_vf_d, OP_UUU_D, H8, H8,
+        FCVT_NONE, float64_muladd_n, float_muladd_negate_product)
 GEN_VEXT_VF(vfnmsac_vf_h, 2)
-GEN_VEXT_VF(vfnmsac_vf_w, 4)
-GEN_VEXT_VF(vfnmsac_vf_d, 8)
+GEN_VEXT_VF_BATCH(vfnmsac_vf_w, 4)
+GEN_VEXT_VF_BATCH(vfnmsac_vf_d, 8)
 
 static uint16_t fmadd16(uint16_t a, uint16_t b, uint16_t d, float_status *s)
 {
@@ -3560,12 +3813,16 @@ static uint64_t fwmacc32(uint32_t a, uint32_t b, uint64_t d, float_status *s)
 
 RVVCALL(OPFVV3, vfwmacc_vv_h, WOP_UUU_H, H4, H2, H2, fwmacc16)
 RVVCALL(OPFVV3, vfwmacc_vv_w, WOP_UUU_W, H8, H4, H4, fwmacc32)
+RVVCALL(OPFVV3_BATCH, vfwmacc_vv_w, WOP_UUU_W, H8, H4, H4,
+        FCVT_WIDEN, float64_muladd_n, 0)
 GEN_VEXT_VV_ENV(vfwmacc_vv_h, 4)
-GEN_VEXT_VV_ENV(vfwmacc_vv_w, 8)
+GEN_VEXT_VV_ENV_BATCH(vfwmacc_vv_w, 8)
 RVVCALL(OPFVF3, vfwmacc_vf_h, WOP_UUU_H, H4, H2, fwmacc16)
 RVVCALL(OPFVF3, vfwmacc_vf_w, WOP_UUU_W, H8, H4, fwmacc32)
+RVVCALL(OPFVF3_BATCH, vfwmacc_vf_w, WOP_UUU_W, H8, H4,
+        FCVT_WIDEN, float64_muladd_n, 0)
 GEN_VEXT_VF(vfwmacc_vf_h, 4)
-GEN_VEXT_VF(vfwmacc_vf_w, 8)
+GEN_VEXT_VF_BATCH(vfwmacc_vf_w, 8)
 
 static uint32_t fwnmacc16(uint16_t a, uint16_t b, uint32_t d, float_status *s)
 {
@@ -4699,15 +4956,55 @@ void HELPER(NAME)(void *vd, void *v0, void *vs1,           \
     vext_set_elems_1s(vd, vta, esz, vlenb);                \
 }
 
+/*
+ * Sums gather the active elements in batches, whose additions softfloat
+ * can still perform on the host FPU, in order; see float32_sum_n().
+ */
+#define GEN_VEXT_FRED_SUM(NAME, TD, TS2, HD, HS2, CVT, SUM)  \
+void HELPER(NAME)(void *vd, void *v0, void *vs1,           \
+                  void *vs2, CPURISCVState *env,           \
+                  uint32_t desc)                           \
+{                                                          \
+    uint32_t vm = vext_vm(desc);                           \
+    uint32_t vl = env->vl;                                 \
+    uint32_t esz = sizeof(TD);                             \
+    uint32_t vlenb = simd_maxsz(desc);                     \
+    uint32_t vta = vext_vta(desc);                         \
+    uint32_t i, n = 0;                                     \
+    TD s1 =  *((TD *)vs1 + HD(0));                         \
+    TD s2[VEXT_FP_BATCH];                                  \
+                                                           \
+    for (i = env->vstart; i < vl; i++) {                   \
+        if (!vm && !vext_elem_mask(v0, i)) {               \
+            continue;                                      \
+        }                                                  \
+        s2[n++] = CVT(*((TS2 *)vs2 + HS2(i)),              \
+                      &env->fp_status);                    \
+        if (n == VEXT_FP_BATCH) {                          \
+            s1 = SUM(s1, s2, n, &env->fp_status);          \
+            n = 0;                                         \
+        }                                                  \
+    }                                                      \
+    s1 = SUM(s1, s2, n, &env->fp_status);                  \
+    *((TD *)vd + HD(0)) = s1;                              \
+    env->vstart = 0;                                       \
+    /* set tail elements to 1s */                          \
+    vext_set_elems_1s(vd, vta, esz, vlenb);                \
+}
+
 /* Unordered sum */
 GEN_VEXT_FRED(vfredusum_vs_h, uint16_t, uint16_t, H2, H2, float16_add)
-GEN_VEXT_FRED(vfredusum_vs_w, uint32_t, uint32_t, H4, H4, float32_add)
-GEN_VEXT_FRED(vfredusum_vs_d, uint64_t, uint64_t, H8, H8, float64_add)
+GEN_VEXT_FRED_SUM(vfredusum_vs_w, uint32_t, uint32_t, H4, H4, FCVT_NONE,
+                  float32_sum_n)
+GEN_VEXT_FRED_SUM(vfredusum_vs_d, uint64_t, uint64_t, H8, H8, FCVT_NONE,
+                  float64_sum_n)
 
 /* Ordered sum */
 GEN_VEXT_FRED(vfredosum_vs_h, uint16_t, uint16_t, H2, H2, float16_add)
-GEN_VEXT_FRED(vfredosum_vs_w, uint32_t, uint32_t, H4, H4, float32_add)
-GEN_VEXT_FRED(vfredosum_vs_d, uint64_t, uint64_t, H8, H8, float64_add)
+GEN_VEXT_FRED_SUM(vfredosum_vs_w, uint32_t, uint32_t, H4, H4, FCVT_NONE,
+                  float32_sum_n)
+GEN_VEXT_FRED_SUM(vfredosum_vs_d, uint64_t, uint64_t, H8, H8, FCVT_NONE,
+                  float64_sum_n)
 
 /* Maximum value */
 GEN_VEXT_FRED(vfredmax_vs_h, uint16_t, uint16_t, H2, H2, float16_maximum_number)
@@ -4725,17 +5022,14 @@ static uint32_t fwadd16(uint32_t a, uint16_t b, float_status *s)
     return float32_add(a, float16_to_float32(b, true, s), s);
 }
 
-static uint64_t fwadd32(uint64_t a, uint32_t b, float_status *s)
-{
-    return float64_add(a, float32_to_float64(b, s), s);
-}
-
 /* Vector Widening Floating-Point Reduction Instructions */
 /* Ordered/unordered reduce 2*SEW = 2*SEW + sum(promote(SEW)) */
 GEN_VEXT_FRED(vfwredusum_vs_h, uint32_t, uint16_t, H4, H2, fwadd16)
-GEN_VEXT_FRED(vfwredusum_vs_w, uint64_t, uint32_t, H8, H4, fwadd32)
+GEN_VEXT_FRED_SUM(vfwredusum_vs_w, uint64_t, uint32_t, H8, H4, FCVT_WIDEN,
+                  float64_sum_n)
 GEN_VEXT_FRED(vfwredosum_vs_h, uint32_t, uint16_t, H4, H2, fwadd16)
-GEN_VEXT_FRED(vfwredosum_vs_w, uint64_t, uint32_t, H8, H4, fwadd32)
+GEN_VEXT_FRED_SUM(vfwredosum_vs_w, uint64_t, uint32_t, H8, H4, FCVT_WIDEN,
+                  float64_sum_n)
 
 /*
  *** Vector Mask Operations
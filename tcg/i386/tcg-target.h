@@ -244,5 +244,9 @@ extern bool have_movbe;
 
 #define TCG_TARGET_NEED_LDST_LABELS
 #define TCG_TARGET_NEED_POOL_LABELS
+#if TCG_TARGET_REG_BITS == 64
+/* Fill in tcg_ctx->host_relocs for the TB cache. */
+#define TCG_TARGET_HOST_RELOCS
+#endif
 
 #endif
@@ -45,6 +45,11 @@ struct tcg_region_tree {
  * dynamically allocate from as demand dictates. Given appropriate region
  * sizing, this minimizes flushes even when some TCG threads generate a lot
  * more code than others.
+ *
+ * With eviction enabled, regions that filled up are queued in that order.
+ * When few regions are left, the oldest one is evicted: its TBs are
+ * invalidated, and once no vCPU can be running them the region is free
+ * again.  See tb_evict_region().
  */
 struct tcg_region_state {
     QemuMutex lock;
@@ -56,12 +61,26 @@ struct tcg_region_state {
     size_t size; /* size of one region */
     size_t stride; /* .size + guard size */
     size_t total_size; /* size of entire buffer, >= n * stride */
+    bool evict;
 
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+
+    /* eviction state, also protected by the lock */
+    size_t *full; /* ring of full regions, oldest first */
+    size_t full_head;
+    size_t n_full;
+    size_t *free; /* evicted regions */
+    size_t n_free;
+    size_t n_evicting;
+    unsigned *gen; /* bumped when eviction starts and on reset */
+    bool evict_wanted; /* also read without the lock */
 };
 
+/* Regions to keep free or being evicted, on top of those in use. */
+#define TCG_REGION_EVICT_RESERVE 2
+
 static struct tcg_region_state region;
 
 /*
@@ -167,10 +186,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* Return the index of the region containing @p, in the rw buffer. */
+static size_t tcg_region_index(const void *p)
 {
-    size_t region_idx;
+    ptrdiff_t offset;
+
+    if (p < region.start_aligned) {
+        return 0;
+    }
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
+    }
+    return offset / region.stride;
+}
 
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
     /*
      * Like tcg_splitwx_to_rw, with no assert.  The pc may come from
      * a signal handler over which the caller has no control.
@@ -181,19 +213,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
             return NULL;
         }
     }
-
-    if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
-    }
-    return region_trees + region_idx * tree_size;
+    return region_trees + tcg_region_index(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -333,13 +353,26 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
     s->code_gen_highwater = end - TCG_HIGHWATER;
 }
 
+static void tcg_region_evict_update__locked(void)
+{
+    size_t avail = region.n - region.current + region.n_free +
+                   region.n_evicting;
+
+    qatomic_set(&region.evict_wanted,
+                region.evict && region.n_full &&
+                avail < TCG_REGION_EVICT_RESERVE);
+}
+
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    if (region.current < region.n) {
+        tcg_region_assign(s, region.current);
+        region.current++;
+    } else if (region.n_free) {
+        tcg_region_assign(s, region.free[--region.n_free]);
+    } else {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
     return false;
 }
 
@@ -352,16 +385,98 @@ bool tcg_region_alloc(TCGContext *s)
     bool err;
     /* read the region size now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    size_t prev = tcg_region_index(s->code_gen_buffer);
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
         region.agg_size_full += size_full - TCG_HIGHWATER;
+        if (region.evict) {
+            region.full[(region.full_head + region.n_full) % region.n] = prev;
+            region.n_full++;
+        }
+        tcg_region_evict_update__locked();
     }
     qemu_mutex_unlock(&region.lock);
     return err;
 }
 
+/* Return whether tcg_region_evict_start() would pick a region. */
+bool tcg_region_evict_wanted(void)
+{
+    return qatomic_read(&region.evict_wanted);
+}
+
+/*
+ * If few regions are left, take the one that filled up first out of the
+ * queue, and return its index and generation.  The caller must invalidate
+ * its TBs and, once no thread can be executing them, pass both values to
+ * tcg_region_evict_finish().
+ */
+bool tcg_region_evict_start(size_t *idx, unsigned *gen)
+{
+    void *start, *end;
+    bool ret = false;
+
+    qemu_mutex_lock(&region.lock);
+    if (region.evict_wanted) {
+        *idx = region.full[region.full_head];
+        region.full_head = (region.full_head + 1) % region.n;
+        region.n_full--;
+        region.n_evicting++;
+        *gen = ++region.gen[*idx];
+
+        tcg_region_bounds(*idx, &start, &end);
+        region.agg_size_full -= end - start - TCG_HIGHWATER;
+        tcg_region_evict_update__locked();
+        ret = true;
+    }
+    qemu_mutex_unlock(&region.lock);
+    return ret;
+}
+
+/* Return whether @p, in the rw buffer, is within region @idx. */
+bool tcg_region_contains(size_t idx, const void *p)
+{
+    void *start, *end;
+
+    tcg_region_bounds(idx, &start, &end);
+    return p >= start && p < end;
+}
+
+/* Call @func on each TB of region @idx, see tcg_tb_foreach(). */
+void tcg_region_tb_foreach(size_t idx, GTraverseFunc func, gpointer user_data)
+{
+    struct tcg_region_tree *rt = region_trees + idx * tree_size;
+
+    qemu_mutex_lock(&rt->lock);
+    g_tree_foreach(rt->tree, func, user_data);
+    qemu_mutex_unlock(&rt->lock);
+}
+
+/*
+ * Make region @idx available again, unless the buffer was flushed since
+ * tcg_region_evict_start() returned @gen.
+ */
+void tcg_region_evict_finish(size_t idx, unsigned gen)
+{
+    struct tcg_region_tree *rt = region_trees + idx * tree_size;
+
+    qemu_mutex_lock(&region.lock);
+    if (region.gen[idx] == gen) {
+        qemu_mutex_lock(&rt->lock);
+        /* Increment the refcount first so that destroy acts as a reset */
+        g_tree_ref(rt->tree);
+        g_tree_destroy(rt->tree);
+        qemu_mutex_unlock(&rt->lock);
+
+        region.free[region.n_free++] = idx;
+        region.n_evicting--;
+        tcg_region_evict_update__locked();
+    }
+    qemu_mutex_unlock(&region.lock);
+}
+
 /*
  * Perform a context's first region allocation.
  * This function does _not_ increment region.agg_size_full.
@@ -389,16 +504,29 @@ void tcg_region_reset_all(void)
     region.current = 0;
     region.agg_size_full = 0;
 
+    if (region.evict) {
+        /* Evictions in progress must not free their region. */
+        for (i = 0; i < region.n; i++) {
+            region.gen[i]++;
+        }
+        region.full_head = 0;
+        region.n_full = 0;
+        region.n_free = 0;
+        region.n_evicting = 0;
+    }
+
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
         tcg_region_initial_alloc__locked(s);
     }
+    tcg_region_evict_update__locked();
     qemu_mutex_unlock(&region.lock);
 
     tcg_region_tree_reset_all();
 }
 
-static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
+static size_t tcg_n_regions(size_t tb_size, unsigned max_threads,
+                            bool evict)
 {
 #ifdef CONFIG_USER_ONLY
     return 1;
@@ -406,25 +534,34 @@ static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
     size_t n_regions;
 
     /*
-     * It is likely that some vCPUs will translate more code than others,
-     * so we first try to set more regions than max_cpus, with those regions
-     * being of reasonable size. If that's not possible we make do by evenly
-     * dividing the code_gen_buffer among the vCPUs.
+     * Eviction works a region at a time, so it wants small regions, and
+     * a few more of them than TCG threads.
      */
-    /* Use a single region if all we have is one vCPU thread */
-    if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
+    if (evict) {
+        n_regions = MIN(tb_size / (2 * MiB), 64);
+        return MAX(n_regions, max_threads + TCG_REGION_EVICT_RESERVE);
+    }
+
+    /*
+     * It is likely that some threads will translate more code than others,
+     * so we first try to set more regions than max_threads, with those
+     * regions being of reasonable size. If that's not possible we make do
+     * by evenly dividing the code_gen_buffer among the threads.
+     */
+    /* Use a single region if all we have is one TCG thread */
+    if (max_threads == 1) {
         return 1;
     }
 
     /*
-     * Try to have more regions than max_cpus, with each region being >= 2 MB.
-     * If we can't, then just allocate one region per vCPU thread.
+     * Try to have more regions than max_threads, with each region being
+     * >= 2 MB.  If we can't, then just allocate one region per TCG thread.
      */
     n_regions = tb_size / (2 * MiB);
-    if (n_regions <= max_cpus) {
-        return max_cpus;
+    if (n_regions <= max_threads) {
+        return max_threads;
     }
-    return MIN(n_regions, max_cpus * 8);
+    return MIN(n_regions, max_threads * 8);
 #endif
 }
 
@@ -709,11 +846,10 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * and then assigning regions to TCG threads so that the threads can translate
  * code in parallel without synchronization.
  *
- * In softmmu the number of TCG threads is bounded by max_cpus, so we use at
- * least max_cpus regions in MTTCG. In !MTTCG we use a single region.
- * Note that the TCG options from the command-line (i.e. -accel accel=tcg,[...])
- * must have been parsed before calling this function, since it calls
- * qemu_tcg_mttcg_enabled().
+ * In softmmu the number of TCG threads is bounded by max_threads: one per
+ * vCPU in MTTCG, or a single one otherwise, plus any background translation
+ * threads.  We use at least max_threads regions, or a single region if
+ * there is only one TCG thread.
  *
  * In user-mode we use a single region.  Having multiple regions in user-mode
  * is not supported, because the number of vCPU threads (recall that each thread
@@ -726,8 +862,12 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * However, this user-mode limitation is unlikely to be a significant problem
  * in practice. Multi-threaded guests share most if not all of their translated
  * code, which makes parallel code generation less appealing than in softmmu.
+ *
+ * If @evict, a full buffer has its oldest region evicted instead of being
+ * flushed; this is only supported in softmmu.
  */
-void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
+void tcg_region_init(size_t tb_size, int splitwx, unsigned max_threads,
+                     bool evict)
 {
     const size_t page_size = qemu_real_host_page_size();
     size_t region_size;
@@ -765,7 +905,7 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
      * As a result of this we might end up with a few extra pages at the end of
      * the buffer; we will assign those to the last region.
      */
-    region.n = tcg_n_regions(tb_size, max_cpus);
+    region.n = tcg_n_regions(tb_size, max_threads, evict);
     region_size = tb_size / region.n;
     region_size = QEMU_ALIGN_DOWN(region_size, page_size);
 
@@ -786,6 +926,14 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+#ifndef CONFIG_USER_ONLY
+    region.evict = evict;
+#endif
+    if (region.evict) {
+        region.full = g_new(size_t, region.n);
+        region.free = g_new(size_t, region.n);
+        region.gen = g_new0(unsigned, region.n);
+    }
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
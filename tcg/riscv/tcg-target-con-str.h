@@ -10,6 +10,7 @@
  */
 REGS('r', ALL_GENERAL_REGS)
 REGS('L', ALL_GENERAL_REGS & ~SOFTMMU_RESERVE_REGS)
+REGS('v', ALL_VECTOR_REGS)
 
 /*
  * Define constraint letters for constants:
@@ -18,4 +19,6 @@ REGS('L', ALL_GENERAL_REGS & ~SOFTMMU_RESERVE_REGS)
 CONST('I', TCG_CT_CONST_S12)
 CONST('N', TCG_CT_CONST_N12)
 CONST('M', TCG_CT_CONST_M12)
+CONST('B', TCG_CT_CONST_BSET)
+CONST('C', TCG_CT_CONST_BCLR)
 CONST('Z', TCG_CT_CONST_ZERO)
@@ -0,0 +1,9 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Target-specific opcodes for host vector expansion.  These will be
+ * emitted by tcg_expand_vec_op.  For those familiar with GCC internals,
+ * consider these to be UNSPEC with names.
+ *
+ * Every vector operation advertised by the RISC-V backend is emitted
+ * directly, so none are needed yet.
+ */
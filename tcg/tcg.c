@@ -157,6 +157,28 @@ static bool tcg_target_const_match(int64_t val, TCGType type, int ct);
 static int tcg_out_ldst_finalize(TCGContext *s);
 #endif
 
+/*
+ * Note that the code at @site, of kind @kind, holds the host address
+ * @target.  @addr is false if it may be an integer constant instead.
+ */
+static inline void tcg_out_host_reloc(TCGContext *s, void *site,
+                                      TCGHostRelocKind kind,
+                                      uintptr_t target, bool addr)
+{
+    TCGHostReloc *r;
+
+    if (!s->record_host_relocs) {
+        return;
+    }
+    r = tcg_malloc(sizeof(*r));
+    r->site = site;
+    r->target = target;
+    r->kind = kind;
+    r->addr = addr;
+    r->next = s->host_relocs;
+    s->host_relocs = r;
+}
+
 TCGContext tcg_init_ctx;
 __thread TCGContext *tcg_ctx;
 
@@ -919,7 +941,7 @@ static void process_op_defs(TCGContext *s);
 static TCGTemp *tcg_global_reg_new_internal(TCGContext *s, TCGType type,
                                             TCGReg reg, const char *name);
 
-static void tcg_context_init(unsigned max_cpus)
+static void tcg_context_init(unsigned max_threads)
 {
     TCGContext *s = &tcg_init_ctx;
     int op, total_args, n, i;
@@ -987,15 +1009,15 @@ static void tcg_context_init(unsigned max_cpus)
      * In user-mode we simply share the init context among threads, since we
      * use a single region. See the documentation tcg_region_init() for the
      * reasoning behind this.
-     * In softmmu we will have at most max_cpus TCG threads.
+     * In softmmu we will have at most max_threads TCG threads.
      */
 #ifdef CONFIG_USER_ONLY
     tcg_ctxs = &tcg_ctx;
     tcg_cur_ctxs = 1;
     tcg_max_ctxs = 1;
 #else
-    tcg_max_ctxs = max_cpus;
-    tcg_ctxs = g_new0(TCGContext *, max_cpus);
+    tcg_max_ctxs = max_threads;
+    tcg_ctxs = g_new0(TCGContext *, max_threads);
 #endif
 
     tcg_debug_assert(!tcg_regset_test_reg(s->reserved_regs, TCG_AREG0));
@@ -1003,10 +1025,10 @@ static void tcg_context_init(unsigned max_cpus)
     cpu_env = temp_tcgv_ptr(ts);
 }
 
-void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus)
+void tcg_init(size_t tb_size, int splitwx, unsigned max_threads, bool evict)
 {
-    tcg_context_init(max_cpus);
-    tcg_region_init(tb_size, splitwx, max_cpus);
+    tcg_context_init(max_threads);
+    tcg_region_init(tb_size, splitwx, max_threads, evict);
 }
 
 /*
@@ -1119,6 +1141,7 @@ void tcg_prologue_init(TCGContext *s)
 void tcg_func_start(TCGContext *s)
 {
     tcg_pool_reset(s);
+    s->host_relocs = NULL;
     s->nb_temps = s->nb_globals;
 
     /* No temps have been previously allocated for size or locality.  */
@@ -1255,6 +1278,34 @@ TCGTemp *tcg_global_mem_new_internal(TCGType type, TCGv_ptr base,
     return ts;
 }
 
+bool tcg_global_pin_internal(TCGTemp *ts)
+{
+#ifdef TCG_TARGET_PIN_REGS
+    TCGContext *s = tcg_ctx;
+    int i;
+
+    tcg_debug_assert(ts->kind == TEMP_GLOBAL && !ts->pinned);
+    if (s->nb_pinned >= s->max_pinned || ts->indirect_reg ||
+        ts->mem_base->kind != TEMP_FIXED || ts->base_type != ts->type ||
+        ts->type > TCG_TYPE_I64) {
+        return false;
+    }
+    for (i = 0; i < ARRAY_SIZE(tcg_target_pin_regs); i++) {
+        TCGReg reg = tcg_target_pin_regs[i];
+
+        if (!tcg_regset_test_reg(s->reserved_regs, reg)) {
+            tcg_regset_set_reg(s->reserved_regs, reg);
+            tcg_regset_set_reg(s->pinned_regs, reg);
+            ts->pinned = 1;
+            ts->pin_reg = reg;
+            s->nb_pinned++;
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+
 TCGTemp *tcg_temp_new_internal(TCGType type, bool temp_local)
 {
     TCGContext *s = tcg_ctx;
@@ -1927,6 +1978,7 @@ static void tcg_reg_alloc_start(TCGContext *s)
     }
 
     memset(s->reg_to_temp, 0, sizeof(s->reg_to_temp));
+    s->pinned_valid = s->pinned_regs;
 }
 
 static char *tcg_get_arg_str_ptr(TCGContext *s, char *buf, int buf_size,
@@ -2747,8 +2799,12 @@ static void la_func_end(TCGContext *s, int ng, int nt)
     }
 }
 
-/* liveness analysis: end of basic block: all temps are dead, globals
-   and local temps should be in memory. */
+/*
+ * liveness analysis: end of basic block: all temps are dead, globals
+ * and local temps should be in memory.  With cross_bb_regs, the register
+ * allocator may keep the globals and local temps in registers past the
+ * end of the block, so they are only synced.
+ */
 static void la_bb_end(TCGContext *s, int ng, int nt)
 {
     int i;
@@ -2758,9 +2814,14 @@ static void la_bb_end(TCGContext *s, int ng, int nt)
         int state;
 
         switch (ts->kind) {
-        case TEMP_FIXED:
         case TEMP_GLOBAL:
         case TEMP_LOCAL:
+            if (s->cross_bb_regs && !ts->indirect_reg) {
+                state = TS_MEM;
+                break;
+            }
+            /* fall through */
+        case TEMP_FIXED:
             state = TS_DEAD | TS_MEM;
             break;
         case TEMP_NORMAL:
@@ -3488,6 +3549,36 @@ static void set_temp_val_nonreg(TCGContext *s, TCGTemp *ts, TCGTempVal type)
 
 static void temp_load(TCGContext *, TCGTemp *, TCGRegSet, TCGRegSet, TCGRegSet);
 
+/* @ts was just stored from @reg: update its pinned register, if any. */
+static void temp_pin_update(TCGContext *s, TCGTemp *ts, TCGReg reg)
+{
+    if (ts->pinned) {
+        tcg_out_mov(s, ts->type, ts->pin_reg, reg);
+        tcg_regset_set_reg(s->pinned_valid, ts->pin_reg);
+    }
+}
+
+/*
+ * Reload the pinned registers whose global may have been changed in
+ * memory by a helper.  The globals must be in memory.
+ */
+static void tcg_reg_alloc_pin_sync(TCGContext *s)
+{
+    TCGRegSet stale = s->pinned_regs & ~s->pinned_valid;
+    int i, n;
+
+    for (i = 0, n = s->nb_globals; stale && i < n; i++) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (ts->pinned && tcg_regset_test_reg(stale, ts->pin_reg)) {
+            tcg_out_ld(s, ts->type, ts->pin_reg,
+                       ts->mem_base->reg, ts->mem_offset);
+            tcg_regset_reset_reg(stale, ts->pin_reg);
+        }
+    }
+    s->pinned_valid = s->pinned_regs;
+}
+
 /* Mark a temporary as free or dead.  If 'free_or_dead' is negative,
    mark it free; otherwise mark it dead.  */
 static void temp_free_or_dead(TCGContext *s, TCGTemp *ts, int free_or_dead)
@@ -3539,6 +3630,10 @@ static void temp_sync(TCGContext *s, TCGTemp *ts, TCGRegSet allocated_regs,
             if (free_or_dead
                 && tcg_out_sti(s, ts->type, ts->val,
                                ts->mem_base->reg, ts->mem_offset)) {
+                if (ts->pinned) {
+                    tcg_out_movi(s, ts->type, ts->pin_reg, ts->val);
+                    tcg_regset_set_reg(s->pinned_valid, ts->pin_reg);
+                }
                 break;
             }
             temp_load(s, ts, tcg_target_available_regs[ts->type],
@@ -3548,6 +3643,7 @@ static void temp_sync(TCGContext *s, TCGTemp *ts, TCGRegSet allocated_regs,
         case TEMP_VAL_REG:
             tcg_out_st(s, ts->type, ts->reg,
                        ts->mem_base->reg, ts->mem_offset);
+            temp_pin_update(s, ts, ts->reg);
             break;
 
         case TEMP_VAL_MEM:
@@ -3730,7 +3826,11 @@ static void temp_load(TCGContext *s, TCGTemp *ts, TCGRegSet desired_regs,
     case TEMP_VAL_MEM:
         reg = tcg_reg_alloc(s, desired_regs, allocated_regs,
                             preferred_regs, ts->indirect_base);
-        tcg_out_ld(s, ts->type, reg, ts->mem_base->reg, ts->mem_offset);
+        if (ts->pinned && tcg_regset_test_reg(s->pinned_valid, ts->pin_reg)) {
+            tcg_out_mov(s, ts->type, reg, ts->pin_reg);
+        } else {
+            tcg_out_ld(s, ts->type, reg, ts->mem_base->reg, ts->mem_offset);
+        }
         ts->mem_coherent = 1;
         break;
     case TEMP_VAL_DEAD:
@@ -3776,12 +3876,87 @@ static void sync_globals(TCGContext *s, TCGRegSet allocated_regs)
     }
 }
 
-/* at the end of a basic block, we assume all temporaries are dead and
-   all globals are stored at their canonical location. */
+/*
+ * With cross_bb_regs, whether @ts is a global or local temp that is in a
+ * host register and in sync with memory, which the register allocator
+ * may carry across a label.
+ */
+static bool temp_keep_across_bb(TCGTemp *ts)
+{
+    return ts && (ts->kind == TEMP_GLOBAL || ts->kind == TEMP_LOCAL) &&
+           ts->val_type == TEMP_VAL_REG && ts->mem_coherent;
+}
+
+/*
+ * With cross_bb_regs, narrow the register state recorded for @l to what
+ * the current one has in common with it.  Call this on every edge into
+ * @l: @branch is false for the fall-through into its set_label.
+ */
+static void tcg_reg_alloc_label_edge(TCGContext *s, TCGLabel *l, bool branch)
+{
+    int i;
+
+    if (!l->reg_state) {
+        l->reg_state = tcg_malloc(sizeof(TCGTemp *) * TCG_TARGET_NB_REGS);
+        for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+            TCGTemp *ts = s->reg_to_temp[i];
+            l->reg_state[i] = temp_keep_across_bb(ts) ? ts : NULL;
+        }
+    } else {
+        for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+            TCGTemp *ts = s->reg_to_temp[i];
+            if (l->reg_state[i] != ts || !temp_keep_across_bb(ts)) {
+                l->reg_state[i] = NULL;
+            }
+        }
+    }
+    l->edges += branch;
+}
+
+/*
+ * With cross_bb_regs, assume the register state recorded for @l after
+ * its set_label, if the register allocator went through every branch
+ * to it, i.e. none of them is backward.
+ */
+static void tcg_reg_alloc_label(TCGContext *s, TCGLabel *l)
+{
+    int i;
+
+    if (!l->reg_state || l->edges != l->refs) {
+        return;
+    }
+    for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+        TCGTemp *ts = l->reg_state[i];
+        if (ts) {
+            set_temp_val_reg(s, ts, i);
+            ts->mem_coherent = 1;
+        }
+    }
+}
+
+/*
+ * at the end of a basic block, we assume all temporaries are dead and
+ * all globals are stored at their canonical location.  With
+ * cross_bb_regs, globals and local temps may still be in registers,
+ * which are forgotten.
+ */
 static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
 {
     int i;
 
+    if (s->cross_bb_regs) {
+        for (i = 0; i < s->nb_temps; i++) {
+            TCGTemp *ts = &s->temps[i];
+
+            if ((ts->kind == TEMP_GLOBAL || ts->kind == TEMP_LOCAL) &&
+                (ts->val_type == TEMP_VAL_REG ||
+                 ts->val_type == TEMP_VAL_CONST)) {
+                tcg_debug_assert(ts->mem_coherent);
+                temp_free_or_dead(s, ts, 1);
+            }
+        }
+    }
+
     for (i = s->nb_globals; i < s->nb_temps; i++) {
         TCGTemp *ts = &s->temps[i];
 
@@ -3805,6 +3980,7 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
     }
 
     save_globals(s, allocated_regs);
+    tcg_reg_alloc_pin_sync(s);
 }
 
 /*
@@ -3815,6 +3991,7 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
 static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs)
 {
     sync_globals(s, allocated_regs);
+    tcg_reg_alloc_pin_sync(s);
 
     for (int i = s->nb_globals; i < s->nb_temps; i++) {
         TCGTemp *ts = &s->temps[i];
@@ -3911,6 +4088,7 @@ static void tcg_reg_alloc_mov(TCGContext *s, const TCGOp *op)
             temp_allocate_frame(s, ots);
         }
         tcg_out_st(s, otype, ireg, ots->mem_base->reg, ots->mem_offset);
+        temp_pin_update(s, ots, ireg);
         if (IS_DEAD_ARG(1)) {
             temp_dead(s, ts);
         }
@@ -4112,6 +4290,10 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
             /* constant is OK for instruction */
             const_args[i] = 1;
             new_args[i] = ts->val;
+            if (ts->type == TCG_TYPE_PTR) {
+                tcg_out_host_reloc(s, s->code_ptr, TCG_HOST_RELOC_IMM,
+                                   ts->val, false);
+            }
             continue;
         }
 
@@ -4299,7 +4481,14 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
 
     if (def->flags & TCG_OPF_COND_BRANCH) {
         tcg_reg_alloc_cbranch(s, i_allocated_regs);
+        if (s->cross_bb_regs) {
+            tcg_reg_alloc_label_edge(s, arg_label(op->args[nb_iargs + 1]),
+                                     true);
+        }
     } else if (def->flags & TCG_OPF_BB_END) {
+        if (s->cross_bb_regs && op->opc == INDEX_op_br) {
+            tcg_reg_alloc_label_edge(s, arg_label(op->args[0]), true);
+        }
         tcg_reg_alloc_bb_end(s, i_allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -4620,6 +4809,8 @@ static void tcg_reg_alloc_call(TCGContext *s, TCGOp *op)
         sync_globals(s, allocated_regs);
     } else {
         save_globals(s, allocated_regs);
+        /* The helper may change the globals behind the pinned registers. */
+        s->pinned_valid = 0;
     }
 
     /*
@@ -4926,6 +5117,22 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, target_ulong pc_start)
     s->code_buf = tcg_splitwx_to_rw(tb->tc.ptr);
     s->code_ptr = s->code_buf;
 
+    /*
+     * Load the pinned globals when entering from the prologue.  Jumps
+     * from other TBs, which kept them up to date, enter after this.
+     */
+    if (s->nb_pinned) {
+        for (i = 0; i < s->nb_globals; i++) {
+            TCGTemp *ts = &s->temps[i];
+
+            if (ts->pinned) {
+                tcg_out_ld(s, ts->type, ts->pin_reg,
+                           ts->mem_base->reg, ts->mem_offset);
+            }
+        }
+        s->pinned_entry_size = tcg_current_code_size(s);
+    }
+
 #ifdef TCG_TARGET_NEED_LDST_LABELS
     QSIMPLEQ_INIT(&s->ldst_labels);
 #endif
@@ -4972,8 +5179,22 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, target_ulong pc_start)
             temp_dead(s, arg_temp(op->args[0]));
             break;
         case INDEX_op_set_label:
+            if (s->cross_bb_regs) {
+                TCGOp *prev = QTAILQ_PREV(op, link);
+
+                /* Unless the label is only reached by branches */
+                if (!prev || (prev->opc != INDEX_op_br &&
+                              prev->opc != INDEX_op_exit_tb &&
+                              prev->opc != INDEX_op_goto_ptr)) {
+                    tcg_reg_alloc_label_edge(s, arg_label(op->args[0]),
+                                             false);
+                }
+            }
             tcg_reg_alloc_bb_end(s, s->reserved_regs);
             tcg_out_label(s, arg_label(op->args[0]));
+            if (s->cross_bb_regs) {
+                tcg_reg_alloc_label(s, arg_label(op->args[0]));
+            }
             break;
         case INDEX_op_call:
             tcg_reg_alloc_call(s, op);
@@ -4982,6 +5203,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, target_ulong pc_start)
             tcg_out_exit_tb(s, op->args[0]);
             break;
         case INDEX_op_goto_tb:
+            tcg_reg_alloc_pin_sync(s);
             tcg_out_goto_tb(s, op->args[0]);
             break;
         case INDEX_op_dup2_vec:
@@ -0,0 +1,366 @@
+/*
+ * fp-test-batch.c - test QEMU's batched softfloat operations
+ *
+ * Each float{32,64}_*_n function must give the same results and the same
+ * exception flags as the scalar operation applied in a loop.  Targets also
+ * call them with a single element in place of the scalar operation, so
+ * that case gets many more inputs.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef HW_POISON_H
+#error Must define HW_POISON_H to work around TARGET_* poisoning
+#endif
+
+#include "qemu/osdep.h"
+#include "fpu/softfloat.h"
+
+/* Three chunks and a tail */
+#define N 53
+#define ITERATIONS 16
+#define SCALAR_ITERATIONS 2048
+
+static int errors;
+static uint64_t rnd_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}
+
+enum {
+    V_NORMAL,
+    V_TINY,         /* just above the smallest normal */
+    V_HALF_MIN,     /* products straddle the smallest normal */
+    V_SUBNORMAL,
+    V_ZERO,
+    V_INF,
+    V_QNAN,
+    V_SNAN,
+    V_HUGE,
+    V_NUM,
+};
+
+enum {
+    MIX_NORMAL,     /* every chunk can take the host path */
+    MIX_SPARSE,     /* a few special values */
+    MIX_DENSE,      /* anything goes */
+    MIX_TINY,       /* results around the subnormal range */
+    MIX_BOUNDARY,   /* special values either side of a chunk boundary */
+    MIX_NUM,
+};
+
+static const char * const mix_names[MIX_NUM] = {
+    [MIX_NORMAL] = "normal",
+    [MIX_SPARSE] = "sparse",
+    [MIX_DENSE] = "dense",
+    [MIX_TINY] = "tiny",
+    [MIX_BOUNDARY] = "boundary",
+};
+
+static uint64_t gen_value(int kind, int ebits, int fbits)
+{
+    uint64_t emax = (1ull << ebits) - 1;
+    uint64_t bias = emax >> 1;
+    uint64_t frac = rnd() & ((1ull << fbits) - 1);
+    uint64_t exp;
+
+    switch (kind) {
+    case V_NORMAL:
+        exp = bias - 20 + rnd() % 41;
+        break;
+    case V_TINY:
+        exp = 1 + rnd() % 3;
+        break;
+    case V_HALF_MIN:
+        /*
+         * For float64 this also covers the margin that the host multiply
+         * keeps above the smallest normal.
+         */
+        exp = (bias + 1) / 2 - 4 + rnd() % (ebits == 8 ? 12 : 40);
+        break;
+    case V_SUBNORMAL:
+        exp = 0;
+        frac |= 1;
+        break;
+    case V_ZERO:
+        exp = 0;
+        frac = 0;
+        break;
+    case V_INF:
+        exp = emax;
+        frac = 0;
+        break;
+    case V_QNAN:
+        exp = emax;
+        frac |= 1ull << (fbits - 1);
+        break;
+    case V_SNAN:
+        exp = emax;
+        frac &= ~(1ull << (fbits - 1));
+        frac |= 1;
+        break;
+    case V_HUGE:
+        exp = emax - 1 - rnd() % 2;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    return (rnd() & 1) << (ebits + fbits) | exp << fbits | frac;
+}
+
+static int pick_kind(int mix, size_t i, int operand)
+{
+    static const int specials[] = { V_SUBNORMAL, V_INF, V_QNAN, V_SNAN };
+
+    switch (mix) {
+    case MIX_NORMAL:
+        return V_NORMAL;
+    case MIX_SPARSE:
+        return rnd() % 32 ? V_NORMAL : rnd() % V_NUM;
+    case MIX_DENSE:
+        return rnd() % V_NUM;
+    case MIX_TINY:
+        switch (rnd() % 8) {
+        case 0:
+            return V_SUBNORMAL;
+        case 1:
+        case 2:
+        case 3:
+            return V_TINY;
+        default:
+            return V_HALF_MIN;
+        }
+    case MIX_BOUNDARY:
+        /* a, b and c hit elements 15, 16 and 17 */
+        if (i == 15 + operand) {
+            return specials[rnd() % ARRAY_SIZE(specials)];
+        }
+        return V_NORMAL;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void init_status(float_status *s, FloatRoundMode rm, bool inexact)
+{
+    *s = (float_status){0};
+    set_float_rounding_mode(rm, s);
+    if (inexact) {
+        float_raise(float_flag_inexact, s);
+    }
+}
+
+static void check(const char *op, int mix, size_t n, FloatRoundMode rm,
+                  const void *got, const void *want, size_t count,
+                  size_t size, float_status *sgot, float_status *swant)
+{
+    const uint8_t *pgot = got, *pwant = want;
+    int fgot = get_float_exception_flags(sgot);
+    int fwant = get_float_exception_flags(swant);
+    uint64_t vgot = 0, vwant = 0;
+    size_t i;
+
+    if (!memcmp(got, want, count * size) && fgot == fwant) {
+        return;
+    }
+
+    for (i = 0; i + 1 < count; i++) {
+        if (memcmp(pgot + i * size, pwant + i * size, size)) {
+            break;
+        }
+    }
+    memcpy(&vgot, pgot + i * size, size);
+    memcpy(&vwant, pwant + i * size, size);
+
+    printf("%s: mix %s, n %zu, rounding mode %d\n"
+           "  element %zu: got %0*" PRIx64 ", expected %0*" PRIx64 "\n"
+           "  flags: got 0x%x, expected 0x%x\n\n",
+           op, mix_names[mix], n, rm, i, (int)size * 2, vgot,
+           (int)size * 2, vwant, fgot, fwant);
+
+    if (++errors == 20) {
+        exit(1);
+    }
+}
+
+static const int muladd_flags[] = {
+    0,
+    float_muladd_negate_c,
+    float_muladd_negate_product,
+    float_muladd_negate_result,
+    float_muladd_halve_result,
+};
+
+/*
+ * Compare one random set of inputs of length @n.  Elements from @n to N
+ * are checked too, to catch stores past the end.
+ */
+#define GEN_TEST(SZ, EBITS, FBITS)                                          \
+static void test_##SZ(int mix, size_t n, FloatRoundMode rm, bool inexact)   \
+{                                                                           \
+    SZ a[N], b[N], c[N], d[N], r[N], neg, acc, acc_n, acc_r;                \
+    float_status sn, sr, scratch = {0};                                     \
+    char op[32];                                                            \
+    size_t i, j;                                                            \
+                                                                            \
+    neg = make_##SZ(1ull << (EBITS + FBITS));                               \
+    for (i = 0; i < N; i++) {                                               \
+        a[i] = make_##SZ(gen_value(pick_kind(mix, i, 0), EBITS, FBITS));    \
+        b[i] = make_##SZ(gen_value(pick_kind(mix, i, 1), EBITS, FBITS));    \
+        c[i] = make_##SZ(gen_value(pick_kind(mix, i, 2), EBITS, FBITS));    \
+                                                                            \
+        /* Exact and near cancellation */                                   \
+        switch (rnd() % 8) {                                                \
+        case 0:                                                             \
+            b[i] = make_##SZ(SZ##_val(a[i]) ^ SZ##_val(neg));               \
+            break;                                                          \
+        case 1:                                                             \
+            b[i] = a[i];                                                    \
+            break;                                                          \
+        case 2:                                                             \
+            b[i] = make_##SZ((SZ##_val(a[i]) ^ SZ##_val(neg)) + 1);         \
+            break;                                                          \
+        case 3:                                                             \
+            c[i] = SZ##_mul(a[i], b[i], &scratch);                          \
+            c[i] = make_##SZ(SZ##_val(c[i]) ^ SZ##_val(neg));               \
+            break;                                                          \
+        case 4:                                                             \
+            /* Exact squares and quotients */                               \
+            b[i] = make_##SZ(SZ##_val(b[i]) &                               \
+                             ~((1ull << (FBITS / 2 + 1)) - 1));             \
+            a[i] = SZ##_mul(b[i], b[i], &scratch);                          \
+            break;                                                          \
+        }                                                                   \
+    }                                                                       \
+    acc = c[0];                                                             \
+                                                                            \
+    memset(d, 0xa5, sizeof(d));                                             \
+    memcpy(r, d, sizeof(r));                                                \
+    init_status(&sr, rm, inexact);                                          \
+    for (i = 0; i < n; i++) {                                               \
+        r[i] = SZ##_add(a[i], b[i], &sr);                                   \
+    }                                                                       \
+    init_status(&sn, rm, inexact);                                          \
+    SZ##_add_n(d, a, b, n, &sn);                                            \
+    check(#SZ "_add_n", mix, n, rm, d, r, N, sizeof(SZ), &sn, &sr);         \
+                                                                            \
+    /* The same again, in place */                                          \
+    memcpy(d, a, sizeof(d));                                                \
+    init_status(&sn, rm, inexact);                                          \
+    SZ##_add_n(d, d, b, n, &sn);                                            \
+    for (i = n; i < N; i++) {                                               \
+        r[i] = a[i];                                                        \
+    }                                                                       \
+    check(#SZ "_add_n in place", mix, n, rm, d, r, N, sizeof(SZ),           \
+          &sn, &sr);                                                        \
+                                                                            \
+    memset(d, 0xa5, sizeof(d));                                             \
+    memcpy(r, d, sizeof(r));                                                \
+    init_status(&sr, rm, inexact);                                          \
+    for (i = 0; i < n; i++) {                                               \
+        r[i] = SZ##_sub(a[i], b[i], &sr);                                   \
+    }                                                                       \
+    init_status(&sn, rm, inexact);                                          \
+    SZ##_sub_n(d, a, b, n, &sn);                                            \
+    check(#SZ "_sub_n", mix, n, rm, d, r, N, sizeof(SZ), &sn, &sr);         \
+                                                                            \
+    memset(d, 0xa5, sizeof(d));                                             \
+    memcpy(r, d, sizeof(r));                                                \
+    init_status(&sr, rm, inexact);                                          \
+    for (i = 0; i < n; i++) {                                               \
+        r[i] = SZ##_mul(a[i], b[i], &sr);                                   \
+    }                                                                       \
+    init_status(&sn, rm, inexact);                                          \
+    SZ##_mul_n(d, a, b, n, &sn);                                            \
+    check(#SZ "_mul_n", mix, n, rm, d, r, N, sizeof(SZ), &sn, &sr);         \
+                                                                            \
+    memset(d, 0xa5, sizeof(d));                                             \
+    memcpy(r, d, sizeof(r));                                                \
+    init_status(&sr, rm, inexact);                                          \
+    for (i = 0; i < n; i++) {                                               \
+        r[i] = SZ##_div(a[i], b[i], &sr);                                   \
+    }                                                                       \
+    init_status(&sn, rm, inexact);                                          \
+    SZ##_div_n(d, a, b, n, &sn);                                            \
+    check(#SZ "_div_n", mix, n, rm, d, r, N, sizeof(SZ), &sn, &sr);         \
+                                                                            \
+    memset(d, 0xa5, sizeof(d));                                             \
+    memcpy(r, d, sizeof(r));                                                \
+    init_status(&sr, rm, inexact);                                          \
+    for (i = 0; i < n; i++) {                                               \
+        r[i] = SZ##_sqrt(a[i], &sr);                                        \
+    }                                                                       \
+    init_status(&sn, rm, inexact);                                          \
+    SZ##_sqrt_n(d, a, n, &sn);                                              \
+    check(#SZ "_sqrt_n", mix, n, rm, d, r, N, sizeof(SZ), &sn, &sr);        \
+                                                                            \
+    for (j = 0; j < ARRAY_SIZE(muladd_flags); j++) {                        \
+        memset(d, 0xa5, sizeof(d));                                         \
+        memcpy(r, d, sizeof(r));                                            \
+        init_status(&sr, rm, inexact);                                      \
+        for (i = 0; i < n; i++) {                                           \
+            r[i] = SZ##_muladd(a[i], b[i], c[i], muladd_flags[j], &sr);     \
+        }                                                                   \
+        init_status(&sn, rm, inexact);                                      \
+        SZ##_muladd_n(d, a, b, c, n, muladd_flags[j], &sn);                 \
+        snprintf(op, sizeof(op), #SZ "_muladd_n/%d", muladd_flags[j]);      \
+        check(op, mix, n, rm, d, r, N, sizeof(SZ), &sn, &sr);               \
+    }                                                                       \
+                                                                            \
+    acc_r = acc;                                                            \
+    init_status(&sr, rm, inexact);                                          \
+    for (i = 0; i < n; i++) {                                               \
+        acc_r = SZ##_add(acc_r, a[i], &sr);                                 \
+    }                                                                       \
+    init_status(&sn, rm, inexact);                                          \
+    acc_n = SZ##_sum_n(acc, a, n, &sn);                                     \
+    check(#SZ "_sum_n", mix, n, rm, &acc_n, &acc_r, 1, sizeof(SZ),          \
+          &sn, &sr);                                                        \
+}
+
+GEN_TEST(float32, 8, 23)
+GEN_TEST(float64, 11, 52)
+
+int main(int ac, char **av)
+{
+    /* Empty, single, either side of each chunk boundary, and ragged */
+    static const size_t lengths[] = { 0, 1, 15, 16, 17, 32, 33, N };
+    static const FloatRoundMode modes[] = {
+        float_round_nearest_even,
+        float_round_to_zero,
+        float_round_up,
+    };
+    size_t l, m;
+    int mix, inexact, i;
+
+    for (mix = 0; mix < MIX_NUM; mix++) {
+        for (l = 0; l < ARRAY_SIZE(lengths); l++) {
+            for (m = 0; m < ARRAY_SIZE(modes); m++) {
+                for (inexact = 0; inexact < 2; inexact++) {
+                    for (i = 0; i < ITERATIONS; i++) {
+                        test_float32(mix, lengths[l], modes[m], inexact);
+                        test_float64(mix, lengths[l], modes[m], inexact);
+                    }
+                }
+            }
+        }
+    }
+
+    for (mix = 0; mix < MIX_NUM; mix++) {
+        for (m = 0; m < ARRAY_SIZE(modes); m++) {
+            for (inexact = 0; inexact < 2; inexact++) {
+                for (i = 0; i < SCALAR_ITERATIONS; i++) {
+                    test_float32(mix, 1, modes[m], inexact);
+                    test_float64(mix, 1, modes[m], inexact);
+                }
+            }
+        }
+    }
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * Check per-vCPU inline operations and conditional callbacks against
+ * plain callbacks.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+/* Blocks between two calls of the conditional callback */
+#define TB_PERIOD 100
+
+typedef struct {
+    uint64_t tb;
+    uint64_t tb_inline;
+    uint64_t insn;
+    uint64_t insn_inline;
+    uint64_t mem;
+    uint64_t mem_inline;
+    uint64_t last_insn;
+    uint64_t last_insn_inline;
+    uint64_t tb_since_cond;
+    uint64_t cond;
+} CPUCount;
+
+static struct qemu_plugin_scoreboard *counts;
+static qemu_plugin_u64 tb_count;
+static qemu_plugin_u64 tb_inline;
+static qemu_plugin_u64 insn_count;
+static qemu_plugin_u64 insn_inline;
+static qemu_plugin_u64 mem_count;
+static qemu_plugin_u64 mem_inline;
+static qemu_plugin_u64 last_insn;
+static qemu_plugin_u64 last_insn_inline;
+static qemu_plugin_u64 tb_since_cond;
+static qemu_plugin_u64 cond_count;
+
+static void plugin_exit(qemu_plugin_id_t id, void *udata)
+{
+    g_autoptr(GString) report = g_string_new("");
+    uint64_t tb = 0, insn = 0, mem = 0;
+    int i;
+
+    for (i = 0; i < qemu_plugin_num_vcpus(); i++) {
+        CPUCount *c = qemu_plugin_scoreboard_find(counts, i);
+
+        g_string_append_printf(report,
+                               "cpu %d: tb %" PRIu64 ", insn %" PRIu64
+                               ", mem %" PRIu64 ", cond %" PRIu64 "\n",
+                               i, c->tb, c->insn, c->mem, c->cond);
+
+        g_assert_cmpuint(c->tb_inline, ==, c->tb);
+        g_assert_cmpuint(c->insn_inline, ==, c->insn);
+        g_assert_cmpuint(c->mem_inline, ==, c->mem);
+        g_assert_cmpuint(c->last_insn_inline, ==, c->last_insn);
+
+        /* The inline add runs before the condition is checked */
+        g_assert_cmpuint(c->tb_since_cond, <, TB_PERIOD);
+        g_assert_cmpuint(c->cond * TB_PERIOD + c->tb_since_cond, ==, c->tb);
+
+        tb += c->tb;
+        insn += c->insn;
+        mem += c->mem;
+    }
+    qemu_plugin_outs(report->str);
+
+    g_assert_cmpuint(qemu_plugin_u64_sum(tb_inline), ==, tb);
+    g_assert_cmpuint(qemu_plugin_u64_sum(insn_inline), ==, insn);
+    g_assert_cmpuint(qemu_plugin_u64_sum(mem_inline), ==, mem);
+
+    qemu_plugin_scoreboard_free(counts);
+}
+
+static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_add(tb_count, cpu_index, 1);
+}
+
+static void vcpu_tb_cond(unsigned int cpu_index, void *udata)
+{
+    g_assert_cmpuint(qemu_plugin_u64_get(tb_since_cond, cpu_index), ==,
+                     TB_PERIOD);
+    qemu_plugin_u64_set(tb_since_cond, cpu_index, 0);
+    qemu_plugin_u64_add(cond_count, cpu_index, 1);
+}
+
+static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_add(insn_count, cpu_index, 1);
+    qemu_plugin_u64_set(last_insn, cpu_index, (uintptr_t)udata);
+}
+
+static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t info,
+                     uint64_t vaddr, void *udata)
+{
+    qemu_plugin_u64_add(mem_count, cpu_index, 1);
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n = qemu_plugin_tb_n_insns(tb);
+    size_t i;
+
+    qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec,
+                                         QEMU_PLUGIN_CB_NO_REGS, NULL);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, tb_inline, 1);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, tb_since_cond, 1);
+    qemu_plugin_register_vcpu_tb_exec_cond_cb(
+        tb, vcpu_tb_cond, QEMU_PLUGIN_CB_NO_REGS,
+        QEMU_PLUGIN_COND_GE, tb_since_cond, TB_PERIOD, NULL);
+
+    for (i = 0; i < n; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+        /* Truncated like the callback's udata on 32-bit hosts */
+        uintptr_t vaddr = qemu_plugin_insn_vaddr(insn);
+
+        qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
+                                               QEMU_PLUGIN_CB_NO_REGS,
+                                               (void *)vaddr);
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, insn_inline, 1);
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_STORE_U64, last_insn_inline, vaddr);
+
+        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem,
+                                         QEMU_PLUGIN_CB_NO_REGS,
+                                         QEMU_PLUGIN_MEM_RW, NULL);
+        qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+            insn, QEMU_PLUGIN_MEM_RW, QEMU_PLUGIN_INLINE_ADD_U64,
+            mem_inline, 1);
+    }
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
+                                           const qemu_info_t *info,
+                                           int argc, char **argv)
+{
+    counts = qemu_plugin_scoreboard_new(sizeof(CPUCount));
+    tb_count = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, tb);
+    tb_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, tb_inline);
+    insn_count = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, insn);
+    insn_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, insn_inline);
+    mem_count = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, mem);
+    mem_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, mem_inline);
+    last_insn = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, last_insn);
+    last_insn_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, last_insn_inline);
+    tb_since_cond = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, tb_since_cond);
+    cond_count = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, cond);
+
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}